@@ -21,8 +21,16 @@
 
 #include "RayTracingEngine.h"
 
+// With surface binning enabled, non-sequential beams whose runs of rays on
+// the same surface are shorter than this (on average) are binned
+#define RZ_CPU_ENGINE_MIN_RUN_LENGTH 32
+
 namespace RZ {
   class CPURayTracingEngine : public RayTracingEngine {
+      RayBeamBins m_bins;
+
+      bool transmitBinned(RayBeam *);
+
     protected:
       virtual void cast(const OpticalSurface *, RayBeam *) override;
       virtual void transmit(const OpticalSurface *, RayBeam *) override;
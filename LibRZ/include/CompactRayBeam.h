@@ -0,0 +1,79 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _COMPACT_RAY_BEAM_H
+#define _COMPACT_RAY_BEAM_H
+
+#include <RayBeam.h>
+#include <LargeAllocator.h>
+#include <vector>
+
+namespace RZ {
+  enum TracingPrecision {
+    DoublePrecision,
+    SinglePrecision
+  };
+
+#ifndef SWIG
+  //
+  // Input of a sequential trace, stored with scalar type T. Single
+  // precision storage takes about 52 bytes per ray, against some 160 of
+  // a RayBeam. It is only expanded to double precision one block at a time
+  // (see Simulation::traceSequentialCompact()), so the kernels keep
+  // running in double precision, on data that is already in the cache.
+  // Cumulative optical lengths are always kept in double precision: they
+  // are large next to the path differences they are used for.
+  //
+  template <class T>
+  struct CompactRayBeam {
+    template <class U>
+    using Array = std::vector<U, LargeAllocator<U>>;
+
+    uint64_t    count = 0;
+
+    Array<T>        origins;       // count x 3
+    Array<T>        directions;    // count x 3
+    Array<T>        wavelengths;
+    Array<T>        lengths;
+    Array<T>        refNdx;
+    Array<T>        amplitudes;
+    Array<Real>     cumOptLengths;
+    Array<uint32_t> ids;
+    Array<uint64_t> chiefMask;
+
+    void assign(RayList const &);
+    void assign(RayArrays const &);
+
+    // Expand rays [start, start + count) into `dest', with all of them
+    // alive, as in RayTracingEngine::pushRays(). `start' must be a
+    // multiple of 64.
+    void expand(RayBeam *dest, uint64_t start, uint64_t count) const;
+
+    void clear();
+    uint64_t bytes() const;
+
+  private:
+    void resize(uint64_t);
+  };
+
+  extern template struct CompactRayBeam<float>;
+  extern template struct CompactRayBeam<double>;
+#endif // SWIG
+}
+
+#endif // _COMPACT_RAY_BEAM_H
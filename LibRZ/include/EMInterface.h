@@ -112,6 +112,20 @@ namespace RZ {
         unsigned int rows,
         unsigned int stride);
 
+      // Reseeds the generator used by the transmission map
+      inline void
+      setSeed(uint64_t seed)
+      {
+        m_randState.setSeed(seed);
+      }
+
+      // Fraction of the power of a ray (with direction and normal in the
+      // frame of the surface) that is reflected back as a ghost, instead of
+      // following transmit(). Zero for interfaces that cause no ghosts.
+      virtual Real ghostReflectance(
+        Vec3 const &direction,
+        Vec3 const &normal) const;
+
       virtual std::string name() const = 0;
       virtual void transmit(RayBeamSlice const &beam) = 0;
       virtual ~EMInterface();
@@ -29,7 +29,27 @@ namespace RZ {
 
     public:
       void setRefractiveIndex(Real , Real);
+
+      // Index at the side the normals point to (in) and at the other (out)
+      inline Real
+      refractiveIndexIn() const
+      {
+        return m_muIn;
+      }
+
+      inline Real
+      refractiveIndexOut() const
+      {
+        return m_muOut;
+      }
       
+      // Fresnel reflectance for unpolarized light. Rays undergoing total
+      // internal reflection are already reflected by transmit(), and cause
+      // no ghosts.
+      virtual Real ghostReflectance(
+        Vec3 const &direction,
+        Vec3 const &normal) const override;
+
       virtual std::string name() const override;
       virtual void transmit(RayBeamSlice const &beam) override;
       virtual ~DielectricEMInterface() override;
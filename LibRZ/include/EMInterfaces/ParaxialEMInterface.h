@@ -27,6 +27,12 @@ namespace RZ {
 
     public:
       void setFocalLength(Real);
+
+      inline Real
+      focalLength() const
+      {
+        return m_fLen;
+      }
       virtual std::string name() const override;
       virtual void transmit(RayBeamSlice const &beam) override;
       virtual ~ParaxialEMInterface() override;
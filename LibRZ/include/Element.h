@@ -170,6 +170,14 @@ namespace RZ {
   
   class ElementFactory;
 
+  //
+  // Properties can be resolved once to a handle, which can be used later to
+  // set them without looking them up by name. Handles are only valid for
+  // the element that returned them.
+  //
+  typedef int32_t PropertyHandle;
+#define RZ_INVALID_PROPERTY_HANDLE -1
+
   class Element {
       std::string            m_className;
       std::string            m_name;
@@ -186,6 +194,10 @@ namespace RZ {
       std::map<std::string, ReferenceFrame *> m_nameToPort;
       std::vector<std::string>                m_sortedProperties;
       std::map<std::string, PropertyValue>    m_properties;
+
+      // Interned properties
+      std::vector<std::pair<const std::string, PropertyValue> *> m_handles;
+      std::map<std::string, PropertyHandle>   m_nameToHandle;
       
       // Representation state
       bool m_selected  = false;
@@ -348,6 +360,12 @@ namespace RZ {
       bool set(std::string const &, PropertyValue const &);
       void setDefaults();
 
+      // Fast access to properties by handle
+      PropertyHandle propertyHandle(std::string const &);
+      bool set(PropertyHandle, Real);
+      PropertyValueType queryPropertyType(PropertyHandle) const;
+      std::string const &propertyName(PropertyHandle) const;
+
       // Get properties
       PropertyValue get(std::string const &) const;
       template <class T>
@@ -20,6 +20,7 @@
 #define _DETECTOR_H
 
 #include <OpticalElement.h>
+#include <LargeAllocator.h>
 #include <vector>
 
 namespace RZ {
@@ -27,9 +28,39 @@ namespace RZ {
   class RotatedFrame;
   class MediumBoundary;
 
+  //
+  // Detectors can store their pixels in two different ways:
+  //
+  // - Dense: a contiguous rows x stride array of counts and amplitudes. This
+  //   is the default and the fastest option for small and medium detectors.
+  // - Tiled: the detector is split in square tiles of RZ_DETECTOR_TILE_SIZE
+  //   pixels per side, that are only allocated on the first hit. This is
+  //   intended for very large, mostly-empty detectors (e.g. stray light).
+  //
+  // Additionally, the amplitude plane can be dropped for incoherent runs,
+  // reducing the per-pixel footprint from 20 to 4 bytes.
+  //
+  // Weighted detectors also accumulate the power |amplitude|^2 of every hit
+  // in a plane of reals. Rays of ghost splitting traces carry fractions of
+  // the power of their source ray (see GhostSplittingProperties), so there
+  // the counts alone overestimate the ghosts.
+  //
+
+#define RZ_DETECTOR_TILE_BITS   6
+#define RZ_DETECTOR_TILE_SIZE   (1 << RZ_DETECTOR_TILE_BITS)
+#define RZ_DETECTOR_TILE_MASK   (RZ_DETECTOR_TILE_SIZE - 1)
+#define RZ_DETECTOR_TILE_PIXELS (RZ_DETECTOR_TILE_SIZE * RZ_DETECTOR_TILE_SIZE)
+
+  struct DetectorTile {
+    uint32_t             photons[RZ_DETECTOR_TILE_PIXELS] = {0};
+    std::vector<Complex> amplitude; // Empty if the detector is incoherent
+    std::vector<Real>    weights;   // Empty if the detector is unweighted
+  };
+
   class DetectorStorage {
-      std::vector<uint32_t> m_photons;
-      std::vector<Complex>  m_amplitude;
+      std::vector<uint32_t, LargeAllocator<uint32_t>> m_photons;
+      std::vector<Complex, LargeAllocator<Complex>>   m_amplitude;
+      std::vector<Real, LargeAllocator<Real>>         m_weights;
       Real m_width;
       Real m_height;
 
@@ -38,20 +69,91 @@ namespace RZ {
 
       uint32_t     m_maxCounts = 0;
       Real         m_maxEnergy = 0;
+      Real         m_maxWeight = 0;
 
       unsigned int m_cols;
       unsigned int m_rows;
       unsigned int m_stride;
 
-      void recalculate();
-      
+      // Tiled storage
+      bool         m_tiled    = false;
+      bool         m_coherent = true;
+      bool         m_weighted = false;
+      unsigned int m_tileCols = 0;
+      unsigned int m_tileRows = 0;
+      uint64_t     m_allocatedTiles = 0;
+      std::vector<DetectorTile *> m_tiles;
+
+      // Densified views of the tiled storage, built on demand
+      mutable std::vector<uint32_t, LargeAllocator<uint32_t>> m_densePhotons;
+      mutable std::vector<Complex, LargeAllocator<Complex>>   m_denseAmplitude;
+      mutable std::vector<Real, LargeAllocator<Real>>         m_denseWeights;
+      mutable bool                  m_denseDirty = true;
+
+      void recalculate(bool force = false);
+      void freeTiles();
+      DetectorTile *makeTile(unsigned int tileCol, unsigned int tileRow);
+      void densify() const;
+      void getRow(uint32_t *, unsigned int row) const;
+      void getRow(Complex *, unsigned int row) const;
+      void getRow(Real *, unsigned int row) const;
+      void addAt(unsigned int col, unsigned int row, uint32_t, Complex, Real);
+
+      inline void
+      accumulate(uint32_t &photons, Complex *amp, Real *weight, Complex amplitude)
+      {
+        ++photons;
+
+        if (photons > m_maxCounts)
+          m_maxCounts = photons;
+
+        if (weight != nullptr) {
+          *weight += std::norm(amplitude);
+
+          if (*weight > m_maxWeight)
+            m_maxWeight = *weight;
+        }
+
+        if (amp != nullptr) {
+          Real E;
+
+          *amp += amplitude;
+          E = (*amp * std::conj(*amp)).real();
+
+          if (E > m_maxEnergy)
+            m_maxEnergy = E;
+        }
+      }
+
+      inline void
+      hitTiled(unsigned int col, unsigned int row, Complex amplitude)
+      {
+        unsigned int tileCol = col >> RZ_DETECTOR_TILE_BITS;
+        unsigned int tileRow = row >> RZ_DETECTOR_TILE_BITS;
+        size_t ndx;
+
+        DetectorTile *tile = m_tiles[tileCol + tileRow * m_tileCols];
+        if (tile == nullptr)
+          tile = makeTile(tileCol, tileRow);
+
+        ndx = (col & RZ_DETECTOR_TILE_MASK)
+            + ((row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS);
+
+        accumulate(
+          tile->photons[ndx],
+          m_coherent ? tile->amplitude.data() + ndx : nullptr,
+          m_weighted ? tile->weights.data() + ndx : nullptr,
+          amplitude);
+
+        m_denseDirty = true;
+      }
+
     public:
       inline bool
       hit(Real x, Real y, Complex amplitude)
       {
         int row, col;
         size_t ndx;
-        Real E;
 
         col = floor((x + .5 * m_width) / m_pxWidth);
         row = floor((y + .5 * m_height) / m_pxHeight);
@@ -59,18 +161,17 @@ namespace RZ {
         if (col < 0 || col >= m_cols || row < 0 || row >= m_rows)
           return false;
 
-        ndx = col + row * m_stride;
-        ++m_photons[ndx];
-        m_amplitude[ndx] += amplitude;
-
-        E = (m_amplitude[ndx] * std::conj(m_amplitude[ndx])).real();
+        if (m_tiled) {
+          hitTiled(col, row, amplitude);
+        } else {
+          ndx = col + row * m_stride;
+          accumulate(
+            m_photons[ndx],
+            m_coherent ? m_amplitude.data() + ndx : nullptr,
+            m_weighted ? m_weights.data() + ndx : nullptr,
+            amplitude);
+        }
 
-        if (m_photons[ndx] > m_maxCounts)
-          m_maxCounts = m_photons[ndx];
-        
-        if (E > m_maxEnergy)
-          m_maxEnergy = E;
-        
         return true;
       }
 
@@ -86,10 +187,65 @@ namespace RZ {
         return m_maxEnergy;
       }
 
+      inline Real
+      maxWeight() const
+      {
+        return m_maxWeight;
+      }
+
+      inline bool
+      tiled() const
+      {
+        return m_tiled;
+      }
+
+      inline bool
+      coherent() const
+      {
+        return m_coherent;
+      }
+
+      inline bool
+      weighted() const
+      {
+        return m_weighted;
+      }
+
+      inline uint64_t
+      allocatedTiles() const
+      {
+        return m_allocatedTiles;
+      }
+
       DetectorStorage(unsigned int cols, unsigned int rows, Real width, Real height);
+      ~DetectorStorage();
 
       void setPixelDimensions(Real, Real);
       void setResolution(unsigned, unsigned);
+      void setTiled(bool);
+      void setCoherent(bool);
+
+      // Unlike the other settings, enabling the weights keeps the counts
+      // and amplitudes accumulated so far (with zero weight)
+      void setWeighted(bool);
+
+      // Exchanges pixels and configuration with another storage
+      void swap(DetectorStorage &);
+
+      // Adds the counts (and amplitudes and weights, if both have them) of
+      // another storage with the same resolution. False if the resolutions
+      // differ.
+      bool merge(DetectorStorage const &);
+
+      // Partial images are exchanged (e.g. between processes) as the tiles
+      // with hits, also in dense mode. Every tile takes tileRecordSize()
+      // bytes: its index, its counts and, if the storage has them, its
+      // amplitudes and weights. packTiles() returns false if the tiles do
+      // not fit in `size' bytes. mergeTiles() takes records of a storage
+      // with the same resolution and planes.
+      size_t tileRecordSize() const;
+      bool packTiles(uint8_t *dest, size_t size, uint64_t &tiles) const;
+      void mergeTiles(const uint8_t *src, uint64_t tiles);
 
       void clear();
       bool savePNG(std::string const &) const;
@@ -99,24 +255,40 @@ namespace RZ {
       unsigned int    cols() const;
       unsigned int    rows() const;
       unsigned int    stride() const;
+      size_t          memoryUsage() const;
+      uint32_t        counts(unsigned int col, unsigned int row) const;
+      Complex         amplitudeAt(unsigned int col, unsigned int row) const;
+      Real            weightAt(unsigned int col, unsigned int row) const;
+
+      // In tiled mode, these densify the storage on demand. amplitude()
+      // returns nullptr if the detector is incoherent, and weights() if it
+      // is unweighted.
       const uint32_t *data() const;
       const Complex  *amplitude() const;
+      const Real     *weights() const;
   };
 
   class DetectorBoundary : public MediumBoundary {
       DetectorStorage *m_storage; // Borrowed
+      int              m_generation = -1;
 
     public:
       DetectorBoundary(DetectorStorage *storage);
+
+      // Only rays of this ghost generation (see ghostGeneration()) hit the
+      // storage. Negative to count every generation.
+      void setGeneration(int);
+
       virtual ~DetectorBoundary() = default;
       virtual void transmit(RayBeamSlice const &) const;
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 
   class Detector : public OpticalElement {
     RotatedFrame         *m_detectorSurface = nullptr;
     DetectorStorage      *m_storage = nullptr; // Owned
-    MediumBoundary *m_boundary = nullptr;
+    DetectorBoundary     *m_boundary = nullptr;
     
     Real m_pxWidth  = 15e-6;
     Real m_pxHeight = 15e-6;
@@ -125,6 +297,10 @@ namespace RZ {
     Real m_height;
 
     bool m_flip         = false;
+    bool m_tiled        = false;
+    bool m_coherent     = true;
+    bool m_weighted     = false;
+    int  m_generation   = -1;
     unsigned int m_rows = 512;
     unsigned int m_cols = 512;
 
@@ -145,6 +321,24 @@ namespace RZ {
       virtual void renderOpenGL() override;
 
       void clear();
+
+      // Hands the accumulated image over to `spare' (reconfigured to match
+      // this detector) and continues on the previous contents of `spare',
+      // which is expected to be clear. This lets the image of one sweep step
+      // be saved while the next one is being traced.
+      void swapStorage(DetectorStorage &spare);
+
+      // Takes over the image of a detector with the same geometry (e.g.
+      // the one it replaces after a model rebuild). False if they differ.
+      bool adoptStorage(Detector *);
+
+      // Accumulates the image of a detector with the same geometry, e.g.
+      // the same detector of another copy of the model traced in parallel.
+      bool merge(Detector const *);
+      size_t tileRecordSize() const;
+      bool packTiles(uint8_t *dest, size_t size, uint64_t &tiles) const;
+      void mergeTiles(const uint8_t *src, uint64_t tiles);
+
       virtual bool savePNG(std::string const &) const;
       virtual bool saveRawData(std::string const &) const;
       virtual bool saveAmplitude(std::string const &) const;
@@ -156,11 +350,18 @@ namespace RZ {
       Real            width() const;
       Real            height() const;
       unsigned int    stride() const;
+      bool            tiled() const;
+      bool            coherent() const;
+      bool            weighted() const;
+      int             generation() const;
+      size_t          memoryUsage() const;
       const uint32_t *data() const;
       const Complex  *amplitude() const;
+      const Real     *weights() const;
       
       uint32_t        maxCounts() const;
       Real            maxEnergy() const;
+      Real            maxWeight() const;
   };
 
   RZ_DECLARE_OPTICAL_ELEMENT(Detector);
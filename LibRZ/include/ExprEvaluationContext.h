@@ -0,0 +1,78 @@
+//
+//  Copyright (c) 2024 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _EXPR_EVALUATION_CONTEXT_H
+#define _EXPR_EVALUATION_CONTEXT_H
+
+#include <ExprTkEvaluator.h>
+#include <Recipe.h>
+#include <map>
+
+namespace RZ {
+  struct ExprEvaluationVar {
+    std::string                 name;
+    GenericEvaluatorSymbolDict *dict = nullptr;
+    RecipeParameter             description;
+    Real                        value = 0;
+
+    ExprEvaluationVar &operator=(Real val);
+  };
+
+  //
+  // Named expressions over a set of variables, possibly chained to a parent
+  // context whose variables and expressions they can refer to. Used to
+  // evaluate the parameters of simulation sweeps and their beams.
+  //
+  class ExprEvaluationContext {
+      std::map<std::string, ExprTkEvaluator *>  m_evaluators;
+      std::map<std::string, ExprEvaluationVar>  m_varDescriptions;
+      GenericEvaluatorSymbolDict                m_variables;
+      std::string                               m_lastCompileError;
+      ExprEvaluationContext                    *m_parentCtx = nullptr;
+
+      void addVariablesToEvaluator(ExprTkEvaluator *) const;
+
+    public:
+      ExprEvaluationContext(ExprEvaluationContext *parent = nullptr);
+      ~ExprEvaluationContext();
+
+      bool defineExpression(std::string const &, std::string const &);
+
+      void defineVariable(
+        std::string const &,
+        Real value = 0,
+        Real min = -std::numeric_limits<Real>::infinity(),
+        Real max = +std::numeric_limits<Real>::infinity());
+
+      Real setVariable(std::string const &, Real);
+      Real eval(std::string const &);
+      bool evalColumns(
+        std::string const &,
+        std::vector<GenericEvaluatorColumn> const &,
+        Real *output,
+        size_t count);
+      bool dependsOn(std::string const &, std::string const &) const;
+      std::list<std::string> expressions() const;
+      std::string const getLastError() const;
+      std::list<std::string> variables() const;
+      ExprEvaluationVar &operator[] (std::string const &);
+      Real operator() (std::string const &);
+  };
+}
+
+#endif // _EXPR_EVALUATION_CONTEXT_H
@@ -37,6 +37,9 @@ namespace RZ {
       virtual std::list<std::string> dependencies() const override;
       virtual bool compile(std::string const &) override;
       virtual Real evaluate() override;
+      virtual Real *variable(std::string const &) override;
+      using GenericEvaluator::evaluate;
+
       std::string getLastParserError() const;
       virtual bool registerCustomFunction(GenericCustomFunction *) override;
 
@@ -0,0 +1,70 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _FORKED_WORKERS_H
+#define _FORKED_WORKERS_H
+
+#include <sys/types.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace RZ {
+  //
+  // Worker processes forked from the current one. The parent maps an
+  // anonymous shared segment before starting them, the workers run their
+  // task on their copy-on-write copy of the parent and leave their results
+  // in the segment, and the parent reads them after wait().
+  //
+  // Workers that have not been waited for when the object is destroyed
+  // (e.g. because the parent threw while they were running) are killed
+  // and reaped, and the segment is unmapped.
+  //
+  class ForkedWorkers {
+    public:
+      // Runs in the child. Returning false (or throwing) fails the worker.
+      typedef std::function<bool (unsigned int)> Task;
+
+    private:
+      std::string        m_name;
+      uint8_t           *m_segment = nullptr;
+      size_t             m_size    = 0;
+      unsigned int       m_workers = 0;
+      std::vector<pid_t> m_pids;
+
+      void killAll();
+
+    public:
+      ForkedWorkers(std::string const &name);
+      ForkedWorkers(ForkedWorkers const &) = delete;
+      ForkedWorkers &operator = (ForkedWorkers const &) = delete;
+      ~ForkedWorkers();
+
+      bool map(size_t size);
+      uint8_t *segment() const;
+
+      // False if some fork failed. The workers started so far are killed.
+      bool start(unsigned int workers, Task const &task);
+
+      // False if some worker failed
+      bool wait();
+  };
+}
+
+#endif // _FORKED_WORKERS_H
@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <Random.h>
 
 namespace RZ {
@@ -40,6 +41,8 @@ namespace RZ {
   class OMModel;
   class ExprRandomState;
   class Detector;
+
+  typedef int32_t PropertyHandle; // As in Element.h
   
 #ifdef PYTHON_SCRIPT_SUPPORT
   class Script;
@@ -59,6 +62,41 @@ namespace RZ {
     std::string name;
     unsigned argc;
     virtual Real evaluate (Real const *args, unsigned argc) = 0;
+
+    //
+    // Functions that are cheaper to call once for many sets of arguments.
+    // evaluateBatch() computes the result of every row of args at once.
+    // If it fails, the evaluator falls back to one evaluate() per row.
+    // Like evaluate(), it may be called from several threads at once.
+    //
+    virtual bool
+    batched() const
+    {
+      return false;
+    }
+
+    virtual bool
+    evaluateBatch(std::vector<std::vector<Real>> const &, Real *)
+    {
+      return false;
+    }
+  };
+
+  // Calls of a batched function during a column evaluation
+  struct GenericCustomFunctionBatch {
+    std::set<std::vector<Real>>       pending;
+    std::map<std::vector<Real>, Real> results;
+  };
+
+  //
+  // Per-row values of a symbol, for batch evaluation. The value of row i
+  // is data[i * stride], so that columns can be taken directly from
+  // interleaved arrays (e.g. the x coordinate of a RayBeam's origins).
+  //
+  struct GenericEvaluatorColumn {
+    std::string name;
+    const Real *data   = nullptr;
+    size_t      stride = 1;
   };
 
   class GenericEvaluator {
@@ -67,6 +105,10 @@ namespace RZ {
       ExprRandomState                   *m_ownState  = nullptr;
       std::list<GenericCustomFunction *> m_funcList; // Borrowed
 
+      // Column evaluation in progress
+      bool m_recording = false;
+      std::map<GenericCustomFunction *, GenericCustomFunctionBatch> m_batches;
+
     protected:
       std::list<std::string> symbols() const;
       std::list<GenericCustomFunction *> functions() const;
@@ -80,16 +122,47 @@ namespace RZ {
       virtual std::list<std::string> dependencies() const = 0;
       virtual bool compile(std::string const &) = 0;
       virtual Real evaluate() = 0;
+
+      // Storage of a symbol, null if it is not known to this evaluator
+      virtual Real *variable(std::string const &);
+
+      // To be used by implementations to call registered functions
+      Real call(GenericCustomFunction *, Real const *args, unsigned argc);
+
+      //
+      // Evaluates the compiled expression once per row, with the symbols
+      // named by the columns taking the values of that row. The result of
+      // row i is stored in output[i * outStride]. Symbols are restored to
+      // their previous values afterwards. Note that randu() and randn()
+      // are only refreshed once per epoch of the random state: per-row
+      // random values must be passed as columns. Returns false if any of
+      // the columns names an unknown symbol.
+      //
+      // Batched custom functions are called once for all rows: a first
+      // pass records their arguments (with every custom function returning
+      // a placeholder instead of being called), and the second one uses the
+      // results. Calls whose arguments depend on other custom functions are
+      // not known in the first pass and fall back to one call per row.
+      //
+      virtual bool evaluate(
+        std::vector<GenericEvaluatorColumn> const &columns,
+        Real *output,
+        size_t count,
+        size_t outStride = 1);
   };
 
   // This describes how a parameter of an element or a frame is calculated
   struct GenericComponentParamEvaluator {
-    GenericModelParamType type;                   // What type of object we need to update
+    // What type of object we need to update
+    GenericModelParamType type = GENERIC_MODEL_PARAM_TYPE_VARIABLE;
+
     ParamAssignExpression *description = nullptr; // Already contains an index
     GenericModelParam     *storage = nullptr;     // Where to store this result
     GenericEvaluator      *evaluator = nullptr;   // Owned
     std::string            assignString;
-    int                    position = -1;
+    int                    position  = -1;
+    PropertyHandle         handle    = -1; // Resolved on first assign
+    uint64_t               evalCount = 0;  // For debugging slow models
 
     // What to do with this result
     union {
@@ -98,7 +171,9 @@ namespace RZ {
       TranslatedFrame *translation;
     };
 
+    void resolve();
     void assign();
+    std::string label() const;
     ~GenericComponentParamEvaluator();
   };
 
@@ -110,7 +185,13 @@ namespace RZ {
     // What needs to be evaluated
     std::list<GenericComponentParamEvaluator *> dependencies;
 
+    // Everything that depends on this parameter, directly or through
+    // variables, in evaluation order. Computed on first use.
+    std::vector<GenericComponentParamEvaluator *> cone;
+    uint64_t                                      coneGeneration = 0;
+
     bool test(Real val);
+    void propagate();
   };
 
   // Serves as storage
@@ -132,6 +213,8 @@ namespace RZ {
       std::list<CompositeElementFactory *> m_customFactoryList;  // Owned
       std::map<std::string, CompositeElementFactory *> m_customFactories;
       std::list<GenericComponentParamEvaluator *> m_expressions; // Owned
+      std::vector<GenericComponentParamEvaluator *> m_schedule;  // Borrowed
+      uint64_t                      m_scheduleGeneration = 0;
       ExprRandomState               m_ownState;
       ExprRandomState              *m_randState;
 
@@ -149,6 +232,9 @@ namespace RZ {
       std::map<std::string, GenericModelParam *> m_params;       // Borrowed
       std::map<std::string, GenericModelParam *> m_dofs;         // Borrowed
 
+      // Expressions of the previous recipe, during update()
+      std::map<const ParamAssignExpression *, GenericComponentParamEvaluator *> m_previous;
+
       std::string m_prefix;
 
       bool m_constructed = false;
@@ -181,6 +267,11 @@ namespace RZ {
       GenericComponentParamEvaluator *makeExpression(
         std::string const &expr,
         const GenericEvaluatorSymbolDict *dict);
+      GenericComponentParamEvaluator *makeExpression(
+        ParamAssignExpression *desc,
+        const GenericEvaluatorSymbolDict *dict);
+      GenericModelParam *makeStorage(const ParamAssignExpression *desc);
+      void collectExpressions(std::set<GenericComponentParamEvaluator *> &) const;
         
       static bool getLastDottedElement(
         std::string const &,
@@ -233,6 +324,9 @@ namespace RZ {
       GenericModelParam *lookupDof(std::string const &);
       GenericCompositeModel *parentCompositeModel() const;
 
+      // Functions registered by the scripts of this model
+      std::list<GenericCustomFunction *> customFunctions() const;
+
       bool loadScript(std::string const &path);
       bool setParam(std::string const &, Real);
       bool setDof(std::string const &, Real);
@@ -240,6 +334,14 @@ namespace RZ {
       std::string resolveFilePath(std::string const &) const;
 
       void assignEverything();
+
+      // Applies an edited recipe, rebuilding only what changed
+      bool update(Recipe *);
+
+      // Dependency graph of the model, in Graphviz format
+      std::string dependencyGraph() const;
+      void resetEvaluationCounts();
+
       void updateRandState();
       void setRandomState(ExprRandomState * state);
       ExprRandomState *randState() const;
@@ -42,6 +42,9 @@ std::string string_printf(const char* fmt, ...);
 std::vector<std::string> operator / (std::string const &, std::string const &);
 std::vector<std::string> operator / (std::string const &, char sep);
 
+// Seconds since an arbitrary point, not affected by clock adjustments
+double monotonicSeconds();
+
 static inline bool
 iequals(const std::string &a, const std::string &b)
 {
@@ -0,0 +1,119 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RZ_JSON_H
+#define _RZ_JSON_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+
+namespace RZ {
+  enum JSONType {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+  };
+
+  //
+  // Minimal JSON document reader. It is intended for small configuration
+  // and report files (benchmark baselines, simulation descriptions) and
+  // therefore favors simplicity over speed. Parse errors are reported
+  // by means of std::runtime_error, with the offending line and column.
+  //
+  class JSONValue {
+      JSONType    m_type   = JSON_NULL;
+      bool        m_bool   = false;
+      double      m_number = 0;
+      std::string m_string;
+      std::vector<JSONValue>           m_array;
+      std::map<std::string, JSONValue> m_object;
+      std::list<std::string>           m_keys; // In declaration order
+
+      friend class JSONParser;
+
+    public:
+      inline JSONType
+      type() const
+      {
+        return m_type;
+      }
+
+      inline bool
+      isNull() const
+      {
+        return m_type == JSON_NULL;
+      }
+
+      inline bool
+      isNumber() const
+      {
+        return m_type == JSON_NUMBER;
+      }
+
+      inline bool
+      isString() const
+      {
+        return m_type == JSON_STRING;
+      }
+
+      inline bool
+      isArray() const
+      {
+        return m_type == JSON_ARRAY;
+      }
+
+      inline bool
+      isObject() const
+      {
+        return m_type == JSON_OBJECT;
+      }
+
+      bool        asBool() const;
+      double      asNumber() const;
+      std::string const &asString() const;
+
+      // Arrays
+      size_t size() const;
+      JSONValue const &operator[](size_t) const;
+
+      // Objects. Absent keys evaluate to null.
+      bool has(std::string const &) const;
+      std::list<std::string> const &keys() const;
+      JSONValue const &operator[](std::string const &) const;
+
+      // Convenience getters with defaults
+      double      get(std::string const &, double dflt) const;
+      std::string get(std::string const &, std::string const &dflt) const;
+      std::string get(std::string const &, const char *dflt) const;
+      bool        getBool(std::string const &, bool dflt) const;
+
+      static JSONValue parse(
+        std::string const &text,
+        std::string const &fileName = "<string>");
+      static JSONValue fromFile(std::string const &path);
+  };
+
+  std::string jsonEscape(std::string const &);
+}
+
+#endif // _RZ_JSON_H
@@ -0,0 +1,148 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _LARGE_ALLOCATOR_H
+#define _LARGE_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <complex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#define RZ_LARGE_ALLOC_ALIGNMENT  64          // Cache line size
+#define RZ_LARGE_ALLOC_THRESHOLD  (1 << 21)   // Buffers mapped from here on
+#define RZ_HUGE_PAGE_SIZE         (1 << 21)
+
+namespace RZ {
+  struct LargeAllocStats {
+    uint64_t allocations = 0;
+    uint64_t releases    = 0;
+    uint64_t inUse       = 0; // [bytes]
+    uint64_t peak        = 0; // [bytes]
+    uint64_t mapped      = 0; // [bytes] Currently served by mmap
+    uint64_t hugePages   = 0; // [bytes] Currently advised as huge pages
+  };
+
+  //
+  // Allocation of large, long-lived buffers: beam arrays, detector planes
+  // and hit buffers. Buffers of RZ_LARGE_ALLOC_THRESHOLD bytes or more are
+  // mapped directly and aligned to huge page boundaries. Advising them as
+  // transparent huge pages is opt-in (setLargeAllocHugePages() or
+  // RZ_HUGE_PAGES=1), as it measured slower than plain pages on the
+  // reference traces. Smaller buffers come from the heap.
+  //
+  // Mapped buffers are never written by the allocator. Their pages are
+  // placed on the NUMA node of the thread that touches them first, which
+  // is the one that fills and traces the beam (or hits the detector) and
+  // not the one that created the object. zeroLargeBuffer() releases the
+  // pages of mapped buffers instead of clearing them, so they are placed
+  // again on the next touch.
+  //
+  void *allocLargeBuffer(size_t size, bool zero = true);
+  void  freeLargeBuffer(void *);
+  void  zeroLargeBuffer(void *, size_t size);
+
+  void setLargeAllocHugePages(bool);
+  bool largeAllocHugePages();
+
+  LargeAllocStats largeAllocStats();
+  void resetLargeAllocPeak();
+
+#ifndef SWIG
+  // Types whose value-initialization is all zeroes, and that need not be
+  // constructed in the (zeroed) storage returned by allocLargeBuffer().
+  template <class T>
+  struct IsZeroInitializable : std::is_arithmetic<T> {};
+
+  template <class T>
+  struct IsZeroInitializable<std::complex<T>> : std::is_arithmetic<T> {};
+
+  template <class T>
+  struct LargeAllocator {
+    typedef T value_type;
+
+    LargeAllocator() = default;
+
+    template <class U>
+    LargeAllocator(LargeAllocator<U> const &) {}
+
+    inline T *
+    allocate(size_t n)
+    {
+      return static_cast<T *>(allocLargeBuffer(n * sizeof(T)));
+    }
+
+    inline void
+    deallocate(T *p, size_t)
+    {
+      freeLargeBuffer(p);
+    }
+
+    // Default-inserting elements (e.g. resize()) does not touch memory.
+    // This relies on unused capacity being zero: fresh storage is, and
+    // destroy() restores it.
+    template <class U>
+    inline void
+    construct(U *p)
+    {
+      if constexpr (!IsZeroInitializable<U>::value)
+        ::new (static_cast<void *>(p)) U();
+    }
+
+    template <class U, class... Args>
+    inline void
+    construct(U *p, Args &&... args)
+    {
+      ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <class U>
+    inline void
+    destroy(U *p)
+    {
+      if constexpr (IsZeroInitializable<U>::value)
+        *p = U();
+      else
+        p->~U();
+    }
+
+    template <class U>
+    struct rebind {
+      typedef LargeAllocator<U> other;
+    };
+  };
+
+  template <class T, class U>
+  inline bool
+  operator==(LargeAllocator<T> const &, LargeAllocator<U> const &)
+  {
+    return true;
+  }
+
+  template <class T, class U>
+  inline bool
+  operator!=(LargeAllocator<T> const &, LargeAllocator<U> const &)
+  {
+    return false;
+  }
+#endif // SWIG
+}
+
+#endif // _LARGE_ALLOCATOR_H
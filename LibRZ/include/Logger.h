@@ -25,7 +25,8 @@ namespace RZ {
   enum LogLevel {
     LOG_ERROR,
     LOG_WARNING,
-    LOG_INFO
+    LOG_INFO,
+    LOG_DEBUG
   };
 
   class Logger {
@@ -68,5 +69,7 @@ namespace RZ {
   RZ::Logger::log(RZ::LOG_WARNING, __FILE__, __LINE__, fmt, ##arg)
 #define RZInfo(fmt, arg...) \
   RZ::Logger::log(RZ::LOG_INFO, __FILE__, __LINE__, fmt, ##arg)
+#define RZDebug(fmt, arg...) \
+  RZ::Logger::log(RZ::LOG_DEBUG, __FILE__, __LINE__, fmt, ##arg)
 
 #endif // _LIBRZ_LOGGER_H
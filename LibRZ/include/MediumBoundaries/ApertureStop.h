@@ -29,6 +29,7 @@ namespace RZ {
       ApertureStopBoundary();
       void setRadius(Real);
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
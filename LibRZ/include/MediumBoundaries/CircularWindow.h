@@ -31,6 +31,7 @@ namespace RZ {
       void setRadius(Real);
       void setRefractiveIndex(Real , Real);
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
@@ -39,6 +39,7 @@ namespace RZ {
       void setConvex(bool);
 
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
@@ -30,6 +30,7 @@ namespace RZ {
       void setRadius(Real);
       void setEccentricity(Real ecc);
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
@@ -29,6 +29,7 @@ namespace RZ {
   public:
     InfiniteMirrorBoundary();
     virtual std::string name() const;
+    virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
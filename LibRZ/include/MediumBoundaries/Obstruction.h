@@ -38,6 +38,7 @@ namespace RZ {
         unsigned int rows,
         unsigned int stride);
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
@@ -26,6 +26,7 @@ namespace RZ {
   class PassThroughBoundary : public MediumBoundary {
   public:
     virtual std::string name() const;
+    virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
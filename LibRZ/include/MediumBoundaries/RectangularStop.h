@@ -30,6 +30,7 @@ namespace RZ {
       void setWidth(Real);
       void setHeight(Real);
       virtual std::string name() const;
+      virtual bool paraxial(ParaxialBoundary &) const override;
   };
 }
 
@@ -32,6 +32,29 @@ namespace RZ {
   struct RayBeam;
   struct RayBeamSlice;
 
+  enum ParaxialBoundaryType {
+    ParaxialFlat,       // No power, no change of index
+    ParaxialRefractive,
+    ParaxialReflective,
+    ParaxialThinLens
+  };
+
+  //
+  // First-order description of a boundary, in the frame of its surface
+  // (see ParaxialModel in Paraxial.h). Indices are those at each side of
+  // the XY plane.
+  //
+  struct ParaxialBoundary {
+    ParaxialBoundaryType type = ParaxialFlat;
+    Real curvature   = 0;        // [1/m] Positive if the center is at +Z
+    Real vertex      = 0;        // [m] Z of the vertex
+    Real nPlus       = 1;        // Index at +Z
+    Real nMinus      = 1;        // Index at -Z
+    Real focalLength = INFINITY; // [m] Thin lenses only
+    Real aperture    = INFINITY; // [m] Semi-diameter
+    bool stop        = false;
+  };
+
   class MediumBoundary {
     SurfaceShape   *m_surfaceShape  = nullptr;
     EMInterface    *m_emInterface   = nullptr;
@@ -131,8 +154,17 @@ namespace RZ {
     }
 
     virtual std::string name() const = 0;
+
+    // False if the boundary has no first-order model (the default)
+    virtual bool paraxial(ParaxialBoundary &) const;
     
     virtual void cast(RayBeamSlice const &) const;
+
+    // Slices may be gathered from a non-sequential beam (see
+    // RayBeam::gatherTransmit()). Only destinations, directions, normals,
+    // amplitudes, refractive indices, wavelengths, ids and masks can be
+    // read, and only directions, amplitudes, refractive indices and the
+    // prune mask can be updated.
     virtual void transmit(RayBeamSlice const &) const;
 
     virtual ~MediumBoundary();
@@ -127,6 +127,16 @@ namespace RZ {
     Real focusZ              = 0;            // [m]
     bool vignetting          = true;
 
+    // Ray aiming (see Simulation::aimBeam). Circular beams are only sampled
+    // where this circle of the beam section overlaps the beam, and every
+    // ray stands for aimWeight / numRays of the flux of the full beam. A
+    // beam that is not aimed because nothing gets through has a zero weight.
+    bool aimed               = false;
+    Real aimX                = 0;            // [m]
+    Real aimY                = 0;            // [m]
+    Real aimRadius           = 0;            // [m]
+    Real aimWeight           = 1;            // [1]
+
     // Object structure
     SkyObjectShape objectShape = PointLike;
     Real angularDiameter     = M_PI / 6; // [1]
@@ -203,6 +213,19 @@ namespace RZ {
     void debug() const;
   };
 
+  //
+  // Name indices of a model, saved to undo registrations that fail
+  // halfway (see GenericCompositeModel::update)
+  //
+  struct OMModelIndex {
+    std::list<ReferenceFrame *>             frames;
+    std::map<std::string, ReferenceFrame *> nameToFrame;
+    std::list<Element *>                    elements;
+    std::map<std::string, Element *>        nameToElement;
+    std::map<std::string, OpticalElement *> nameToOpticalElement;
+    std::map<std::string, Detector *>       nameToDetector;
+  };
+
   class OMModel {
       std::list<ReferenceFrame *> m_frames;                  // Frame allocation
       std::map<std::string, ReferenceFrame *> m_nameToFrame; // Frame indexation
@@ -243,6 +266,15 @@ namespace RZ {
       void setFrameAlias(ReferenceFrame *, std::string const &name);
       Element *autoRegisterElement(Element *);
 
+      // These release every name of an element (including its ports and
+      // the detectors inside it) or a frame, without deleting them
+      void unregisterElement(Element *);
+      void unregisterFrame(ReferenceFrame *);
+      void clearOpticalPaths();
+
+      void saveIndex(OMModelIndex &) const;
+      void restoreIndex(OMModelIndex const &);
+
       inline ReferenceFrame *
       world() const
       {
@@ -459,7 +491,13 @@ namespace RZ {
         bool random = true,
         Real offZ = 0);
 
-      static void addBeam(RZ::RayList &dest, BeamProperties const &);
+      // If `pupil' is given, the coordinates of each ray in the section of
+      // the beam (relative to its center, in meters) are appended to it,
+      // two per ray
+      static void addBeam(
+        RZ::RayList &dest,
+        BeamProperties const &,
+        std::vector<Real> *pupil = nullptr);
       
   };
 }
@@ -38,15 +38,13 @@ namespace RZ {
 
     std::map<uint32_t, RayBeamStatistics> statistics;
     
-    mutable std::vector<RZ::Ray, std::allocator<RZ::Ray>> hits;
+    mutable RayHitBuffer hits;
 
     // Haha C++
-    mutable std::vector<Real>     locationArray;
-    mutable std::vector<Real>     directionArray;
     mutable std::vector<uint32_t> idArray;
 
-    std::vector<Real> &locations() const;
-    std::vector<Real> &directions() const;
+    RayHitColumn const &locations() const;
+    RayHitColumn const &directions() const;
 
     void clearCache() const;
     void clearStatistics();
@@ -59,8 +57,8 @@ namespace RZ {
     OpticalPath &plug(OpticalElement *, std::string const &name = "");
     void push(const OpticalSurface *);
 
-    const std::vector<Real>     &hits(std::string const &name) const;
-    const std::vector<Real>     &directions(std::string const &name) const;
+    RayHitColumn const          &hits(std::string const &name) const;
+    RayHitColumn const          &directions(std::string const &name) const;
 
     inline const OpticalSurface *
     getSurface(std::string const &name) const
@@ -137,8 +135,8 @@ namespace RZ {
       
       OpticalSurface *lookupSurface(std::string const &);
 
-      const std::vector<Real> &hits(std::string const &name = "") const;
-      const std::vector<Real> &directions(std::string const &name = "") const;
+      RayHitColumn const &hits(std::string const &name = "") const;
+      RayHitColumn const &directions(std::string const &name = "") const;
 
       virtual void setRecordHits(bool);
       virtual void clearHits();
@@ -0,0 +1,103 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _OPTIMIZER_H
+#define _OPTIMIZER_H
+
+#include <Sensitivity.h>
+
+namespace RZ {
+  //
+  // Terms of the merit function. Every target contributes the square of
+  // its residual, weight * (metric - target), so weights are the inverse
+  // of the tolerance of each metric (e.g. 1e6 for 1 µm on a spot radius).
+  //
+  struct OptimizerTarget {
+    SensitivityMetric metric;
+    Real              target = 0;
+    Real              weight = 1;
+  };
+
+  struct OptimizerProperties {
+    std::vector<std::string>     variables;   // Empty for all dofs
+    std::vector<OptimizerTarget> targets;
+    unsigned int                 maxIterations = 50;
+    Real                         tolerance     = 1e-6; // Relative merit decrease
+    Real                         damping       = 1e-3; // Initial lambda
+    unsigned int                 maxRejections = 10;   // Per iteration
+
+    // Finite differences (see JacobianProperties)
+    Real                         step      = 1e-6;
+    std::map<std::string, Real>  steps;
+    bool                         central   = true;
+    unsigned int                 processes = 0;
+    uint64_t                     seed      = RZ_SHARED_STATE_DEFAULT_SEED;
+  };
+
+  struct OptimizerResult {
+    std::vector<std::string> variables;
+    std::vector<std::string> metrics;
+    std::vector<Real>        initial;  // Variables before the optimization
+    std::vector<Real>        values;   // Best variables found
+    std::vector<Real>        nominal;  // Metrics at the best variables
+    std::vector<Real>        merits;   // Initial merit and accepted steps
+    unsigned int             iterations = 0;
+    unsigned int             traces     = 0;
+    bool                     converged  = false;
+    double                   elapsed    = 0; // [s]
+
+    inline Real
+    merit() const
+    {
+      return merits.empty() ? 0 : merits.back();
+    }
+  };
+
+  //
+  // Damped least squares (Levenberg-Marquardt) minimization of a merit
+  // function over dofs and parameters of a model. The Jacobian of every
+  // iteration is evaluated by SensitivityAnalysis (one forked process per
+  // difference trace), and trial steps in the calling process. All traces
+  // use the same rays and random streams, and the model is updated in
+  // place, so the merit function is deterministic and smooth.
+  //
+  // Steps are clamped to the ranges of the variables. The optimization
+  // stops when a step decreases the merit less than the tolerance (or no
+  // damping yields a better merit), or after maxIterations. The model is
+  // left at the best variables found. Detectors are left as the last trial
+  // trace left them, which may not be that of the best variables.
+  //
+  class Optimizer {
+      TopLevelModel      *m_model = nullptr; // Borrowed
+      SensitivityAnalysis m_analysis;
+
+      bool setVariables(
+        std::vector<std::string> const &,
+        std::vector<Real> const &);
+
+    public:
+      Optimizer(TopLevelModel *);
+
+      bool optimize(
+        TracingProperties const &,
+        OptimizerProperties const &,
+        OptimizerResult &);
+  };
+}
+
+#endif // _OPTIMIZER_H
@@ -0,0 +1,145 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _PARAXIAL_H
+#define _PARAXIAL_H
+
+#include <vector>
+#include <MediumBoundary.h>
+#include <Vector.h>
+
+namespace RZ {
+  struct OpticalPath;
+  struct OpticalSurface;
+
+  //
+  // Surface of a path, unfolded along the direction of propagation:
+  // distances are positive downstream, mirrors keep the sign of the
+  // index and have a power of -2nc. Rays are (y, nu), with nu = n * u
+  // (reduced angle), transferred as y += t / n * nu and refracted as
+  // nu -= y * power.
+  //
+  struct ParaxialSurface {
+    const OpticalSurface *surface = nullptr;
+    ParaxialBoundaryType  type    = ParaxialFlat;
+    Real distance       = 0;        // [m] From the previous vertex
+    Real nIn            = 1;
+    Real nOut           = 1;
+    Real power          = 0;        // [1/m]
+    Real aperture       = INFINITY; // [m] Semi-diameter
+    bool stop           = false;
+
+    // Rays at this surface, after refraction / reflection
+    Real marginalHeight = 0;        // [m]
+    Real marginalAngle  = 0;        // [1] u, not nu
+    Real chiefHeight    = 0;        // [m]
+    Real chiefAngle     = 0;        // [1]
+  };
+
+  //
+  // First-order properties. Positions are signed distances along the
+  // direction of propagation, measured from the first vertex (object
+  // side) or the last one (image side). Infinite positions mean afocal
+  // systems or telecentric pupils.
+  //
+  struct ParaxialProperties {
+    // Gaussian matrix, first to last vertex: (y, nu)' = [A B; C D] (y, nu)
+    Real A = 1, B = 0, C = 0, D = 1;
+
+    Real power                 = 0;        // [1/m]
+    Real efl                   = INFINITY; // [m] 1 / power
+    Real frontFocalPoint       = INFINITY; // [m] From the first vertex
+    Real backFocalPoint        = INFINITY; // [m] From the last vertex
+    Real frontPrincipalPlane   = INFINITY; // [m] From the first vertex
+    Real backPrincipalPlane    = INFINITY; // [m] From the last vertex
+
+    int  stopIndex             = -1;       // -1 if nothing limits the beam
+    Real entrancePupilPosition = INFINITY; // [m] From the first vertex
+    Real entrancePupilRadius   = 0;        // [m]
+    Real exitPupilPosition     = INFINITY; // [m] From the last vertex
+    Real exitPupilRadius       = 0;        // [m]
+
+    Real imagePosition         = INFINITY; // [m] From the last vertex
+    Real imageHeight           = 0;        // [m] Chief ray at the image
+    Real magnification         = 0;        // Finite objects only
+    Real fNumber               = INFINITY; // Working f/#, 1 / (2 n'u')
+  };
+
+  //
+  // First-order (ABCD / y-nu) model of a sequential path, built from the
+  // boundaries of its surfaces (see MediumBoundary::paraxial()) and the
+  // position of their frames. Surfaces are assumed to be centered on the
+  // axis that joins their vertices, which may be folded by mirrors.
+  //
+  // evaluate() reads the current geometry and traces the marginal and
+  // chief rays. It allocates nothing after the first call and does not
+  // touch any ray beam, so it can be called after every change of the
+  // model (e.g. in optimization loops).
+  //
+  class ParaxialModel {
+      const OpticalPath *m_path = nullptr;
+      std::vector<ParaxialSurface> m_surfaces;
+      ParaxialProperties m_properties;
+
+      // Scratch, reused across evaluations
+      std::vector<ParaxialBoundary> m_boundaries;
+      std::vector<Vec3> m_vertices;
+
+      Vec3 m_direction;
+      bool m_haveDirection  = false;
+      Real m_objectDistance = INFINITY; // [m] Object to first vertex
+      Real m_fieldAngle     = 0;        // [rad]
+      Real m_objectHeight   = 0;        // [m]
+
+      bool updateSurfaces();
+      void propagate(Real &y, Real &nu, size_t count) const;
+      void traceRays();
+
+    public:
+      ParaxialModel(const OpticalPath *path);
+
+      // Direction of the light at the first surface. By default, -Z of
+      // the first surface, as beams arrive to elements.
+      void setDirection(Vec3 const &);
+
+      // Distance from the object to the first vertex. Infinite by default.
+      void setObjectDistance(Real);
+
+      // Field angle (infinite objects) or object height (finite objects)
+      // of the chief ray.
+      void setFieldAngle(Real);
+      void setObjectHeight(Real);
+
+      // False (and an error is logged) if a surface has no paraxial model
+      bool evaluate();
+
+      inline std::vector<ParaxialSurface> const &
+      surfaces() const
+      {
+        return m_surfaces;
+      }
+
+      inline ParaxialProperties const &
+      properties() const
+      {
+        return m_properties;
+      }
+  };
+}
+
+#endif // _PARAXIAL_H
@@ -153,6 +153,7 @@ namespace RZ {
       std::list<std::set<std::string>> m_includeOnceContexts;
       std::set<std::string>  m_includeOnce;
       std::list<std::string> m_searchPaths;
+      std::list<std::string> m_dependencies; // Imported files, root only
 
       int m_recursion = 0;
       int m_line = 0;
@@ -210,6 +211,7 @@ namespace RZ {
       void debugParamList(ParserAssignList const &);
       bool alreadyImported(std::string const &path) const;
       void addImportOnce(std::string const &path);
+      void addDependency(std::string const &path);
 
       template<class T> 
       ValueType &value()
@@ -310,6 +312,7 @@ namespace RZ {
       bool parse();
       void addSearchPath(std::string const &path);
       void inheritSearchPaths(ParserContext const *);
+      std::list<std::string> const &dependencies() const;
       virtual int read() = 0;
 
   };
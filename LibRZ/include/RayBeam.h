@@ -25,12 +25,15 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <functional>
 
 #include <Vector.h>
 #include "MediumBoundary.h"
+#include <LargeAllocator.h>
 
 #define RZ_BEAM_MINIMUM_WAVELENGTH 1e-12
+#define RZ_BEAM_ALIGNMENT          64 // Cache line size
 
 namespace RZ {
   class ReferenceFrame;
@@ -51,6 +54,7 @@ namespace RZ {
 
     Real wavelength = RZ_WAVELENGTH;
     Real refNdx     = 1.; // Refractive index of the medium
+    Real amplitude  = 1.; // Its square is the intensity of the ray
 
     // Defined by the user
     uint32_t id = 0;
@@ -58,6 +62,114 @@ namespace RZ {
 
   class RayList : public std::list<RZ::Ray, std::allocator<RZ::Ray>> { };
 
+  typedef std::vector<Real, LargeAllocator<Real>> RayHitColumn;
+
+  //
+  // Hits of a single beam id, as a view of the columns of a RayHitBuffer.
+  // It remains valid until the buffer records new hits or is cleared.
+  //
+  struct RayHitGroup {
+    uint32_t    id            = 0;
+    size_t      offset        = 0; // Of the first hit in the buffer
+    size_t      count         = 0;
+    const Real *origins       = nullptr; // 3 per hit
+    const Real *directions    = nullptr; // 3 per hit
+    const Real *cumOptLengths = nullptr; // 1 per hit
+
+    inline size_t
+    size() const
+    {
+      return count;
+    }
+
+    inline Vec3
+    origin(size_t i) const
+    {
+      return Vec3(origins + 3 * i);
+    }
+
+    inline Vec3
+    direction(size_t i) const
+    {
+      return Vec3(directions + 3 * i);
+    }
+  };
+
+  //
+  // Rays recorded by a surface (see OpticalElement::setRecordHits()), in
+  // surface coordinates. Hits are appended to flat columns (one of them
+  // with the beam id of every hit) as they are recorded, so that recording
+  // costs the same whatever the number of beam ids.
+  //
+  // The columns are read grouped by beam id: before they are accessed,
+  // hits are sorted by id if they were not already. The sort is stable, so
+  // the hits of a beam keep the order in which they were recorded. The
+  // index of the groups is built at the same time, with a single entry
+  // per beam id.
+  //
+  class RayHitBuffer {
+      std::vector<uint32_t, LargeAllocator<uint32_t>> m_ids; // 1 per hit
+      RayHitColumn                      m_origins;           // 3 per hit
+      RayHitColumn                      m_directions;        // 3 per hit
+      RayHitColumn                      m_cumOptLengths;     // 1 per hit
+      std::vector<RayHitGroup>          m_groups;            // Sorted by id
+      bool                              m_sorted = true;
+
+      void index();
+
+    public:
+      RayHitBuffer() = default;
+      RayHitBuffer(RayHitBuffer const &);
+      RayHitBuffer(RayHitBuffer &&) = default;
+      RayHitBuffer &operator=(RayHitBuffer const &);
+      RayHitBuffer &operator=(RayHitBuffer &&) = default;
+
+      size_t size() const;
+      bool empty() const;
+      void clear();
+      void swap(RayHitBuffer &);
+
+      std::vector<RayHitGroup> const &groups();
+
+      // Null if there are no hits of this id
+      const RayHitGroup *find(uint32_t id);
+
+      RayHitColumn const &origins();
+      RayHitColumn const &directions();
+      RayHitColumn const &cumOptLengths();
+
+      inline void
+      push(
+        uint32_t id,
+        const Real *origin,
+        const Real *direction,
+        Real cumOptLength)
+      {
+        if (m_sorted && !m_ids.empty() && id < m_ids.back())
+          m_sorted = false;
+
+        m_ids.push_back(id);
+        m_origins.insert(m_origins.end(), origin, origin + 3);
+        m_directions.insert(m_directions.end(), direction, direction + 3);
+        m_cumOptLengths.push_back(cumOptLength);
+
+        if (!m_groups.empty())
+          m_groups.clear();
+      }
+  };
+
+  //
+  // Borrowed, row-major input buffers. Used to fill a beam directly
+  // (e.g. from numpy arrays) without building a RayList first.
+  //
+  struct RayArrays {
+    uint64_t        count       = 0;
+    const Real     *origins     = nullptr; // count x 3
+    const Real     *directions  = nullptr; // count x 3, normalized
+    const Real     *wavelengths = nullptr; // count. If null, RZ_WAVELENGTH
+    const uint32_t *ids         = nullptr; // count. If null, 0
+  };
+
 struct RayBeamStatistics {
     uint64_t intercepted = 0;
     uint64_t vignetted   = 0;
@@ -97,6 +209,34 @@ struct RayBeamStatistics {
     inline RayBeamSlice();
   };
   
+  //
+  // Alive rays of a non-sequential beam grouped by the surface they are on
+  // (see RayBeam::bin()). This is a counting sort: rays keep their order
+  // within every bin, and bins are ordered by first appearance.
+  //
+  struct RayBeamBins {
+    std::vector<OpticalSurface *> surfaces; // Surface of every bin
+    std::vector<uint64_t>         offsets;  // Bin starts, plus the end
+    std::vector<uint64_t>         indices;  // Ray indices, bin after bin
+    uint64_t                      runs = 0; // Runs of equal surfaces
+
+    // Scratch, kept to avoid reallocations
+    std::vector<uint32_t>         binOf;
+    std::unordered_map<OpticalSurface *, uint32_t> binIndex;
+
+    inline size_t
+    bins() const
+    {
+      return surfaces.size();
+    }
+
+    inline uint64_t
+    binSize(size_t bin) const
+    {
+      return offsets[bin + 1] - offsets[bin];
+    }
+  };
+
   struct RayBeam {
     uint64_t count      = 0;
     uint64_t allocation = 0;
@@ -193,25 +333,27 @@ struct RayBeamStatistics {
       return (~prevMask[index >> 6] & (1ull << (index & 63))) >> (index & 63);
     }
 
-    #define SETMASK(field) \
-      field[word] = (field[word] & ~bit) | (existing->field[word] & bit)
+    #define SETMASK(field)                                  \
+      field[word] = (field[word] & ~bit)                    \
+        | (((existing->field[from >> 6] >> (from & 63)) & 1) << (index & 63))
+    // Copies ray `from' of `existing' to ray `index' (surfaces excluded)
     inline void
-    copyRay(const RayBeam *existing, uint64_t index)
+    copyRay(const RayBeam *existing, uint64_t from, uint64_t index)
     {
       uint64_t bit  = 1ull << (index & 63);
       uint64_t word = index >> 6;
 
-      memcpy(origins      + 3 * index, existing->origins      + 3 * index, 3 * sizeof(Real));
-      memcpy(directions   + 3 * index, existing->directions   + 3 * index, 3 * sizeof(Real));
-      memcpy(normals      + 3 * index, existing->normals      + 3 * index, 3 * sizeof(Real));
-      memcpy(destinations + 3 * index, existing->destinations + 3 * index, 3 * sizeof(Real));
+      memcpy(origins      + 3 * index, existing->origins      + 3 * from, 3 * sizeof(Real));
+      memcpy(directions   + 3 * index, existing->directions   + 3 * from, 3 * sizeof(Real));
+      memcpy(normals      + 3 * index, existing->normals      + 3 * from, 3 * sizeof(Real));
+      memcpy(destinations + 3 * index, existing->destinations + 3 * from, 3 * sizeof(Real));
 
-      amplitude[index]     = existing->amplitude[index];
-      lengths[index]       = existing->lengths[index];
-      cumOptLengths[index] = existing->cumOptLengths[index];
-      refNdx[index]        = existing->refNdx[index];
-      wavelengths[index]   = existing->wavelengths[index];
-      ids[index]           = existing->ids[index];
+      amplitude[index]     = existing->amplitude[from];
+      lengths[index]       = existing->lengths[from];
+      cumOptLengths[index] = existing->cumOptLengths[from];
+      refNdx[index]        = existing->refNdx[from];
+      wavelengths[index]   = existing->wavelengths[from];
+      ids[index]           = existing->ids[from];
 
       SETMASK(mask);
       SETMASK(chiefMask);
@@ -220,7 +362,13 @@ struct RayBeamStatistics {
     }
     #undef SETMASK
 
-    virtual void allocate(uint64_t);
+    inline void
+    copyRay(const RayBeam *existing, uint64_t index)
+    {
+      copyRay(existing, index, index);
+    }
+
+    virtual void allocate(uint64_t, bool keep = true);
     virtual void deallocate();
 
     template <class T> void extractRays(
@@ -238,7 +386,12 @@ struct RayBeamStatistics {
 
 
     void clearMask();
+    uint64_t countAlive() const;
+    uint64_t countIntercepted() const;
     void computeInterceptStatistics(OpticalSurface * = nullptr);
+
+    // Intercepted rays of a surface-relative slice, as hits
+    static void recordHits(RayHitBuffer &, RayBeamSlice const &);
     void updateOrigins();
 
     //
@@ -252,6 +405,14 @@ struct RayBeamStatistics {
     // EMInterface calculations
     //
     void copyTo(RayBeam *) const;
+
+    // Copy `count' rays (including normals and masks) from `start' to
+    // `destStart' in `dest'. Both offsets must be multiples of 64.
+    void copyTo(
+      RayBeam *dest,
+      uint64_t start,
+      uint64_t destStart,
+      uint64_t count) const;
     void toRelative(const ReferenceFrame *plane);
     void toRelative(RayBeam *, const ReferenceFrame *plane) const;
 
@@ -270,10 +431,19 @@ struct RayBeamStatistics {
     uint64_t updateFromVisible(
       const OpticalSurface *currentSurface,
       const RayBeam *beam);
+
+    // Non-sequential beams only. Bins the alive rays by surface.
+    void bin(RayBeamBins &) const;
+
+    // Copies the fields seen by MediumBoundary::transmit() of the rays
+    // `indices[0..n)' of `src' to [0, n) of this beam, and those that
+    // transmit() may update back.
+    void gatherTransmit(const RayBeam *src, const uint64_t *indices, uint64_t n);
+    void scatterTransmit(const RayBeam *src, const uint64_t *indices, uint64_t n);
     void debug() const;
 
     RayBeam(uint64_t, bool surfaces = false);
-    ~RayBeam();
+    virtual ~RayBeam();
 
   private:
     void addInterceptMetrics(OpticalSurface *surface, RayBeamSlice const &slice);
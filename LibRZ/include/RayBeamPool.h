@@ -0,0 +1,63 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RAY_BEAM_POOL_H
+#define _RAY_BEAM_POOL_H
+
+#include <RayBeam.h>
+#include <map>
+
+#define RZ_BEAM_POOL_MAX_CACHED 4 // Per beam type
+
+namespace RZ {
+  //
+  // Cache of released beams, indexed by capacity. Tracing the same number
+  // of rays repeatedly (e.g. in sweeps) or creating a new non-sequential
+  // beam per propagation ends up recycling the same buffers instead of
+  // going through the allocator.
+  //
+  // Acquired beams have the requested number of rays, with all of them
+  // alive, unintercepted and non-chief (non-sequential beams are all
+  // pruned instead, as in the RayBeam constructor). The rest of the
+  // fields are uninitialized.
+  //
+  class RayBeamPool {
+      std::multimap<uint64_t, RayBeam *> m_free[2]; // Sequential, non-seq.
+      size_t   m_maxCached = RZ_BEAM_POOL_MAX_CACHED;
+      uint64_t m_hits      = 0;
+      uint64_t m_misses    = 0;
+
+    public:
+      RayBeamPool();
+      ~RayBeamPool();
+
+      RayBeam *acquire(uint64_t count, bool nonSeq = false);
+      void release(RayBeam *);
+
+      // Free all cached beams
+      void clear();
+
+      void setMaxCached(size_t);
+      size_t cached() const;
+      uint64_t cachedBytes() const;
+      uint64_t hits() const;
+      uint64_t misses() const;
+  };
+}
+
+#endif // _RAY_BEAM_POOL_H
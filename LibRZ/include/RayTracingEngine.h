@@ -23,6 +23,8 @@
 #include <cassert>
 
 #include "RayBeam.h"
+#include "RayBeamPool.h"
+#include "RayTracingProfiler.h"
 
 namespace RZ {
   class ReferenceFrame;
@@ -64,6 +66,9 @@ namespace RZ {
       void toRays(bool keepPruned = false);  // From beam->destinations and beam->directions to rays
 
       RayTracingProcessListener *m_listener = nullptr; // Always borrowed
+      RayTracingProfiler         m_profiler;
+      RayBeamPool                m_beamPool;
+      bool                       m_surfaceBinning = false;
 
       struct timeval m_start;
 
@@ -80,6 +85,40 @@ namespace RZ {
         return m_beam;
       }
 
+      inline RayTracingProfiler &
+      profiler()
+      {
+        return m_profiler;
+      }
+
+      inline RayTracingProfiler const &
+      profiler() const
+      {
+        return m_profiler;
+      }
+
+      inline RayBeamPool &
+      beamPool()
+      {
+        return m_beamPool;
+      }
+
+      // Non-sequential beams interleaved by surface are transmitted from
+      // per-surface bins (see RayBeam::bin()), if the engine supports it.
+      // It trades a gather and a scatter of every ray for fewer and longer
+      // calls to MediumBoundary::transmit().
+      inline void
+      setSurfaceBinning(bool binning)
+      {
+        m_surfaceBinning = binning;
+      }
+
+      inline bool
+      surfaceBinning() const
+      {
+        return m_surfaceBinning;
+      }
+
       inline void
       setCurrentStage(std::string const &name, size_t current, size_t num)
       {
@@ -90,6 +129,7 @@ namespace RZ {
 
       virtual RayBeam *makeBeam();
       virtual RayBeam *makeNSBeam();
+      virtual void releaseBeam(RayBeam *); // Beams from makeBeam / makeNSBeam
       
       RayBeam *ensureMainBeam();
 
@@ -106,6 +146,10 @@ namespace RZ {
       // This sets a beam that was initialized from somewhere else
       void setMainBeam(RayBeam *);
 
+      // Make `beam' the main beam without copying it, and return the
+      // previous one. The caller must restore it before clear().
+      RayBeam *exchangeMainBeam(RayBeam *beam);
+
       // This adds a new ray to the list
       void pushRay(
         Point3 const &origin,
@@ -113,6 +157,7 @@ namespace RZ {
         Real length = 0,
         uint32_t id = 0);
       void pushRays(RayList const &);
+      void pushRays(RayArrays const &);
       
       // Intersect with this surface. It needs to check if the beam is up to
       // date, and recreated it with toBeam() if necessary.
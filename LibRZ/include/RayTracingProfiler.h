@@ -0,0 +1,131 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RAYTRACING_PROFILER_H
+#define _RAYTRACING_PROFILER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <list>
+
+namespace RZ {
+  struct OpticalSurface;
+
+  enum RayTracingPhase {
+    PHASE_TO_RELATIVE,   // Beam conversion to surface coordinates
+    PHASE_CAST,          // Intersection with the surface
+    PHASE_TRANSMIT,      // Transmission through the medium boundary
+    PHASE_STATISTICS,    // Intercept statistics and hit recording
+    PHASE_EXTRACTION,    // Extraction of intermediate rays
+    PHASE_FROM_RELATIVE, // Beam conversion back to world coordinates
+  };
+
+#define RZ_TRACING_PHASE_COUNT 6
+
+  const char *tracingPhaseToString(RayTracingPhase);
+
+  //
+  // A tracing event is a measurement of the time spent by a given phase
+  // of the tracing process on a given surface, along with the number of
+  // rays that entered and left that phase.
+  //
+  struct RayTracingEvent {
+    std::string     stage;        // Fully qualified surface name
+    RayTracingPhase phase;
+    uint64_t        start    = 0; // [ns] Since the beginning of the trace
+    uint64_t        duration = 0; // [ns]
+    uint64_t        raysIn   = 0;
+    uint64_t        raysOut  = 0;
+
+    inline double
+    raysPerSecond() const
+    {
+      return duration > 0 ? 1e9 * static_cast<double>(raysIn) / duration : 0;
+    }
+  };
+
+  // Accumulated events of a (stage, phase) pair
+  struct RayTracingStageSummary {
+    std::string     stage;
+    RayTracingPhase phase;
+    uint64_t        calls    = 0;
+    uint64_t        duration = 0; // [ns]
+    uint64_t        raysIn   = 0;
+    uint64_t        raysOut  = 0;
+
+    inline double
+    raysPerSecond() const
+    {
+      return duration > 0 ? 1e9 * static_cast<double>(raysIn) / duration : 0;
+    }
+  };
+
+  //
+  // The profiler is owned by the tracing engine. When it is disabled, the
+  // only overhead is a branch per phase. When enabled, a clock read and a
+  // pass over the ray masks is performed per phase and surface.
+  //
+  class RayTracingProfiler {
+      bool            m_enabled = false;
+      struct timespec m_origin;
+      std::vector<RayTracingEvent> m_events;
+
+    public:
+      inline bool
+      enabled() const
+      {
+        return m_enabled;
+      }
+
+      // Nanoseconds elapsed since the last reset()
+      inline uint64_t
+      now() const
+      {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return static_cast<uint64_t>(ts.tv_sec - m_origin.tv_sec) * 1000000000ull
+          + ts.tv_nsec - m_origin.tv_nsec;
+      }
+
+      RayTracingProfiler();
+
+      void setEnabled(bool);
+      void reset();
+
+      void record(
+        const OpticalSurface *,
+        RayTracingPhase,
+        uint64_t start,
+        uint64_t raysIn,
+        uint64_t raysOut);
+
+      std::vector<RayTracingEvent> const &events() const;
+      std::list<RayTracingStageSummary> summary() const;
+      uint64_t totalTime(RayTracingPhase) const;
+      uint64_t totalTime() const;
+
+      std::string chromeTrace() const;
+      bool saveChromeTrace(std::string const &) const;
+  };
+}
+
+#endif // _RAYTRACING_PROFILER_H
@@ -232,6 +232,10 @@ namespace RZ {
       std::vector<RecipeOpticalPath *> const &paths() const;
       std::map<std::string, RecipeContext *> const &ports() const;
 
+      std::vector<ParamAssignExpression *> const &elementParameters() const;
+      std::vector<ParamAssignExpression *> const &frameParameters() const;
+      std::vector<ParamAssignExpression *> const &variables() const;
+
       std::map<std::string, Recipe *> const &customElements() const;
       std::map<std::string, RecipeParameter> const &dofs() const;
       std::map<std::string, RecipeParameter> const &params() const;
@@ -241,6 +245,9 @@ namespace RZ {
       RecipeOpticalPath *lookupOpticalPath(std::string const & = "") const;
       RecipeElementStep *resolveElement(std::string const &) const;
       Recipe            *makeCustomElement(std::string const &);
+
+      // Exchanges custom element definitions with another recipe
+      void swapCustomElements(Recipe *);
       
       bool addScript(std::string const &scriptPath);
       void pushSearchPath(std::string const &path);
@@ -290,6 +297,7 @@ namespace RZ {
       void debug();
 
     friend class RecipeElementStep;
+    friend class RecipeCache;
   };
 
   class GenericCompositeModel;
@@ -0,0 +1,112 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RECIPE_CACHE_H
+#define _RECIPE_CACHE_H
+
+#include <Recipe.h>
+#include <string>
+#include <list>
+
+// Bump this every time the layout of the Recipe changes
+#define RZ_RECIPE_CACHE_VERSION 1
+
+namespace RZ {
+  enum RecipeSerializationMode {
+    RECIPE_SERIALIZE_ALL,      // Everything, as stored in the cache
+    RECIPE_SERIALIZE_CONTENTS, // Everything but source locations
+    RECIPE_SERIALIZE_LAYOUT    // No expressions nor parameter values
+  };
+
+  class RecipeCacheWriter;
+  class RecipeCacheReader;
+
+  //
+  // On-disk cache of parsed recipes. Entries are keyed by the model file
+  // and the search paths it was parsed with, and store the size and hash
+  // of the contents of every file in its import closure. If any of them
+  // changed (or disappeared) the entry is ignored and the model must be
+  // parsed again.
+  //
+  // The cache is opt-in: library users enable it with setEnabled(), and
+  // applications (the GUI and rzsim) with setDefaultEnabled(), which
+  // leaves the final word to RZ_RECIPE_CACHE. This variable may be 0 (never
+  // cache), 1 (cache in the default directory) or the cache directory
+  // itself. The default directory is $XDG_CACHE_HOME/rayzaler/recipes,
+  // falling back to ~/.cache/rayzaler/recipes.
+  //
+  // A directory that cannot be written is not an error: the failure is
+  // logged at debug level and the cache disables itself.
+  //
+  class RecipeCache {
+      std::string m_dir;
+      bool        m_enabled  = false;
+      bool        m_fromEnv  = false; // RZ_RECIPE_CACHE decided
+      uint64_t    m_hits     = 0;
+      uint64_t    m_misses   = 0;
+
+      static RecipeCache *m_instance;
+
+      static std::string makeKey(
+        std::string const &path,
+        std::list<std::string> const &searchPaths);
+      std::string entryPath(std::string const &key) const;
+
+      static void writeRecipe(RecipeCacheWriter &, Recipe const *);
+      static Recipe *readRecipe(RecipeCacheReader &, Recipe *parent);
+
+    public:
+      RecipeCache(std::string const &dir = "");
+
+      static RecipeCache *instance();
+
+      void setDirectory(std::string const &);
+      std::string directory() const;
+      void setEnabled(bool);
+      void setDefaultEnabled(bool);
+      bool enabled() const;
+      uint64_t hits() const;
+      uint64_t misses() const;
+
+      // Null if there is no valid entry for this model
+      Recipe *load(
+        std::string const &path,
+        std::list<std::string> const &searchPaths);
+
+      // Dependencies are the imported files, as reported by ParserContext
+      bool save(
+        std::string const &path,
+        std::list<std::string> const &searchPaths,
+        Recipe const *recipe,
+        std::list<std::string> const &dependencies);
+
+      //
+      // Two recipes with the same layout have the same frames, elements,
+      // variables, parameters and paths, in the same order, and differ at
+      // most in the expressions and values assigned to them. Custom
+      // element definitions are always compared in full.
+      //
+      static void serialize(
+        Recipe const *,
+        std::string &,
+        RecipeSerializationMode mode = RECIPE_SERIALIZE_ALL);
+      static Recipe *deserialize(std::string const &, Recipe *parent = nullptr);
+  };
+}
+
+#endif // _RECIPE_CACHE_H
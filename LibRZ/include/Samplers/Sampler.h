@@ -36,6 +36,7 @@ namespace RZ {
     virtual bool sampleUniform(std::vector<Vec3> &) = 0;
 
   public:
+    virtual ~Sampler() = default;
     virtual void setRadius(Real) = 0;
     void setRandom(bool);
     void reset();
@@ -24,14 +24,47 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 #include "GenericCompositeModel.h"
 
+// Results kept per pure function. The cache is dropped when full.
+#define RZ_SCRIPT_MEMO_MAX_ENTRIES 65536
+
 namespace RZ {
+  //
+  // Functions registered by Python scripts. Pure functions (same arguments,
+  // same result) are memoized. Vectorized functions take one numpy array
+  // per argument and return an array of results, which lets evaluators
+  // batch all the calls of a column evaluation into a single one.
+  //
+  // The memo and the statistics are shared by every evaluator the function
+  // is registered in, possibly in different threads, and are only touched
+  // with the GIL held.
+  //
   struct ScriptFunction : public GenericCustomFunction {
     using GenericCustomFunction::GenericCustomFunction;
-    PyObject *pFunc = nullptr;
+    typedef std::vector<Real> ArgList;
+
+    PyObject *pFunc      = nullptr;
+    bool      pure       = false;
+    bool      vectorized = false;
+
+    // Statistics
+    uint64_t  calls      = 0; // Calls into Python
+    uint64_t  memoHits   = 0;
+
+    std::map<ArgList, Real> memo;
+
+    bool callScalar(Real const *args, Real &result);
+    bool callVectorized(std::vector<ArgList> const &args, Real *results);
+    void remember(ArgList const &, Real);
 
     virtual Real evaluate(Real const *args, unsigned argc) override;
+
+    virtual bool batched() const override;
+    virtual bool evaluateBatch(
+      std::vector<ArgList> const &args,
+      Real *results) override;
   };
 
   class ScriptLoader;
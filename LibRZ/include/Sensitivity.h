@@ -0,0 +1,142 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _SENSITIVITY_H
+#define _SENSITIVITY_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <Simulation.h>
+
+namespace RZ {
+  class TopLevelModel;
+  class OpticalElement;
+  class GenericModelParam;
+
+  //
+  // Metrics are computed from the exact hits on the first optical surface
+  // of an element (usually a detector), in surface coordinates. Hits are
+  // recorded during the analysis regardless of recordHits(). The OPD RMS
+  // is the spread of the optical path lengths of the rays up to the
+  // surface, which vanishes for a perfect image on a spherical surface
+  // centered at the pupil (or on any surface, for collimated beams hitting
+  // flat surfaces at normal incidence).
+  //
+  enum SensitivityMetricKind {
+    SpotCentroidX,
+    SpotCentroidY,
+    SpotRmsRadius,
+    SpotMomentXX,       // Central second moments
+    SpotMomentYY,
+    SpotMomentXY,
+    SpotTransmission,   // Hits over traced rays
+    SpotOpdRms          // [m] RMS of the optical path length
+  };
+
+  struct SensitivityMetric {
+    SensitivityMetricKind kind = SpotCentroidX;
+    std::string           element;
+
+    std::string label() const;
+  };
+
+  //
+  // Dofs are looked up first. Names that are not dofs are taken as model
+  // parameters, which re-evaluate the whole model when changed.
+  //
+  struct JacobianProperties {
+    std::vector<std::string>    dofs;            // Empty for all dofs
+    std::vector<SensitivityMetric> metrics;
+    Real                        step    = 1e-6;  // In the units of the dof
+    std::map<std::string, Real> steps;           // Per-dof overrides
+    bool                        central = true;  // Else forward differences
+    unsigned int                processes = 0;   // Zero for one per core
+    uint64_t                    seed    = RZ_SHARED_STATE_DEFAULT_SEED;
+  };
+
+  struct JacobianResult {
+    std::vector<std::string> dofs;
+    std::vector<std::string> metrics;
+    std::vector<Real>        nominal;  // Metrics at the current dof values
+    std::vector<Real>        steps;    // Actual difference step of each dof
+    std::vector<Real>        jacobian; // Row-major, metrics x dofs
+    unsigned int             traces  = 0;
+    double                   elapsed = 0; // [s]
+
+    inline Real
+    at(size_t metric, size_t dof) const
+    {
+      return jacobian[metric * dofs.size() + dof];
+    }
+  };
+
+  //
+  // Finite-difference derivatives of spot metrics with respect to the dofs
+  // of a model. Every evaluation traces the same rays with the same random
+  // streams (common random numbers), so differences are free of sampling
+  // noise. Evaluations are split across forked processes, each perturbing
+  // its own copy-on-write copy of the model, with the dofs updated in
+  // place (only the parameters that depend on them are re-evaluated).
+  //
+  // The nominal trace runs in the calling process, and the detectors are
+  // left as it leaves them. Steps that would leave the range of a dof
+  // fall back to one-sided differences.
+  //
+  class SensitivityAnalysis {
+      TopLevelModel *m_model = nullptr; // Borrowed
+
+      struct Evaluation {
+        size_t dof;  // Ignored for the nominal evaluation
+        Real   value;
+      };
+
+      std::vector<OpticalElement *> m_elements;       // Unique
+      std::vector<bool>             m_recorded;       // Their recordHits()
+      std::vector<OpticalElement *> m_metricElements; // One per metric
+      std::vector<Evaluation>       m_evaluations;
+
+      void prepare(JacobianProperties const &);
+      void restore();
+      bool evaluate(
+        TracingProperties const &,
+        JacobianProperties const &,
+        std::vector<std::string> const &dofs,
+        Evaluation const &,
+        Real *dest);
+
+    public:
+      SensitivityAnalysis(TopLevelModel *);
+
+      GenericModelParam *lookupVariable(std::string const &) const;
+      bool setVariable(std::string const &, Real);
+
+      // Metrics at the current dof values, from one trace
+      bool metrics(
+        TracingProperties const &,
+        JacobianProperties const &,
+        std::vector<Real> &values);
+
+      bool jacobian(
+        TracingProperties const &,
+        JacobianProperties const &,
+        JacobianResult &);
+  };
+}
+
+#endif // _SENSITIVITY_H
@@ -22,17 +22,82 @@
 #include <string>
 #include <list>
 #include <RayTracingEngine.h>
+#include <Random.h>
+#include <CompactRayBeam.h>
+
+// Rays per block in depth-first sequential traces. About 200 bytes per ray
+// are touched at every stage, so this fits the beam in a 2 MiB L2.
+#define RZ_SIMULATION_DEFAULT_BLOCK_SIZE 8192
+
+// Probe rays traced by Simulation::aimBeam
+#define RZ_SIMULATION_DEFAULT_AIM_PROBES 1024
+
+// Ghost generations are stored in the top bits of the ray ids
+#define RZ_GHOST_GENERATION_SHIFT 24
+#define RZ_GHOST_ID_MASK          ((1u << RZ_GHOST_GENERATION_SHIFT) - 1)
+#define RZ_GHOST_MAX_GENERATION   ((1u << (32 - RZ_GHOST_GENERATION_SHIFT)) - 1)
 
 namespace RZ {
   class RayBeamElement;
   class RayTracingHeuristic;
   class OMModel;
+  class Detector;
+  struct OpticalPath;
+  struct BeamProperties;
+  struct SimulationShardLayout;
+  class OpticalSurface;
 
   enum TracingType {
     Sequential,
     NonSequential
   };
 
+  //
+  // Ghost (stray light) analysis of non-sequential traces. Every ray that
+  // goes through an interface with a ghost reflectance (i.e. dielectrics,
+  // see EMInterface::ghostReflectance()) spawns a reflected child ray, and
+  // the children of a generation are traced from a pooled beam once the
+  // previous generation is done, up to maxDepth generations.
+  //
+  // The power of a ray, relative to that of its source ray, is carried by
+  // its amplitude as |amplitude|^2: parents keep the transmittance of the
+  // interface and children get its reflectance. Children weaker than
+  // `cutoff' play Russian roulette: they survive with probability
+  // weight / cutoff, with their weight raised to `cutoff'.
+  //
+  // The generation of every ray is stored in the top bits of its id (see
+  // ghostGeneration()), so ghosts are told apart in the statistics and
+  // recorded hits of the surfaces, and detectors can be restricted to one
+  // generation (see their `generation' property). This leaves 24 bits for
+  // the ids of the source rays and limits maxDepth to 255: traces outside
+  // these ranges are rejected. Detectors are weighted for the duration of
+  // the trace, so that they accumulate the power of the hits along with
+  // their counts. Only those whose `weighted' property is set keep it once
+  // the trace is over.
+  //
+  struct GhostSplittingProperties {
+    unsigned int maxDepth = 0;    // Zero disables ray splitting
+    Real         cutoff   = 1e-4; // Russian roulette threshold
+  };
+
+  static inline unsigned int
+  ghostGeneration(uint32_t id)
+  {
+    return id >> RZ_GHOST_GENERATION_SHIFT;
+  }
+
+  static inline uint32_t
+  ghostSourceId(uint32_t id)
+  {
+    return id & RZ_GHOST_ID_MASK;
+  }
+
+  static inline uint32_t
+  ghostId(uint32_t id, unsigned int generation)
+  {
+    return ghostSourceId(id) | (generation << RZ_GHOST_GENERATION_SHIFT);
+  }
+
   struct TracingProperties {
     TracingType     type                  = Sequential;
     RayBeamElement *beamElement           = nullptr;
@@ -40,13 +105,63 @@ namespace RZ {
     bool            clearDetectors        = true;
     std::string     path;
     const RayList  *pRays                 = nullptr;
+    const RayArrays *pArrays              = nullptr; // Overrides pRays
     RayList         rays;
     std::string           heuristic       = "dummy";
     unsigned int          maxPropagations = 1000;
     const struct timeval *startTime       = nullptr;
     RayTracingProcessListener *listener   = nullptr;
+    bool                  keepBeam        = false; // Never shard
+    GhostSplittingProperties ghosts;             // Non-sequential only
+  };
+
+  //
+  // Progressive traces generate and trace batches of rays until every
+  // estimator has converged to the requested relative tolerance, or until
+  // the ray or time budget is exhausted. Estimators are computed on the
+  // accumulated result, and their standard errors from the spread of the
+  // per-batch values (batch means).
+  //
+  // - Transmission: fraction of the rays intercepted by the detector
+  //   surface, or by the last surface of the path if there is no detector.
+  // - Spot RMS radius and encircled energy radius on the detector, around
+  //   the centroid of the image.
+  //
+  // Estimators that are exactly zero (e.g. a spot within a single pixel)
+  // are reported, but do not take part in the convergence test.
+  //
+  struct ProgressiveTracingProperties {
+    Real         tolerance         = 1e-2; // Relative standard error
+    double       timeBudget        = 0;    // [s] Zero for no limit
+    uint64_t     batchRays         = 10000;
+    uint64_t     maxRays           = 0;    // Zero for no limit
+    unsigned int minBatches        = 4;
+    std::string  detector;                 // If empty, no spot estimators
+    Real         encircledFraction = .8;
   };
 
+  struct ProgressiveTracingResult {
+    uint64_t     rays                 = 0;
+    unsigned int batches              = 0;
+    double       elapsed              = 0; // [s]
+    bool         converged            = false;
+
+    Real         transmission         = 0;
+    Real         transmissionError    = 0; // Relative
+    Real         centroidX            = 0; // [m] Detector coordinates
+    Real         centroidY            = 0; // [m]
+    Real         rmsRadius            = 0; // [m]
+    Real         rmsRadiusError       = 0; // Relative
+    Real         encircledRadius      = 0; // [m]
+    Real         encircledRadiusError = 0; // Relative
+  };
+
+  //
+  // Simulations can be split across forked worker processes (see
+  // traceSharded() in Simulation.cpp). Every process traces a disjoint
+  // shard of the rays with its own random streams, and only the detector
+  // images and the surface statistics are merged back.
+  //
   class Simulation {
       OMModel          *m_model  = nullptr;
       RayTracingEngine *m_engine = nullptr;
@@ -55,9 +170,58 @@ namespace RZ {
       RayList           m_intermediateRays;
       RayTracingHeuristic *m_heuristic = nullptr;
       struct timeval    m_lastTick;
+      unsigned int      m_processes = 1;
+      uint64_t          m_shardSeed = RZ_SHARED_STATE_DEFAULT_SEED;
+      uint64_t          m_blockSize = RZ_SIMULATION_DEFAULT_BLOCK_SIZE;
+      TracingPrecision  m_precision = DoublePrecision;
+      CompactRayBeam<float> m_compactBeam;
+
+      // Children of the ghost generation being traced
+      struct GhostRay {
+        Vec3            origin;
+        Vec3            direction;
+        Complex         amplitude;
+        Real            cumOptLength;
+        Real            wavelength;
+        Real            refNdx;
+        uint32_t        id;
+        OpticalSurface *surface;
+      };
+
+      std::vector<GhostRay> m_ghosts;
+      ExprRandomState       m_ghostRandState;
 
+      bool traceSequentialStages(TracingProperties const &, const OpticalPath *);
+      bool traceSequentialBlocks(TracingProperties const &, const OpticalPath *);
+      bool traceSequentialCompact(TracingProperties const &);
       bool traceSequential(TracingProperties const &);
       bool traceNonSequential(TracingProperties const &);
+      bool propagateNonSequential(TracingProperties const &, unsigned int gen);
+      void prepareGhosts(
+        TracingProperties const &,
+        size_t count,
+        std::vector<Detector *> &weighted);
+      void restoreGhosts(std::vector<Detector *> const &weighted);
+      bool traceRays(TracingProperties const &, size_t count);
+      void spawnGhosts(GhostSplittingProperties const &, unsigned int gen);
+      RayBeam *makeGhostBeam();
+      bool planShards(
+        TracingProperties const &,
+        size_t count,
+        SimulationShardLayout &);
+      bool traceSharded(
+        TracingProperties const &,
+        size_t count,
+        SimulationShardLayout const &,
+        bool &overflow);
+      bool traceShard(
+        TracingProperties const &,
+        SimulationShardLayout const &,
+        size_t start,
+        size_t end,
+        unsigned int shard,
+        uint8_t *dest);
+      void seedShard(unsigned int shard);
       void initNSBeam();
       
     public:
@@ -71,7 +235,59 @@ namespace RZ {
       ~Simulation();
 
       bool trace(TracingProperties const &);
+
+      // Rays come from `beam' (always random, numRays is ignored) instead
+      // of the tracing properties. Either maxRays or timeBudget must be
+      // set. Returns false if a batch failed or was cancelled.
+      bool traceProgressive(
+        TracingProperties const &,
+        BeamProperties const &beam,
+        ProgressiveTracingProperties const &,
+        ProgressiveTracingResult &);
+
+      // Ray aiming. Traces a grid of probe rays of a circular beam through
+      // `path' and restricts the beam to a circle of its section around
+      // the rays that get through (see BeamProperties::aimed). Returns the
+      // fraction of the flux of the beam that the aimed beam samples (0 if
+      // nothing gets through, 1 if the beam was left as is), by which
+      // transmissions and detector counts must be scaled, and which is also
+      // stored in beam.aimWeight. Detectors, hits and statistics are left
+      // untouched, but not the engine beam.
+      // Collimated beams from extended objects are never aimed.
+      Real aimBeam(
+        BeamProperties &beam,
+        std::string const &path = "",
+        unsigned int probes = RZ_SIMULATION_DEFAULT_AIM_PROBES);
+
       struct timeval lastTick() const;
+
+      // Per-stage timing of the last trace
+      void setProfiling(bool);
+      bool profiling() const;
+      RayTracingProfiler const &profiler() const;
+
+      // Number of forked processes. Traces that need the traced beam
+      // (keepBeam, beam elements, elements recording hits) always run
+      // in-process.
+      void setProcesses(unsigned int);
+      unsigned int processes() const;
+      void setShardSeed(uint64_t);
+
+      // Reseeds the random streams used while tracing (random samplers and
+      // EM interfaces), so that traces can be repeated exactly.
+      void seedRandomStreams(uint64_t);
+
+      // Sequential traces of more rays than this are done depth-first, in
+      // blocks of this size (rounded up to a multiple of 64). Zero always
+      // traces the whole beam stage by stage.
+      void setBlockSize(uint64_t);
+      uint64_t blockSize() const;
+
+      // In single precision, sequential traces store the input rays in
+      // floats and trace them in blocks (see CompactRayBeam.h). The traced
+      // beam is not kept, and keepBeam traces are always double precision.
+      void setPrecision(TracingPrecision);
+      TracingPrecision precision() const;
   };
 }
 
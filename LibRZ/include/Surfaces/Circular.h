@@ -49,6 +49,12 @@ namespace RZ {
     void setRadius(Real);
     void setEccentricity(Real);
 
+    inline Real
+    radius() const
+    {
+      return m_radius;
+    }
+
     // 
     // Calculate radius and eccentricity from width and height. Given that:
     //
@@ -85,6 +85,30 @@ namespace RZ {
     void setConvex(bool);
     Real z(Real r) const;
 
+    inline Real
+    radius() const
+    {
+      return m_radius;
+    }
+
+    inline Real
+    curvatureRadius() const
+    {
+      return m_rCurv;
+    }
+
+    inline Real
+    depth() const
+    {
+      return m_depth;
+    }
+
+    inline bool
+    convex() const
+    {
+      return m_convex;
+    }
+
     virtual bool intercept(
       Vec3 &hit,
       Vec3 &normal,
@@ -56,9 +56,11 @@ namespace std {
 #include <Vector.h>
 #include <Matrix.h>
 #include <Linalg.h>
+#include <LargeAllocator.h>
 #include <GenericCompositeModel.h>
 #include <CompositeElement.h>
 #include <RayTracingEngine.h>
+#include <RayTracingProfiler.h>
 #include <OMModel.h>
 #include <TopLevelModel.h>
 #include <Logger.h>
@@ -68,7 +70,9 @@ namespace std {
 #include <ModelRenderer.h>
 #include <ParserContext.h>
 #include <RayBeam.h>
+#include <RayBeamPool.h>
 #include <Recipe.h>
+#include <RecipeCache.h>
 #include <RotatedFrame.h>
 #include <Singleton.h>
 #include <SkySampler.h>
@@ -77,10 +81,14 @@ namespace std {
 #include <TripodFrame.h>
 #include <WorldFrame.h>
 #include <OpticalElement.h>
+#include <Paraxial.h>
 #include <Elements/All.h>
 #include <RayTracingHeuristics/All.h>
 #include <EMInterfaces/All.h>
+#include <CompactRayBeam.h>
 #include <Simulation.h>
+#include <Sensitivity.h>
+#include <Optimizer.h>
 
 using namespace RZ;
 PyMODINIT_FUNC PyInit_RZ();
@@ -93,6 +101,8 @@ namespace std {
   %rename(ConstOpticSurfList) list<const RZ::OpticalSurface *>;
   %template(PureRayList)      list<RZ::Ray, allocator<RZ::Ray>>;
   %template(PureRayVec)       vector<RZ::Ray, allocator<RZ::Ray>>;
+  %template(TracingEventVec)  vector<RZ::RayTracingEvent>;
+  %template(TracingSummList)  list<RZ::RayTracingStageSummary>;
 }
 
 %exception {
@@ -107,6 +117,7 @@ namespace std {
 %include "Vector.h"
 %include "Matrix.h"
 %include "Linalg.h"
+%include "LargeAllocator.h"
 %include "ReferenceFrame.h"
 %include "EMInterface.h"
 %include "Element.h"
@@ -122,14 +133,29 @@ namespace std {
 %include "GLRenderEngine.h"
 %include "GLModel.h"
 %include "MediumBoundary.h"
+%include "Paraxial.h"
 %include "ModelRenderer.h"
 %include "ParserContext.h"
 %include "RayBeam.h"
+%include "RayBeamPool.h"
+%include "RayTracingProfiler.h"
 %include "RayTracingEngine.h"
 
 %include "Recipe.h"
+%include "RecipeCache.h"
 %include "RotatedFrame.h"
+%include "CompactRayBeam.h"
 %include "Simulation.h"
+%include "Sensitivity.h"
+%include "Optimizer.h"
+
+namespace std {
+  %template(RealVec)              vector<double>;
+  %template(RealMap)              map<string, double>;
+  %template(SensitivityMetricVec) vector<RZ::SensitivityMetric>;
+  %template(OptimizerTargetVec)   vector<RZ::OptimizerTarget>;
+}
+
 %include "Singleton.h"
 %include "SkySampler.h"
 %include "TranslatedFrame.h"
@@ -272,6 +298,309 @@ namespace std {
 
     return outArray;
   }
+
+  //
+  // Hits of a surface by beam id, as {id: {"origins": N x 3, "directions":
+  // N x 3, "optLengths": N}}. The hits are moved out of the surface (which
+  // is left without hits, as after clearHits()) into a buffer owned by the
+  // arrays, which are read-only views of its columns. The buffer is freed
+  // along with the last of them.
+  //
+  PyObject *
+  hitGroups(std::string const &name = "")
+  {
+    const RZ::OpticalSurface *surface = name.empty()
+      ? self->opticalSurfaces().front()
+      : self->opticalPath().getSurface(name);
+
+    if (surface == nullptr)
+      throw std::runtime_error("No such optical surface `" + name + "'");
+
+    auto hits = new RZ::RayHitBuffer(std::move(surface->hits));
+    surface->hits.clear();
+
+    PyObject *owner = PyCapsule_New(hits, RZ_HIT_BUFFER_CAPSULE, rzDeleteHitBuffer);
+    if (owner == nullptr) {
+      delete hits;
+      throw std::runtime_error("Cannot allocate hit buffer capsule");
+    }
+
+    PyObject *dict = PyDict_New();
+
+    for (auto &group : hits->groups()) {
+      npy_intp rows   = static_cast<npy_intp>(group.size());
+      npy_intp vec[]  = {rows, 3};
+      npy_intp scal[] = {rows};
+      PyObject *key   = PyLong_FromUnsignedLong(group.id);
+      PyObject *entry = PyDict_New();
+
+      PyObject *items[][2] = {
+        {PyUnicode_FromString("origins"),
+          rzNewView(2, vec, group.origins, owner)},
+        {PyUnicode_FromString("directions"),
+          rzNewView(2, vec, group.directions, owner)},
+        {PyUnicode_FromString("optLengths"),
+          rzNewView(1, scal, group.cumOptLengths, owner)}
+      };
+
+      for (auto &item : items) {
+        if (item[1] != nullptr)
+          PyDict_SetItem(entry, item[0], item[1]);
+        Py_DECREF(item[0]);
+        Py_XDECREF(item[1]);
+      }
+
+      PyDict_SetItem(dict, key, entry);
+      Py_DECREF(key);
+      Py_DECREF(entry);
+    }
+
+    Py_DECREF(owner);
+
+    return dict;
+  }
+}
+
+%{
+//
+// Converts any array-like to a C-contiguous array of the given type. Rows
+// are checked against `rows` (if nonzero) and columns against `cols` (if
+// nonzero, requiring a 2D array). Returns a new reference.
+//
+static PyArrayObject *
+rzArrayFromObject(
+  PyObject *obj,
+  int type,
+  npy_intp rows,
+  npy_intp cols,
+  const char *what)
+{
+  PyArrayObject *array = reinterpret_cast<PyArrayObject *>(
+    PyArray_FROMANY(obj, type, 1, 2, NPY_ARRAY_IN_ARRAY));
+
+  if (array == nullptr)
+    throw std::runtime_error(std::string("Cannot convert ") + what + " to an array");
+
+  int ndim       = PyArray_NDIM(array);
+  npy_intp *dims = PyArray_DIMS(array);
+
+  if ((cols > 0 && (ndim != 2 || dims[1] != cols))
+      || (cols == 0 && ndim != 1)
+      || (rows > 0 && dims[0] != rows)) {
+    Py_DECREF(array);
+    throw std::runtime_error(std::string("Unexpected shape for ") + what);
+  }
+
+  return array;
+}
+
+#define RZ_HIT_BUFFER_CAPSULE "RZ.RayHitBuffer"
+
+static void
+rzDeleteHitBuffer(PyObject *capsule)
+{
+  delete static_cast<RZ::RayHitBuffer *>(
+    PyCapsule_GetPointer(capsule, RZ_HIT_BUFFER_CAPSULE));
+}
+
+//
+// Read-only array of doubles pointing to data, which is kept alive by
+// owner. The array takes a new reference to it.
+//
+static PyObject *
+rzNewView(int nd, npy_intp *dims, const Real *data, PyObject *owner)
+{
+  PyObject *array = PyArray_SimpleNewFromData(
+    nd,
+    dims,
+    NPY_DOUBLE,
+    const_cast<Real *>(data));
+
+  if (array == nullptr)
+    return nullptr;
+
+  PyArray_CLEARFLAGS(
+    reinterpret_cast<PyArrayObject *>(array),
+    NPY_ARRAY_WRITEABLE);
+
+  Py_INCREF(owner);
+  if (PyArray_SetBaseObject(reinterpret_cast<PyArrayObject *>(array), owner) != 0) {
+    Py_DECREF(array);
+    return nullptr;
+  }
+
+  return array;
+}
+
+static PyObject *
+rzNewArray(int nd, npy_intp *dims, int type, const void *data, size_t size)
+{
+  PyObject *array = PyArray_SimpleNew(nd, dims, type);
+
+  if (array != nullptr && size > 0)
+    memcpy(
+      PyArray_DATA(reinterpret_cast<PyArrayObject *>(array)),
+      data,
+      size);
+
+  return array;
+}
+%}
+
+%extend RZ::OMModel {
+  //
+  // Traces a beam given as (N, 3) origins and directions, and optional
+  // (N,) wavelengths and ids. The arrays are copied straight into the
+  // beam and the GIL is released while tracing, so several models can be
+  // traced from different Python threads. Returns a dict of (N, ...)
+  // arrays with the final state of every ray. "alive" is false for rays
+  // that were absorbed, and "intercepted" tells which rays hit the last
+  // surface that was traced.
+  //
+  // The output arrays are copies: the beam they come from belongs to the
+  // engine and is overwritten (or released to the beam pool) by the next
+  // trace. One memcpy per column is negligible next to the trace itself.
+  //
+  PyObject *
+  traceArrays(
+    PyObject *origins,
+    PyObject *directions,
+    PyObject *wavelengths = nullptr,
+    PyObject *ids = nullptr,
+    std::string const &path = "",
+    bool nonSequential = false,
+    bool clear = true)
+  {
+    PyArrayObject *oArr = nullptr, *dArr = nullptr;
+    PyArrayObject *wArr = nullptr, *iArr = nullptr;
+    RZ::RayArrays arrays;
+    RZ::TracingProperties props;
+    std::string error;
+    bool ok = false;
+
+    try {
+      oArr = rzArrayFromObject(origins, NPY_DOUBLE, 0, 3, "origins");
+      arrays.count = PyArray_DIMS(oArr)[0];
+      dArr = rzArrayFromObject(directions, NPY_DOUBLE, arrays.count, 3, "directions");
+
+      if (wavelengths != nullptr && wavelengths != Py_None)
+        wArr = rzArrayFromObject(wavelengths, NPY_DOUBLE, arrays.count, 0, "wavelengths");
+      if (ids != nullptr && ids != Py_None)
+        iArr = rzArrayFromObject(ids, NPY_UINT32, arrays.count, 0, "ids");
+    } catch (std::runtime_error &) {
+      Py_XDECREF(oArr);
+      Py_XDECREF(dArr);
+      Py_XDECREF(wArr);
+      throw;
+    }
+
+    arrays.origins     = static_cast<const Real *>(PyArray_DATA(oArr));
+    arrays.directions  = static_cast<const Real *>(PyArray_DATA(dArr));
+    arrays.wavelengths = wArr != nullptr ? static_cast<const Real *>(PyArray_DATA(wArr)) : nullptr;
+    arrays.ids         = iArr != nullptr ? static_cast<const uint32_t *>(PyArray_DATA(iArr)) : nullptr;
+
+    props.type           = nonSequential ? RZ::NonSequential : RZ::Sequential;
+    props.path           = path;
+    props.pArrays        = &arrays;
+    props.clearDetectors = clear;
+    props.keepBeam       = true; // Output rays are read from the engine
+
+    if (clear)
+      for (auto element : self->allOpticalElements())
+        element->clearHits();
+
+    // Nothing below may touch Python objects
+    Py_BEGIN_ALLOW_THREADS
+    try {
+      ok = self->simulation()->trace(props);
+    } catch (std::exception const &e) {
+      error = e.what();
+    } catch (...) {
+      error = "Unknown exception while tracing";
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(oArr);
+    Py_DECREF(dArr);
+    Py_XDECREF(wArr);
+    Py_XDECREF(iArr);
+
+    if (!error.empty())
+      throw std::runtime_error(error);
+
+    if (!ok)
+      throw std::runtime_error("Trace was cancelled");
+
+    const RZ::RayBeam *beam = self->simulation()->engine()->beam();
+    npy_intp count  = static_cast<npy_intp>(beam->count);
+    npy_intp vec[]  = {count, 3};
+    npy_intp scal[] = {count};
+    PyObject *dict  = PyDict_New();
+    PyObject *alive = PyArray_SimpleNew(1, scal, NPY_BOOL);
+    PyObject *hit   = PyArray_SimpleNew(1, scal, NPY_BOOL);
+    npy_bool *flags = static_cast<npy_bool *>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject *>(alive)));
+    npy_bool *hits  = static_cast<npy_bool *>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject *>(hit)));
+
+    for (npy_intp i = 0; i < count; ++i) {
+      flags[i] = beam->hasRay(i) ? NPY_TRUE : NPY_FALSE;
+      hits[i]  = beam->hasRay(i) && beam->isIntercepted(i) ? NPY_TRUE : NPY_FALSE;
+    }
+
+    PyObject *items[][2] = {
+      {PyUnicode_FromString("origins"),
+        rzNewArray(2, vec, NPY_DOUBLE, beam->origins, 3 * count * sizeof(Real))},
+      {PyUnicode_FromString("directions"),
+        rzNewArray(2, vec, NPY_DOUBLE, beam->directions, 3 * count * sizeof(Real))},
+      {PyUnicode_FromString("lengths"),
+        rzNewArray(1, scal, NPY_DOUBLE, beam->lengths, count * sizeof(Real))},
+      {PyUnicode_FromString("optLengths"),
+        rzNewArray(1, scal, NPY_DOUBLE, beam->cumOptLengths, count * sizeof(Real))},
+      {PyUnicode_FromString("ids"),
+        rzNewArray(1, scal, NPY_UINT32, beam->ids, count * sizeof(uint32_t))},
+      {PyUnicode_FromString("alive"), alive},
+      {PyUnicode_FromString("intercepted"), hit}
+    };
+
+    for (auto &item : items) {
+      PyDict_SetItem(dict, item[0], item[1]);
+      Py_DECREF(item[0]);
+      Py_DECREF(item[1]);
+    }
+
+    return dict;
+  }
+
+  //
+  // Intercept statistics since the hits were last cleared, as a (S, 3)
+  // array of intercepted, vignetted and pruned rays per surface of the
+  // path.
+  //
+  PyObject *
+  statisticsArray(std::string const &path = "")
+  {
+    auto opticalPath = self->lookupOpticalPathOrEx(path);
+    npy_intp dims[]  = {
+      static_cast<npy_intp>(opticalPath->m_sequence.size()),
+      3};
+    PyObject *array  = PyArray_SimpleNew(2, dims, NPY_UINT64);
+    uint64_t *data   = static_cast<uint64_t *>(
+      PyArray_DATA(reinterpret_cast<PyArrayObject *>(array)));
+
+    for (auto surface : opticalPath->m_sequence) {
+      RZ::RayBeamStatistics total;
+
+      for (auto &p : surface->statistics)
+        total += p.second;
+
+      *data++ = total.intercepted;
+      *data++ = total.vignetted;
+      *data++ = total.pruned;
+    }
+
+    return array;
+  }
 }
 
 %extend RZ::Matrix3 {
@@ -404,6 +733,33 @@ namespace std {
 
     return outArray;
   }
+
+  PyObject *
+  weightImage()
+  {
+    unsigned int imgWidth  = self->cols();
+    unsigned int imgHeight = self->rows();
+    unsigned int imgStride = self->stride();
+    const Real *data       = self->weights();
+
+    if (data == nullptr)
+      Py_RETURN_NONE;
+
+    npy_intp dims[]    = {imgHeight, imgWidth};
+    npy_intp strides[] = {imgStride * sizeof(Real), sizeof(Real)};
+    PyObject *outArray = PyArray_New(
+      &PyArray_Type,
+      2,
+      dims,
+      NPY_DOUBLE,
+      strides,
+      const_cast<Real *>(data),
+      0,
+      NPY_ARRAY_CARRAY,
+      nullptr);
+
+    return outArray;
+  }
 }
 
 %extend RZ::RayList {
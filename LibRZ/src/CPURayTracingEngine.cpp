@@ -20,6 +20,8 @@
 #include <MediumBoundary.h>
 #include <OpticalElement.h>
 
+#include <algorithm>
+
 using namespace RZ;
 
 // In a Ray Tracing engine, every call to cast and transmit assumes that
@@ -58,9 +60,48 @@ CPURayTracingEngine::cast(const OpticalSurface *surface, RayBeam *beam)
   rayProgress(count, count);
 }
 
+//
+// Interleaved non-sequential beams (e.g. right after updateFromVisible())
+// would be transmitted in many tiny slices. Instead, the rays of every
+// surface are gathered into a contiguous scratch beam, transmitted as a
+// single slice and scattered back. Bins are independent of each other.
+//
+bool
+CPURayTracingEngine::transmitBinned(RayBeam *beam)
+{
+  beam->bin(m_bins);
+
+  if (m_bins.runs == 0
+    || m_bins.indices.size() >= RZ_CPU_ENGINE_MIN_RUN_LENGTH * m_bins.runs)
+    return false;
+
+  uint64_t largest = 0;
+  for (size_t b = 0; b < m_bins.bins(); ++b)
+    largest = std::max(largest, m_bins.binSize(b));
+
+  auto scratch = beamPool().acquire(largest);
+
+  for (size_t b = 0; b < m_bins.bins(); ++b) {
+    auto surface = m_bins.surfaces[b];
+    auto indices = m_bins.indices.data() + m_bins.offsets[b];
+    auto size    = m_bins.binSize(b);
+
+    scratch->gatherTransmit(beam, indices, size);
+    surface->boundary->transmit(RayBeamSlice(scratch, 0, size));
+    beam->scatterTransmit(scratch, indices, size);
+  }
+
+  releaseBeam(scratch);
+
+  return true;
+}
+
 void
 CPURayTracingEngine::transmit(const OpticalSurface *surface, RayBeam *beam)
 {
+  if (surface == nullptr && surfaceBinning() && transmitBinned(beam))
+    return;
+
   beam->walk(
     const_cast<OpticalSurface *>(surface),
     [&] (OpticalSurface *surf, RayBeamSlice const &slice) {
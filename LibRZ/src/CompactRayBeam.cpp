@@ -0,0 +1,186 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <CompactRayBeam.h>
+#include <Helpers.h>
+#include <cstring>
+#include <cmath>
+
+using namespace RZ;
+
+static inline void
+checkWavelength(Real wavelength)
+{
+  if (wavelength <= RZ_BEAM_MINIMUM_WAVELENGTH)
+    throw std::runtime_error(
+      string_printf(
+        "Wavelength is too short (minimum: %g pm)",
+        RZ_BEAM_MINIMUM_WAVELENGTH * 1e12));
+}
+
+template <class T>
+void
+CompactRayBeam<T>::resize(uint64_t count)
+{
+  this->count = count;
+
+  origins.resize(3 * count);
+  directions.resize(3 * count);
+  wavelengths.resize(count);
+  lengths.resize(count);
+  refNdx.resize(count);
+  amplitudes.resize(count);
+  cumOptLengths.resize(count);
+  ids.resize(count);
+  chiefMask.assign((count + 63) >> 6, 0);
+}
+
+template <class T>
+void
+CompactRayBeam<T>::assign(RayList const &rays)
+{
+  uint64_t i = 0;
+
+  resize(rays.size());
+
+  for (auto &ray : rays) {
+    checkWavelength(ray.wavelength);
+
+    for (int k = 0; k < 3; ++k) {
+      origins[3 * i + k]    = static_cast<T>(ray.origin.coords[k]);
+      directions[3 * i + k] = static_cast<T>(ray.direction.coords[k]);
+    }
+
+    wavelengths[i]   = static_cast<T>(ray.wavelength);
+    lengths[i]       = static_cast<T>(ray.length);
+    refNdx[i]        = static_cast<T>(ray.refNdx);
+    amplitudes[i]    = static_cast<T>(ray.amplitude);
+    cumOptLengths[i] = ray.cumOptLength;
+    ids[i]           = ray.id;
+
+    if (ray.chief)
+      chiefMask[i >> 6] |= 1ull << (i & 63);
+
+    ++i;
+  }
+}
+
+template <class T>
+void
+CompactRayBeam<T>::assign(RayArrays const &arrays)
+{
+  uint64_t count = arrays.count;
+
+  resize(count);
+
+  for (uint64_t i = 0; i < 3 * count; ++i) {
+    origins[i]    = static_cast<T>(arrays.origins[i]);
+    directions[i] = static_cast<T>(arrays.directions[i]);
+  }
+
+  for (uint64_t i = 0; i < count; ++i) {
+    Real wavelength = RZ_WAVELENGTH;
+
+    if (arrays.wavelengths != nullptr) {
+      wavelength = arrays.wavelengths[i];
+      checkWavelength(wavelength);
+    }
+
+    wavelengths[i]   = static_cast<T>(wavelength);
+    lengths[i]       = 0;
+    refNdx[i]        = 1;
+    amplitudes[i]    = 1;
+    cumOptLengths[i] = 0;
+    ids[i]           = arrays.ids != nullptr ? arrays.ids[i] : 0;
+  }
+}
+
+template <class T>
+void
+CompactRayBeam<T>::expand(RayBeam *dest, uint64_t start, uint64_t count) const
+{
+  assert((start & 63) == 0);
+  assert(start + count <= this->count);
+
+  dest->allocate(count, false);
+  memcpy(dest->chiefMask, chiefMask.data() + (start >> 6), ((count + 63) >> 6) << 3);
+
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t j = start + i;
+    Real *o = dest->origins    + 3 * i;
+    Real *d = dest->directions + 3 * i;
+    Real norm;
+
+    for (int k = 0; k < 3; ++k) {
+      o[k] = origins[3 * j + k];
+      d[k] = directions[3 * j + k];
+    }
+
+    // Rounding breaks the normalization of the directions
+    norm = 1. / sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    d[0] *= norm;
+    d[1] *= norm;
+    d[2] *= norm;
+
+    dest->wavelengths[i]   = wavelengths[j];
+    dest->lengths[i]       = lengths[j];
+    dest->refNdx[i]        = refNdx[j];
+    dest->cumOptLengths[i] = cumOptLengths[j];
+    dest->ids[i]           = ids[j];
+    dest->amplitude[i]     = amplitudes[j];
+  }
+
+  memcpy(dest->destinations, dest->origins,    3 * count * sizeof(Real));
+
+  // Assume rays come from a flat surface
+  memcpy(dest->normals,      dest->directions, 3 * count * sizeof(Real));
+}
+
+template <class T>
+void
+CompactRayBeam<T>::clear()
+{
+  count = 0;
+
+  Array<T>().swap(origins);
+  Array<T>().swap(directions);
+  Array<T>().swap(wavelengths);
+  Array<T>().swap(lengths);
+  Array<T>().swap(refNdx);
+  Array<T>().swap(amplitudes);
+  Array<Real>().swap(cumOptLengths);
+  Array<uint32_t>().swap(ids);
+  Array<uint64_t>().swap(chiefMask);
+}
+
+template <class T>
+uint64_t
+CompactRayBeam<T>::bytes() const
+{
+  return (origins.capacity() + directions.capacity() + wavelengths.capacity()
+    + lengths.capacity() + refNdx.capacity() + amplitudes.capacity())
+    * sizeof(T)
+    + cumOptLengths.capacity() * sizeof(Real)
+    + ids.capacity() * sizeof(uint32_t)
+    + chiefMask.capacity() * sizeof(uint64_t);
+}
+
+namespace RZ {
+  template struct CompactRayBeam<float>;
+  template struct CompactRayBeam<double>;
+}
@@ -68,15 +68,25 @@ ScatterSet::ScatterSet(
 }
 
 
+//
+// Hits are read straight from their columns
+//
 ScatterSet::ScatterSet(
   uint32_t id,
   OpticalSurface const *surface,
-  std::string const &label) : ScatterSet(
-    id,                       // Id
-    surface->locations(),     // 3D vector of locations 
-    label,                    // Label
-    3)                        // Stride
+  std::string const &label)
 {
+  m_tree  = new ScatterTree();
+  m_label = label;
+  m_id    = id;
+  m_size  = 0;
+
+  auto &origins = surface->hits.origins();
+
+  for (size_t i = 0; i < origins.size(); i += 3)
+    m_tree->push(origins[i + 0], origins[i + 1]);
+
+  m_size = surface->hits.size();
 }
 
 ScatterSet::~ScatterSet()
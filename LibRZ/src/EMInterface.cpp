@@ -27,6 +27,12 @@ EMInterface::~EMInterface()
 
 }
 
+Real
+EMInterface::ghostReflectance(Vec3 const &, Vec3 const &) const
+{
+  return 0;
+}
+
 void
 EMInterface::setTransmission(Real tx)
 {
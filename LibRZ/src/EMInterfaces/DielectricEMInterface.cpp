@@ -18,6 +18,7 @@
 
 #include <EMInterfaces/DielectricEMInterface.h>
 #include <RayTracingEngine.h>
+#include <cmath>
 
 using namespace RZ;
 
@@ -35,6 +36,35 @@ DielectricEMInterface::setRefractiveIndex(Real in, Real out)
   m_IOratio = in / out;
 }
 
+Real
+DielectricEMInterface::ghostReflectance(
+  Vec3 const &direction,
+  Vec3 const &normal) const
+{
+  Real cosI = direction * normal;
+  Real n1, n2, sinT2, cosT, rs, rp;
+
+  // Same sides as in transmit()
+  if (cosI < 0) {
+    n1   = m_muIn;
+    n2   = m_muOut;
+    cosI = -cosI;
+  } else {
+    n1   = m_muOut;
+    n2   = m_muIn;
+  }
+
+  sinT2 = (n1 / n2) * (n1 / n2) * (1 - cosI * cosI);
+  if (sinT2 >= 1)
+    return 0;
+
+  cosT = sqrt(1 - sinT2);
+  rs   = (n1 * cosI - n2 * cosT) / (n1 * cosI + n2 * cosT);
+  rp   = (n1 * cosT - n2 * cosI) / (n1 * cosT + n2 * cosI);
+
+  return .5 * (rs * rs + rp * rp);
+}
+
 void
 DielectricEMInterface::transmit(RayBeamSlice const &slice)
 {
@@ -227,6 +227,69 @@ Element::set(std::string const &name, PropertyValue const &val)
   return true;
 }
 
+PropertyHandle
+Element::propertyHandle(std::string const &name)
+{
+  auto it = m_nameToHandle.find(name);
+
+  if (it != m_nameToHandle.end())
+    return it->second;
+
+  auto prop = m_properties.find(name);
+  if (prop == m_properties.end())
+    return RZ_INVALID_PROPERTY_HANDLE;
+
+  // Map entries are never removed, so we can keep pointers to them
+  PropertyHandle handle = static_cast<PropertyHandle>(m_handles.size());
+  m_handles.push_back(&*prop);
+  m_nameToHandle[name] = handle;
+
+  return handle;
+}
+
+bool
+Element::set(PropertyHandle handle, Real value)
+{
+  if (handle < 0 || static_cast<size_t>(handle) >= m_handles.size())
+    return false;
+
+  auto prop = m_handles[handle];
+  PropertyValue asValue = value;
+
+  if (!propertyChanged(prop->first, asValue)) {
+    RZWarning(
+      "Element %s (%s): cannot set %s to %g\n",
+      this->name().c_str(),
+      factory()->name().c_str(),
+      prop->first.c_str(),
+      value);
+    return false;
+  }
+
+  // Keep description and context of the property
+  static_cast<BasePropertyVariant &>(prop->second) = value;
+
+  return true;
+}
+
+PropertyValueType
+Element::queryPropertyType(PropertyHandle handle) const
+{
+  if (handle < 0 || static_cast<size_t>(handle) >= m_handles.size())
+    return UndefinedValue;
+
+  return m_handles[handle]->second.type();
+}
+
+std::string const &
+Element::propertyName(PropertyHandle handle) const
+{
+  if (handle < 0 || static_cast<size_t>(handle) >= m_handles.size())
+    throw std::runtime_error("Invalid property handle");
+
+  return m_handles[handle]->first;
+}
+
 void
 Element::setDefaults()
 {
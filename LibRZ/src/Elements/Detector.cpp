@@ -25,9 +25,12 @@
 #include <Logger.h>
 #include <RayTracingEngine.h>
 #include <Surfaces/Rectangular.h>
+#include <Simulation.h>
 #include <png++/png.hpp>
 #include <cmath>
 #include <complex>
+#include <cstring>
+#include <algorithm>
 
 using namespace RZ;
 
@@ -41,6 +44,10 @@ RZ_DESCRIBE_OPTICAL_ELEMENT(Detector, "Generic detector with rectangular pixels"
   property("cols",        512,   "Number of pixels in the horizontal direction");
   property("rows",        512,   "Number of pixels in the vertical direction");
   property("flip",        false, "Flip detector 180º around the X axis");
+  property("tiled",       false, "Allocate pixels in tiles on first hit (for large, sparse detectors)");
+  property("coherent",    true,  "Accumulate the complex amplitude of the hits");
+  property("weighted",    false, "Accumulate the power |amplitude|^2 of the hits");
+  property("generation",  -1,    "Only count rays of this ghost generation (0: primary, -1: all)");
 }
 
 DetectorStorage::DetectorStorage(
@@ -58,20 +65,86 @@ DetectorStorage::DetectorStorage(
   recalculate();
 }
 
+DetectorStorage::~DetectorStorage()
+{
+  freeTiles();
+}
+
+void
+DetectorStorage::freeTiles()
+{
+  for (auto &tile : m_tiles) {
+    if (tile != nullptr) {
+      delete tile;
+      tile = nullptr;
+    }
+  }
+
+  m_allocatedTiles = 0;
+}
+
+DetectorTile *
+DetectorStorage::makeTile(unsigned int tileCol, unsigned int tileRow)
+{
+  DetectorTile *tile = new DetectorTile;
+
+  if (m_coherent)
+    tile->amplitude.resize(RZ_DETECTOR_TILE_PIXELS);
+
+  if (m_weighted)
+    tile->weights.resize(RZ_DETECTOR_TILE_PIXELS);
+
+  m_tiles[tileCol + tileRow * m_tileCols] = tile;
+  ++m_allocatedTiles;
+
+  return tile;
+}
+
 void
-DetectorStorage::recalculate()
+DetectorStorage::recalculate(bool force)
 {
-  size_t newSize;
+  size_t newSize, ampSize, weightSize;
 
   m_width  = m_pxWidth  * m_cols;
   m_height = m_pxHeight * m_rows;
 
   m_stride = 4 * ((m_cols + 3) / 4);
-  newSize = m_rows * m_stride;
+  newSize  = m_tiled ? 0 : m_rows * m_stride;
+  ampSize  = m_coherent ? newSize : 0;
+  weightSize = m_weighted ? newSize : 0;
+
+  if (m_tiled) {
+    unsigned int tileCols = (m_cols + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS;
+    unsigned int tileRows = (m_rows + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS;
+
+    if (force || tileCols != m_tileCols || tileRows != m_tileRows) {
+      freeTiles();
+      m_tileCols = tileCols;
+      m_tileRows = tileRows;
+      m_tiles.assign(static_cast<size_t>(tileCols) * tileRows, nullptr);
+      force = true;
+    }
+  } else if (!m_tiles.empty()) {
+    freeTiles();
+    m_tiles.clear();
+    m_tiles.shrink_to_fit();
+    m_tileCols = m_tileRows = 0;
+    force = true;
+  }
 
-  if (m_photons.size() != newSize) {
+  if (force
+      || m_photons.size() != newSize
+      || m_amplitude.size() != ampSize
+      || m_weights.size() != weightSize) {
     m_photons.resize(newSize);
-    m_amplitude.resize(newSize);
+    m_amplitude.resize(ampSize);
+    m_weights.resize(weightSize);
+    m_photons.shrink_to_fit();
+    m_amplitude.shrink_to_fit();
+    m_weights.shrink_to_fit();
+    m_densePhotons.clear();
+    m_denseAmplitude.clear();
+    m_denseWeights.clear();
     clear();
   }
 }
@@ -94,6 +167,300 @@ DetectorStorage::setResolution(unsigned int cols, unsigned int rows)
   recalculate();
 }
 
+void
+DetectorStorage::setTiled(bool tiled)
+{
+  if (m_tiled != tiled) {
+    m_tiled = tiled;
+    recalculate(true);
+  }
+}
+
+void
+DetectorStorage::setCoherent(bool coherent)
+{
+  if (m_coherent != coherent) {
+    m_coherent = coherent;
+    recalculate(true);
+  }
+}
+
+void
+DetectorStorage::setWeighted(bool weighted)
+{
+  if (m_weighted == weighted)
+    return;
+
+  m_weighted  = weighted;
+  m_maxWeight = 0;
+
+  if (!m_tiled) {
+    m_weights.assign(weighted ? m_rows * m_stride : 0, 0.);
+    m_weights.shrink_to_fit();
+  }
+
+  for (auto tile : m_tiles) {
+    if (tile != nullptr) {
+      tile->weights.assign(weighted ? RZ_DETECTOR_TILE_PIXELS : 0, 0.);
+      tile->weights.shrink_to_fit();
+    }
+  }
+
+  m_denseWeights.clear();
+  m_denseDirty = true;
+}
+
+void
+DetectorStorage::swap(DetectorStorage &other)
+{
+  std::swap(m_photons,        other.m_photons);
+  std::swap(m_amplitude,      other.m_amplitude);
+  std::swap(m_weights,        other.m_weights);
+  std::swap(m_width,          other.m_width);
+  std::swap(m_height,         other.m_height);
+  std::swap(m_pxWidth,        other.m_pxWidth);
+  std::swap(m_pxHeight,       other.m_pxHeight);
+  std::swap(m_maxCounts,      other.m_maxCounts);
+  std::swap(m_maxEnergy,      other.m_maxEnergy);
+  std::swap(m_maxWeight,      other.m_maxWeight);
+  std::swap(m_cols,           other.m_cols);
+  std::swap(m_rows,           other.m_rows);
+  std::swap(m_stride,         other.m_stride);
+  std::swap(m_tiled,          other.m_tiled);
+  std::swap(m_coherent,       other.m_coherent);
+  std::swap(m_weighted,       other.m_weighted);
+  std::swap(m_tileCols,       other.m_tileCols);
+  std::swap(m_tileRows,       other.m_tileRows);
+  std::swap(m_allocatedTiles, other.m_allocatedTiles);
+  std::swap(m_tiles,          other.m_tiles);
+  std::swap(m_densePhotons,   other.m_densePhotons);
+  std::swap(m_denseAmplitude, other.m_denseAmplitude);
+  std::swap(m_denseWeights,   other.m_denseWeights);
+  std::swap(m_denseDirty,     other.m_denseDirty);
+}
+
+void
+DetectorStorage::addAt(
+  unsigned int col,
+  unsigned int row,
+  uint32_t counts,
+  Complex amplitude,
+  Real weight)
+{
+  uint32_t *photons;
+  Complex  *amp = nullptr;
+  Real     *w   = nullptr;
+
+  if (m_tiled) {
+    unsigned int tileCol = col >> RZ_DETECTOR_TILE_BITS;
+    unsigned int tileRow = row >> RZ_DETECTOR_TILE_BITS;
+    size_t ndx = (col & RZ_DETECTOR_TILE_MASK)
+               + ((row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS);
+
+    DetectorTile *tile = m_tiles[tileCol + tileRow * m_tileCols];
+    if (tile == nullptr)
+      tile = makeTile(tileCol, tileRow);
+
+    photons = tile->photons + ndx;
+    if (m_coherent)
+      amp = tile->amplitude.data() + ndx;
+    if (m_weighted)
+      w = tile->weights.data() + ndx;
+    m_denseDirty = true;
+  } else {
+    size_t ndx = col + row * m_stride;
+    photons = m_photons.data() + ndx;
+    if (m_coherent)
+      amp = m_amplitude.data() + ndx;
+    if (m_weighted)
+      w = m_weights.data() + ndx;
+  }
+
+  *photons += counts;
+  if (*photons > m_maxCounts)
+    m_maxCounts = *photons;
+
+  if (amp != nullptr) {
+    Real E;
+
+    *amp += amplitude;
+    E = (*amp * std::conj(*amp)).real();
+    if (E > m_maxEnergy)
+      m_maxEnergy = E;
+  }
+
+  if (w != nullptr) {
+    *w += weight;
+    if (*w > m_maxWeight)
+      m_maxWeight = *w;
+  }
+}
+
+bool
+DetectorStorage::merge(DetectorStorage const &other)
+{
+  bool amplitude = m_coherent && other.m_coherent;
+  bool weights   = m_weighted && other.m_weighted;
+
+  if (other.m_cols != m_cols || other.m_rows != m_rows)
+    return false;
+
+  for (unsigned int row = 0; row < m_rows; ++row) {
+    for (unsigned int col = 0; col < m_cols; ++col) {
+      uint32_t counts = other.counts(col, row);
+      Complex  amp    = amplitude ? other.amplitudeAt(col, row) : 0.;
+      Real     weight = weights ? other.weightAt(col, row) : 0.;
+
+      if (counts != 0 || amp != 0. || weight != 0.)
+        addAt(col, row, counts, amp, weight);
+    }
+  }
+
+  return true;
+}
+
+size_t
+DetectorStorage::tileRecordSize() const
+{
+  size_t size = sizeof(uint64_t) + RZ_DETECTOR_TILE_PIXELS * sizeof(uint32_t);
+
+  if (m_coherent)
+    size += RZ_DETECTOR_TILE_PIXELS * sizeof(Complex);
+
+  if (m_weighted)
+    size += RZ_DETECTOR_TILE_PIXELS * sizeof(Real);
+
+  return size;
+}
+
+//
+// Records are written with memcpy, as they are not aligned to any of the
+// types they hold. In dense mode, tiles are cut from the pixel planes and
+// skipped if they have no hits. The pixels of the border tiles that fall
+// outside the detector are zero.
+//
+bool
+DetectorStorage::packTiles(uint8_t *dest, size_t size, uint64_t &tiles) const
+{
+  unsigned int tileCols = (m_cols + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS;
+  unsigned int tileRows = (m_rows + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS;
+  size_t recordSize = tileRecordSize();
+  DetectorTile block;
+
+  if (m_coherent)
+    block.amplitude.resize(RZ_DETECTOR_TILE_PIXELS);
+
+  if (m_weighted)
+    block.weights.resize(RZ_DETECTOR_TILE_PIXELS);
+
+  tiles = 0;
+
+  for (uint64_t index = 0; index < uint64_t(tileCols) * tileRows; ++index) {
+    const DetectorTile *tile = nullptr;
+    uint8_t *p = dest + tiles * recordSize;
+
+    if (m_tiled) {
+      tile = m_tiles[index];
+    } else {
+      unsigned int col0 = (index % tileCols) << RZ_DETECTOR_TILE_BITS;
+      unsigned int row0 = (index / tileCols) << RZ_DETECTOR_TILE_BITS;
+      unsigned int width  = std::min(m_cols - col0, unsigned(RZ_DETECTOR_TILE_SIZE));
+      unsigned int height = std::min(m_rows - row0, unsigned(RZ_DETECTOR_TILE_SIZE));
+      bool hit = false;
+
+      std::fill(block.photons, block.photons + RZ_DETECTOR_TILE_PIXELS, 0);
+      std::fill(block.amplitude.begin(), block.amplitude.end(), 0.);
+      std::fill(block.weights.begin(), block.weights.end(), 0.);
+
+      for (unsigned int j = 0; j < height; ++j) {
+        size_t src = col0 + (row0 + j) * m_stride;
+        size_t ndx = j << RZ_DETECTOR_TILE_BITS;
+
+        for (unsigned int i = 0; i < width; ++i) {
+          block.photons[ndx + i] = m_photons[src + i];
+          if (m_coherent)
+            block.amplitude[ndx + i] = m_amplitude[src + i];
+          if (m_weighted)
+            block.weights[ndx + i] = m_weights[src + i];
+
+          hit = hit
+            || block.photons[ndx + i] != 0
+            || (m_coherent && block.amplitude[ndx + i] != 0.)
+            || (m_weighted && block.weights[ndx + i] != 0.);
+        }
+      }
+
+      if (hit)
+        tile = &block;
+    }
+
+    if (tile == nullptr)
+      continue;
+
+    if ((tiles + 1) * recordSize > size)
+      return false;
+
+    memcpy(p, &index, sizeof(uint64_t));
+    p += sizeof(uint64_t);
+
+    memcpy(p, tile->photons, RZ_DETECTOR_TILE_PIXELS * sizeof(uint32_t));
+    p += RZ_DETECTOR_TILE_PIXELS * sizeof(uint32_t);
+
+    if (m_coherent) {
+      memcpy(p, tile->amplitude.data(), RZ_DETECTOR_TILE_PIXELS * sizeof(Complex));
+      p += RZ_DETECTOR_TILE_PIXELS * sizeof(Complex);
+    }
+
+    if (m_weighted)
+      memcpy(p, tile->weights.data(), RZ_DETECTOR_TILE_PIXELS * sizeof(Real));
+
+    ++tiles;
+  }
+
+  return true;
+}
+
+void
+DetectorStorage::mergeTiles(const uint8_t *src, uint64_t tiles)
+{
+  unsigned int tileCols = (m_cols + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS;
+  size_t recordSize = tileRecordSize();
+  size_t ampOffset  = sizeof(uint64_t) + RZ_DETECTOR_TILE_PIXELS * sizeof(uint32_t);
+  size_t wOffset    = ampOffset
+    + (m_coherent ? RZ_DETECTOR_TILE_PIXELS * sizeof(Complex) : 0);
+
+  for (uint64_t n = 0; n < tiles; ++n, src += recordSize) {
+    uint64_t index;
+
+    memcpy(&index, src, sizeof(uint64_t));
+
+    unsigned int col0 = (index % tileCols) << RZ_DETECTOR_TILE_BITS;
+    unsigned int row0 = (index / tileCols) << RZ_DETECTOR_TILE_BITS;
+
+    for (unsigned int ndx = 0; ndx < RZ_DETECTOR_TILE_PIXELS; ++ndx) {
+      unsigned int col = col0 + (ndx & RZ_DETECTOR_TILE_MASK);
+      unsigned int row = row0 + (ndx >> RZ_DETECTOR_TILE_BITS);
+      uint32_t counts;
+      Complex  amp    = 0.;
+      Real     weight = 0.;
+
+      if (col >= m_cols || row >= m_rows)
+        continue;
+
+      memcpy(&counts, src + sizeof(uint64_t) + ndx * sizeof(uint32_t), sizeof(uint32_t));
+
+      if (m_coherent)
+        memcpy(&amp, src + ampOffset + ndx * sizeof(Complex), sizeof(Complex));
+
+      if (m_weighted)
+        memcpy(&weight, src + wOffset + ndx * sizeof(Real), sizeof(Real));
+
+      if (counts != 0 || amp != 0. || weight != 0.)
+        addAt(col, row, counts, amp, weight);
+    }
+  }
+}
+
 unsigned int
 DetectorStorage::cols() const
 {
@@ -112,26 +479,243 @@ DetectorStorage::stride() const
   return m_stride;
 }
 
+size_t
+DetectorStorage::memoryUsage() const
+{
+  size_t tileSize = sizeof(DetectorTile);
+
+  if (m_coherent)
+    tileSize += RZ_DETECTOR_TILE_PIXELS * sizeof(Complex);
+
+  if (m_weighted)
+    tileSize += RZ_DETECTOR_TILE_PIXELS * sizeof(Real);
+
+  return m_photons.capacity() * sizeof(uint32_t)
+    + m_amplitude.capacity() * sizeof(Complex)
+    + m_weights.capacity() * sizeof(Real)
+    + m_tiles.capacity() * sizeof(DetectorTile *)
+    + m_allocatedTiles * tileSize
+    + m_densePhotons.capacity() * sizeof(uint32_t)
+    + m_denseAmplitude.capacity() * sizeof(Complex)
+    + m_denseWeights.capacity() * sizeof(Real);
+}
+
+uint32_t
+DetectorStorage::counts(unsigned int col, unsigned int row) const
+{
+  if (col >= m_cols || row >= m_rows)
+    return 0;
+
+  if (!m_tiled)
+    return m_photons[col + row * m_stride];
+
+  auto tile = m_tiles[
+      (col >> RZ_DETECTOR_TILE_BITS)
+    + (row >> RZ_DETECTOR_TILE_BITS) * m_tileCols];
+
+  if (tile == nullptr)
+    return 0;
+
+  return tile->photons[
+      (col & RZ_DETECTOR_TILE_MASK)
+    + ((row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS)];
+}
+
+Complex
+DetectorStorage::amplitudeAt(unsigned int col, unsigned int row) const
+{
+  if (!m_coherent || col >= m_cols || row >= m_rows)
+    return 0.;
+
+  if (!m_tiled)
+    return m_amplitude[col + row * m_stride];
+
+  auto tile = m_tiles[
+      (col >> RZ_DETECTOR_TILE_BITS)
+    + (row >> RZ_DETECTOR_TILE_BITS) * m_tileCols];
+
+  if (tile == nullptr)
+    return 0.;
+
+  return tile->amplitude[
+      (col & RZ_DETECTOR_TILE_MASK)
+    + ((row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS)];
+}
+
+Real
+DetectorStorage::weightAt(unsigned int col, unsigned int row) const
+{
+  if (!m_weighted || col >= m_cols || row >= m_rows)
+    return 0.;
+
+  if (!m_tiled)
+    return m_weights[col + row * m_stride];
+
+  auto tile = m_tiles[
+      (col >> RZ_DETECTOR_TILE_BITS)
+    + (row >> RZ_DETECTOR_TILE_BITS) * m_tileCols];
+
+  if (tile == nullptr)
+    return 0.;
+
+  return tile->weights[
+      (col & RZ_DETECTOR_TILE_MASK)
+    + ((row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS)];
+}
+
+//
+// Extract a full row of the detector from the tiles. Rows are always
+// m_cols wide. Missing tiles are filled with zeroes.
+//
+void
+DetectorStorage::getRow(uint32_t *dest, unsigned int row) const
+{
+  unsigned int tileRow = row >> RZ_DETECTOR_TILE_BITS;
+  unsigned int offset  = (row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS;
+
+  for (unsigned int tc = 0; tc < m_tileCols; ++tc) {
+    unsigned int col  = tc << RZ_DETECTOR_TILE_BITS;
+    unsigned int len  = std::min<unsigned int>(RZ_DETECTOR_TILE_SIZE, m_cols - col);
+    auto tile = m_tiles[tc + tileRow * m_tileCols];
+
+    if (tile == nullptr)
+      memset(dest + col, 0, len * sizeof(uint32_t));
+    else
+      memcpy(dest + col, tile->photons + offset, len * sizeof(uint32_t));
+  }
+}
+
+void
+DetectorStorage::getRow(Complex *dest, unsigned int row) const
+{
+  unsigned int tileRow = row >> RZ_DETECTOR_TILE_BITS;
+  unsigned int offset  = (row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS;
+
+  for (unsigned int tc = 0; tc < m_tileCols; ++tc) {
+    unsigned int col  = tc << RZ_DETECTOR_TILE_BITS;
+    unsigned int len  = std::min<unsigned int>(RZ_DETECTOR_TILE_SIZE, m_cols - col);
+    auto tile = m_tiles[tc + tileRow * m_tileCols];
+
+    if (tile == nullptr || tile->amplitude.empty())
+      std::fill(dest + col, dest + col + len, Complex(0.));
+    else
+      std::copy(
+        tile->amplitude.begin() + offset,
+        tile->amplitude.begin() + offset + len,
+        dest + col);
+  }
+}
+
+void
+DetectorStorage::getRow(Real *dest, unsigned int row) const
+{
+  unsigned int tileRow = row >> RZ_DETECTOR_TILE_BITS;
+  unsigned int offset  = (row & RZ_DETECTOR_TILE_MASK) << RZ_DETECTOR_TILE_BITS;
+
+  for (unsigned int tc = 0; tc < m_tileCols; ++tc) {
+    unsigned int col  = tc << RZ_DETECTOR_TILE_BITS;
+    unsigned int len  = std::min<unsigned int>(RZ_DETECTOR_TILE_SIZE, m_cols - col);
+    auto tile = m_tiles[tc + tileRow * m_tileCols];
+
+    if (tile == nullptr || tile->weights.empty())
+      std::fill(dest + col, dest + col + len, 0.);
+    else
+      std::copy(
+        tile->weights.begin() + offset,
+        tile->weights.begin() + offset + len,
+        dest + col);
+  }
+}
+
+void
+DetectorStorage::densify() const
+{
+  size_t size = m_rows * m_stride;
+
+  if (!m_denseDirty && m_densePhotons.size() == size)
+    return;
+
+  m_densePhotons.resize(size);
+  std::fill(m_densePhotons.begin(), m_densePhotons.end(), 0);
+
+  if (m_coherent) {
+    m_denseAmplitude.resize(size);
+    std::fill(m_denseAmplitude.begin(), m_denseAmplitude.end(), 0.);
+  }
+
+  if (m_weighted) {
+    m_denseWeights.resize(size);
+    std::fill(m_denseWeights.begin(), m_denseWeights.end(), 0.);
+  }
+
+  for (unsigned int j = 0; j < m_rows; ++j) {
+    getRow(m_densePhotons.data() + j * m_stride, j);
+    if (m_coherent)
+      getRow(m_denseAmplitude.data() + j * m_stride, j);
+    if (m_weighted)
+      getRow(m_denseWeights.data() + j * m_stride, j);
+  }
+
+  m_denseDirty = false;
+}
+
 const uint32_t *
 DetectorStorage::data() const
 {
+  if (m_tiled) {
+    densify();
+    return m_densePhotons.data();
+  }
+
   return m_photons.data();
 }
 
 const Complex *
 DetectorStorage::amplitude() const
 {
+  if (!m_coherent)
+    return nullptr;
+
+  if (m_tiled) {
+    densify();
+    return m_denseAmplitude.data();
+  }
+
   return m_amplitude.data();
 }
 
+const Real *
+DetectorStorage::weights() const
+{
+  if (!m_weighted)
+    return nullptr;
+
+  if (m_tiled) {
+    densify();
+    return m_denseWeights.data();
+  }
+
+  return m_weights.data();
+}
+
 void
 DetectorStorage::clear()
 {
-  std::fill(m_photons.begin(), m_photons.end(), 0);
-  std::fill(m_amplitude.begin(), m_amplitude.end(), 0.);
+  // Pages of large planes are dropped, to be placed again by the first hit
+  zeroLargeBuffer(m_photons.data(), m_photons.size() * sizeof(uint32_t));
+  zeroLargeBuffer(m_amplitude.data(), m_amplitude.size() * sizeof(Complex));
+  zeroLargeBuffer(m_weights.data(), m_weights.size() * sizeof(Real));
+
+  // Tiles are released, so that the memory is only paid for the hit regions
+  freeTiles();
+  m_densePhotons.clear();
+  m_denseAmplitude.clear();
+  m_denseWeights.clear();
+  m_denseDirty = true;
 
   m_maxCounts = 0;
   m_maxEnergy = 0;
+  m_maxWeight = 0;
 }
 
 bool
@@ -141,8 +725,8 @@ DetectorStorage::savePNG(std::string const &path) const
 
   for (size_t j = 0; j < m_rows; ++j) {
     for (size_t i = 0; i < m_cols; ++i) {
-      auto ndx = i + j * m_stride;
-      uint8_t value = m_maxCounts > 0 ? (m_photons[ndx] * 255) / m_maxCounts : 0;
+      uint32_t counts = m_tiled ? this->counts(i, j) : m_photons[i + j * m_stride];
+      uint8_t value = m_maxCounts > 0 ? (counts * 255) / m_maxCounts : 0;
 
       image[j][i] = png::rgb_pixel(value, value, value);
     }
@@ -153,11 +737,16 @@ DetectorStorage::savePNG(std::string const &path) const
   return true; // Cross your fingers
 }
 
+//
+// In tiled mode, raw data is streamed row by row directly from the tiles,
+// so that saving does not require densifying the whole detector.
+//
 bool
 DetectorStorage::saveRawData(std::string const &path) const
 {
   FILE *fp = nullptr;
   size_t chunkSize = sizeof(uint32_t) * m_cols;
+  std::vector<uint32_t> rowBuffer;
   bool ok = false;
 
   if ((fp = fopen(path.c_str(), "wb")) == nullptr) {
@@ -165,8 +754,19 @@ DetectorStorage::saveRawData(std::string const &path) const
     goto done;
   }
 
+  if (m_tiled)
+    rowBuffer.resize(m_cols);
+
   for (auto j = 0; j < m_rows; ++j) {
-    const uint32_t *data = m_photons.data() + j * m_stride;
+    const uint32_t *data;
+
+    if (m_tiled) {
+      getRow(rowBuffer.data(), j);
+      data = rowBuffer.data();
+    } else {
+      data = m_photons.data() + j * m_stride;
+    }
+
     if (fwrite(data, chunkSize, 1, fp) < 1) {
       RZError("Failed to write raw data to `%s': %s\n", path.c_str(), strerror(errno));
       goto done;
@@ -186,15 +786,32 @@ DetectorStorage::saveAmplitude(std::string const &path) const
 {
   FILE *fp = nullptr;
   size_t chunkSize = sizeof(RZ::Complex) * m_cols;
+  std::vector<Complex> rowBuffer;
   bool ok = false;
 
+  if (!m_coherent) {
+    RZError("Cannot save complex amplitude to `%s': detector is incoherent\n", path.c_str());
+    return false;
+  }
+
   if ((fp = fopen(path.c_str(), "wb")) == nullptr) {
     RZError("Cannot save complex amplitude to `%s': %s\n", path.c_str(), strerror(errno));
     goto done;
   }
 
+  if (m_tiled)
+    rowBuffer.resize(m_cols);
+
   for (auto j = 0; j < m_rows; ++j) {
-    const RZ::Complex *data = m_amplitude.data() + j * m_stride;
+    const RZ::Complex *data;
+
+    if (m_tiled) {
+      getRow(rowBuffer.data(), j);
+      data = rowBuffer.data();
+    } else {
+      data = m_amplitude.data() + j * m_stride;
+    }
+
     if (fwrite(data, chunkSize, 1, fp) < 1) {
       RZError("Failed to write complex amplitude to `%s': %s\n", path.c_str(), strerror(errno));
       goto done;
@@ -228,16 +845,36 @@ DetectorBoundary::transmit(RayBeamSlice const &slice) const
 
   for (uint64_t i = slice.start; i < end; ++i) {
     // Check intercept
-    if (beam.hasRay(i) && beam.isIntercepted(i))
-      m_storage->hit(
-        beam.destinations[3 * i + 0], 
-        beam.destinations[3 * i + 1], 
-        beam.amplitude[i]);
+    if (!beam.hasRay(i) || !beam.isIntercepted(i))
+      continue;
+
+    if (m_generation >= 0
+        && ghostGeneration(beam.ids[i]) != static_cast<unsigned>(m_generation))
+      continue;
+
+    m_storage->hit(
+      beam.destinations[3 * i + 0],
+      beam.destinations[3 * i + 1],
+      beam.amplitude[i]);
   }
 
   MediumBoundary::transmit(slice);
 }
 
+bool
+DetectorBoundary::paraxial(ParaxialBoundary &p) const
+{
+  p.type = ParaxialFlat;
+
+  return true;
+}
+
+void
+DetectorBoundary::setGeneration(int generation)
+{
+  m_generation = generation;
+}
+
 DetectorBoundary::DetectorBoundary(DetectorStorage *storage)
 {
   m_storage = storage;
@@ -277,6 +914,18 @@ Detector::propertyChanged(
   } else if (name == "flip") {
     m_flip = value;
     recalcModel();
+  } else if (name == "tiled") {
+    m_tiled = value;
+    m_storage->setTiled(m_tiled);
+  } else if (name == "coherent") {
+    m_coherent = value;
+    m_storage->setCoherent(m_coherent);
+  } else if (name == "weighted") {
+    m_weighted = value;
+    m_storage->setWeighted(m_weighted);
+  } else if (name == "generation") {
+    m_generation = (int) value;
+    m_boundary->setGeneration(m_generation);
   } else if (name == "pixelHeight") {
     m_pxHeight = value;
     recalcModel();
@@ -345,6 +994,36 @@ Detector::stride() const
   return m_storage->stride();
 }
 
+bool
+Detector::tiled() const
+{
+  return m_storage->tiled();
+}
+
+bool
+Detector::coherent() const
+{
+  return m_storage->coherent();
+}
+
+bool
+Detector::weighted() const
+{
+  return m_storage->weighted();
+}
+
+int
+Detector::generation() const
+{
+  return m_generation;
+}
+
+size_t
+Detector::memoryUsage() const
+{
+  return m_storage->memoryUsage();
+}
+
 Real
 Detector::pxWidth() const
 {
@@ -380,12 +1059,75 @@ Detector::amplitude() const
   return m_storage->amplitude();
 }
 
+const Real *
+Detector::weights() const
+{
+  return m_storage->weights();
+}
+
 void
 Detector::clear()
 {
   m_storage->clear();
 }
 
+void
+Detector::swapStorage(DetectorStorage &spare)
+{
+  // These are no-ops if the spare already has the right shape
+  spare.setTiled(m_tiled);
+  spare.setCoherent(m_coherent);
+  spare.setWeighted(m_weighted);
+  spare.setResolution(m_storage->cols(), m_storage->rows());
+  spare.setPixelDimensions(m_pxWidth, m_pxHeight);
+
+  m_storage->swap(spare);
+}
+
+bool
+Detector::adoptStorage(Detector *other)
+{
+  if (other->m_storage->cols() != m_storage->cols()
+      || other->m_storage->rows() != m_storage->rows()
+      || other->m_pxWidth  != m_pxWidth
+      || other->m_pxHeight != m_pxHeight
+      || other->m_tiled    != m_tiled
+      || other->m_coherent != m_coherent
+      || other->m_weighted != m_weighted)
+    return false;
+
+  m_storage->swap(*other->m_storage);
+
+  return true;
+}
+
+bool
+Detector::merge(Detector const *other)
+{
+  if (other->m_pxWidth  != m_pxWidth || other->m_pxHeight != m_pxHeight)
+    return false;
+
+  return m_storage->merge(*other->m_storage);
+}
+
+size_t
+Detector::tileRecordSize() const
+{
+  return m_storage->tileRecordSize();
+}
+
+bool
+Detector::packTiles(uint8_t *dest, size_t size, uint64_t &tiles) const
+{
+  return m_storage->packTiles(dest, size, tiles);
+}
+
+void
+Detector::mergeTiles(const uint8_t *src, uint64_t tiles)
+{
+  m_storage->mergeTiles(src, tiles);
+}
+
 bool
 Detector::savePNG(std::string const &path) const
 {
@@ -417,6 +1159,12 @@ Detector::maxEnergy() const
   return m_storage->maxEnergy();
 }
 
+Real
+Detector::maxWeight() const
+{
+  return m_storage->maxWeight();
+}
+
 void
 Detector::nativeMaterialOpenGL(std::string const &name)
 {
@@ -116,7 +116,7 @@ PhaseScreen::propertyChanged(
   } else if (name == "no") {
     m_muOut = value;
     recalcModel();
-  } else if (sscanf(name.c_str(), "Z%u", &zCoef) == 1) {
+  } else if (name[0] == 'Z' && sscanf(name.c_str(), "Z%u", &zCoef) == 1) {
     Real asReal = value;
     if (!releq(m_boundary->coef(zCoef), asReal)) {
       m_boundary->setCoef(zCoef, asReal);
@@ -20,8 +20,10 @@
 #include <stdexcept>
 #include <Logger.h>
 
+using namespace RZ;
+
 ExprEvaluationVar &
-ExprEvaluationVar::operator=(RZ::Real val)
+ExprEvaluationVar::operator=(Real val)
 {
   this->value = val;
 
@@ -55,7 +57,7 @@ ExprEvaluationContext::defineExpression(
     std::string const &name,
     std::string const &expr)
 {
-  RZ::ExprTkEvaluator *evaluator = new RZ::ExprTkEvaluator(&m_variables);
+  ExprTkEvaluator *evaluator = new ExprTkEvaluator(&m_variables);
 
   if (m_parentCtx != nullptr)
     m_parentCtx->addVariablesToEvaluator(evaluator);
@@ -107,7 +109,7 @@ ExprEvaluationContext::expressions() const
 
 void
 ExprEvaluationContext::addVariablesToEvaluator(
-    RZ::ExprTkEvaluator *evaluator) const
+    ExprTkEvaluator *evaluator) const
 {
   evaluator->addVariables(&m_variables);
 
@@ -118,9 +120,9 @@ ExprEvaluationContext::addVariablesToEvaluator(
 void
 ExprEvaluationContext::defineVariable(
     std::string const &name,
-    RZ::Real value,
-    RZ::Real min,
-    RZ::Real max)
+    Real value,
+    Real min,
+    Real max)
 {
   if (m_varDescriptions.find(name) == m_varDescriptions.end()) {
     m_varDescriptions[name].name = name;
@@ -133,14 +135,14 @@ ExprEvaluationContext::defineVariable(
 
 
   if (m_variables.find(name) == m_variables.end())
-    m_variables[name] = new RZ::GenericModelParam();
+    m_variables[name] = new GenericModelParam();
 
   m_variables[name]->description    = &m_varDescriptions[name].description;
   m_variables[name]->value          = value;
 }
 
-RZ::Real
-ExprEvaluationContext::setVariable(std::string const &name, RZ::Real val)
+Real
+ExprEvaluationContext::setVariable(std::string const &name, Real val)
 {
   auto it = m_varDescriptions.find(name);
 
@@ -152,7 +154,7 @@ ExprEvaluationContext::setVariable(std::string const &name, RZ::Real val)
   return val;
 }
 
-RZ::Real
+Real
 ExprEvaluationContext::eval(std::string const &name)
 {
   auto it = m_evaluators.find(name);
@@ -163,6 +165,41 @@ ExprEvaluationContext::eval(std::string const &name)
   return it->second->evaluate();
 }
 
+// Evaluates an expression once per row of the columns (see
+// GenericEvaluator::evaluate), which is much cheaper than calling
+// setVariable() and eval() for every row.
+bool
+ExprEvaluationContext::evalColumns(
+    std::string const &name,
+    std::vector<GenericEvaluatorColumn> const &columns,
+    Real *output,
+    size_t count)
+{
+  auto it = m_evaluators.find(name);
+
+  if (it == m_evaluators.end())
+    throw std::runtime_error("No such expression `" + name + "'");
+
+  return it->second->evaluate(columns, output, count);
+}
+
+bool
+ExprEvaluationContext::dependsOn(
+    std::string const &name,
+    std::string const &var) const
+{
+  auto it = m_evaluators.find(name);
+
+  if (it == m_evaluators.end())
+    return false;
+
+  for (auto &dep : it->second->dependencies())
+    if (dep == var)
+      return true;
+
+  return false;
+}
+
 ExprEvaluationVar &
 ExprEvaluationContext::operator[] (std::string const &name)
 {
@@ -174,7 +211,7 @@ ExprEvaluationContext::operator[] (std::string const &name)
   return m_varDescriptions[name];
 }
 
-RZ::Real
+Real
 ExprEvaluationContext::operator() (std::string const &name)
 {
   return eval(name);
@@ -32,18 +32,20 @@ namespace RZ {
   struct RandN;
 
   struct ExprTkGenericCaller : public exprtk::ifunction<Real> {
-    GenericCustomFunction *m_func = nullptr;
+    GenericCustomFunction *m_func  = nullptr;
+    GenericEvaluator      *m_owner = nullptr;
 
-    ExprTkGenericCaller(GenericCustomFunction *func)
+    ExprTkGenericCaller(GenericCustomFunction *func, GenericEvaluator *owner)
       : exprtk::ifunction<RZ::Real>(func->argc)
     {
-      m_func = func;
+      m_func  = func;
+      m_owner = owner;
     }
 
     Real
     operator()()
     {
-      return m_func->evaluate(nullptr, 0);
+      return m_owner->call(m_func, nullptr, 0);
     }
 
     Real
@@ -51,7 +53,7 @@ namespace RZ {
       Real const &a0)
     {
       Real args[] = {a0};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -60,7 +62,7 @@ namespace RZ {
       Real const &a1)
     {
       Real args[] = {a0, a1};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -70,7 +72,7 @@ namespace RZ {
       Real const &a2)
     {
       Real args[] = {a0, a1, a2};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -81,7 +83,7 @@ namespace RZ {
       Real const &a3)
     {
       Real args[] = {a0, a1, a2, a3};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -93,7 +95,7 @@ namespace RZ {
       Real const &a4)
     {
       Real args[] = {a0, a1, a2, a3, a4};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -106,7 +108,7 @@ namespace RZ {
       Real const &a5)
     {
       Real args[] = {a0, a1, a2, a3, a4, a5};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -120,7 +122,7 @@ namespace RZ {
       Real const &a6)
     {
       Real args[] = {a0, a1, a2, a3, a4, a5, a6};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
 
     Real
@@ -135,7 +137,7 @@ namespace RZ {
       Real const &a7)
     {
       Real args[] = {a0, a1, a2, a3, a4, a5, a6, a7};
-      return m_func->evaluate(args, sizeof(args) / sizeof(Real));
+      return m_owner->call(m_func, args, sizeof(args) / sizeof(Real));
     }
   };
 
@@ -181,9 +183,12 @@ namespace RZ {
 
     bool compile(std::string const &name);
     Real evaluate();
+    Real *variable(std::string const &);
     std::list<std::string> const &dependencies() const;
     std::string getLastParserError() const;
-    bool registerCustomFunction(GenericCustomFunction *func);
+    bool registerCustomFunction(
+      GenericCustomFunction *func,
+      GenericEvaluator *owner);
     void addVariables(const GenericEvaluatorSymbolDict *);
   };
 }
@@ -267,9 +272,11 @@ ExprTkEvaluatorImpl::~ExprTkEvaluatorImpl()
 }
 
 bool
-ExprTkEvaluatorImpl::registerCustomFunction(GenericCustomFunction *func)
+ExprTkEvaluatorImpl::registerCustomFunction(
+  GenericCustomFunction *func,
+  GenericEvaluator *owner)
 {
-  m_customFuncs.push_back(ExprTkGenericCaller(func));
+  m_customFuncs.push_back(ExprTkGenericCaller(func, owner));
   auto &last = m_customFuncs.back();
   return m_symTab.add_function(func->name, last);
 }
@@ -283,6 +290,9 @@ ExprTkEvaluatorImpl::compile(std::string const &expr)
     std::deque<exprtk_symbol_t> symbol_list;
     m_parser.dec().symbols(symbol_list);
 
+    // Expressions may be recompiled (see GenericCompositeModel::update)
+    m_deps.clear();
+
     for (auto p : symbol_list)
       m_deps.push_back(p.first);
   }
@@ -296,6 +306,17 @@ ExprTkEvaluatorImpl::evaluate()
   return m_expr.value();
 }
 
+Real *
+ExprTkEvaluatorImpl::variable(std::string const &name)
+{
+  auto var = m_symTab.get_variable(name);
+
+  if (var == nullptr)
+    return nullptr;
+
+  return &var->ref();
+}
+
 std::string
 ExprTkEvaluatorImpl::getLastParserError() const
 {
@@ -331,7 +352,7 @@ bool
 ExprTkEvaluator::registerCustomFunction(GenericCustomFunction *func)
 {
   GenericEvaluator::registerCustomFunction(func);
-  return p_impl->registerCustomFunction(func);
+  return p_impl->registerCustomFunction(func, this);
 }
 
 bool
@@ -346,6 +367,13 @@ ExprTkEvaluator::evaluate()
   return p_impl->evaluate();
 }
 
+// Includes the variables added with addVariables()
+Real *
+ExprTkEvaluator::variable(std::string const &name)
+{
+  return p_impl->variable(name);
+}
+
 std::string
 ExprTkEvaluator::getLastParserError() const
 {
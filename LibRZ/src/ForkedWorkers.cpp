@@ -0,0 +1,146 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <ForkedWorkers.h>
+#include <Logger.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+using namespace RZ;
+
+ForkedWorkers::ForkedWorkers(std::string const &name) : m_name(name)
+{
+}
+
+ForkedWorkers::~ForkedWorkers()
+{
+  killAll();
+
+  if (m_segment != nullptr)
+    munmap(m_segment, m_size);
+}
+
+void
+ForkedWorkers::killAll()
+{
+  int status;
+
+  for (auto pid : m_pids)
+    kill(pid, SIGKILL);
+
+  for (auto pid : m_pids)
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+  m_pids.clear();
+}
+
+// Slices are sized for the worst case and only the written pages are
+// backed, so the segment is not charged against the commit limit.
+bool
+ForkedWorkers::map(size_t size)
+{
+  void *segment = mmap(
+    nullptr,
+    size,
+    PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+    -1,
+    0);
+
+  if (segment == MAP_FAILED) {
+    RZError("mmap(): cannot allocate shared segment: %s\n", strerror(errno));
+    return false;
+  }
+
+  if (m_segment != nullptr)
+    munmap(m_segment, m_size);
+
+  m_segment = static_cast<uint8_t *>(segment);
+  m_size    = size;
+
+  return true;
+}
+
+uint8_t *
+ForkedWorkers::segment() const
+{
+  return m_segment;
+}
+
+bool
+ForkedWorkers::start(unsigned int workers, Task const &task)
+{
+  killAll();
+
+  m_workers = workers;
+
+  for (unsigned int i = 0; i < workers; ++i) {
+    pid_t pid = fork();
+
+    if (pid == -1) {
+      RZError("fork(): %s\n", strerror(errno));
+      killAll();
+      return false;
+    }
+
+    if (pid == 0) {
+      bool ok = false;
+
+      try {
+        ok = task(i);
+      } catch (std::exception const &e) {
+        RZError("%s %u: %s\n", m_name.c_str(), i + 1, e.what());
+      } catch (...) {
+        RZError("%s %u: unknown exception\n", m_name.c_str(), i + 1);
+      }
+
+      _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    m_pids.push_back(pid);
+  }
+
+  return true;
+}
+
+bool
+ForkedWorkers::wait()
+{
+  bool ok = true;
+
+  for (unsigned int i = 0; i < m_pids.size(); ++i) {
+    int status = 0;
+    pid_t ret;
+
+    while ((ret = waitpid(m_pids[i], &status, 0)) == -1 && errno == EINTR);
+
+    if (ret == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      RZError("%s %u of %u failed\n", m_name.c_str(), i + 1, m_workers);
+      ok = false;
+    }
+  }
+
+  m_pids.clear();
+
+  return ok;
+}
@@ -18,6 +18,7 @@
 
 #include <GenericCompositeModel.h>
 #include <Recipe.h>
+#include <RecipeCache.h>
 #include <RotatedFrame.h>
 #include <TranslatedFrame.h>
 #include <Singleton.h>
@@ -25,6 +26,10 @@
 #include <CompositeElement.h>
 #include <cassert>
 #include <Logger.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <sstream>
 
 #ifdef PYTHON_SCRIPT_SUPPORT
 #  include <ScriptLoader.h>
@@ -32,6 +37,51 @@
 
 using namespace RZ;
 
+//
+// Parameters, variables and element / frame assignments form a DAG. Edges
+// go from a parameter (or the storage of a variable) to the evaluators that
+// use it, possibly crossing into nested composite models. When something
+// changes, everything downstream (its "cone") is evaluated once, in
+// topological order.
+//
+// Schedules are cached, and invalidated by bumping the graph generation
+// every time a new edge is created.
+//
+static std::atomic<uint64_t> g_graphGeneration(1);
+
+static void
+scheduleVisit(
+  GenericComponentParamEvaluator *node,
+  std::set<GenericComponentParamEvaluator *> &visited,
+  std::vector<GenericComponentParamEvaluator *> &postOrder)
+{
+  if (!visited.insert(node).second)
+    return;
+
+  if (node->storage != nullptr)
+    for (auto p : node->storage->dependencies)
+      scheduleVisit(p, visited, postOrder);
+
+  postOrder.push_back(node);
+}
+
+// Reverse DFS post-order of everything reachable from roots
+template <class Container>
+static void
+schedule(
+  Container const &roots,
+  std::vector<GenericComponentParamEvaluator *> &order)
+{
+  std::set<GenericComponentParamEvaluator *> visited;
+
+  order.clear();
+
+  for (auto p : roots)
+    scheduleVisit(p, visited, order);
+
+  std::reverse(order.begin(), order.end());
+}
+
 std::list<std::string>
 GenericEvaluator::symbols() const
 {
@@ -74,6 +124,104 @@ GenericEvaluator::resolve(std::string const &symbol)
   return nullptr;
 }
 
+Real *
+GenericEvaluator::variable(std::string const &symbol)
+{
+  return resolve(symbol);
+}
+
+Real
+GenericEvaluator::call(
+  GenericCustomFunction *func,
+  Real const *args,
+  unsigned argc)
+{
+  if (!m_batches.empty()) {
+    auto it = m_batches.find(func);
+
+    if (m_recording) {
+      if (it != m_batches.end())
+        it->second.pending.insert(std::vector<Real>(args, args + argc));
+      return 0;
+    }
+
+    if (it != m_batches.end()) {
+      auto result = it->second.results.find(
+        std::vector<Real>(args, args + argc));
+      if (result != it->second.results.end())
+        return result->second;
+    }
+  }
+
+  return func->evaluate(args, argc);
+}
+
+bool
+GenericEvaluator::evaluate(
+  std::vector<GenericEvaluatorColumn> const &columns,
+  Real *output,
+  size_t count,
+  size_t outStride)
+{
+  size_t numCols = columns.size();
+  std::vector<Real *> slots(numCols);
+  std::vector<Real>   saved(numCols);
+
+  for (size_t j = 0; j < numCols; ++j) {
+    slots[j] = variable(columns[j].name);
+    if (slots[j] == nullptr)
+      return false;
+    saved[j] = *slots[j];
+  }
+
+  if (count > 1)
+    for (auto func : m_funcList)
+      if (func->batched())
+        m_batches[func];
+
+  if (!m_batches.empty()) {
+    m_recording = true;
+
+    for (size_t i = 0; i < count; ++i) {
+      for (size_t j = 0; j < numCols; ++j)
+        *slots[j] = columns[j].data[i * columns[j].stride];
+
+      (void) evaluate();
+    }
+
+    m_recording = false;
+
+    // Failed batches are retried (and reported) row by row
+    for (auto &p : m_batches) {
+      auto &batch = p.second;
+      std::vector<std::vector<Real>> rows(
+        batch.pending.begin(),
+        batch.pending.end());
+      std::vector<Real> results(rows.size());
+
+      batch.pending.clear();
+
+      if (!rows.empty() && p.first->evaluateBatch(rows, results.data()))
+        for (size_t i = 0; i < rows.size(); ++i)
+          batch.results[rows[i]] = results[i];
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = 0; j < numCols; ++j)
+      *slots[j] = columns[j].data[i * columns[j].stride];
+
+    output[i * outStride] = evaluate();
+  }
+
+  m_batches.clear();
+
+  for (size_t j = 0; j < numCols; ++j)
+    *slots[j] = saved[j];
+
+  return true;
+}
+
 GenericEvaluator::GenericEvaluator(
   const GenericEvaluatorSymbolDict *dict,
   ExprRandomState *state)
@@ -100,11 +248,28 @@ GenericComponentParamEvaluator::~GenericComponentParamEvaluator()
     delete evaluator;
 }
 
+//
+// Parameters are resolved to a handle (an element property handle, or the
+// index of the frame parameter) and checked once, on the first assignment.
+// Later assignments (e.g. on every DOF change of a sweep) skip all the name
+// lookups.
+//
+enum {
+  ROTATED_FRAME_PARAM_ANGLE,
+  ROTATED_FRAME_PARAM_EX,
+  ROTATED_FRAME_PARAM_EY,
+  ROTATED_FRAME_PARAM_EZ
+};
+
+enum {
+  TRANSLATED_FRAME_PARAM_DX,
+  TRANSLATED_FRAME_PARAM_DY,
+  TRANSLATED_FRAME_PARAM_DZ
+};
+
 void
-GenericComponentParamEvaluator::assign()
+GenericComponentParamEvaluator::resolve()
 {
-  std::string param;
-
   if (description == nullptr)
     throw std::runtime_error("Param evaluator has no description");
 
@@ -122,7 +287,83 @@ GenericComponentParamEvaluator::assign()
     position = -1;
   }
 
-  param = description->parameter;
+  std::string const &param = description->parameter;
+
+  switch (type) {
+    case GENERIC_MODEL_PARAM_TYPE_ELEMENT:
+      handle = element->propertyHandle(param);
+
+      if (handle == RZ_INVALID_PROPERTY_HANDLE)
+        throw std::runtime_error(
+          element->name() + " (" + element->factory()->name() + ") has "
+          + "no property named `" + param + "'");
+
+      if (evaluator != nullptr
+          && element->queryPropertyType(handle) == StringValue)
+        throw std::runtime_error(
+            "Property `" 
+            + param 
+            + "' of "
+            + element->name() + " (" + element->factory()->name() + ") must be "
+            + "a literal string");
+
+      if (evaluator == nullptr
+          && element->queryPropertyType(handle) != StringValue)
+        throw std::runtime_error(
+            "Property `" 
+            + param 
+            + "' of "
+            + element->name() + " (" + element->factory()->name() + ") cannot be "
+            + "a literal string");
+      break;
+
+    case GENERIC_MODEL_PARAM_TYPE_ROTATED_FRAME:
+      if (evaluator == nullptr)
+        throw std::runtime_error("Reference frames do not accept string parameters");
+
+      if (param == "angle")
+        handle = ROTATED_FRAME_PARAM_ANGLE;
+      else if (param == "eX")
+        handle = ROTATED_FRAME_PARAM_EX;
+      else if (param == "eY")
+        handle = ROTATED_FRAME_PARAM_EY;
+      else if (param == "eZ")
+        handle = ROTATED_FRAME_PARAM_EZ;
+      else
+        throw std::runtime_error("Unknown rotation parameter `" + param + "'");
+      break;
+
+    case GENERIC_MODEL_PARAM_TYPE_TRANSLATED_FRAME:
+      if (evaluator == nullptr)
+        throw std::runtime_error("Reference frames do not accept string parameters");
+
+      if (param == "dX")
+        handle = TRANSLATED_FRAME_PARAM_DX;
+      else if (param == "dY")
+        handle = TRANSLATED_FRAME_PARAM_DY;
+      else if (param == "dZ")
+        handle = TRANSLATED_FRAME_PARAM_DZ;
+      else
+        throw std::runtime_error("Unknown translation parameter `" + param + "'");
+      break;
+
+    case GENERIC_MODEL_PARAM_TYPE_VARIABLE:
+      handle = 0;
+      break;
+  }
+}
+
+//
+// Dependent expressions are not assigned from here, that is the job of
+// the scheduler (see GenericModelParam::propagate)
+//
+void
+GenericComponentParamEvaluator::assign()
+{
+  if (handle == RZ_INVALID_PROPERTY_HANDLE)
+    resolve();
+
+  ++evalCount;
 
   // An evaluator exists, this string must be evaluated as such
   if (evaluator != nullptr) {
@@ -133,46 +374,45 @@ GenericComponentParamEvaluator::assign()
 
     switch (type) {
       case GENERIC_MODEL_PARAM_TYPE_ELEMENT:
-        if (element->get(param).type() == UndefinedValue)
-          throw std::runtime_error(
-            element->name() + " (" + element->factory()->name() + ") has "
-            + "no property named `" + param + "'");
-
-        if (element->get(param).type() == StringValue)
-          throw std::runtime_error(
-              "Property `" 
-              + param 
-              + "' of "
-              + element->name() + " (" + element->factory()->name() + ") must be "
-              + "a literal string");
-
-        element->set(param, value);
+        element->set(handle, value);
         break;
 
       case GENERIC_MODEL_PARAM_TYPE_ROTATED_FRAME:
-        if (param == "angle")
-          rotation->setAngle(deg2rad(value));
-        else if (param == "eX")
-          rotation->setAxisX(value);
-        else if (param == "eY")
-          rotation->setAxisY(value);
-        else if (param == "eZ")
-          rotation->setAxisZ(value);
-        else
-          throw std::runtime_error("Unknown rotation parameter `" + param + "'");
+        switch (handle) {
+          case ROTATED_FRAME_PARAM_ANGLE:
+            rotation->setAngle(deg2rad(value));
+            break;
+
+          case ROTATED_FRAME_PARAM_EX:
+            rotation->setAxisX(value);
+            break;
+
+          case ROTATED_FRAME_PARAM_EY:
+            rotation->setAxisY(value);
+            break;
+
+          case ROTATED_FRAME_PARAM_EZ:
+            rotation->setAxisZ(value);
+            break;
+        }
         
         rotation->recalculate();
         break;
 
       case GENERIC_MODEL_PARAM_TYPE_TRANSLATED_FRAME:
-        if (param == "dX")
-          translation->setDistanceX(value);
-        else if (param == "dY")
-          translation->setDistanceY(value);
-        else if (param == "dZ")
-          translation->setDistanceZ(value);
-        else
-          throw std::runtime_error("Unknown translation parameter `" + param + "'");
+        switch (handle) {
+          case TRANSLATED_FRAME_PARAM_DX:
+            translation->setDistanceX(value);
+            break;
+
+          case TRANSLATED_FRAME_PARAM_DY:
+            translation->setDistanceY(value);
+            break;
+
+          case TRANSLATED_FRAME_PARAM_DZ:
+            translation->setDistanceZ(value);
+            break;
+        }
 
         translation->recalculate();
         break;
@@ -184,33 +424,16 @@ GenericComponentParamEvaluator::assign()
       if (!storage->test(value)) {
         RZWarning(
           "Cannot assign `%s': evaluated expression is out of bounds\n",
-          param.c_str());
+          description->parameter.c_str());
       } else {
         storage->value = value;
-        // Storage changed, assign recursively
-
-        for (auto p : storage->dependencies)
-          p->assign();
       }
     }
   } else {
     // No evaluator. This is basically a string.
     switch (type) {
       case GENERIC_MODEL_PARAM_TYPE_ELEMENT:
-        if (element->get(param).type() == UndefinedValue)
-          throw std::runtime_error(
-              element->name() + " (" + element->factory()->name() + ") has "
-              + "no property named `" + param + "'");
-
-        if (element->get(param).type() != StringValue)
-          throw std::runtime_error(
-              "Property `" 
-              + param 
-              + "' of "
-              + element->name() + " (" + element->factory()->name() + ") cannot be "
-              + "a literal string");
-        
-        element->set(param, assignString);
+        element->set(element->propertyName(handle), assignString);
         break;
 
       default:
@@ -219,6 +442,40 @@ GenericComponentParamEvaluator::assign()
   }
 }
 
+std::string
+GenericComponentParamEvaluator::label() const
+{
+  std::string const &param = description != nullptr
+    ? description->parameter
+    : assignString;
+
+  switch (type) {
+    case GENERIC_MODEL_PARAM_TYPE_ELEMENT:
+      return element->name() + "." + param;
+
+    case GENERIC_MODEL_PARAM_TYPE_ROTATED_FRAME:
+      return rotation->name() + "." + param;
+
+    case GENERIC_MODEL_PARAM_TYPE_TRANSLATED_FRAME:
+      return translation->name() + "." + param;
+
+    default:
+      return param;
+  }
+}
+
+void
+GenericModelParam::propagate()
+{
+  if (coneGeneration != g_graphGeneration) {
+    schedule(dependencies, cone);
+    coneGeneration = g_graphGeneration;
+  }
+
+  for (auto p : cone)
+    p->assign();
+}
+
 bool
 GenericModelParam::test(Real val)
 {
@@ -357,10 +614,669 @@ GenericCompositeModel::resolveFilePath(std::string const &path) const
 void
 GenericCompositeModel::assignEverything()
 {
-  for (auto p : m_expressions)
+  // This includes expressions of nested models that depend on ours
+  if (m_scheduleGeneration != g_graphGeneration) {
+    schedule(m_expressions, m_schedule);
+    m_scheduleGeneration = g_graphGeneration;
+  }
+
+  for (auto p : m_schedule)
     p->assign();
 }
 
+//
+// Pairs the frames (recipe contexts) and element steps of two recipes.
+// Objects are paired if they have the same name, type (or factory) and
+// creation mode, and their parents (and, for ports, their elements) are
+// paired as well. ctxMap and stepMap hold the index of the counterpart of
+// each object of the new recipe, or -1 if it has none.
+//
+static void
+matchRecipes(
+  Recipe const *old,
+  Recipe const *recipe,
+  std::vector<int> &ctxMap,
+  std::vector<int> &stepMap)
+{
+  std::map<std::string, std::list<int>> oldContexts, oldSteps;
+  std::vector<bool> ctxDone, stepDone;
+  bool progress = true;
+
+  auto contextKey = [] (const RecipeContext *ctx, int parent, int element) {
+    std::string key = std::to_string(parent) + ":"
+      + std::to_string(ctx->type) + ":"
+      + std::to_string(ctx->delayed) + ":";
+
+    if (ctx->type == RECIPE_CONTEXT_TYPE_PORT)
+      key += std::to_string(element) + "." + ctx->port;
+
+    return key + ":" + ctx->name;
+  };
+
+  auto stepKey = [] (const RecipeElementStep *step, int parent) {
+    return std::to_string(parent) + ":"
+      + std::to_string(step->delayedCreation) + ":"
+      + step->factory + ":" + step->name;
+  };
+
+  auto take = [] (
+    std::map<std::string, std::list<int>> &pool,
+    std::string const &key) {
+      auto it = pool.find(key);
+
+      if (it == pool.end() || it->second.empty())
+        return -1;
+
+      int index = it->second.front();
+      it->second.pop_front();
+      return index;
+  };
+
+  for (auto ctx : old->contexts())
+    if (ctx->parent != nullptr)
+      oldContexts[contextKey(
+        ctx,
+        ctx->parent->s_index,
+        ctx->type == RECIPE_CONTEXT_TYPE_PORT ? ctx->element->s_index : -1)]
+        .push_back(ctx->s_index);
+
+  for (auto step : old->elements())
+    oldSteps[stepKey(step, step->parent->s_index)].push_back(step->s_index);
+
+  ctxMap.assign(recipe->contexts().size(), -1);
+  stepMap.assign(recipe->elements().size(), -1);
+  ctxDone.assign(ctxMap.size(), false);
+  stepDone.assign(stepMap.size(), false);
+
+  ctxMap[0]  = 0;
+  ctxDone[0] = true;
+
+  // Port contexts depend on elements, that depend on contexts
+  while (progress) {
+    progress = false;
+
+    for (auto ctx : recipe->contexts()) {
+      int index   = ctx->s_index;
+      int element = -1;
+      bool port   = ctx->type == RECIPE_CONTEXT_TYPE_PORT;
+
+      if (ctxDone[index] || !ctxDone[ctx->parent->s_index])
+        continue;
+
+      if (port) {
+        if (!stepDone[ctx->element->s_index])
+          continue;
+        element = stepMap[ctx->element->s_index];
+      }
+
+      ctxDone[index] = progress = true;
+
+      if (ctxMap[ctx->parent->s_index] != -1 && (!port || element != -1))
+        ctxMap[index] = take(
+          oldContexts,
+          contextKey(ctx, ctxMap[ctx->parent->s_index], element));
+    }
+
+    for (auto step : recipe->elements()) {
+      int index  = step->s_index;
+      int parent = step->parent->s_index;
+
+      if (stepDone[index] || !ctxDone[parent])
+        continue;
+
+      stepDone[index] = progress = true;
+
+      if (ctxMap[parent] != -1)
+        stepMap[index] = take(oldSteps, stepKey(step, ctxMap[parent]));
+    }
+  }
+}
+
+// Everything update() cannot change in place
+static bool
+sameDefinitions(Recipe const *a, Recipe const *b)
+{
+  auto sameKeys = [] (auto const &x, auto const &y) {
+    if (x.size() != y.size())
+      return false;
+
+    auto it = y.begin();
+    for (auto &p : x)
+      if (p.first != (it++)->first)
+        return false;
+
+    return true;
+  };
+
+  if (a->scripts() != b->scripts() || a->searchPaths() != b->searchPaths())
+    return false;
+
+  if (!sameKeys(a->params(), b->params())
+      || !sameKeys(a->dofs(), b->dofs())
+      || !sameKeys(a->ports(), b->ports())
+      || !sameKeys(a->customElements(), b->customElements()))
+    return false;
+
+  for (auto &p : a->customElements()) {
+    std::string x, y;
+
+    RecipeCache::serialize(p.second, x, RECIPE_SERIALIZE_CONTENTS);
+    RecipeCache::serialize(
+      b->customElements().at(p.first),
+      y,
+      RECIPE_SERIALIZE_CONTENTS);
+
+    if (x != y)
+      return false;
+  }
+
+  return true;
+}
+
+static bool
+samePaths(Recipe const *a, Recipe const *b)
+{
+  auto &x = a->paths();
+  auto &y = b->paths();
+
+  if (x.size() != y.size())
+    return false;
+
+  for (size_t i = 0; i < x.size(); ++i)
+    if (x[i]->name != y[i]->name || x[i]->steps != y[i]->steps)
+      return false;
+
+  return true;
+}
+
+// Sets a property of an element back to the default of its factory
+static void
+resetProperty(Element *element, std::string const &name)
+{
+  auto value = element->factory()->queryProperty(name);
+
+  if (value != nullptr) {
+    element->set(name, *value);
+    return;
+  }
+
+  // Properties of composite elements are their DOFs and parameters
+  auto model = element->nestedCompositeModel();
+  if (model != nullptr) {
+    auto param = model->lookupDof(name);
+    if (param == nullptr)
+      param = model->lookupParam(name);
+
+    if (param != nullptr && param->description != nullptr)
+      element->set(name, param->description->defaultVal);
+  }
+}
+
+//
+// Properties of the elements in `kept' that were assigned by the
+// expressions in `before' and are no longer assigned by those in `after'
+// go back to their defaults.
+//
+static void
+resetUnassigned(
+  std::list<GenericComponentParamEvaluator *> const &before,
+  std::list<GenericComponentParamEvaluator *> const &after,
+  std::set<Element *> const &kept)
+{
+  std::set<std::pair<Element *, std::string>> assigned;
+
+  for (auto p : after)
+    if (p->type == GENERIC_MODEL_PARAM_TYPE_ELEMENT && p->description != nullptr)
+      assigned.insert(std::make_pair(p->element, p->description->parameter));
+
+  for (auto p : before) {
+    if (p->type != GENERIC_MODEL_PARAM_TYPE_ELEMENT
+        || p->description == nullptr
+        || kept.find(p->element) == kept.end())
+      continue;
+
+    auto &name = p->description->parameter;
+    if (name.empty() || assigned.find(std::make_pair(p->element, name)) != assigned.end())
+      continue;
+
+    resetProperty(p->element, name);
+  }
+}
+
+//
+// Updates the model to an edited version of its recipe. Frames and
+// elements of both recipes are paired by name, type and position in the
+// tree (see matchRecipes). Paired ones are kept as they are (with their
+// OpenGL resources, detector images, etc), the rest of the old ones are
+// destroyed and the rest of the new ones created. Likewise, expressions
+// of paired objects that did not change are kept compiled, and the
+// storage of paired variables is kept, so that the nested models of kept
+// composite elements still refer to it. Properties of kept elements that
+// are no longer assigned go back to their defaults.
+//
+// Returns false if the edition changes anything else (scripts, search
+// paths, the set of parameters, DOFs or ports, or the definition of custom
+// elements), or if the new recipe fails to build. Either way, the model is
+// left as it was and must be rebuilt from the new recipe.
+//
+// On success the model refers to the new recipe (owning it if it owned
+// the previous one). As the composite elements of the model were built
+// from the custom element definitions of the previous recipe (which are
+// identical), these are moved to the new recipe.
+//
+bool
+GenericCompositeModel::update(Recipe *recipe)
+{
+  Recipe *old = m_recipe;
+  std::vector<int> ctxMap, stepMap;
+  std::map<const ParamAssignExpression *, GenericComponentParamEvaluator *> evaluatorOf;
+  std::set<GenericComponentParamEvaluator *> paired, orphans, removed;
+  std::vector<ReferenceFrame *> removedFrames;
+  std::vector<Element *> removedElements;
+  std::set<Element *> kept;
+  std::set<int> keptContexts, keptSteps;
+  bool structural, pathsChanged;
+  bool pathsExposed = false, portsExposed = false;
+
+  if (recipe == old)
+    return true;
+
+  if (!sameDefinitions(old, recipe))
+    return false;
+
+  matchRecipes(old, recipe, ctxMap, stepMap);
+
+  // Expressions of paired objects are paired by parameter (or position)
+  // and variable name, if both are strings or both are not
+  for (auto p : m_expressions)
+    if (p->description != nullptr)
+      evaluatorOf[p->description] = p;
+
+  auto pair = [&] (ParamAssignExpression *to, const ParamAssignExpression *from) {
+    auto it = evaluatorOf.find(from);
+    if (it != evaluatorOf.end()
+        && (to->expression[0] == '"') == (from->expression[0] == '"')) {
+      m_previous[to] = it->second;
+      paired.insert(it->second);
+    }
+  };
+
+  auto pairByName = [&] (
+    std::map<std::string, ParamAssignExpression *> const &to,
+    std::map<std::string, ParamAssignExpression *> const &from) {
+      for (auto &p : to) {
+        auto it = from.find(p.first);
+        if (it != from.end())
+          pair(p.second, it->second);
+      }
+  };
+
+  for (size_t i = 1; i < ctxMap.size(); ++i) {
+    if (ctxMap[i] == -1)
+      continue;
+
+    auto to   = recipe->contexts()[i];
+    auto from = old->contexts()[ctxMap[i]];
+
+    keptContexts.insert(ctxMap[i]);
+    pairByName(to->params,    from->params);
+    pairByName(to->variables, from->variables);
+  }
+
+  for (size_t i = 0; i < stepMap.size(); ++i) {
+    if (stepMap[i] == -1)
+      continue;
+
+    auto to   = recipe->elements()[i];
+    auto from = old->elements()[stepMap[i]];
+    auto it   = from->positionalParams.begin();
+
+    keptSteps.insert(stepMap[i]);
+    kept.insert(m_elements[stepMap[i]]);
+
+    for (auto p : to->positionalParams)
+      if (it != from->positionalParams.end())
+        pair(p, *it++);
+
+    pairByName(to->params, from->params);
+  }
+
+  for (size_t i = 1; i < m_frames.size(); ++i)
+    if (keptContexts.find(i) == keptContexts.end()
+        && old->contexts()[i]->type != RECIPE_CONTEXT_TYPE_PORT)
+      removedFrames.push_back(m_frames[i]);
+
+  for (size_t i = 0; i < m_elements.size(); ++i)
+    if (keptSteps.find(i) == keptSteps.end()) {
+      removedElements.push_back(m_elements[i]);
+      if (m_elements[i]->nestedCompositeModel() != nullptr)
+        m_elements[i]->nestedCompositeModel()->collectExpressions(orphans);
+    }
+
+  // The root frame is always kept
+  structural = keptContexts.size() + 1 != old->contexts().size()
+    || keptContexts.size() + 1 != recipe->contexts().size()
+    || keptSteps.size() != old->elements().size()
+    || keptSteps.size() != recipe->elements().size();
+  pathsChanged = structural || !samePaths(old, recipe);
+
+  // Removed variables must not be used by the nested models that are kept
+  for (auto p : m_expressions) {
+    if (p->type != GENERIC_MODEL_PARAM_TYPE_VARIABLE
+        || p->storage == nullptr
+        || paired.find(p) != paired.end())
+      continue;
+
+    for (auto q : p->storage->dependencies)
+      if (std::find(m_expressions.begin(), m_expressions.end(), q) == m_expressions.end()
+          && orphans.find(q) == orphans.end()) {
+        m_previous.clear();
+        return false;
+      }
+  }
+
+  // Everything needed to undo the update
+  std::list<GenericComponentParamEvaluator *> oldExpressions = m_expressions;
+  std::set<GenericComponentParamEvaluator *> oldSet(
+    m_expressions.begin(),
+    m_expressions.end());
+  std::vector<std::pair<GenericComponentParamEvaluator *, ParamAssignExpression *>> descriptions;
+  std::map<GenericModelParam *, std::pair<const RecipeParameter *, Real>> oldParams;
+  std::list<std::pair<GenericModelParam *, GenericComponentParamEvaluator *>> cut;
+  std::vector<ReferenceFrame *> oldFrames = m_frames;
+  std::vector<Element *> oldElements = m_elements;
+  GenericEvaluatorSymbolDict oldGlobal = m_global;
+  unsigned int oldCompletedFrames = m_completedFrames;
+  unsigned int oldCompletedElements = m_completedElements;
+  size_t storageCount = m_genParamStorage.size();
+  OMModelIndex index;
+
+  for (auto p : m_expressions)
+    descriptions.push_back(std::make_pair(p, p->description));
+
+  for (auto &p : m_params)
+    oldParams[p.second] = std::make_pair(p.second->description, p.second->value);
+
+  for (auto &p : m_dofs)
+    oldParams[p.second] = std::make_pair(p.second->description, p.second->value);
+
+  m_model->saveIndex(index);
+
+  try {
+    m_recipe = recipe;
+    m_expressions.clear();
+    m_global.clear();
+
+    // Composite elements created below import the global scope
+    initGlobalScope();
+
+    for (auto p : removedElements)
+      m_model->unregisterElement(p);
+
+    for (auto p : removedFrames)
+      m_model->unregisterFrame(p);
+
+    m_frames.assign(recipe->contexts().size(), nullptr);
+    m_elements.assign(recipe->elements().size(), nullptr);
+
+    for (size_t i = 0; i < ctxMap.size(); ++i)
+      if (ctxMap[i] != -1)
+        m_frames[i] = oldFrames[ctxMap[i]];
+
+    for (size_t i = 0; i < stepMap.size(); ++i)
+      if (stepMap[i] != -1)
+        m_elements[i] = oldElements[stepMap[i]];
+
+    m_completedFrames   = keptContexts.size() + 1;
+    m_completedElements = keptSteps.size();
+
+    createFrames(nullptr);
+    createElements(nullptr);
+    delayedCreationLoop();
+    createExpressions();
+
+    // Drop the dependencies on the expressions that are gone
+    for (auto p : oldExpressions)
+      if (std::find(m_expressions.begin(), m_expressions.end(), p) == m_expressions.end())
+        removed.insert(p);
+
+    removed.insert(orphans.begin(), orphans.end());
+
+    for (auto model = this; model != nullptr; model = model->m_parentModel)
+      for (auto param : model->m_genParamStorage)
+        for (auto it = param->dependencies.begin(); it != param->dependencies.end();) {
+          if (removed.find(*it) != removed.end()) {
+            cut.push_back(std::make_pair(param, *it));
+            it = param->dependencies.erase(it);
+          } else {
+            ++it;
+          }
+        }
+
+    ++g_graphGeneration;
+
+    for (auto p : m_expressions)
+      if (oldSet.find(p) == oldSet.end())
+        p->resolve();
+
+    resetUnassigned(oldExpressions, m_expressions, kept);
+
+    // Parameters and DOFs. New defaults are applied.
+    auto updateParams = [] (
+      std::map<std::string, GenericModelParam *> &params,
+      std::map<std::string, RecipeParameter> const &descriptions) {
+        for (auto &p : params) {
+          auto desc = &descriptions.at(p.first);
+          if (desc->defaultVal != p.second->description->defaultVal)
+            p.second->value = desc->defaultVal;
+          p.second->description = desc;
+        }
+    };
+
+    updateParams(m_params, recipe->params());
+    updateParams(m_dofs,   recipe->dofs());
+
+    if (pathsChanged) {
+      pathsExposed = true;
+      m_model->clearOpticalPaths();
+      exposeOpticalPaths();
+    }
+
+    if (structural) {
+      portsExposed = true;
+      exposePorts();
+    }
+
+    assignEverything();
+  } catch (std::exception const &e) {
+    RZDebug(
+      "%s: cannot update model in place: %s\n",
+      m_givenName.c_str(),
+      e.what());
+
+    std::list<GenericComponentParamEvaluator *> attempted = m_expressions;
+    std::set<GenericComponentParamEvaluator *> fresh;
+    std::set<Element *> oldElementSet(oldElements.begin(), oldElements.end());
+    std::set<ReferenceFrame *> oldFrameSet(oldFrames.begin(), oldFrames.end());
+    std::vector<Element *> created;
+    std::vector<ReferenceFrame *> createdFrames;
+
+    for (auto p : m_elements)
+      if (p != nullptr && oldElementSet.find(p) == oldElementSet.end()) {
+        created.push_back(p);
+        if (p->nestedCompositeModel() != nullptr)
+          p->nestedCompositeModel()->collectExpressions(fresh);
+      }
+
+    for (size_t i = 1; i < m_frames.size(); ++i)
+      if (m_frames[i] != nullptr
+          && recipe->contexts()[i]->type != RECIPE_CONTEXT_TYPE_PORT
+          && oldFrameSet.find(m_frames[i]) == oldFrameSet.end())
+        createdFrames.push_back(m_frames[i]);
+
+    for (auto p : attempted)
+      if (oldSet.find(p) == oldSet.end())
+        fresh.insert(p);
+
+    for (auto model = this; model != nullptr; model = model->m_parentModel)
+      for (auto param : model->m_genParamStorage)
+        param->dependencies.remove_if(
+          [&] (GenericComponentParamEvaluator *p) {
+            return fresh.find(p) != fresh.end();
+          });
+
+    for (auto &p : cut)
+      p.first->dependencies.push_back(p.second);
+
+    for (auto &p : descriptions)
+      p.first->description = p.second;
+
+    resetUnassigned(attempted, oldExpressions, kept);
+
+    for (auto p : attempted)
+      if (oldSet.find(p) == oldSet.end())
+        delete p;
+
+    while (m_genParamStorage.size() > storageCount) {
+      delete m_genParamStorage.back();
+      m_genParamStorage.pop_back();
+    }
+
+    for (auto &p : oldParams) {
+      p.first->description = p.second.first;
+      p.first->value       = p.second.second;
+    }
+
+    m_recipe            = old;
+    m_expressions       = oldExpressions;
+    m_global            = oldGlobal;
+    m_frames            = oldFrames;
+    m_elements          = oldElements;
+    m_completedFrames   = oldCompletedFrames;
+    m_completedElements = oldCompletedElements;
+    m_previous.clear();
+
+    m_model->restoreIndex(index);
+
+    for (auto p : created)
+      delete p;
+
+    for (auto it = createdFrames.rbegin(); it != createdFrames.rend(); ++it)
+      delete *it;
+
+    if (pathsExposed) {
+      m_model->clearOpticalPaths();
+      exposeOpticalPaths();
+    }
+
+    if (portsExposed)
+      exposePorts();
+
+    ++g_graphGeneration;
+    assignEverything();
+
+    return false;
+  }
+
+  // Nothing can fail from here. Release what is gone.
+  std::set<GenericModelParam *> live;
+
+  for (auto p : m_expressions)
+    if (p->storage != nullptr)
+      live.insert(p->storage);
+
+  for (auto p : oldExpressions) {
+    if (removed.find(p) == removed.end())
+      continue;
+
+    if (p->storage != nullptr && live.find(p->storage) == live.end()) {
+      m_genParamStorage.remove(p->storage);
+      delete p->storage;
+    }
+
+    delete p;
+  }
+
+  for (auto p : removedElements)
+    delete p;
+
+  for (auto it = removedFrames.rbegin(); it != removedFrames.rend(); ++it)
+    delete *it;
+
+  m_previous.clear();
+
+  old->swapCustomElements(recipe);
+
+  if (m_ownsRecipe)
+    delete old;
+
+  return true;
+}
+
+static std::string
+graphNodeId(const void *ptr)
+{
+  char id[32];
+
+  snprintf(id, sizeof(id), "n%p", ptr);
+
+  return id;
+}
+
+std::string
+GenericCompositeModel::dependencyGraph() const
+{
+  std::ostringstream os;
+  std::set<GenericComponentParamEvaluator *> own(
+    m_expressions.begin(),
+    m_expressions.end());
+
+  auto edges = [&] (const void *from, GenericModelParam *param) {
+    for (auto p : param->dependencies)
+      os << "  " << graphNodeId(from) << " -> " << graphNodeId(p) << ";\n";
+  };
+
+  os << "digraph \"" << m_givenName << "\" {\n";
+
+  for (auto &p : m_dofs) {
+    os << "  " << graphNodeId(p.second)
+       << " [shape=box, label=\"dof " << p.first << "\"];\n";
+    edges(p.second, p.second);
+  }
+
+  for (auto &p : m_params) {
+    os << "  " << graphNodeId(p.second)
+       << " [shape=box, label=\"param " << p.first << "\"];\n";
+    edges(p.second, p.second);
+  }
+
+  for (auto p : m_expressions) {
+    os << "  " << graphNodeId(p)
+       << " [label=\"" << p->label() << "\\n" << p->evalCount << " evals\"];\n";
+
+    if (p->storage != nullptr)
+      edges(p, p->storage);
+  }
+
+  // Expressions of nested models reached from here
+  for (auto p : m_schedule)
+    if (own.find(p) == own.end())
+      os << "  " << graphNodeId(p)
+         << " [style=dashed, label=\"" << p->label() << "\\n"
+         << p->evalCount << " evals\"];\n";
+
+  os << "}\n";
+
+  return os.str();
+}
+
+void
+GenericCompositeModel::resetEvaluationCounts()
+{
+  for (auto p : m_expressions)
+    p->evalCount = 0;
+}
+
 bool
 GenericCompositeModel::loadScript(std::string const &path)
 {
@@ -416,9 +1332,7 @@ GenericCompositeModel::setParam(std::string const &name, Real value)
   }
 
   param->value = value;
-
-  for (auto p : param->dependencies)
-    p->assign();
+  param->propagate();
 
   return true;
 }
@@ -451,9 +1365,7 @@ GenericCompositeModel::setDof(std::string const &name, Real value)
   }
 
   dof->value = value;
-
-  for (auto p : dof->dependencies)
-    p->assign();
+  dof->propagate();
 
   return true;
 }
@@ -672,17 +1584,19 @@ GenericCompositeModel::createElementInside(
   if (factory == nullptr)
     throw std::runtime_error("Undefined element class `" + step->factory + "'");
 
-  m_elements[index] = factory->make(name, pFrame, m_parent);
-  m_elements[index]->setParentModel(this);
-  
-  ++m_completedElements;
+  Element *element = factory->make(name, pFrame, m_parent);
+  element->setParentModel(this);
 
-  if (!m_model->autoRegisterElement(m_elements[index]))
+  // This deletes the element on failure
+  if (!m_model->autoRegisterElement(element))
     throw std::runtime_error("Element`" + name + "' already exists");
 
+  m_elements[index] = element;
+  ++m_completedElements;
+
   if (step->factory == "Detector") {
     // Detectors must be notified accordingly
-    Detector *det = static_cast<Detector *>(m_elements[index]);
+    Detector *det = static_cast<Detector *>(element);
     notifyDetector(det->name(), det);
   }
 }
@@ -703,11 +1617,10 @@ GenericCompositeModel::createElements(ReferenceFrame *parent)
   }
   
   for (size_t i = 0; i < elements.size(); ++i) {
-    if (elements[i]->delayedCreation) {
-      // This one is created during a plug step
-      m_elements[i] = nullptr;
+    // Delayed ones are created during a plug step. Existing ones are
+    // kept by update().
+    if (elements[i]->delayedCreation || m_elements[i] != nullptr)
       continue;
-    }
 
     ReferenceFrame *pFrame = getFrameOfContext(elements[i]->parent);
     
@@ -788,12 +1701,9 @@ GenericCompositeModel::loadScripts()
       throw std::runtime_error("Failed to load Python script `" + p + "'");
 }
 
-GenericComponentParamEvaluator *
-GenericCompositeModel::makeExpression(
-  std::string const &expr,
-  const GenericEvaluatorSymbolDict *dict)
+std::list<GenericCustomFunction *>
+GenericCompositeModel::customFunctions() const
 {
-  GenericComponentParamEvaluator *paramEvaluator = new GenericComponentParamEvaluator();
   std::list<GenericCustomFunction *> customFuncs;
 
 #ifdef PYTHON_SCRIPT_SUPPORT
@@ -805,15 +1715,28 @@ GenericCompositeModel::makeExpression(
   }
 #endif // PYTHON_SCRIPT_SUPPORT
 
+  return customFuncs;
+}
+
+GenericComponentParamEvaluator *
+GenericCompositeModel::makeExpression(
+  std::string const &expr,
+  const GenericEvaluatorSymbolDict *dict)
+{
+  GenericComponentParamEvaluator *paramEvaluator = nullptr;
+  std::list<GenericCustomFunction *> customFuncs = customFunctions();
+
   if (expr[0] == '"' && expr.size() >= 2) {
     // Assign string. Nothing 
     std::string assignStr = expr.substr(1, expr.size() - 2);
+    paramEvaluator = new GenericComponentParamEvaluator();
     paramEvaluator->assignString = assignStr;
     paramEvaluator->evaluator = nullptr;
     m_expressions.push_back(paramEvaluator);
   } else {
     auto evaluator = allocateEvaluator(expr, dict, customFuncs, randState());
 
+    paramEvaluator = new GenericComponentParamEvaluator();
     paramEvaluator->evaluator = evaluator;
     
     m_expressions.push_back(paramEvaluator);
@@ -825,8 +1748,10 @@ GenericCompositeModel::makeExpression(
 
     for (auto dep : deps) {
       auto it = dict->find(dep);
-      if (it != dict->end())
+      if (it != dict->end()) {
         it->second->dependencies.push_back(paramEvaluator);
+        ++g_graphGeneration;
+      }
       else
         throw std::runtime_error("Undefined expression dependency (" + dep + ")");
     }
@@ -835,6 +1760,82 @@ GenericCompositeModel::makeExpression(
   return paramEvaluator;
 }       
 
+// True if every symbol of an expression is still bound to the same storage
+static bool
+sameBindings(
+  GenericComponentParamEvaluator *expr,
+  const GenericEvaluatorSymbolDict *dict)
+{
+  if (expr->evaluator == nullptr)
+    return true;
+
+  for (auto &dep : expr->evaluator->dependencies()) {
+    auto it = dict->find(dep);
+    if (it == dict->end() || &it->second->value != expr->evaluator->variable(dep))
+      return false;
+  }
+
+  return true;
+}
+
+//
+// During update(), unchanged expressions of the previous recipe are taken
+// as they are (compiled, resolved and with their dependencies in place),
+// as long as their symbols still refer to the same variables.
+//
+GenericComponentParamEvaluator *
+GenericCompositeModel::makeExpression(
+  ParamAssignExpression *desc,
+  const GenericEvaluatorSymbolDict *dict)
+{
+  GenericComponentParamEvaluator *expr;
+  auto it = m_previous.find(desc);
+
+  if (it != m_previous.end()
+      && it->second->description->expression == desc->expression
+      && sameBindings(it->second, dict)) {
+    expr = it->second;
+
+    // Names of positional parameters are only known once resolved
+    if (desc->parameter.empty())
+      desc->parameter = expr->description->parameter;
+
+    m_expressions.push_back(expr);
+  } else {
+    expr = makeExpression(desc->expression, dict);
+  }
+
+  expr->description = desc;
+
+  return expr;
+}
+
+// Variables and frame parameters keep their storage across updates
+GenericModelParam *
+GenericCompositeModel::makeStorage(const ParamAssignExpression *desc)
+{
+  auto it = m_previous.find(desc);
+
+  if (it != m_previous.end() && it->second->storage != nullptr)
+    return it->second->storage;
+
+  auto genP   = allocateParam();
+  genP->value = 0;
+
+  return genP;
+}
+
+void
+GenericCompositeModel::collectExpressions(
+  std::set<GenericComponentParamEvaluator *> &dest) const
+{
+  dest.insert(m_expressions.begin(), m_expressions.end());
+
+  for (auto p : m_elements)
+    if (p != nullptr && p->nestedCompositeModel() != nullptr)
+      p->nestedCompositeModel()->collectExpressions(dest);
+}
+
 void
 GenericCompositeModel::createScopedVariables(GenericEvaluatorSymbolDict &global, RecipeContext *frame)
 {
@@ -843,16 +1844,12 @@ GenericCompositeModel::createScopedVariables(GenericEvaluatorSymbolDict &global,
   // This are created to abbreviate certain expressions used along the model
   for (auto name : frame->varNames) {
     auto p            = frame->variables.find(name);
-    auto expr         = makeExpression(p->second->expression, &global);
-    
-    auto genP         = allocateParam();
-
-    genP->value       = 0;
+    auto expr         = makeExpression(p->second, &global);
+    auto genP         = makeStorage(p->second);
 
     global[name]      = genP;
 
     expr->type        = GENERIC_MODEL_PARAM_TYPE_VARIABLE;
-    expr->description = p->second;
     expr->storage     = genP;
   }
 
@@ -878,14 +1875,10 @@ GenericCompositeModel::createScopedExpressions(
   ///////////////////////// CREATE FRAME EXPRESSIONS ///////////////////////////
   // Make them and expose their storage.
   for (auto p : localFrame->params) {
-    auto name     = p.first;
-    auto genP     = allocateParam();
-    genP->value   = 0;
+    auto genP = makeStorage(p.second);
+    auto expr = makeExpression(p.second, &local);
 
-    auto expr = makeExpression(p.second->expression, &local);
-
-    expr->description = p.second;
-    expr->storage     = genP;
+    expr->storage = genP;
 
     switch (localFrame->type) {
       case RECIPE_CONTEXT_TYPE_ROOT:
@@ -914,17 +1907,19 @@ GenericCompositeModel::createScopedExpressions(
     unsigned int count = 0;
 
     for (auto p : elem->positionalParams) {
-      auto expr         = makeExpression(p->expression, &local);
+      auto expr         = makeExpression(p, &local);
       expr->type        = GENERIC_MODEL_PARAM_TYPE_ELEMENT;
-      expr->description = p;
-      expr->position    = count++;
       expr->element     = m_elements[expr->description->s_target];
+
+      // Expressions kept by update() are already resolved
+      if (expr->handle == RZ_INVALID_PROPERTY_HANDLE)
+        expr->position  = count;
+      ++count;
     }
 
     for (auto p : elem->params) {
-      auto expr         = makeExpression(p.second->expression, &local);
+      auto expr         = makeExpression(p.second, &local);
       expr->type        = GENERIC_MODEL_PARAM_TYPE_ELEMENT;
-      expr->description = p.second;
       expr->element     = m_elements[expr->description->s_target];
     }
   }
@@ -19,6 +19,7 @@
 #include <Helpers.h>
 #include <Vector.h>
 #include <vector>
+#include <ctime>
 
 template<> RZ::Real sumPrecise(const RZ::Real *, size_t);
 template<> RZ::Vec3 sumPrecise(const RZ::Vec3 *, size_t);
@@ -104,3 +105,13 @@ operator / (std::string const &str, char c)
 {
   return string_split(str, c);
 }
+
+double
+monotonicSeconds()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
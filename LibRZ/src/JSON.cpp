@@ -0,0 +1,452 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <JSON.h>
+#include <Helpers.h>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+
+namespace RZ {
+  class JSONParser {
+      std::string const &m_text;
+      std::string        m_fileName;
+      size_t             m_pos = 0;
+
+      [[noreturn]] void error(std::string const &) const;
+      void skipSpaces();
+      bool consume(char);
+      void expect(char);
+
+      std::string parseString();
+      void parseLiteral(const char *);
+      void parseNumber(JSONValue &);
+      void parseArray(JSONValue &);
+      void parseObject(JSONValue &);
+      void parseValue(JSONValue &);
+
+    public:
+      JSONParser(std::string const &text, std::string const &fileName);
+      void parse(JSONValue &);
+  };
+}
+
+using namespace RZ;
+
+std::string
+RZ::jsonEscape(std::string const &str)
+{
+  std::string result;
+
+  for (auto c : str) {
+    switch (c) {
+      case '"':
+        result += "\\\"";
+        break;
+
+      case '\\':
+        result += "\\\\";
+        break;
+
+      default:
+        if (static_cast<unsigned char>(c) < 0x20)
+          result += string_printf("\\u%04x", c);
+        else
+          result += c;
+    }
+  }
+
+  return result;
+}
+
+//////////////////////////////// JSON parser ///////////////////////////////////
+JSONParser::JSONParser(std::string const &text, std::string const &fileName) :
+  m_text(text), m_fileName(fileName)
+{
+}
+
+void
+JSONParser::error(std::string const &msg) const
+{
+  unsigned line = 1, col = 1;
+
+  for (size_t i = 0; i < m_pos && i < m_text.size(); ++i) {
+    if (m_text[i] == '\n') {
+      ++line;
+      col = 1;
+    } else {
+      ++col;
+    }
+  }
+
+  throw std::runtime_error(
+    string_printf("%s:%u:%u: %s", m_fileName.c_str(), line, col, msg.c_str()));
+}
+
+void
+JSONParser::skipSpaces()
+{
+  while (m_pos < m_text.size() && isspace(m_text[m_pos]))
+    ++m_pos;
+}
+
+bool
+JSONParser::consume(char c)
+{
+  skipSpaces();
+
+  if (m_pos < m_text.size() && m_text[m_pos] == c) {
+    ++m_pos;
+    return true;
+  }
+
+  return false;
+}
+
+void
+JSONParser::expect(char c)
+{
+  if (!consume(c))
+    error(string_printf("expected `%c'", c));
+}
+
+std::string
+JSONParser::parseString()
+{
+  std::string result;
+
+  expect('"');
+
+  while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+    char c = m_text[m_pos++];
+
+    if (c == '\\') {
+      if (m_pos >= m_text.size())
+        break;
+
+      c = m_text[m_pos++];
+      switch (c) {
+        case 'b': result += '\b'; break;
+        case 'f': result += '\f'; break;
+        case 'n': result += '\n'; break;
+        case 'r': result += '\r'; break;
+        case 't': result += '\t'; break;
+        case 'u': {
+          unsigned int code;
+          if (m_pos + 4 > m_text.size()
+              || sscanf(m_text.c_str() + m_pos, "%4x", &code) != 1)
+            error("invalid unicode escape sequence");
+          m_pos += 4;
+
+          // Encode as UTF-8. Surrogate pairs are not handled.
+          if (code < 0x80) {
+            result += static_cast<char>(code);
+          } else if (code < 0x800) {
+            result += static_cast<char>(0xc0 | (code >> 6));
+            result += static_cast<char>(0x80 | (code & 0x3f));
+          } else {
+            result += static_cast<char>(0xe0 | (code >> 12));
+            result += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            result += static_cast<char>(0x80 | (code & 0x3f));
+          }
+          break;
+        }
+
+        default:
+          result += c;
+      }
+    } else {
+      result += c;
+    }
+  }
+
+  if (m_pos >= m_text.size())
+    error("unterminated string");
+
+  ++m_pos;
+
+  return result;
+}
+
+void
+JSONParser::parseLiteral(const char *literal)
+{
+  size_t len = strlen(literal);
+
+  if (m_text.compare(m_pos, len, literal) != 0)
+    error("unexpected token");
+
+  m_pos += len;
+}
+
+void
+JSONParser::parseNumber(JSONValue &value)
+{
+  const char *start = m_text.c_str() + m_pos;
+  char *end = nullptr;
+
+  value.m_type   = JSON_NUMBER;
+  value.m_number = strtod(start, &end);
+
+  if (end == start)
+    error("invalid number");
+
+  m_pos += end - start;
+}
+
+void
+JSONParser::parseArray(JSONValue &value)
+{
+  value.m_type = JSON_ARRAY;
+
+  expect('[');
+  if (consume(']'))
+    return;
+
+  do {
+    value.m_array.push_back(JSONValue());
+    parseValue(value.m_array.back());
+  } while (consume(','));
+
+  expect(']');
+}
+
+void
+JSONParser::parseObject(JSONValue &value)
+{
+  value.m_type = JSON_OBJECT;
+
+  expect('{');
+  if (consume('}'))
+    return;
+
+  do {
+    skipSpaces();
+    std::string key = parseString();
+    expect(':');
+
+    if (value.m_object.find(key) == value.m_object.end())
+      value.m_keys.push_back(key);
+
+    parseValue(value.m_object[key]);
+  } while (consume(','));
+
+  expect('}');
+}
+
+void
+JSONParser::parseValue(JSONValue &value)
+{
+  skipSpaces();
+
+  if (m_pos >= m_text.size())
+    error("unexpected end of document");
+
+  switch (m_text[m_pos]) {
+    case '{':
+      parseObject(value);
+      break;
+
+    case '[':
+      parseArray(value);
+      break;
+
+    case '"':
+      value.m_type   = JSON_STRING;
+      value.m_string = parseString();
+      break;
+
+    case 't':
+      parseLiteral("true");
+      value.m_type = JSON_BOOL;
+      value.m_bool = true;
+      break;
+
+    case 'f':
+      parseLiteral("false");
+      value.m_type = JSON_BOOL;
+      value.m_bool = false;
+      break;
+
+    case 'n':
+      parseLiteral("null");
+      value.m_type = JSON_NULL;
+      break;
+
+    default:
+      parseNumber(value);
+  }
+}
+
+void
+JSONParser::parse(JSONValue &value)
+{
+  parseValue(value);
+  skipSpaces();
+
+  if (m_pos < m_text.size())
+    error("trailing characters after document");
+}
+
+//////////////////////////////// JSON values ///////////////////////////////////
+bool
+JSONValue::asBool() const
+{
+  if (m_type == JSON_NUMBER)
+    return m_number != 0;
+
+  if (m_type != JSON_BOOL)
+    throw std::runtime_error("JSON value is not a boolean");
+
+  return m_bool;
+}
+
+double
+JSONValue::asNumber() const
+{
+  if (m_type == JSON_BOOL)
+    return m_bool ? 1 : 0;
+
+  if (m_type != JSON_NUMBER)
+    throw std::runtime_error("JSON value is not a number");
+
+  return m_number;
+}
+
+std::string const &
+JSONValue::asString() const
+{
+  if (m_type != JSON_STRING)
+    throw std::runtime_error("JSON value is not a string");
+
+  return m_string;
+}
+
+size_t
+JSONValue::size() const
+{
+  if (m_type == JSON_ARRAY)
+    return m_array.size();
+
+  if (m_type == JSON_OBJECT)
+    return m_object.size();
+
+  return 0;
+}
+
+JSONValue const &
+JSONValue::operator[](size_t index) const
+{
+  if (m_type != JSON_ARRAY)
+    throw std::runtime_error("JSON value is not an array");
+
+  if (index >= m_array.size())
+    throw std::runtime_error("JSON array index out of bounds");
+
+  return m_array[index];
+}
+
+bool
+JSONValue::has(std::string const &key) const
+{
+  return m_type == JSON_OBJECT && m_object.find(key) != m_object.end();
+}
+
+std::list<std::string> const &
+JSONValue::keys() const
+{
+  return m_keys;
+}
+
+JSONValue const &
+JSONValue::operator[](std::string const &key) const
+{
+  static const JSONValue null;
+
+  if (m_type != JSON_OBJECT)
+    return null;
+
+  auto it = m_object.find(key);
+  if (it == m_object.end())
+    return null;
+
+  return it->second;
+}
+
+double
+JSONValue::get(std::string const &key, double dflt) const
+{
+  auto &value = (*this)[key];
+
+  return value.isNull() ? dflt : value.asNumber();
+}
+
+std::string
+JSONValue::get(std::string const &key, std::string const &dflt) const
+{
+  auto &value = (*this)[key];
+
+  return value.isNull() ? dflt : value.asString();
+}
+
+std::string
+JSONValue::get(std::string const &key, const char *dflt) const
+{
+  return get(key, std::string(dflt));
+}
+
+bool
+JSONValue::getBool(std::string const &key, bool dflt) const
+{
+  auto &value = (*this)[key];
+
+  return value.isNull() ? dflt : value.asBool();
+}
+
+JSONValue
+JSONValue::parse(std::string const &text, std::string const &fileName)
+{
+  JSONValue value;
+  JSONParser parser(text, fileName);
+
+  parser.parse(value);
+
+  return value;
+}
+
+JSONValue
+JSONValue::fromFile(std::string const &path)
+{
+  FILE *fp = fopen(path.c_str(), "rb");
+  std::string text;
+  char buffer[4096];
+  size_t got;
+
+  if (fp == nullptr)
+    throw std::runtime_error(
+      string_printf("Cannot open %s: %s", path.c_str(), strerror(errno)));
+
+  while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    text.append(buffer, got);
+
+  fclose(fp);
+
+  return parse(text, path);
+}
@@ -0,0 +1,258 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <LargeAllocator.h>
+#include <Logger.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace RZ;
+
+//
+// Every buffer is preceded by a header of one cache line, so that it can
+// be released without knowing its size. Mapped buffers are placed at the
+// beginning of a huge page-aligned mapping.
+//
+#define RZ_LARGE_ALLOC_MAGIC_HEAP   0x48454150u // HEAP
+#define RZ_LARGE_ALLOC_MAGIC_MAPPED 0x4d415050u // MAPP
+
+struct LargeAllocHeader {
+  uint32_t magic;
+  uint32_t huge;
+  uint64_t size;   // Requested
+  uint64_t length; // Of the mapping, if mapped
+};
+
+static_assert(
+  sizeof(LargeAllocHeader) <= RZ_LARGE_ALLOC_ALIGNMENT,
+  "Allocation header does not fit in a cache line");
+
+static std::atomic<uint64_t> g_allocations {0};
+static std::atomic<uint64_t> g_releases    {0};
+static std::atomic<uint64_t> g_inUse       {0};
+static std::atomic<uint64_t> g_peak        {0};
+static std::atomic<uint64_t> g_mapped      {0};
+static std::atomic<uint64_t> g_hugePages   {0};
+static std::atomic<int>      g_useHugePages {-1}; // Not initialized
+
+static inline LargeAllocHeader *
+headerOf(void *ptr)
+{
+  return reinterpret_cast<LargeAllocHeader *>(
+    static_cast<uint8_t *>(ptr) - RZ_LARGE_ALLOC_ALIGNMENT);
+}
+
+static void
+accountAllocation(uint64_t size)
+{
+  uint64_t inUse = g_inUse += size;
+  uint64_t peak  = g_peak;
+
+  ++g_allocations;
+
+  while (inUse > peak && !g_peak.compare_exchange_weak(peak, inUse));
+}
+
+bool
+RZ::largeAllocHugePages()
+{
+  if (g_useHugePages < 0) {
+    const char *env = getenv("RZ_HUGE_PAGES");
+    g_useHugePages = env != nullptr && atoi(env) != 0;
+  }
+
+  return g_useHugePages != 0;
+}
+
+void
+RZ::setLargeAllocHugePages(bool enabled)
+{
+  g_useHugePages = enabled;
+}
+
+static void *
+mapBuffer(size_t size)
+{
+  size_t length, total, head, tail;
+  uint8_t *map, *start;
+  LargeAllocHeader *header;
+
+  length = size + RZ_LARGE_ALLOC_ALIGNMENT;
+  length = (length + RZ_HUGE_PAGE_SIZE - 1) & ~size_t(RZ_HUGE_PAGE_SIZE - 1);
+  total  = length + RZ_HUGE_PAGE_SIZE;
+
+  map = static_cast<uint8_t *>(
+    mmap(
+      nullptr,
+      total,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0));
+
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  // Trim the mapping so that it starts at a huge page boundary
+  start = reinterpret_cast<uint8_t *>(
+    (reinterpret_cast<uintptr_t>(map) + RZ_HUGE_PAGE_SIZE - 1)
+    & ~uintptr_t(RZ_HUGE_PAGE_SIZE - 1));
+  head  = start - map;
+  tail  = total - head - length;
+
+  if (head > 0)
+    munmap(map, head);
+  if (tail > 0)
+    munmap(start + length, tail);
+
+  header         = reinterpret_cast<LargeAllocHeader *>(start);
+  header->magic  = RZ_LARGE_ALLOC_MAGIC_MAPPED;
+  header->huge   = 0;
+  header->size   = size;
+  header->length = length;
+
+#ifdef MADV_HUGEPAGE
+  if (largeAllocHugePages() && madvise(start, length, MADV_HUGEPAGE) == 0) {
+    header->huge = 1;
+    g_hugePages += length;
+  }
+#endif // MADV_HUGEPAGE
+
+  g_mapped += length;
+
+  return start + RZ_LARGE_ALLOC_ALIGNMENT;
+}
+
+void *
+RZ::allocLargeBuffer(size_t size, bool zero)
+{
+  LargeAllocHeader *header;
+  void *mem = nullptr;
+
+  if (size >= RZ_LARGE_ALLOC_THRESHOLD) {
+    // Fresh mappings are already zero, and left untouched
+    mem = mapBuffer(size);
+    if (mem == nullptr)
+      throw std::bad_alloc();
+  } else {
+    if (posix_memalign(&mem, RZ_LARGE_ALLOC_ALIGNMENT, size + RZ_LARGE_ALLOC_ALIGNMENT) != 0)
+      throw std::bad_alloc();
+
+    header         = static_cast<LargeAllocHeader *>(mem);
+    header->magic  = RZ_LARGE_ALLOC_MAGIC_HEAP;
+    header->huge   = 0;
+    header->size   = size;
+    header->length = 0;
+
+    mem = static_cast<uint8_t *>(mem) + RZ_LARGE_ALLOC_ALIGNMENT;
+
+    if (zero)
+      memset(mem, 0, size);
+  }
+
+  accountAllocation(size);
+
+  return mem;
+}
+
+void
+RZ::freeLargeBuffer(void *ptr)
+{
+  LargeAllocHeader *header;
+
+  if (ptr == nullptr)
+    return;
+
+  header = headerOf(ptr);
+
+  ++g_releases;
+  g_inUse -= header->size;
+
+  if (header->magic == RZ_LARGE_ALLOC_MAGIC_MAPPED) {
+    g_mapped -= header->length;
+    if (header->huge)
+      g_hugePages -= header->length;
+
+    munmap(header, header->length);
+  } else if (header->magic == RZ_LARGE_ALLOC_MAGIC_HEAP) {
+    free(header);
+  } else {
+    RZError("freeLargeBuffer(): %p was not allocated by allocLargeBuffer()\n", ptr);
+    abort();
+  }
+}
+
+void
+RZ::zeroLargeBuffer(void *ptr, size_t size)
+{
+  LargeAllocHeader *header;
+  uint8_t *start, *end, *pageStart, *pageEnd;
+  size_t pageSize;
+
+  if (ptr == nullptr || size == 0)
+    return;
+
+  header = headerOf(ptr);
+
+  if (header->magic != RZ_LARGE_ALLOC_MAGIC_MAPPED) {
+    memset(ptr, 0, size);
+    return;
+  }
+
+  // Whole pages are dropped (and read back as zeroes), the rest is cleared
+  pageSize  = RZ_HUGE_PAGE_SIZE;
+  start     = static_cast<uint8_t *>(ptr);
+  end       = start + size;
+  pageStart = reinterpret_cast<uint8_t *>(
+    (reinterpret_cast<uintptr_t>(start) + pageSize - 1) & ~uintptr_t(pageSize - 1));
+  pageEnd   = reinterpret_cast<uint8_t *>(
+    reinterpret_cast<uintptr_t>(end) & ~uintptr_t(pageSize - 1));
+
+  if (pageStart >= pageEnd
+      || madvise(pageStart, pageEnd - pageStart, MADV_DONTNEED) != 0) {
+    memset(ptr, 0, size);
+    return;
+  }
+
+  memset(start, 0, pageStart - start);
+  memset(pageEnd, 0, end - pageEnd);
+}
+
+LargeAllocStats
+RZ::largeAllocStats()
+{
+  LargeAllocStats stats;
+
+  stats.allocations = g_allocations;
+  stats.releases    = g_releases;
+  stats.inUse       = g_inUse;
+  stats.peak        = g_peak;
+  stats.mapped      = g_mapped;
+  stats.hugePages   = g_hugePages;
+
+  return stats;
+}
+
+void
+RZ::resetLargeAllocPeak()
+{
+  g_peak = g_inUse.load();
+}
@@ -72,6 +72,10 @@ StdErrLogger::logFunction(
       case LOG_INFO:
         fprintf(stderr, "RayZaler info: ");
         break;
+
+      case LOG_DEBUG:
+        fprintf(stderr, "RayZaler debug: ");
+        break;
     }
   }
 
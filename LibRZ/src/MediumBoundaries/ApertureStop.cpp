@@ -46,3 +46,13 @@ ApertureStopBoundary::setRadius(Real R)
 {
   surfaceShape<CircularFlatSurface>()->setRadius(R);
 }
+
+bool
+ApertureStopBoundary::paraxial(ParaxialBoundary &p) const
+{
+  p.type     = ParaxialFlat;
+  p.aperture = surfaceShape<CircularFlatSurface>()->radius();
+  p.stop     = true;
+
+  return true;
+}
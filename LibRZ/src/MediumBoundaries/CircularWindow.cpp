@@ -45,3 +45,16 @@ CircularWindowBoundary::setRefractiveIndex(Real in, Real out)
 {
   emInterface<DielectricEMInterface>()->setRefractiveIndex(in, out);
 }
+
+bool
+CircularWindowBoundary::paraxial(ParaxialBoundary &p) const
+{
+  auto em   = emInterface<DielectricEMInterface>();
+
+  p.type     = ParaxialRefractive;
+  p.nPlus    = em->refractiveIndexIn();
+  p.nMinus   = em->refractiveIndexOut();
+  p.aperture = surfaceShape<CircularFlatSurface>()->radius();
+
+  return true;
+}
@@ -73,3 +73,24 @@ ConicLensBoundary::setConvex(bool convex)
     surfaceShape<ConicSurface>()->setConvex(convex);
   }
 }
+
+bool
+ConicLensBoundary::paraxial(ParaxialBoundary &p) const
+{
+  auto em    = emInterface<DielectricEMInterface>();
+  auto shape = surfaceShape<ConicSurface>();
+  Real Rc    = shape->curvatureRadius();
+  Real sigma = shape->convex() ? 1 : -1;
+
+  if (!std::isinf(Rc) && !isZero(Rc)) {
+    p.curvature = -sigma / Rc;
+    p.vertex    = sigma * shape->depth();
+  }
+
+  p.aperture = shape->radius();
+  p.type     = ParaxialRefractive;
+  p.nPlus    = em->refractiveIndexIn();
+  p.nMinus   = em->refractiveIndexOut();
+
+  return true;
+}
@@ -73,3 +73,21 @@ ConicMirrorBoundary::setConvex(bool convex)
     surfaceShape<ConicSurface>()->setConvex(convex);
   }
 }
+
+bool
+ConicMirrorBoundary::paraxial(ParaxialBoundary &p) const
+{
+  auto shape = surfaceShape<ConicSurface>();
+  Real Rc    = shape->curvatureRadius();
+  Real sigma = shape->convex() ? 1 : -1;
+
+  if (!std::isinf(Rc) && !isZero(Rc)) {
+    p.curvature = -sigma / Rc;
+    p.vertex    = sigma * shape->depth();
+  }
+
+  p.aperture = shape->radius();
+  p.type     = ParaxialReflective;
+
+  return true;
+}
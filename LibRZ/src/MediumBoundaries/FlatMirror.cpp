@@ -45,3 +45,14 @@ FlatMirrorBoundary::setEccentricity(Real ecc)
 {
   surfaceShape<CircularFlatSurface>()->setEccentricity(ecc);
 }
+
+bool
+FlatMirrorBoundary::paraxial(ParaxialBoundary &p) const
+{
+  auto shape = surfaceShape<CircularFlatSurface>();
+
+  p.type     = ParaxialReflective;
+  p.aperture = shape->radius() * fmin(shape->a(), shape->b());
+
+  return true;
+}
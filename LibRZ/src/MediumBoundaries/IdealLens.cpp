@@ -45,3 +45,13 @@ IdealLensBoundary::setFocalLength(Real fLen)
 {
   emInterface<ParaxialEMInterface>()->setFocalLength(fLen);
 }
+
+bool
+IdealLensBoundary::paraxial(ParaxialBoundary &p) const
+{
+  p.type        = ParaxialThinLens;
+  p.focalLength = emInterface<ParaxialEMInterface>()->focalLength();
+  p.aperture    = surfaceShape<CircularFlatSurface>()->radius();
+
+  return true;
+}
@@ -31,3 +31,11 @@ InfiniteMirrorBoundary::name() const
 {
   return "InfiniteMirrorBoundary";
 }
+
+bool
+InfiniteMirrorBoundary::paraxial(ParaxialBoundary &p) const
+{
+  p.type = ParaxialReflective;
+
+  return true;
+}
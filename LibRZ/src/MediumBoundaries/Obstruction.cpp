@@ -65,3 +65,12 @@ ObstructionBoundary::setObstructionMap(
     rows,
     stride);
 }
+
+bool
+ObstructionBoundary::paraxial(ParaxialBoundary &p) const
+{
+  // The obstruction only blocks the center of the beam
+  p.type = ParaxialFlat;
+
+  return true;
+}
@@ -25,3 +25,11 @@ PassThroughBoundary::name() const
 {
   return "PassThroughBoundary";
 }
+
+bool
+PassThroughBoundary::paraxial(ParaxialBoundary &p) const
+{
+  p.type = ParaxialFlat;
+
+  return true;
+}
@@ -51,3 +51,15 @@ RectangularStopBoundary::setHeight(Real height)
 {
   surfaceShape<RectangularFlatSurface>()->setHeight(height);
 }
+
+bool
+RectangularStopBoundary::paraxial(ParaxialBoundary &p) const
+{
+  auto shape = surfaceShape<RectangularFlatSurface>();
+
+  p.type     = ParaxialFlat;
+  p.aperture = .5 * fmin(shape->width(), shape->height());
+  p.stop     = true;
+
+  return true;
+}
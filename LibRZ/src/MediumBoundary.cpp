@@ -34,6 +34,12 @@ MediumBoundary::~MediumBoundary()
     delete m_emInterface;
 }
 
+bool
+MediumBoundary::paraxial(ParaxialBoundary &) const
+{
+  return false;
+}
+
 void
 MediumBoundary::cast(RayBeamSlice const &slice) const
 {
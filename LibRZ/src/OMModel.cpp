@@ -30,6 +30,7 @@
 #include <Samplers/Point.h>
 #include <Samplers/Map.h>
 #include <Simulation.h>
+#include <set>
 
 #define TRACE_PROGRESS_INTERVAL_MS 250
 
@@ -52,6 +53,8 @@ BeamProperties::debug() const
   RZInfo("Diameter: %g\n", diameter);
   RZInfo("Spatial shape: %d\n", shape);
   RZInfo("Angular shape: %d\n", objectShape);
+  if (aimed)
+    RZInfo("Aimed at: (%g, %g), radius %g (weight %g)\n", aimX, aimY, aimRadius, aimWeight);
 }
 
 //
@@ -250,6 +253,73 @@ OMModel::autoRegisterElement(Element *newElement)
   return retElement;
 }
 
+template <class T, class U>
+static void
+eraseNamesOf(std::map<std::string, T *> &names, std::set<U *> const &set)
+{
+  for (auto it = names.begin(); it != names.end();) {
+    if (set.find(it->second) != set.end())
+      it = names.erase(it);
+    else
+      ++it;
+  }
+}
+
+void
+OMModel::unregisterElement(Element *element)
+{
+  std::set<Element *> owned = {element};
+
+  // Detectors of composite elements are registered by their aliases
+  if (element->nestedModel() != nullptr)
+    for (auto p : element->nestedModel()->allElements())
+      owned.insert(p);
+
+  for (auto portName : element->ports())
+    m_nameToFrame.erase(element->name() + "." + portName);
+
+  m_elements.remove(element);
+  eraseNamesOf(m_nameToElement,        owned);
+  eraseNamesOf(m_nameToOpticalElement, owned);
+  eraseNamesOf(m_nameToDetector,       owned);
+}
+
+void
+OMModel::unregisterFrame(ReferenceFrame *frame)
+{
+  m_frames.remove(frame);
+  eraseNamesOf(m_nameToFrame, std::set<ReferenceFrame *>{frame});
+}
+
+void
+OMModel::clearOpticalPaths()
+{
+  m_nameToPath.clear();
+  m_paths.clear();
+}
+
+void
+OMModel::saveIndex(OMModelIndex &index) const
+{
+  index.frames               = m_frames;
+  index.nameToFrame          = m_nameToFrame;
+  index.elements             = m_elements;
+  index.nameToElement        = m_nameToElement;
+  index.nameToOpticalElement = m_nameToOpticalElement;
+  index.nameToDetector       = m_nameToDetector;
+}
+
+void
+OMModel::restoreIndex(OMModelIndex const &index)
+{
+  m_frames               = index.frames;
+  m_nameToFrame          = index.nameToFrame;
+  m_elements             = index.elements;
+  m_nameToElement        = index.nameToElement;
+  m_nameToOpticalElement = index.nameToOpticalElement;
+  m_nameToDetector       = index.nameToDetector;
+}
+
 // Lookup methods
 ReferenceFrame *
 OMModel::lookupReferenceFrame(std::string const &name) const
@@ -1011,7 +1081,10 @@ OMModel::~OMModel()
 }
 
 void
-OMModel::addBeam(RayList &dest, BeamProperties const &properties)
+OMModel::addBeam(
+  RayList &dest,
+  BeamProperties const &properties,
+  std::vector<Real> *pupil)
 {
   const ReferenceFrame *frame = nullptr;
   Sampler *raySampler = nullptr;
@@ -1103,13 +1176,61 @@ OMModel::addBeam(RayList &dest, BeamProperties const &properties)
   raySampler->setRadius(.5 * properties.diameter);
   raySampler->setRandom(properties.random);
 
-  if (!raySampler->sample(properties.numRays)) {
-    delete raySampler;
-    throw std::runtime_error("Failed to acquire points: beam sampler failed");
+  std::vector<Vec3> coords;
+  Vec3 coord;
+
+  if (properties.aimed && properties.shape == Circular) {
+    // Sample the aim circle and keep what falls inside the beam. The
+    // expected fraction that does is the overlap over the aim circle area,
+    // i.e. aimWeight * R^2 / aimRadius^2.
+    Real R2    = .25 * properties.diameter * properties.diameter;
+    Real ratio = properties.aimRadius * properties.aimRadius
+      / (std::max(properties.aimWeight, 1e-6) * R2);
+    unsigned int count = std::max(
+      static_cast<unsigned int>(ceil(properties.numRays * ratio)),
+      properties.numRays);
+    unsigned int tries = 0;
+
+    raySampler->setRadius(properties.aimRadius);
+
+    do {
+      if (!raySampler->sample(count)) {
+        delete raySampler;
+        throw std::runtime_error("Failed to acquire points: beam sampler failed");
+      }
+
+      while (raySampler->get(coord)) {
+        coord.x += properties.aimX;
+        coord.y += properties.aimY;
+        if (coord.x * coord.x + coord.y * coord.y <= R2)
+          coords.push_back(coord);
+      }
+    } while (properties.random
+      && coords.size() < properties.numRays
+      && ++tries < 16);
+
+    // Uniform grids are kept whole, as the other shapes
+    if (properties.random && coords.size() > properties.numRays)
+      coords.resize(properties.numRays);
+  } else {
+    if (!raySampler->sample(properties.numRays)) {
+      delete raySampler;
+      throw std::runtime_error("Failed to acquire points: beam sampler failed");
+    }
+
+    while (raySampler->get(coord))
+      coords.push_back(coord);
   }
 
+  auto pushRay = [&] (Ray const &ray, Vec3 const &coord) {
+    dest.push_back(ray);
+    if (pupil != nullptr) {
+      pupil->push_back(coord.x);
+      pupil->push_back(coord.y);
+    }
+  };
+
   Ray ray;
-  Vec3 coord;
   ray.id         = properties.id;
   ray.chief      = !properties.vignetting;
   ray.wavelength = properties.wavelength;
@@ -1121,18 +1242,20 @@ OMModel::addBeam(RayList &dest, BeamProperties const &properties)
     // Collimated beams are easy to calculate. Just throw some rays parallel
     // to the chief ray.
 
-    dirSampler.setNumRays(properties.numRays);
+    dirSampler.setNumRays(properties.aimed ? coords.size() : properties.numRays);
     dirSampler.setPath(properties.objectPath);
     dirSampler.setShape(properties.objectShape);
     dirSampler.setDiameter(properties.angularDiameter);
     dirSampler.setRandom(properties.random);
     
-    while (raySampler->get(coord) && dirSampler.get(direction)) {
+    for (auto &coord : coords) {
+      if (!dirSampler.get(direction))
+        break;
       if (properties.objectShape != PointLike)
         origin = center - direction * properties.length;
       ray.origin    = system * coord + origin;
       ray.direction = direction;
-      dest.push_back(ray);
+      pushRay(ray, coord);
     }
   } else {
     // Focused beams are a bit trickier, as they have this focus term
@@ -1149,18 +1272,18 @@ OMModel::addBeam(RayList &dest, BeamProperties const &properties)
       direction = mainDirection;
       Vec3 focus     = origin + direction * (properties.length + properties.focusZ);
 
-      while (raySampler->get(coord)) {
+      for (auto &coord : coords) {
         ray.origin    = system * coord + origin;
         ray.direction = (focus - ray.origin).normalized();
-        dest.push_back(ray);
+        pushRay(ray, coord);
       }
     } else {
       Vec3 focus     = origin - direction * (properties.length + properties.focusZ);
 
-      while (raySampler->get(coord)) {
+      for (auto &coord : coords) {
         ray.origin    = system * coord + origin;
         ray.direction = (ray.origin - focus).normalized();
-        dest.push_back(ray);
+        pushRay(ray, coord);
       }
     }
   }
@@ -25,41 +25,23 @@ RZ_DESCRIBE_ABSTRACT_ELEMENT(OpticalElement, "Generic optical element")
   hiddenProperty("optical", true, "The element is optical");
 }
 
-std::vector<Real> &
+// Hits of every beam, grouped by beam id
+RayHitColumn const &
 OpticalSurface::locations() const
 {
-  size_t expectedSize = 3 * hits.size();
-
-  if (locationArray.size() != expectedSize) {
-    locationArray.resize(expectedSize);
-
-    for (size_t i = 0; i < hits.size(); ++i)
-      hits[i].origin.copyToArray(locationArray.data() + 3 * i);
-  }
-
-  return locationArray;
+  return hits.origins();
 }
 
-std::vector<Real> &
+RayHitColumn const &
 OpticalSurface::directions() const
 {
-  size_t expectedSize = 3 * hits.size();
-
-  if (directionArray.size() != expectedSize) {
-    directionArray.resize(expectedSize);
-
-    for (size_t i = 0; i < hits.size(); ++i)
-      hits[i].direction.copyToArray(directionArray.data() + 3 * i);
-  }
-
-  return directionArray;
+  return hits.directions();
 }
 
 void
 OpticalSurface::clearCache() const
 {
-  locationArray.clear();
-  directionArray.clear();
+  idArray.clear();
 }
 
 void
@@ -85,7 +67,7 @@ OpticalPath::push(const OpticalSurface *surface)
   m_nameToSurface[surface->name] = surface;
 }
 
-const std::vector<Real> &
+RayHitColumn const &
 OpticalPath::hits(std::string const &name) const
 {
   // You just have to love C++
@@ -102,7 +84,7 @@ OpticalPath::hits(std::string const &name) const
   return surface->locations();
 }
 
-const std::vector<Real> &
+RayHitColumn const &
 OpticalPath::directions(std::string const &name) const
 {
   // You just have to love C++
@@ -204,13 +186,13 @@ OpticalElement::pushOpticalSurface(
   m_internalPath.push(lookupSurface(name));
 }
 
-const std::vector<Real> &
+RayHitColumn const &
 OpticalElement::hits(std::string const &name) const
 {
   return opticalPath().hits(name);
 }
 
-const std::vector<Real> &
+RayHitColumn const &
 OpticalElement::directions(std::string const &name) const
 {
   return opticalPath().directions(name);
@@ -0,0 +1,305 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <Optimizer.h>
+#include <TopLevelModel.h>
+#include <Recipe.h>
+#include <Logger.h>
+#include <cmath>
+#include <algorithm>
+
+using namespace RZ;
+
+//
+// Solves A x = b in place (the solution is left in b) by Gaussian
+// elimination with partial pivoting. A is row-major, n x n.
+//
+static bool
+solveLinearSystem(std::vector<Real> &A, std::vector<Real> &b, size_t n)
+{
+  for (size_t k = 0; k < n; ++k) {
+    size_t pivot = k;
+
+    for (size_t i = k + 1; i < n; ++i)
+      if (fabs(A[i * n + k]) > fabs(A[pivot * n + k]))
+        pivot = i;
+
+    if (A[pivot * n + k] == 0)
+      return false;
+
+    if (pivot != k) {
+      for (size_t j = 0; j < n; ++j)
+        std::swap(A[k * n + j], A[pivot * n + j]);
+      std::swap(b[k], b[pivot]);
+    }
+
+    for (size_t i = k + 1; i < n; ++i) {
+      Real f = A[i * n + k] / A[k * n + k];
+
+      for (size_t j = k; j < n; ++j)
+        A[i * n + j] -= f * A[k * n + j];
+
+      b[i] -= f * b[k];
+    }
+  }
+
+  for (size_t k = n; k-- > 0;) {
+    for (size_t j = k + 1; j < n; ++j)
+      b[k] -= A[k * n + j] * b[j];
+
+    b[k] /= A[k * n + k];
+  }
+
+  return true;
+}
+
+static Real
+meritOf(
+  OptimizerProperties const &props,
+  std::vector<Real> const &metrics,
+  std::vector<Real> *residuals = nullptr)
+{
+  Real merit = 0;
+
+  if (residuals != nullptr)
+    residuals->resize(metrics.size());
+
+  for (size_t i = 0; i < metrics.size(); ++i) {
+    Real r = props.targets[i].weight * (metrics[i] - props.targets[i].target);
+
+    if (residuals != nullptr)
+      (*residuals)[i] = r;
+
+    merit += r * r;
+  }
+
+  return merit;
+}
+
+Optimizer::Optimizer(TopLevelModel *model) : m_analysis(model)
+{
+  m_model = model;
+}
+
+bool
+Optimizer::setVariables(
+  std::vector<std::string> const &names,
+  std::vector<Real> const &values)
+{
+  for (size_t k = 0; k < names.size(); ++k)
+    if (!m_analysis.setVariable(names[k], values[k]))
+      return false;
+
+  return true;
+}
+
+bool
+Optimizer::optimize(
+  TracingProperties const &tracing,
+  OptimizerProperties const &props,
+  OptimizerResult &result)
+{
+  JacobianProperties jProps;
+  JacobianResult jacobian;
+  std::vector<Real> min, max, residuals, trial, trialMetrics;
+  std::vector<Real> A, g, delta;
+  std::vector<size_t> active;
+  Real lambda = props.damping;
+  Real merit;
+  size_t n, m;
+  double start = monotonicSeconds();
+  bool ok = true;
+
+  result = OptimizerResult();
+
+  if (props.variables.empty())
+    for (auto &name : m_model->dofs())
+      result.variables.push_back(name);
+  else
+    result.variables = props.variables;
+
+  if (props.targets.empty())
+    throw std::runtime_error("No optimization targets were given");
+
+  jProps.dofs      = result.variables;
+  jProps.step      = props.step;
+  jProps.steps     = props.steps;
+  jProps.central   = props.central;
+  jProps.processes = props.processes;
+  jProps.seed      = props.seed;
+
+  for (auto &target : props.targets)
+    jProps.metrics.push_back(target.metric);
+
+  n = result.variables.size();
+  m = props.targets.size();
+
+  for (auto &name : result.variables) {
+    auto param = m_analysis.lookupVariable(name);
+
+    if (param == nullptr)
+      throw std::runtime_error("Unknown dof or parameter `" + name + "'");
+
+    result.initial.push_back(param->value);
+
+    if (param->description != nullptr) {
+      min.push_back(param->description->min);
+      max.push_back(param->description->max);
+    } else {
+      min.push_back(-INFINITY);
+      max.push_back(+INFINITY);
+    }
+  }
+
+  result.values = result.initial;
+
+  while (ok) {
+    // Jacobian and residuals at the current variables
+    if (!m_analysis.jacobian(tracing, jProps, jacobian)) {
+      ok = false;
+      break;
+    }
+
+    result.traces += jacobian.traces;
+    result.metrics = jacobian.metrics;
+    result.nominal = jacobian.nominal;
+
+    merit = meritOf(props, jacobian.nominal, &residuals);
+    if (result.merits.empty())
+      result.merits.push_back(merit);
+
+    if (merit == 0) {
+      result.converged = true;
+      break;
+    }
+
+    if (props.maxIterations == 0)
+      break;
+
+    // Normal equations of the variables that change the merit, with the
+    // weights folded into the Jacobian
+    active.clear();
+    for (size_t k = 0; k < n; ++k)
+      for (size_t i = 0; i < m; ++i)
+        if (jacobian.at(i, k) * props.targets[i].weight != 0) {
+          active.push_back(k);
+          break;
+        }
+
+    if (active.empty()) {
+      result.converged = true;
+      break;
+    }
+
+    size_t p = active.size();
+    std::vector<Real> JtJ(p * p, 0.), Jtr(p, 0.);
+
+    for (size_t a = 0; a < p; ++a) {
+      for (size_t b = 0; b < p; ++b)
+        for (size_t i = 0; i < m; ++i)
+          JtJ[a * p + b] +=
+              props.targets[i].weight * jacobian.at(i, active[a])
+            * props.targets[i].weight * jacobian.at(i, active[b]);
+
+      for (size_t i = 0; i < m; ++i)
+        Jtr[a] += props.targets[i].weight * jacobian.at(i, active[a])
+          * residuals[i];
+    }
+
+    // Damping loop. Rejected steps increase lambda, towards shorter
+    // steps along the gradient.
+    bool accepted = false;
+    Real trialMerit = merit;
+
+    for (unsigned int tries = 0; tries <= props.maxRejections; ++tries) {
+      A = JtJ;
+      delta = Jtr;
+
+      for (size_t a = 0; a < p; ++a)
+        A[a * p + a] += lambda * JtJ[a * p + a];
+
+      for (auto &d : delta)
+        d = -d;
+
+      if (!solveLinearSystem(A, delta, p)) {
+        lambda *= 10;
+        continue;
+      }
+
+      trial = result.values;
+      for (size_t a = 0; a < p; ++a) {
+        size_t k = active[a];
+        trial[k] = std::clamp(result.values[k] + delta[a], min[k], max[k]);
+      }
+
+      if (trial == result.values)
+        break;
+
+      if (!setVariables(result.variables, trial)) {
+        ok = false;
+        break;
+      }
+
+      if (!m_analysis.metrics(tracing, jProps, trialMetrics)) {
+        ok = false;
+        break;
+      }
+
+      ++result.traces;
+      trialMerit = meritOf(props, trialMetrics);
+
+      if (trialMerit < merit) {
+        accepted = true;
+        lambda   = std::max(lambda / 10, 1e-12);
+        break;
+      }
+
+      lambda *= 10;
+    }
+
+    if (!ok)
+      break;
+
+    if (!accepted) {
+      // No step improves the merit: we are at a minimum
+      ok = setVariables(result.variables, result.values);
+      result.converged = true;
+      break;
+    }
+
+    ++result.iterations;
+    result.values  = trial;
+    result.nominal = trialMetrics;
+    result.merits.push_back(trialMerit);
+
+    if (merit - trialMerit <= props.tolerance * merit) {
+      result.converged = true;
+      break;
+    }
+
+    if (result.iterations >= props.maxIterations)
+      break;
+  }
+
+  if (!ok)
+    setVariables(result.variables, result.values);
+
+  result.elapsed = monotonicSeconds() - start;
+
+  return ok;
+}
@@ -0,0 +1,327 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <Paraxial.h>
+#include <OpticalElement.h>
+#include <ReferenceFrame.h>
+#include <Logger.h>
+#include <cmath>
+
+using namespace RZ;
+
+ParaxialModel::ParaxialModel(const OpticalPath *path)
+{
+  if (path == nullptr)
+    throw std::runtime_error("Paraxial models need an optical path");
+
+  m_path = path;
+}
+
+void
+ParaxialModel::setDirection(Vec3 const &direction)
+{
+  m_direction     = direction.normalized();
+  m_haveDirection = true;
+}
+
+void
+ParaxialModel::setObjectDistance(Real distance)
+{
+  m_objectDistance = distance;
+}
+
+void
+ParaxialModel::setFieldAngle(Real angle)
+{
+  m_fieldAngle = angle;
+}
+
+void
+ParaxialModel::setObjectHeight(Real height)
+{
+  m_objectHeight = height;
+}
+
+//
+// Unfolds the path. Every surface is reduced to its distance to the
+// previous vertex and its power, given the direction and the index of the
+// medium in which light arrives to it.
+//
+bool
+ParaxialModel::updateSurfaces()
+{
+  size_t count = m_path->m_sequence.size();
+  size_t i = 0;
+  Vec3 dir;
+  Real n = 1;
+
+  if (count == 0) {
+    RZError("Cannot build a paraxial model of an empty path\n");
+    return false;
+  }
+
+  m_surfaces.resize(count);
+  m_boundaries.resize(count);
+  m_vertices.resize(count);
+
+  for (auto surface : m_path->m_sequence) {
+    auto &b = m_boundaries[i];
+
+    b = ParaxialBoundary();
+    if (surface->boundary == nullptr || !surface->boundary->paraxial(b)) {
+      RZError(
+        "Surface `%s' has no paraxial model\n",
+        surface->name.c_str());
+      return false;
+    }
+
+    m_surfaces[i].surface = surface;
+    m_vertices[i] = surface->frame->getCenter() + b.vertex * surface->frame->eZ();
+    ++i;
+  }
+
+  if (m_haveDirection)
+    dir = m_direction;
+  else
+    dir = -m_surfaces[0].surface->frame->eZ();
+
+  // Light arrives from whatever side of the first surface it comes from
+  if (m_boundaries[0].type == ParaxialRefractive)
+    n = dir * m_surfaces[0].surface->frame->eZ() < 0
+      ? m_boundaries[0].nPlus
+      : m_boundaries[0].nMinus;
+
+  for (i = 0; i < count; ++i) {
+    auto &b  = m_boundaries[i];
+    auto &s  = m_surfaces[i];
+    Vec3 eZ  = s.surface->frame->eZ();
+    bool up  = dir * eZ > 0; // Travelling towards +Z
+    Real c   = up ? b.curvature : -b.curvature;
+
+    s.type     = b.type;
+    s.distance = i == 0 ? 0 : (m_vertices[i] - m_vertices[i - 1]) * dir;
+    s.aperture = b.aperture;
+    s.stop     = b.stop;
+    s.nIn      = n;
+    s.nOut     = n;
+
+    switch (b.type) {
+      case ParaxialRefractive:
+        s.nIn   = up ? b.nMinus : b.nPlus;
+        s.nOut  = up ? b.nPlus  : b.nMinus;
+        s.power = (s.nOut - s.nIn) * c;
+        break;
+
+      case ParaxialReflective:
+        s.power = -2 * n * c;
+        dir     = dir - 2 * (dir * eZ) * eZ;
+        break;
+
+      case ParaxialThinLens:
+        s.power = std::isinf(b.focalLength) ? 0 : n / b.focalLength;
+        break;
+
+      default:
+        s.power = 0;
+    }
+
+    n = s.nOut;
+  }
+
+  return true;
+}
+
+//
+// Takes a ray at the first vertex (before the first surface) through the
+// first `count' surfaces.
+//
+void
+ParaxialModel::propagate(Real &y, Real &nu, size_t count) const
+{
+  for (size_t i = 0; i < count; ++i) {
+    auto &s = m_surfaces[i];
+
+    if (i > 0)
+      y += s.distance / s.nIn * nu;
+    nu -= y * s.power;
+  }
+}
+
+void
+ParaxialModel::traceRays()
+{
+  auto &p     = m_properties;
+  size_t count = m_surfaces.size();
+  Real n0     = m_surfaces.front().nIn;
+  Real nK     = m_surfaces.back().nOut;
+  bool finite = !std::isinf(m_objectDistance);
+  Real yA, nuA, yB, nuB, yM, nuM, yC, nuC, k, t, field;
+  Real y, nu, yc, nuc, best = INFINITY;
+  int stop = -1;
+  size_t ref;
+
+  p = ParaxialProperties();
+
+  // System matrix
+  yA  = 1;
+  nuA = 0;
+  yB  = 0;
+  nuB = 1;
+  propagate(yA, nuA, count);
+  propagate(yB, nuB, count);
+
+  p.A = yA;
+  p.B = yB;
+  p.C = nuA;
+  p.D = nuB;
+
+  if (!isZero(p.C)) {
+    p.power               = -p.C;
+    p.efl                 = 1 / p.power;
+    p.backFocalPoint      = -nK * p.A / p.C;
+    p.backPrincipalPlane  = nK * (1 - p.A) / p.C;
+    p.frontFocalPoint     = n0 * p.D / p.C;
+    p.frontPrincipalPlane = n0 * (p.D - 1) / p.C;
+  }
+
+  // Unit marginal ray: parallel to the axis or from the axial object point
+  yM  = finite ? m_objectDistance / n0 : 1;
+  nuM = finite ? 1 : 0;
+
+  // The stop is either flagged as such, or the surface that limits the
+  // marginal ray the most.
+  y  = yM;
+  nu = nuM;
+  for (size_t i = 0; i < count; ++i) {
+    auto &s = m_surfaces[i];
+
+    if (i > 0)
+      y += s.distance / s.nIn * nu;
+    nu -= y * s.power;
+
+    if (s.stop) {
+      stop = i;
+      k    = isZero(y) ? 1 : s.aperture / fabs(y);
+      break;
+    }
+
+    if (!std::isinf(s.aperture) && !isZero(y) && s.aperture / fabs(y) < best) {
+      best = s.aperture / fabs(y);
+      stop = i;
+    }
+  }
+
+  if (stop < 0)
+    k = 1;
+  else if (!m_surfaces[stop].stop)
+    k = best;
+
+  yM  *= k;
+  nuM *= k;
+
+  // Unit chief ray, through the center of the stop (or of the first
+  // surface). It is a combination of a ray with unit field (A) and one
+  // that crosses the first vertex at unit height (B).
+  ref = stop < 0 ? 0 : stop;
+
+  yA  = finite ? 1 : 0;
+  nuA = finite ? 0 : n0;
+  yB  = finite ? m_objectDistance / n0 : 1;
+  nuB = finite ? 1 : 0;
+
+  y   = yA;
+  nu  = nuA;
+  yc  = yB;
+  nuc = nuB;
+  propagate(y, nu, ref + 1);
+  propagate(yc, nuc, ref + 1);
+
+  t   = isZero(yc) ? 0 : -y / yc;
+  yC  = yA  + t * yB;
+  nuC = nuA + t * nuB;
+
+  // Pupils are where the chief ray crosses the axis in each space
+  p.stopIndex = stop;
+
+  if (stop >= 0) {
+    Real yMK = yM, nuMK = nuM, yCK = yC, nuCK = nuC;
+
+    propagate(yMK, nuMK, count);
+    propagate(yCK, nuCK, count);
+
+    if (!isZero(nuC)) {
+      p.entrancePupilPosition = -yC * n0 / nuC;
+      p.entrancePupilRadius   = fabs(yM + p.entrancePupilPosition / n0 * nuM);
+    } else {
+      p.entrancePupilRadius   = isZero(nuM) ? fabs(yM) : INFINITY;
+    }
+
+    if (!isZero(nuCK)) {
+      p.exitPupilPosition = -yCK * nK / nuCK;
+      p.exitPupilRadius   = fabs(yMK + p.exitPupilPosition / nK * nuMK);
+    } else {
+      p.exitPupilRadius   = isZero(nuMK) ? fabs(yMK) : INFINITY;
+    }
+  }
+
+  // Actual chief ray
+  field = finite ? m_objectHeight : tan(m_fieldAngle);
+  yC   *= field;
+  nuC  *= field;
+
+  y   = yM;
+  nu  = nuM;
+  yc  = yC;
+  nuc = nuC;
+  for (size_t i = 0; i < count; ++i) {
+    auto &s = m_surfaces[i];
+
+    if (i > 0) {
+      y  += s.distance / s.nIn * nu;
+      yc += s.distance / s.nIn * nuc;
+    }
+
+    nu  -= y  * s.power;
+    nuc -= yc * s.power;
+
+    s.marginalHeight = y;
+    s.marginalAngle  = nu / s.nOut;
+    s.chiefHeight    = yc;
+    s.chiefAngle     = nuc / s.nOut;
+  }
+
+  if (!isZero(nu)) {
+    p.imagePosition = -y * nK / nu;
+    p.imageHeight   = yc + p.imagePosition / nK * nuc;
+    p.fNumber       = 1 / (2 * fabs(nu));
+
+    if (finite)
+      p.magnification = nuM / nu;
+  }
+}
+
+bool
+ParaxialModel::evaluate()
+{
+  if (!updateSurfaces())
+    return false;
+
+  traceRays();
+
+  return true;
+}
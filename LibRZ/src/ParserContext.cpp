@@ -564,6 +564,24 @@ ParserContext::addImportOnce(std::string const &path)
   }
 }
 
+void
+ParserContext::addDependency(std::string const &path)
+{
+  if (m_parentContext == nullptr) {
+    if (std::find(m_dependencies.begin(), m_dependencies.end(), path)
+      == m_dependencies.end())
+      m_dependencies.push_back(path);
+  } else {
+    m_parentContext->addDependency(path);
+  }
+}
+
+std::list<std::string> const &
+ParserContext::dependencies() const
+{
+  return m_dependencies;
+}
+
 bool
 ParserContext::alreadyImported(std::string const &path) const
 {
@@ -612,6 +630,7 @@ ParserContext::import(std::string const &path)
 
   try {
     addImportOnce(absPath);
+    addDependency(absPath);
     nestedContext->parse();
   } catch (std::runtime_error const &e) {
     error = "In file import:\n" + std::string(e.what());
@@ -22,12 +22,25 @@
 
 using namespace RZ;
 
+//
+// register(name, argc, func, pure = False, vectorized = False)
+//
+// Pure functions are memoized on their arguments. Vectorized functions
+// receive one numpy array per argument and must return an array (or
+// anything that broadcasts to it) with one result per row.
+//
 static PyObject *
-registerFunction(PyObject *self, PyObject *args)
+registerFunction(PyObject *self, PyObject *args, PyObject *kwargs)
 {
+  static const char *keywords[] = {
+    "name", "argc", "func", "pure", "vectorized", nullptr
+  };
+
   PyObject *pFunc      = nullptr;
+  PyObject *pNumpy     = nullptr;
   ScriptFunction newFunc;
   unsigned int argno = 0;
+  int pure = 0, vectorized = 0;
   Script *script = ScriptLoader::instance()->getCurrentScript();
   const char *name;
 
@@ -38,7 +51,16 @@ registerFunction(PyObject *self, PyObject *args)
     goto done;
   }
   
-  if (!PyArg_ParseTuple(args, "sIO", &name, &argno, &pFunc))
+  if (!PyArg_ParseTupleAndKeywords(
+    args,
+    kwargs,
+    "sIO|pp",
+    const_cast<char **>(keywords),
+    &name,
+    &argno,
+    &pFunc,
+    &pure,
+    &vectorized))
     goto done;
   
   if (!PyCallable_Check(pFunc)) {
@@ -46,9 +68,18 @@ registerFunction(PyObject *self, PyObject *args)
     goto done;
   }
 
-  newFunc.argc  = argno;
-  newFunc.name  = name;
-  newFunc.pFunc = pFunc;
+  if (vectorized) {
+    pNumpy = PyImport_ImportModule("numpy");
+    if (pNumpy == nullptr)
+      goto done;
+    Py_DECREF(pNumpy);
+  }
+
+  newFunc.argc       = argno;
+  newFunc.name       = name;
+  newFunc.pFunc      = pFunc;
+  newFunc.pure       = pure != 0;
+  newFunc.vectorized = vectorized != 0;
 
   if (script->registerFunction(newFunc)) {
     Py_INCREF(pFunc);
@@ -68,8 +99,9 @@ done:
 static PyMethodDef g_methods[] = {
   {
     "register",
-    registerFunction,
-    METH_VARARGS,
+    reinterpret_cast<PyCFunction>(
+      reinterpret_cast<void (*)()>(registerFunction)),
+    METH_VARARGS | METH_KEYWORDS,
    "Register a Python function as a RayZaler expression function"
   },
   {nullptr, nullptr, 0, nullptr}
@@ -17,6 +17,8 @@
 //
 
 #include <cassert>
+#include <cstdlib>
+#include <algorithm>
 
 #include "RayBeam.h"
 #include <ReferenceFrame.h>
@@ -89,21 +91,33 @@ using namespace RZ;
 //      Trivial. Used by getRays(). All non-pruned rays.
 //
 
+//
+// Beam buffers are aligned to cache lines and are not zero-filled: their
+// contents are always written by the producer of the beam (toBeam(),
+// copyTo(), toRelative()...) before being read. Only the first `keep'
+// elements of an existing buffer are preserved. Large beams are mapped
+// on huge pages and placed by the tracing thread (see LargeAllocator.h).
+//
 template<typename T>
 static T *
-allocBuffer(uint64_t count, uint64_t prev = 0, T *existing = nullptr)
+allocBuffer(uint64_t count, uint64_t keep = 0, T *existing = nullptr)
 {
+  void *mem = nullptr;
+  size_t size;
+
   if (count == 0)
-    return nullptr;
-  
-  T *result = static_cast<T *>(realloc(existing, count * sizeof(T)));
+    return existing;
 
-  if (result == nullptr)
-    throw std::bad_alloc();
+  size = (count * sizeof(T) + RZ_BEAM_ALIGNMENT - 1) & ~(RZ_BEAM_ALIGNMENT - 1);
+  mem  = allocLargeBuffer(size, false);
 
-  memset(result + prev, 0, (count - prev) * sizeof(T));
-  
-  return result;
+  if (existing != nullptr) {
+    if (keep > 0)
+      memcpy(mem, existing, keep * sizeof(T));
+    freeLargeBuffer(existing);
+  }
+
+  return static_cast<T *>(mem);
 }
 
 template<typename T>
@@ -111,7 +125,7 @@ void
 freeBuffer(T *&buf)
 {
   if (buf != nullptr) {
-    free(buf);
+    freeLargeBuffer(buf);
     buf = nullptr;
   }
 }
@@ -200,12 +214,6 @@ RayBeam::debug() const
   putchar(10);
 }
 
-template static Real *allocBuffer<Real>(uint64_t, uint64_t, Real *);
-template static void  freeBuffer<Real>(Real *&);
-
-template static uint64_t *allocBuffer<uint64_t>(uint64_t, uint64_t, uint64_t *);
-template static void freeBuffer<uint64_t>(uint64_t *&);
-
 void
 RayBeam::clearMask()
 {
@@ -213,6 +221,40 @@ RayBeam::clearMask()
   memset(prevMask, 0, ((count + 63) >> 6) << 3);
 }
 
+//
+// Bit counting over the masks. Bits past the last ray are ignored.
+//
+uint64_t
+RayBeam::countAlive() const
+{
+  uint64_t words = count >> 6;
+  uint64_t alive = 0;
+
+  for (uint64_t i = 0; i < words; ++i)
+    alive += __builtin_popcountll(~mask[i]);
+
+  if (count & 63)
+    alive += __builtin_popcountll(~mask[words] & ((1ull << (count & 63)) - 1));
+
+  return alive;
+}
+
+uint64_t
+RayBeam::countIntercepted() const
+{
+  uint64_t words = count >> 6;
+  uint64_t intercepted = 0;
+
+  for (uint64_t i = 0; i < words; ++i)
+    intercepted += __builtin_popcountll(intMask[i] & ~mask[i]);
+
+  if (count & 63)
+    intercepted += __builtin_popcountll(
+      intMask[words] & ~mask[words] & ((1ull << (count & 63)) - 1));
+
+  return intercepted;
+}
+
 template <class C> void
 RayBeam::extractRays(
       C &dest,
@@ -266,6 +308,7 @@ RayBeam::extractRays(
         ray.chief        = beam->isChief(i);
         ray.wavelength   = beam->wavelengths[i];
         ray.refNdx       = beam->refNdx[i];
+        ray.amplitude    = std::abs(beam->amplitude[i]);
         ray.cumOptLength = beam->cumOptLengths[i];
         ray.length       = beam->lengths[i];
         ray.direction    = Vec3(beam->directions + 3 * i);
@@ -344,19 +387,204 @@ RayBeam::computeInterceptStatistics(OpticalSurface *surface)
     [] (OpticalSurface *surf, RayBeamSlice const &slice) {
       slice.beam->addInterceptMetrics(surf, slice);
 
-      if (surf->parent->recordHits()) {
-        extractRays(
-          surf->hits,
-          slice,
-            DestinationPOV
-          | BeamIsSurfaceRelative
-          | RayShouldBeSurfaceRelative
-          | ExtractIntercepted,
-          surf);
-      }
+      if (surf->parent->recordHits())
+        recordHits(surf->hits, slice);
     });
 }
 
+//
+// Same rays that extractRays() would extract with DestinationPOV and
+// ExtractIntercepted, but written straight to the columns of the hits.
+//
+void
+RayBeam::recordHits(RayHitBuffer &hits, RayBeamSlice const &slice)
+{
+  auto beam = slice.beam;
+
+  for (auto i = slice.start; i < slice.end; ++i)
+    if (beam->hasRay(i)
+      && beam->isIntercepted(i)
+      && beam->lengths[i] > RZ_BEAM_MINIMUM_WAVELENGTH)
+      hits.push(
+        beam->ids[i],
+        beam->destinations + 3 * i,
+        beam->directions + 3 * i,
+        beam->cumOptLengths[i]);
+}
+
+//////////////////////////////// Hit recording /////////////////////////////////
+template <class Column> static void
+permuteColumn(Column &column, std::vector<size_t> const &order, size_t width)
+{
+  Column sorted(column.size());
+
+  for (size_t i = 0; i < order.size(); ++i)
+    std::copy_n(
+      column.data() + width * order[i],
+      width,
+      sorted.data() + width * i);
+
+  column.swap(sorted);
+}
+
+// Groups point to the columns of their own buffer, they are never copied
+RayHitBuffer::RayHitBuffer(RayHitBuffer const &other) :
+  m_ids(other.m_ids),
+  m_origins(other.m_origins),
+  m_directions(other.m_directions),
+  m_cumOptLengths(other.m_cumOptLengths),
+  m_sorted(other.m_sorted)
+{
+}
+
+RayHitBuffer &
+RayHitBuffer::operator=(RayHitBuffer const &other)
+{
+  m_ids           = other.m_ids;
+  m_origins       = other.m_origins;
+  m_directions    = other.m_directions;
+  m_cumOptLengths = other.m_cumOptLengths;
+  m_sorted        = other.m_sorted;
+
+  m_groups.clear();
+
+  return *this;
+}
+
+//
+// Hits arrive sorted when every beam is traced after the other, and the
+// sort is skipped. Otherwise, the same stable permutation is applied to
+// every column.
+//
+void
+RayHitBuffer::index()
+{
+  size_t count = m_ids.size();
+
+  if (!m_sorted) {
+    std::vector<size_t> order(count);
+
+    for (size_t i = 0; i < count; ++i)
+      order[i] = i;
+
+    std::stable_sort(
+      order.begin(),
+      order.end(),
+      [this] (size_t a, size_t b) {
+        return m_ids[a] < m_ids[b];
+      });
+
+    permuteColumn(m_ids, order, 1);
+    permuteColumn(m_origins, order, 3);
+    permuteColumn(m_directions, order, 3);
+    permuteColumn(m_cumOptLengths, order, 1);
+
+    m_sorted = true;
+  }
+
+  if (!m_groups.empty() || count == 0)
+    return;
+
+  size_t start = 0;
+
+  for (size_t i = 1; i <= count; ++i) {
+    if (i == count || m_ids[i] != m_ids[start]) {
+      RayHitGroup group;
+
+      group.id            = m_ids[start];
+      group.offset        = start;
+      group.count         = i - start;
+      group.origins       = m_origins.data() + 3 * start;
+      group.directions    = m_directions.data() + 3 * start;
+      group.cumOptLengths = m_cumOptLengths.data() + start;
+
+      m_groups.push_back(group);
+      start = i;
+    }
+  }
+}
+
+size_t
+RayHitBuffer::size() const
+{
+  return m_ids.size();
+}
+
+bool
+RayHitBuffer::empty() const
+{
+  return m_ids.empty();
+}
+
+void
+RayHitBuffer::clear()
+{
+  m_ids.clear();
+  m_origins.clear();
+  m_directions.clear();
+  m_cumOptLengths.clear();
+  m_groups.clear();
+  m_sorted = true;
+}
+
+void
+RayHitBuffer::swap(RayHitBuffer &other)
+{
+  m_ids.swap(other.m_ids);
+  m_origins.swap(other.m_origins);
+  m_directions.swap(other.m_directions);
+  m_cumOptLengths.swap(other.m_cumOptLengths);
+  m_groups.swap(other.m_groups);
+  std::swap(m_sorted, other.m_sorted);
+}
+
+std::vector<RayHitGroup> const &
+RayHitBuffer::groups()
+{
+  index();
+  return m_groups;
+}
+
+const RayHitGroup *
+RayHitBuffer::find(uint32_t id)
+{
+  index();
+
+  auto it = std::lower_bound(
+    m_groups.begin(),
+    m_groups.end(),
+    id,
+    [] (RayHitGroup const &group, uint32_t id) {
+      return group.id < id;
+    });
+
+  if (it == m_groups.end() || it->id != id)
+    return nullptr;
+
+  return &*it;
+}
+
+RayHitColumn const &
+RayHitBuffer::origins()
+{
+  index();
+  return m_origins;
+}
+
+RayHitColumn const &
+RayHitBuffer::directions()
+{
+  index();
+  return m_directions;
+}
+
+RayHitColumn const &
+RayHitBuffer::cumOptLengths()
+{
+  index();
+  return m_cumOptLengths;
+}
+
 void
 RayBeam::copyTo(RayBeam *dest) const
 {
@@ -386,6 +614,56 @@ RayBeam::copyTo(RayBeam *dest) const
     memcpy(dest->surfaces,    surfaces,      count * sizeof(OpticalSurface *));
 }
 
+static inline void
+copyMaskWords(
+  uint64_t *dest,
+  const uint64_t *src,
+  uint64_t count)
+{
+  uint64_t words = count >> 6;
+
+  memcpy(dest, src, words * sizeof(uint64_t));
+
+  if (count & 63) {
+    uint64_t bits = (1ull << (count & 63)) - 1;
+    dest[words] = (dest[words] & ~bits) | (src[words] & bits);
+  }
+}
+
+void
+RayBeam::copyTo(
+  RayBeam *dest,
+  uint64_t start,
+  uint64_t destStart,
+  uint64_t count) const
+{
+  assert((start & 63) == 0);
+  assert((destStart & 63) == 0);
+  assert(start + count <= this->count);
+  assert(destStart + count <= dest->count);
+
+  copyMaskWords(dest->mask      + (destStart >> 6), mask      + (start >> 6), count);
+  copyMaskWords(dest->prevMask  + (destStart >> 6), prevMask  + (start >> 6), count);
+  copyMaskWords(dest->chiefMask + (destStart >> 6), chiefMask + (start >> 6), count);
+  copyMaskWords(dest->intMask   + (destStart >> 6), intMask   + (start >> 6), count);
+
+  memcpy(dest->lengths       + destStart, lengths       + start, count * sizeof(Real));
+  memcpy(dest->cumOptLengths + destStart, cumOptLengths + start, count * sizeof(Real));
+  memcpy(dest->wavelengths   + destStart, wavelengths   + start, count * sizeof(Real));
+  memcpy(dest->refNdx        + destStart, refNdx        + start, count * sizeof(Real));
+
+  memcpy(dest->ids           + destStart, ids           + start, count * sizeof(uint32_t));
+  memcpy(dest->amplitude     + destStart, amplitude     + start, count * sizeof(Complex));
+
+  memcpy(dest->origins      + 3 * destStart, origins      + 3 * start, 3 * count * sizeof(Real));
+  memcpy(dest->destinations + 3 * destStart, destinations + 3 * start, 3 * count * sizeof(Real));
+  memcpy(dest->directions   + 3 * destStart, directions   + 3 * start, 3 * count * sizeof(Real));
+  memcpy(dest->normals      + 3 * destStart, normals      + 3 * start, 3 * count * sizeof(Real));
+
+  if (nonSeq && dest->nonSeq)
+    memcpy(dest->surfaces + destStart, surfaces + start, count * sizeof(OpticalSurface *));
+}
+
 void
 RayBeam::toRelative(RayBeam *dest, const ReferenceFrame *plane) const
 {
@@ -505,35 +783,212 @@ RayBeam::updateFromVisible(
   return newTransferred;
 }
 
+//
+// Two passes: the first one assigns a bin to every alive ray and counts
+// the rays of every bin, the second one places the ray indices at the
+// prefix sums of the counts.
+//
 void
-RayBeam::allocate(uint64_t count)
-{
-  size_t maskLen = (count + 63) >> 6;
-  size_t prev = this->count;
-  size_t prevMaskLen = (this->count + 63) >> 6;
-
-  if (prev == 0) {
-    this->origins       = allocBuffer<Real>(3 * count);
-    this->directions    = allocBuffer<Real>(3 * count);
-    this->normals       = allocBuffer<Real>(3 * count);
-    this->destinations  = allocBuffer<Real>(3 * count);
-    this->amplitude     = allocBuffer<Complex>(count);
-    this->lengths       = allocBuffer<Real>(count);
-    this->cumOptLengths = allocBuffer<Real>(count);
-    this->refNdx        = allocBuffer<Real>(count);
-    this->wavelengths   = allocBuffer<Real>(count);
-    this->ids           = allocBuffer<uint32_t>(count);
-    this->mask          = allocBuffer<uint64_t>(maskLen);
-    this->prevMask      = allocBuffer<uint64_t>(maskLen);
-    this->intMask       = allocBuffer<uint64_t>(maskLen);
-    this->chiefMask     = allocBuffer<uint64_t>(maskLen);
-    
-    if (this->nonSeq) {
-      this->surfaces     = allocBuffer<OpticalSurface *>(count);
+RayBeam::bin(RayBeamBins &bins) const
+{
+  OpticalSurface *last = nullptr;
+  uint32_t lastBin = 0;
+
+  assert(nonSeq);
+
+  bins.surfaces.clear();
+  bins.offsets.clear();
+  bins.binIndex.clear();
+  bins.binOf.resize(count);
+  bins.runs = 0;
+
+  for (uint64_t i = 0; i < count; ++i) {
+    auto surface = hasRay(i) ? surfaces[i] : nullptr;
+
+    if (surface != last) {
+      last = surface;
+
+      if (surface != nullptr) {
+        auto it = bins.binIndex.find(surface);
+
+        if (it == bins.binIndex.end()) {
+          lastBin = static_cast<uint32_t>(bins.surfaces.size());
+          bins.binIndex[surface] = lastBin;
+          bins.surfaces.push_back(surface);
+          bins.offsets.push_back(0);
+        } else {
+          lastBin = it->second;
+        }
+
+        ++bins.runs;
+      }
     }
-    
-    this->allocation    = count;
-  } else if (count >= this->count) {
+
+    if (surface != nullptr) {
+      bins.binOf[i] = lastBin;
+      ++bins.offsets[lastBin];
+    } else {
+      bins.binOf[i] = UINT32_MAX;
+    }
+  }
+
+  // Counts to bin starts
+  uint64_t total = 0;
+  for (auto &offset : bins.offsets) {
+    uint64_t size = offset;
+    offset = total;
+    total += size;
+  }
+
+  bins.offsets.push_back(total);
+  bins.indices.resize(total);
+
+  // Place the rays, advancing the starts. They are restored afterwards.
+  for (uint64_t i = 0; i < count; ++i)
+    if (bins.binOf[i] != UINT32_MAX)
+      bins.indices[bins.offsets[bins.binOf[i]]++] = i;
+
+  for (size_t b = bins.bins(); b > 0; --b)
+    bins.offsets[b] = bins.offsets[b - 1];
+
+  bins.offsets[0] = 0;
+}
+
+//
+// Gathers and scatters go field by field, so that every loop only streams
+// through two arrays.
+//
+template <class T, int N> static inline void
+gatherField(T *dest, const T *src, const uint64_t *indices, uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    for (int j = 0; j < N; ++j)
+      dest[N * i + j] = src[N * indices[i] + j];
+}
+
+template <class T, int N> static inline void
+scatterField(T *dest, const T *src, const uint64_t *indices, uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    for (int j = 0; j < N; ++j)
+      dest[N * indices[i] + j] = src[N * i + j];
+}
+
+static inline bool
+maskBit(const uint64_t *mask, uint64_t i)
+{
+  return (mask[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void
+gatherMask(uint64_t *dest, const uint64_t *src, const uint64_t *indices, uint64_t n)
+{
+  for (uint64_t w = 0; w < (n + 63) >> 6; ++w) {
+    uint64_t word = 0;
+    uint64_t end  = std::min<uint64_t>(64, n - (w << 6));
+
+    for (uint64_t b = 0; b < end; ++b)
+      word |= static_cast<uint64_t>(maskBit(src, indices[(w << 6) + b])) << b;
+
+    if (end < 64)
+      word |= dest[w] & ~((1ull << end) - 1);
+
+    dest[w] = word;
+  }
+}
+
+static inline void
+scatterMask(uint64_t *dest, const uint64_t *src, const uint64_t *indices, uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i) {
+    uint64_t j   = indices[i];
+    uint64_t bit = 1ull << (j & 63);
+
+    dest[j >> 6] = (dest[j >> 6] & ~bit)
+      | (static_cast<uint64_t>(maskBit(src, i)) << (j & 63));
+  }
+}
+
+void
+RayBeam::gatherTransmit(
+  const RayBeam *src,
+  const uint64_t *indices,
+  uint64_t n)
+{
+  assert(n <= count);
+
+  gatherField<Real, 3>(directions,   src->directions,   indices, n);
+  gatherField<Real, 3>(normals,      src->normals,      indices, n);
+  gatherField<Real, 3>(destinations, src->destinations, indices, n);
+
+  gatherField<Complex, 1>(amplitude, src->amplitude,   indices, n);
+  gatherField<Real, 1>(refNdx,       src->refNdx,      indices, n);
+  gatherField<Real, 1>(wavelengths,  src->wavelengths, indices, n);
+  gatherField<uint32_t, 1>(ids,      src->ids,         indices, n);
+
+  gatherMask(mask,      src->mask,      indices, n);
+  gatherMask(chiefMask, src->chiefMask, indices, n);
+  gatherMask(intMask,   src->intMask,   indices, n);
+}
+
+void
+RayBeam::scatterTransmit(
+  const RayBeam *src,
+  const uint64_t *indices,
+  uint64_t n)
+{
+  assert(n <= src->count);
+
+  scatterField<Real, 3>(directions, src->directions, indices, n);
+  scatterField<Complex, 1>(amplitude, src->amplitude, indices, n);
+  scatterField<Real, 1>(refNdx,     src->refNdx,     indices, n);
+
+  scatterMask(mask, src->mask, indices, n);
+}
+
+//
+// Clear the mask bits of the rays in [start, end)
+//
+static inline void
+clearMaskBits(uint64_t *mask, uint64_t start, uint64_t end)
+{
+  while (start < end && (start & 63)) {
+    mask[start >> 6] &= ~(1ull << (start & 63));
+    ++start;
+  }
+
+  if (start < end) {
+    uint64_t words = (end - start) >> 6;
+
+    memset(mask + (start >> 6), 0, words * sizeof(uint64_t));
+    start += words << 6;
+
+    while (start < end) {
+      mask[start >> 6] &= ~(1ull << (start & 63));
+      ++start;
+    }
+  }
+}
+
+//
+// Buffers only grow. Shrinking a beam just updates its logical count, so
+// the same beam can be reused for a different number of rays without
+// touching the allocator. If `keep' is set, the contents of the rays that
+// were already in the beam are preserved. Rays that are new to the beam
+// (or all of them, if `keep' is unset) start alive, unintercepted and
+// non-chief, with no target surface. The rest of their fields are left
+// uninitialized.
+//
+void
+RayBeam::allocate(uint64_t count, bool keep)
+{
+  size_t   maskLen = (count + 63) >> 6;
+  uint64_t first   = keep ? std::min(this->count, count) : 0;
+
+  if (count > this->allocation) {
+    uint64_t prev        = keep ? this->count : 0;
+    uint64_t prevMaskLen = (prev + 63) >> 6;
+
     this->origins       = allocBuffer<Real>(3 * count, 3 * prev, this->origins);
     this->directions    = allocBuffer<Real>(3 * count, 3 * prev, this->directions);
     this->normals       = allocBuffer<Real>(3 * count, 3 * prev, this->normals);
@@ -549,22 +1004,24 @@ RayBeam::allocate(uint64_t count)
     this->intMask       = allocBuffer<uint64_t>(maskLen, prevMaskLen, this->intMask);
     this->chiefMask     = allocBuffer<uint64_t>(maskLen, prevMaskLen, this->chiefMask);
 
-    if (this->nonSeq) {
-      this->surfaces     = allocBuffer<OpticalSurface *>(count, prev, this->surfaces);
-    }
+    if (this->nonSeq)
+      this->surfaces    = allocBuffer<OpticalSurface *>(count, prev, this->surfaces);
 
     this->allocation    = count;
-  } else {
-    throw std::runtime_error("Cannot shrink ray list");
   }
 
-  memset(
-    this->chiefMask + prevMaskLen,
-    0,
-    (maskLen - prevMaskLen) * sizeof(uint64_t));
-  
-  for (int64_t i = this->count; i < count; ++i)
-    this->refNdx[i] = 1.;
+  if (count > first) {
+    clearMaskBits(this->mask,      first, count);
+    clearMaskBits(this->prevMask,  first, count);
+    clearMaskBits(this->intMask,   first, count);
+    clearMaskBits(this->chiefMask, first, count);
+
+    if (this->nonSeq)
+      memset(
+        this->surfaces + first,
+        0,
+        (count - first) * sizeof(OpticalSurface *));
+  }
 
   this->count = count;
 }
@@ -577,10 +1034,13 @@ RayBeam::walk(
       const std::function <bool (OpticalSurface *, RayBeam const *, uint64_t)>& include)
 {
   auto slice = RayBeamSlice(this); // Start at 0
+  auto target = surface;
 
+  // Note `surface' tracks the current slice. Sequential beams must keep
+  // casting to `target' after a run of excluded rays.
   for (uint64_t i = 0; i < count; ++i) {
-    auto currSurf = hasRay(i) && include(surface, this, i) 
-    ? (nonSeq ? surfaces[i] : surface) 
+    auto currSurf = hasRay(i) && include(target, this, i) 
+    ? (nonSeq ? surfaces[i] : target) 
     : nullptr;
 
     if (surface != currSurf) {
@@ -651,12 +1111,15 @@ RayBeam::deallocate()
   freeBuffer(cumOptLengths);
   freeBuffer(amplitude);
   freeBuffer(ids);
+  freeBuffer(refNdx);
   freeBuffer(mask);
   freeBuffer(prevMask);
+  freeBuffer(intMask);
   freeBuffer(chiefMask);
   freeBuffer(surfaces);
 
-  this->count = 0;
+  this->count      = 0;
+  this->allocation = 0;
 }
 
 RayBeam::RayBeam(uint64_t count, bool nonSeq)
@@ -0,0 +1,147 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <RayBeamPool.h>
+
+using namespace RZ;
+
+static uint64_t
+beamBytes(RayBeam const *beam)
+{
+  uint64_t perRay =
+      16 * sizeof(Real)   // Origins, directions, normals, destinations, etc
+    + sizeof(Complex)     // Amplitude
+    + sizeof(uint32_t);   // Ids
+
+  if (beam->nonSeq)
+    perRay += sizeof(OpticalSurface *);
+
+  return beam->allocation * perRay
+    + 4 * ((beam->allocation + 63) >> 6) * sizeof(uint64_t);
+}
+
+RayBeamPool::RayBeamPool()
+{
+}
+
+RayBeamPool::~RayBeamPool()
+{
+  clear();
+}
+
+RayBeam *
+RayBeamPool::acquire(uint64_t count, bool nonSeq)
+{
+  auto &free = m_free[nonSeq ? 1 : 0];
+  RayBeam *beam = nullptr;
+
+  if (free.empty()) {
+    ++m_misses;
+    return new RayBeam(count, nonSeq);
+  }
+
+  // Smallest beam that fits. If none, grow the largest one.
+  auto it = free.lower_bound(count);
+  if (it != free.end())
+    ++m_hits;
+  else {
+    ++m_misses;
+    it = std::prev(free.end());
+  }
+
+  beam = it->second;
+  free.erase(it);
+
+  beam->allocate(count, false);
+
+  if (nonSeq)
+    beam->pruneAll();
+
+  return beam;
+}
+
+void
+RayBeamPool::release(RayBeam *beam)
+{
+  if (beam == nullptr)
+    return;
+
+  auto &free = m_free[beam->nonSeq ? 1 : 0];
+
+  free.insert(std::make_pair(beam->allocation, beam));
+
+  // Too many cached beams, drop the smallest
+  while (free.size() > m_maxCached) {
+    delete free.begin()->second;
+    free.erase(free.begin());
+  }
+}
+
+void
+RayBeamPool::clear()
+{
+  for (auto &free : m_free) {
+    for (auto &p : free)
+      delete p.second;
+
+    free.clear();
+  }
+}
+
+void
+RayBeamPool::setMaxCached(size_t max)
+{
+  m_maxCached = max;
+
+  for (auto &free : m_free) {
+    while (free.size() > m_maxCached) {
+      delete free.begin()->second;
+      free.erase(free.begin());
+    }
+  }
+}
+
+size_t
+RayBeamPool::cached() const
+{
+  return m_free[0].size() + m_free[1].size();
+}
+
+uint64_t
+RayBeamPool::cachedBytes() const
+{
+  uint64_t bytes = 0;
+
+  for (auto &free : m_free)
+    for (auto &p : free)
+      bytes += beamBytes(p.second);
+
+  return bytes;
+}
+
+uint64_t
+RayBeamPool::hits() const
+{
+  return m_hits;
+}
+
+uint64_t
+RayBeamPool::misses() const
+{
+  return m_misses;
+}
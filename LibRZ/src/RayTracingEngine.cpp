@@ -66,7 +66,7 @@ RayTracingEngine::RayTracingEngine()
 RayTracingEngine::~RayTracingEngine()
 {
   if (m_beam != nullptr)
-    delete m_beam;
+    releaseBeam(m_beam);
 }
 
 void
@@ -75,7 +75,7 @@ RayTracingEngine::clear()
   m_rays.clear();
 
   if (m_beam != nullptr) {
-    delete m_beam;
+    releaseBeam(m_beam);
     m_beam = nullptr;
   }
   
@@ -118,12 +118,58 @@ RayTracingEngine::pushRays(RayList const &rays)
 {
   m_rays.insert(m_rays.end(), rays.begin(), rays.end());
   toBeam();
+}
+
+void
+RayTracingEngine::pushRays(RayArrays const &arrays)
+{
+  uint64_t count = arrays.count;
+
+  m_rays.clear();
+
+  if (m_beam == nullptr)
+    m_beam = m_beamPool.acquire(count);
+  else
+    m_beam->allocate(count, false);
+
+  m_beam->clearMask();
+  memset(m_beam->chiefMask, 0, ((count + 63) >> 6) << 3);
+
+  if (arrays.wavelengths != nullptr) {
+    for (uint64_t i = 0; i < count; ++i)
+      if (arrays.wavelengths[i] <= RZ_BEAM_MINIMUM_WAVELENGTH)
+        throw std::runtime_error(
+          string_printf(
+            "Wavelength is too short (minimum: %g pm)",
+            RZ_BEAM_MINIMUM_WAVELENGTH * 1e12));
+
+    memcpy(m_beam->wavelengths, arrays.wavelengths, count * sizeof(Real));
+  } else {
+    for (uint64_t i = 0; i < count; ++i)
+      m_beam->wavelengths[i] = RZ_WAVELENGTH;
+  }
+
+  if (arrays.ids != nullptr)
+    memcpy(m_beam->ids, arrays.ids, count * sizeof(uint32_t));
+  else
+    memset(m_beam->ids, 0, count * sizeof(uint32_t));
+
+  memcpy(m_beam->origins,      arrays.origins,    3 * count * sizeof(Real));
+  memcpy(m_beam->destinations, arrays.origins,    3 * count * sizeof(Real));
+  memcpy(m_beam->directions,   arrays.directions, 3 * count * sizeof(Real));
 
   // Assume rays come from a flat surface
-  memcpy(m_beam->normals, m_beam->directions, 3 * m_beam->count * sizeof(Real));
+  memcpy(m_beam->normals,      arrays.directions, 3 * count * sizeof(Real));
 
-  for (auto i = 0; i < m_beam->count; ++i)
-    m_beam->amplitude[i] = 1;
+  for (uint64_t i = 0; i < count; ++i) {
+    m_beam->lengths[i]       = 0;
+    m_beam->cumOptLengths[i] = 0;
+    m_beam->refNdx[i]        = 1;
+    m_beam->amplitude[i]     = 1;
+  }
+
+  m_raysDirty = true;
+  m_beamDirty = false;
 }
 
 void
@@ -131,10 +177,11 @@ RayTracingEngine::toBeam()
 {
   uint64_t i = 0;
 
+  // Every field is overwritten below, there is no need to keep them
   if (m_beam == nullptr)
     m_beam = this->makeBeam();
   else
-    m_beam->allocate(m_rays.size());
+    m_beam->allocate(m_rays.size(), false);
 
   m_beam->clearMask();
 
@@ -154,6 +201,7 @@ RayTracingEngine::toBeam()
     m_beam->ids[i]           = p->id;
     m_beam->wavelengths[i]   = p->wavelength;
     m_beam->refNdx[i]        = p->refNdx;
+    m_beam->amplitude[i]     = p->amplitude;
 
     if (p->chief)
       m_beam->setChiefRay(i);
@@ -161,6 +209,9 @@ RayTracingEngine::toBeam()
     ++i;
   }
 
+  // Assume rays come from a flat surface
+  memcpy(m_beam->normals, m_beam->directions, 3 * m_beam->count * sizeof(Real));
+
   m_beamDirty = false;
 }
 
@@ -169,7 +220,8 @@ RayTracingEngine::toRays(bool keepPruned)
 {
   m_rays.clear();
 
-  m_beam->extractRays(m_rays, OriginPOV | ExtractAll);
+  if (m_beam != nullptr)
+    m_beam->extractRays(m_rays, OriginPOV | ExtractAll);
 
   m_raysDirty = false;
 }
@@ -177,37 +229,85 @@ RayTracingEngine::toRays(bool keepPruned)
 void
 RayTracingEngine::castTo(const OpticalSurface *surface, RayBeam *beam)
 {
+  bool     profiling = m_profiler.enabled();
+  uint64_t t0 = 0, raysIn = 0;
+
   if (beam == nullptr) {
     beam = ensureMainBeam();
+
+    if (profiling) {
+      t0     = m_profiler.now();
+      raysIn = beam->countAlive();
+    }
+
     beam->toRelative(surface->frame);
+
+    if (profiling)
+      m_profiler.record(surface, PHASE_TO_RELATIVE, t0, raysIn, raysIn);
+
     m_raysDirty = true;
   }
 
   // Update progress
   stageProgress(PROGRESS_TYPE_TRACE, m_stageName, m_currStage, m_numStages);
 
+  if (profiling) {
+    t0     = m_profiler.now();
+    raysIn = beam->countAlive();
+  }
+
   beam->uninterceptAll();
 
   cast(surface, beam);
 
+  if (profiling)
+    m_profiler.record(
+      surface,
+      PHASE_CAST,
+      t0,
+      raysIn,
+      beam->countIntercepted());
+
   m_notificationPendig = false;
 }
 
 void
 RayTracingEngine::transmitThrough(const OpticalSurface *surface)
 {
+  bool     profiling = m_profiler.enabled();
+  uint64_t t0 = 0, raysIn = 0;
+
   assert(m_beam != nullptr);
   assert(m_beam->nonSeq == (surface == nullptr));
   
   stageProgress(PROGRESS_TYPE_TRANSFER, m_stageName, m_currStage, m_numStages);
 
+  if (profiling) {
+    t0     = m_profiler.now();
+    raysIn = m_beam->countAlive();
+  }
+
   transmit(surface, m_beam);
 
+  if (profiling) {
+    m_profiler.record(
+      surface,
+      PHASE_TRANSMIT,
+      t0,
+      raysIn,
+      m_beam->countAlive());
+    t0     = m_profiler.now();
+    raysIn = m_beam->countAlive();
+  }
+
   if (surface != nullptr)
     m_beam->fromRelative(surface->frame);
   else
     m_beam->fromSurfaceRelative();
 
+  if (profiling)
+    m_profiler.record(surface, PHASE_FROM_RELATIVE, t0, raysIn, raysIn);
+
   m_raysDirty = true;
 }
 
@@ -235,19 +335,26 @@ RayTracingEngine::getRays(bool keepPruned)
 RayBeam *
 RayTracingEngine::makeBeam()
 {
-  return new RayBeam(m_rays.size());
+  // The main beam may have been filled directly, without m_rays
+  return m_beamPool.acquire(m_beam != nullptr ? m_beam->count : m_rays.size());
 }
 
 RayBeam *
 RayTracingEngine::makeNSBeam()
 {
-  auto nsBeam = new RayBeam(beam()->count, true);
+  auto nsBeam = m_beamPool.acquire(beam()->count, true);
 
   beam()->copyTo(nsBeam);
 
   return nsBeam;
 }
 
+void
+RayTracingEngine::releaseBeam(RayBeam *beam)
+{
+  m_beamPool.release(beam);
+}
+
 RayBeam *
 RayTracingEngine::ensureMainBeam()
 {
@@ -257,11 +364,23 @@ RayTracingEngine::ensureMainBeam()
   return m_beam;
 }
 
+RayBeam *
+RayTracingEngine::exchangeMainBeam(RayBeam *beam)
+{
+  RayBeam *prev = m_beam;
+
+  m_beam      = beam;
+  m_beamDirty = beam == nullptr;
+  m_raysDirty = true;
+
+  return prev;
+}
+
 void
 RayTracingEngine::setMainBeam(RayBeam *original)
 {
   if (m_beam != nullptr)
-    delete m_beam;
+    releaseBeam(m_beam);
   
   m_beam = original;
 
@@ -0,0 +1,218 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <RayTracingProfiler.h>
+#include <OpticalElement.h>
+#include <Logger.h>
+#include <JSON.h>
+#include <map>
+#include <cerrno>
+
+using namespace RZ;
+
+const char *
+RZ::tracingPhaseToString(RayTracingPhase phase)
+{
+  switch (phase) {
+    case PHASE_TO_RELATIVE:
+      return "toRelative";
+
+    case PHASE_CAST:
+      return "cast";
+
+    case PHASE_TRANSMIT:
+      return "transmit";
+
+    case PHASE_STATISTICS:
+      return "statistics";
+
+    case PHASE_EXTRACTION:
+      return "extraction";
+
+    case PHASE_FROM_RELATIVE:
+      return "fromRelative";
+  }
+
+  return "unknown";
+}
+
+RayTracingProfiler::RayTracingProfiler()
+{
+  reset();
+}
+
+void
+RayTracingProfiler::setEnabled(bool enabled)
+{
+  m_enabled = enabled;
+}
+
+void
+RayTracingProfiler::reset()
+{
+  m_events.clear();
+  clock_gettime(CLOCK_MONOTONIC, &m_origin);
+}
+
+void
+RayTracingProfiler::record(
+  const OpticalSurface *surface,
+  RayTracingPhase phase,
+  uint64_t start,
+  uint64_t raysIn,
+  uint64_t raysOut)
+{
+  RayTracingEvent event;
+
+  if (surface == nullptr)
+    event.stage = "(non-sequential)";
+  else if (surface->parent != nullptr)
+    event.stage = surface->parent->name() + "." + surface->name;
+  else
+    event.stage = surface->name;
+
+  event.phase    = phase;
+  event.start    = start;
+  event.duration = now() - start;
+  event.raysIn   = raysIn;
+  event.raysOut  = raysOut;
+
+  m_events.push_back(std::move(event));
+}
+
+std::vector<RayTracingEvent> const &
+RayTracingProfiler::events() const
+{
+  return m_events;
+}
+
+std::list<RayTracingStageSummary>
+RayTracingProfiler::summary() const
+{
+  std::list<RayTracingStageSummary> result;
+  std::map<std::pair<std::string, int>, RayTracingStageSummary *> index;
+
+  // Keep the order in which stages were first seen
+  for (auto &ev : m_events) {
+    auto key = std::make_pair(ev.stage, static_cast<int>(ev.phase));
+    auto it  = index.find(key);
+    RayTracingStageSummary *summ;
+
+    if (it == index.end()) {
+      result.push_back(RayTracingStageSummary());
+      summ        = &result.back();
+      summ->stage = ev.stage;
+      summ->phase = ev.phase;
+      index[key]  = summ;
+    } else {
+      summ = it->second;
+    }
+
+    ++summ->calls;
+    summ->duration += ev.duration;
+    summ->raysIn   += ev.raysIn;
+    summ->raysOut  += ev.raysOut;
+  }
+
+  return result;
+}
+
+uint64_t
+RayTracingProfiler::totalTime(RayTracingPhase phase) const
+{
+  uint64_t total = 0;
+
+  for (auto &ev : m_events)
+    if (ev.phase == phase)
+      total += ev.duration;
+
+  return total;
+}
+
+uint64_t
+RayTracingProfiler::totalTime() const
+{
+  uint64_t total = 0;
+
+  for (auto &ev : m_events)
+    total += ev.duration;
+
+  return total;
+}
+
+//
+// Chrome trace-event format (complete events, "ph": "X"). Timestamps
+// and durations are expressed in microseconds. The result can be loaded
+// in chrome://tracing or Perfetto.
+//
+std::string
+RayTracingProfiler::chromeTrace() const
+{
+  std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  bool first = true;
+
+  for (auto &ev : m_events) {
+    if (!first)
+      json += ",";
+
+    json += string_printf(
+      "\n  {\"name\": \"%s (%s)\", \"cat\": \"%s\", \"ph\": \"X\", "
+      "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1, "
+      "\"args\": {\"stage\": \"%s\", \"raysIn\": %lu, \"raysOut\": %lu, "
+      "\"raysPerSecond\": %.6e}}",
+      jsonEscape(ev.stage).c_str(),
+      tracingPhaseToString(ev.phase),
+      tracingPhaseToString(ev.phase),
+      1e-3 * ev.start,
+      1e-3 * ev.duration,
+      jsonEscape(ev.stage).c_str(),
+      ev.raysIn,
+      ev.raysOut,
+      ev.raysPerSecond());
+
+    first = false;
+  }
+
+  json += "\n]}\n";
+
+  return json;
+}
+
+bool
+RayTracingProfiler::saveChromeTrace(std::string const &path) const
+{
+  FILE *fp = fopen(path.c_str(), "w");
+  std::string json;
+  bool ok = false;
+
+  if (fp == nullptr) {
+    RZError("Cannot save trace to `%s': %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  json = chromeTrace();
+
+  if (fwrite(json.c_str(), json.size(), 1, fp) < 1)
+    RZError("Failed to write trace to `%s': %s\n", path.c_str(), strerror(errno));
+  else
+    ok = true;
+
+  fclose(fp);
+
+  return ok;
+}
@@ -220,6 +220,19 @@ Recipe::makeCustomElement(std::string const &name)
   return recipe;
 }
 
+void
+Recipe::swapCustomElements(Recipe *other)
+{
+  std::swap(m_subRecipes, other->m_subRecipes);
+  std::swap(m_customElements, other->m_customElements);
+
+  for (auto p : m_subRecipes)
+    p->m_parent = this;
+
+  for (auto p : other->m_subRecipes)
+    p->m_parent = other;
+}
+
 void
 Recipe::pushSearchPath(std::string const &path)
 {
@@ -479,6 +492,24 @@ Recipe::paths() const
   return m_pathSteps;
 }
 
+std::vector<ParamAssignExpression *> const &
+Recipe::elementParameters() const
+{
+  return m_elemParameters;
+}
+
+std::vector<ParamAssignExpression *> const &
+Recipe::frameParameters() const
+{
+  return m_frameParameters;
+}
+
+std::vector<ParamAssignExpression *> const &
+Recipe::variables() const
+{
+  return m_variables;
+}
+
 void
 Recipe::pushRotation(
   std::string const &angle,
@@ -0,0 +1,809 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <RecipeCache.h>
+#include <Helpers.h>
+#include <Logger.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#define RZ_RECIPE_CACHE_MAGIC "RZRC"
+
+using namespace RZ;
+
+RecipeCache *RecipeCache::m_instance = nullptr;
+
+//
+// Entries are stored in native byte order: the cache is not meant to be
+// shared across machines.
+//
+namespace RZ {
+  class RecipeCacheWriter {
+      std::string &m_buf;
+
+    public:
+      RecipeSerializationMode mode;
+
+      RecipeCacheWriter(
+        std::string &buf,
+        RecipeSerializationMode mode = RECIPE_SERIALIZE_ALL) :
+        m_buf(buf), mode(mode) { }
+
+      template<typename T> void
+      put(T value)
+      {
+        m_buf.append(reinterpret_cast<const char *>(&value), sizeof(T));
+      }
+
+      void
+      putString(std::string const &str)
+      {
+        put<uint32_t>(static_cast<uint32_t>(str.size()));
+        m_buf.append(str);
+      }
+
+      void
+      putStringList(std::list<std::string> const &list)
+      {
+        put<uint32_t>(static_cast<uint32_t>(list.size()));
+        for (auto &str : list)
+          putString(str);
+      }
+  };
+
+  class RecipeCacheReader {
+      std::string const &m_buf;
+      size_t             m_ptr = 0;
+
+      void
+      need(size_t size)
+      {
+        if (m_ptr + size > m_buf.size())
+          throw std::runtime_error("Truncated recipe cache entry");
+      }
+
+    public:
+      RecipeCacheReader(std::string const &buf) : m_buf(buf) { }
+
+      template<typename T> T
+      get()
+      {
+        T value;
+
+        need(sizeof(T));
+        memcpy(&value, m_buf.data() + m_ptr, sizeof(T));
+        m_ptr += sizeof(T);
+
+        return value;
+      }
+
+      std::string
+      getString()
+      {
+        uint32_t size = get<uint32_t>();
+        std::string str;
+
+        need(size);
+        str = m_buf.substr(m_ptr, size);
+        m_ptr += size;
+
+        return str;
+      }
+
+      std::list<std::string>
+      getStringList()
+      {
+        uint32_t count = get<uint32_t>();
+        std::list<std::string> list;
+
+        for (uint32_t i = 0; i < count; ++i)
+          list.push_back(getString());
+
+        return list;
+      }
+
+      // Indices are validated against the number of allocated objects
+      template<typename T> T *
+      getRef(std::vector<T *> const &objects)
+      {
+        int32_t index = get<int32_t>();
+
+        if (index < 0)
+          return nullptr;
+
+        if (static_cast<size_t>(index) >= objects.size())
+          throw std::runtime_error("Corrupted recipe cache entry");
+
+        return objects[index];
+      }
+
+      size_t
+      offset() const
+      {
+        return m_ptr;
+      }
+  };
+}
+
+static uint64_t
+hashBytes(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+  // FNV-1a
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static bool
+hashFile(std::string const &path, uint64_t &size, uint64_t &hash)
+{
+  FILE *fp = fopen(path.c_str(), "rb");
+  char buffer[4096];
+  size_t got;
+
+  if (fp == nullptr)
+    return false;
+
+  size = 0;
+  hash = hashBytes(nullptr, 0);
+
+  while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    hash  = hashBytes(buffer, got, hash);
+    size += got;
+  }
+
+  fclose(fp);
+
+  return true;
+}
+
+static std::string
+absolutePath(std::string const &path)
+{
+  char resolved[PATH_MAX];
+
+  if (realpath(path.c_str(), resolved) == nullptr)
+    return path;
+
+  return resolved;
+}
+
+static bool
+makeDirectories(std::string const &path)
+{
+  size_t pos = 0;
+
+  do {
+    pos = path.find('/', pos + 1);
+    std::string partial = path.substr(0, pos);
+
+    if (mkdir(partial.c_str(), 0755) == -1 && errno != EEXIST)
+      return false;
+  } while (pos != std::string::npos);
+
+  return true;
+}
+
+template<typename T> static void
+writeRefs(RecipeCacheWriter &writer, std::list<T *> const &list)
+{
+  writer.put<uint32_t>(static_cast<uint32_t>(list.size()));
+  for (auto p : list)
+    writer.put<int32_t>(p->s_index);
+}
+
+template<typename T> static void
+readRefs(
+  RecipeCacheReader &reader,
+  std::vector<T *> const &objects,
+  std::list<T *> &list)
+{
+  uint32_t count = reader.get<uint32_t>();
+
+  for (uint32_t i = 0; i < count; ++i)
+    list.push_back(reader.getRef(objects));
+}
+
+template<typename T> static void
+writeRefMap(
+  RecipeCacheWriter &writer,
+  std::map<std::string, T *> const &map)
+{
+  writer.put<uint32_t>(static_cast<uint32_t>(map.size()));
+  for (auto &p : map) {
+    writer.putString(p.first);
+    writer.put<int32_t>(p.second->s_index);
+  }
+}
+
+template<typename T> static void
+readRefMap(
+  RecipeCacheReader &reader,
+  std::vector<T *> const &objects,
+  std::map<std::string, T *> &map)
+{
+  uint32_t count = reader.get<uint32_t>();
+
+  for (uint32_t i = 0; i < count; ++i) {
+    auto name = reader.getString();
+    map[name] = reader.getRef(objects);
+  }
+}
+
+static void
+writeExpressions(
+  RecipeCacheWriter &writer,
+  std::vector<ParamAssignExpression *> const &exprs)
+{
+  for (auto p : exprs) {
+    writer.put<int32_t>(p->s_target);
+    writer.putString(p->parameter);
+
+    // String assignments are not evaluated, changing them to expressions
+    // (or vice versa) changes the layout.
+    if (writer.mode == RECIPE_SERIALIZE_LAYOUT)
+      writer.put<uint8_t>(p->expression[0] == '"');
+    else
+      writer.putString(p->expression);
+
+    writer.put<int32_t>(p->parent != nullptr ? p->parent->s_index : -1);
+  }
+}
+
+static void
+readExpressions(
+  RecipeCacheReader &reader,
+  std::vector<RecipeContext *> const &contexts,
+  std::vector<ParamAssignExpression *> &exprs)
+{
+  for (auto p : exprs) {
+    p->s_target   = reader.get<int32_t>();
+    p->parameter  = reader.getString();
+    p->expression = reader.getString();
+    p->parent     = reader.getRef(contexts);
+  }
+}
+
+static void
+writeParameters(
+  RecipeCacheWriter &writer,
+  std::map<std::string, RecipeParameter> const &params)
+{
+  writer.put<uint32_t>(static_cast<uint32_t>(params.size()));
+  for (auto &p : params) {
+    writer.putString(p.first);
+
+    if (writer.mode == RECIPE_SERIALIZE_LAYOUT)
+      continue;
+
+    writer.put<Real>(p.second.defaultVal);
+    writer.put<Real>(p.second.min);
+    writer.put<Real>(p.second.max);
+
+    if (writer.mode == RECIPE_SERIALIZE_ALL)
+      writer.putString(p.second.where);
+  }
+}
+
+static void
+readParameters(
+  RecipeCacheReader &reader,
+  std::map<std::string, RecipeParameter> &params)
+{
+  uint32_t count = reader.get<uint32_t>();
+
+  for (uint32_t i = 0; i < count; ++i) {
+    auto &param = params[reader.getString()];
+    param.defaultVal = reader.get<Real>();
+    param.min        = reader.get<Real>();
+    param.max        = reader.get<Real>();
+    param.where      = reader.getString();
+  }
+}
+
+//
+// All pointers inside a recipe refer to objects of the same recipe, and
+// are stored as indices to its allocation vectors. Objects are allocated
+// first (counts go at the beginning) so that references can be resolved
+// while reading.
+//
+void
+RecipeCache::writeRecipe(RecipeCacheWriter &writer, Recipe const *recipe)
+{
+  std::map<RecipeOpticalPath const *, int32_t> pathIndex;
+  std::map<Recipe const *, int32_t> subRecipeIndex;
+
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_contexts.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_elementSteps.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_pathSteps.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_elemParameters.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_frameParameters.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_variables.size()));
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_subRecipes.size()));
+
+  writer.putStringList(recipe->m_searchPaths);
+  writer.putStringList(recipe->m_scripts);
+
+  writeExpressions(writer, recipe->m_elemParameters);
+  writeExpressions(writer, recipe->m_frameParameters);
+  writeExpressions(writer, recipe->m_variables);
+
+  for (auto ctx : recipe->m_contexts) {
+    writer.putString(ctx->name);
+    writer.put<int32_t>(ctx->type);
+    writer.put<uint8_t>(ctx->delayed);
+    writer.put<int32_t>(ctx->parent != nullptr ? ctx->parent->s_index : -1);
+    writer.putString(ctx->parentNS);
+
+    // The element is left uninitialized in non-port contexts
+    if (ctx->type == RECIPE_CONTEXT_TYPE_PORT) {
+      writer.put<int32_t>(ctx->element->s_index);
+      writer.putString(ctx->port);
+    }
+
+    writeRefs(writer, ctx->contexts);
+    writeRefs(writer, ctx->elements);
+    writer.putStringList(ctx->varNames);
+    writeRefMap(writer, ctx->variables);
+    writeRefMap(writer, ctx->params);
+  }
+
+  for (auto step : recipe->m_elementSteps) {
+    writer.putString(step->name);
+    writer.putString(step->factory);
+    writer.put<uint8_t>(step->delayedCreation);
+    writer.put<int32_t>(step->parent != nullptr ? step->parent->s_index : -1);
+    writeRefs(writer, step->positionalParams);
+    writeRefMap(writer, step->params);
+  }
+
+  for (size_t i = 0; i < recipe->m_pathSteps.size(); ++i) {
+    auto path = recipe->m_pathSteps[i];
+    pathIndex[path] = static_cast<int32_t>(i);
+
+    writer.putString(path->name);
+    writer.putStringList(path->steps);
+    writer.put<int32_t>(path->parent != nullptr ? path->parent->s_index : -1);
+  }
+
+  for (size_t i = 0; i < recipe->m_subRecipes.size(); ++i) {
+    subRecipeIndex[recipe->m_subRecipes[i]] = static_cast<int32_t>(i);
+
+    if (writer.mode == RECIPE_SERIALIZE_LAYOUT) {
+      writer.mode = RECIPE_SERIALIZE_CONTENTS;
+      writeRecipe(writer, recipe->m_subRecipes[i]);
+      writer.mode = RECIPE_SERIALIZE_LAYOUT;
+    } else {
+      writeRecipe(writer, recipe->m_subRecipes[i]);
+    }
+  }
+
+  writeRefMap(writer, recipe->m_frames);
+  writeRefMap(writer, recipe->m_elements);
+  writeRefMap(writer, recipe->m_ports);
+  writeParameters(writer, recipe->m_parameters);
+  writeParameters(writer, recipe->m_dofs);
+
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_paths.size()));
+  for (auto &p : recipe->m_paths) {
+    writer.putString(p.first);
+    writer.put<int32_t>(pathIndex[p.second]);
+  }
+
+  writer.put<uint32_t>(static_cast<uint32_t>(recipe->m_customElements.size()));
+  for (auto &p : recipe->m_customElements) {
+    writer.putString(p.first);
+    writer.put<int32_t>(subRecipeIndex[p.second]);
+  }
+}
+
+Recipe *
+RecipeCache::readRecipe(RecipeCacheReader &reader, Recipe *parent)
+{
+  Recipe *recipe = new Recipe("", parent);
+
+  try {
+    // Remove the root context created by the constructor
+    for (auto p : recipe->m_contexts)
+      delete p;
+    recipe->m_contexts.clear();
+
+    uint32_t numContexts    = reader.get<uint32_t>();
+    uint32_t numElements    = reader.get<uint32_t>();
+    uint32_t numPaths       = reader.get<uint32_t>();
+    uint32_t numElemParams  = reader.get<uint32_t>();
+    uint32_t numFrameParams = reader.get<uint32_t>();
+    uint32_t numVariables   = reader.get<uint32_t>();
+    uint32_t numSubRecipes  = reader.get<uint32_t>();
+
+    if (numContexts == 0)
+      throw std::runtime_error("Recipe cache entry has no root context");
+
+    recipe->m_contexts.resize(numContexts);
+    for (uint32_t i = 0; i < numContexts; ++i) {
+      recipe->m_contexts[i] = new RecipeContext();
+      recipe->m_contexts[i]->s_index = static_cast<int>(i);
+      recipe->m_contexts[i]->element = nullptr;
+    }
+
+    recipe->m_elementSteps.resize(numElements);
+    for (uint32_t i = 0; i < numElements; ++i) {
+      recipe->m_elementSteps[i] = new RecipeElementStep();
+      recipe->m_elementSteps[i]->s_index = static_cast<int>(i);
+      recipe->m_elementSteps[i]->owner   = recipe;
+    }
+
+    recipe->m_pathSteps.resize(numPaths);
+    for (auto &p : recipe->m_pathSteps)
+      p = new RecipeOpticalPath();
+
+    recipe->m_elemParameters.resize(numElemParams);
+    for (uint32_t i = 0; i < numElemParams; ++i) {
+      recipe->m_elemParameters[i] = new ParamAssignExpression();
+      recipe->m_elemParameters[i]->s_index = static_cast<int>(i);
+    }
+
+    recipe->m_frameParameters.resize(numFrameParams);
+    for (uint32_t i = 0; i < numFrameParams; ++i) {
+      recipe->m_frameParameters[i] = new ParamAssignExpression();
+      recipe->m_frameParameters[i]->s_index = static_cast<int>(i);
+    }
+
+    recipe->m_variables.resize(numVariables);
+    for (uint32_t i = 0; i < numVariables; ++i) {
+      recipe->m_variables[i] = new ParamAssignExpression();
+      recipe->m_variables[i]->s_index = static_cast<int>(i);
+    }
+
+    recipe->m_rootContext = recipe->m_contexts[0];
+    recipe->m_currContext = recipe->m_rootContext;
+
+    recipe->m_searchPaths = reader.getStringList();
+    recipe->m_scripts     = reader.getStringList();
+
+    readExpressions(reader, recipe->m_contexts, recipe->m_elemParameters);
+    readExpressions(reader, recipe->m_contexts, recipe->m_frameParameters);
+    readExpressions(reader, recipe->m_contexts, recipe->m_variables);
+
+    for (auto ctx : recipe->m_contexts) {
+      ctx->name     = reader.getString();
+      ctx->type     = static_cast<RecipeContextType>(reader.get<int32_t>());
+      ctx->delayed  = reader.get<uint8_t>() != 0;
+      ctx->parent   = reader.getRef(recipe->m_contexts);
+      ctx->parentNS = reader.getString();
+
+      if (ctx->type == RECIPE_CONTEXT_TYPE_PORT) {
+        ctx->element = reader.getRef(recipe->m_elementSteps);
+        ctx->port    = reader.getString();
+      }
+
+      readRefs(reader, recipe->m_contexts, ctx->contexts);
+      readRefs(reader, recipe->m_elementSteps, ctx->elements);
+      ctx->varNames = reader.getStringList();
+      readRefMap(reader, recipe->m_variables, ctx->variables);
+      readRefMap(reader, recipe->m_frameParameters, ctx->params);
+    }
+
+    for (auto step : recipe->m_elementSteps) {
+      step->name            = reader.getString();
+      step->factory         = reader.getString();
+      step->delayedCreation = reader.get<uint8_t>() != 0;
+      step->parent          = reader.getRef(recipe->m_contexts);
+      readRefs(reader, recipe->m_elemParameters, step->positionalParams);
+      readRefMap(reader, recipe->m_elemParameters, step->params);
+    }
+
+    for (auto path : recipe->m_pathSteps) {
+      path->name   = reader.getString();
+      path->steps  = reader.getStringList();
+      path->parent = reader.getRef(recipe->m_contexts);
+    }
+
+    for (uint32_t i = 0; i < numSubRecipes; ++i)
+      recipe->m_subRecipes.push_back(readRecipe(reader, recipe));
+
+    readRefMap(reader, recipe->m_contexts, recipe->m_frames);
+    readRefMap(reader, recipe->m_elementSteps, recipe->m_elements);
+    readRefMap(reader, recipe->m_contexts, recipe->m_ports);
+    readParameters(reader, recipe->m_parameters);
+    readParameters(reader, recipe->m_dofs);
+
+    uint32_t count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count; ++i) {
+      auto name = reader.getString();
+      recipe->m_paths[name] = reader.getRef(recipe->m_pathSteps);
+    }
+
+    count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count; ++i) {
+      auto name = reader.getString();
+      recipe->m_customElements[name] = reader.getRef(recipe->m_subRecipes);
+    }
+  } catch (std::runtime_error const &) {
+    delete recipe;
+    throw;
+  }
+
+  return recipe;
+}
+
+void
+RecipeCache::serialize(
+  Recipe const *recipe,
+  std::string &dest,
+  RecipeSerializationMode mode)
+{
+  RecipeCacheWriter writer(dest, mode);
+
+  writeRecipe(writer, recipe);
+}
+
+Recipe *
+RecipeCache::deserialize(std::string const &data, Recipe *parent)
+{
+  RecipeCacheReader reader(data);
+  Recipe *recipe = readRecipe(reader, parent);
+
+  if (reader.offset() != data.size()) {
+    delete recipe;
+    throw std::runtime_error("Trailing data after serialized recipe");
+  }
+
+  return recipe;
+}
+
+//////////////////////////////// RecipeCache ///////////////////////////////////
+RecipeCache::RecipeCache(std::string const &dir)
+{
+  const char *env = getenv("RZ_RECIPE_CACHE");
+  std::string setting = env == nullptr ? "" : env;
+
+  if (!dir.empty()) {
+    m_dir = dir;
+  } else if (!setting.empty() && setting != "0" && setting != "1") {
+    m_dir = setting;
+  } else if ((env = getenv("XDG_CACHE_HOME")) != nullptr && *env != '\0') {
+    m_dir = std::string(env) + "/rayzaler/recipes";
+  } else if ((env = getenv("HOME")) != nullptr && *env != '\0') {
+    m_dir = std::string(env) + "/.cache/rayzaler/recipes";
+  }
+
+  if (!setting.empty()) {
+    m_fromEnv = true;
+    m_enabled = setting != "0" && !m_dir.empty();
+  }
+}
+
+RecipeCache *
+RecipeCache::instance()
+{
+  if (m_instance == nullptr)
+    m_instance = new RecipeCache();
+
+  return m_instance;
+}
+
+void
+RecipeCache::setDirectory(std::string const &dir)
+{
+  m_dir = dir;
+  if (m_dir.empty())
+    m_enabled = false;
+}
+
+std::string
+RecipeCache::directory() const
+{
+  return m_dir;
+}
+
+void
+RecipeCache::setEnabled(bool enabled)
+{
+  m_enabled = enabled && !m_dir.empty();
+}
+
+void
+RecipeCache::setDefaultEnabled(bool enabled)
+{
+  if (!m_fromEnv)
+    setEnabled(enabled);
+}
+
+bool
+RecipeCache::enabled() const
+{
+  return m_enabled;
+}
+
+uint64_t
+RecipeCache::hits() const
+{
+  return m_hits;
+}
+
+uint64_t
+RecipeCache::misses() const
+{
+  return m_misses;
+}
+
+std::string
+RecipeCache::makeKey(
+  std::string const &path,
+  std::list<std::string> const &searchPaths)
+{
+  std::string key = absolutePath(path);
+
+  for (auto &p : searchPaths)
+    key += "\n" + absolutePath(p);
+
+  return key;
+}
+
+std::string
+RecipeCache::entryPath(std::string const &key) const
+{
+  return m_dir + "/" + string_printf(
+    "%016llx.rzc",
+    static_cast<unsigned long long>(hashBytes(key.data(), key.size())));
+}
+
+Recipe *
+RecipeCache::load(
+  std::string const &path,
+  std::list<std::string> const &searchPaths)
+{
+  std::string key, data;
+  Recipe *recipe = nullptr;
+  FILE *fp = nullptr;
+  char buffer[4096];
+  size_t got;
+
+  if (!m_enabled)
+    return nullptr;
+
+  key = makeKey(path, searchPaths);
+  fp  = fopen(entryPath(key).c_str(), "rb");
+
+  if (fp == nullptr)
+    goto done;
+
+  while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    data.append(buffer, got);
+
+  fclose(fp);
+
+  try {
+    RecipeCacheReader reader(data);
+    uint64_t size, hash;
+
+    if (data.compare(0, 4, RZ_RECIPE_CACHE_MAGIC) != 0)
+      goto done;
+
+    reader.get<uint32_t>();
+
+    if (reader.get<uint32_t>() != RZ_RECIPE_CACHE_VERSION)
+      goto done;
+
+    if (reader.getString() != key)
+      goto done;
+
+    uint32_t numDeps = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < numDeps; ++i) {
+      auto     depPath = reader.getString();
+      uint64_t depSize = reader.get<uint64_t>();
+      uint64_t depHash = reader.get<uint64_t>();
+
+      if (!hashFile(depPath, size, hash) || size != depSize || hash != depHash)
+        goto done;
+    }
+
+    recipe = readRecipe(reader, nullptr);
+  } catch (std::runtime_error const &e) {
+    RZWarning("Ignoring recipe cache entry of %s: %s\n", path.c_str(), e.what());
+    recipe = nullptr;
+  }
+
+done:
+  if (recipe != nullptr)
+    ++m_hits;
+  else
+    ++m_misses;
+
+  return recipe;
+}
+
+bool
+RecipeCache::save(
+  std::string const &path,
+  std::list<std::string> const &searchPaths,
+  Recipe const *recipe,
+  std::list<std::string> const &dependencies)
+{
+  std::string key, data, entry, tmpPath;
+  std::list<std::string> files;
+  RecipeCacheWriter writer(data);
+  FILE *fp = nullptr;
+  bool ok = false;
+
+  if (!m_enabled)
+    return false;
+
+  if (!makeDirectories(m_dir)) {
+    RZDebug("Cannot create recipe cache directory %s: %s\n", m_dir.c_str(), strerror(errno));
+    m_enabled = false;
+    return false;
+  }
+
+  key = makeKey(path, searchPaths);
+
+  files.push_back(absolutePath(path));
+  files.insert(files.end(), dependencies.begin(), dependencies.end());
+
+  data.append(RZ_RECIPE_CACHE_MAGIC);
+  writer.put<uint32_t>(RZ_RECIPE_CACHE_VERSION);
+  writer.putString(key);
+
+  writer.put<uint32_t>(static_cast<uint32_t>(files.size()));
+  for (auto &file : files) {
+    uint64_t size, hash;
+
+    if (!hashFile(file, size, hash))
+      return false;
+
+    writer.putString(file);
+    writer.put<uint64_t>(size);
+    writer.put<uint64_t>(hash);
+  }
+
+  writeRecipe(writer, recipe);
+
+  // Write and rename, so that concurrent loads never see partial entries
+  entry   = entryPath(key);
+  tmpPath = entry + string_printf(".%d.tmp", getpid());
+
+  fp = fopen(tmpPath.c_str(), "wb");
+  if (fp == nullptr) {
+    RZDebug("Cannot create %s: %s\n", tmpPath.c_str(), strerror(errno));
+    m_enabled = false;
+    return false;
+  }
+
+  ok = fwrite(data.data(), data.size(), 1, fp) == 1;
+  ok = fclose(fp) == 0 && ok;
+
+  if (ok)
+    ok = rename(tmpPath.c_str(), entry.c_str()) == 0;
+
+  if (!ok) {
+    RZDebug("Cannot save recipe cache entry %s: %s\n", entry.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+  }
+
+  return ok;
+}
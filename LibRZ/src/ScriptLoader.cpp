@@ -56,13 +56,15 @@ getLastPythonError()
 }
 
 ////////////////////////////////// Script function /////////////////////////////
-Real
-ScriptFunction::evaluate(Real const *args, unsigned argc)
+//
+// These helpers must be called with the GIL held
+//
+bool
+ScriptFunction::callScalar(Real const *args, Real &result)
 {
-  PyGILState_STATE state = PyGILState_Ensure();
   PyObject *pArgs = PyTuple_New(argc);
-  Real result = std::numeric_limits<Real>::quiet_NaN();
   Real suggested;
+  bool ok = false;
 
   for (unsigned i = 0; i < argc; ++i)
     PyTuple_SetItem(pArgs, i, PyFloat_FromDouble(args[i]));
@@ -70,6 +72,8 @@ ScriptFunction::evaluate(Real const *args, unsigned argc)
   PyObject *retVal = PyObject_CallObject(pFunc, pArgs);
   Py_DECREF(pArgs);
 
+  ++calls;
+
   if (retVal != nullptr) {
     suggested = PyFloat_AsDouble(retVal);
     if (PyErr_Occurred()) {
@@ -79,6 +83,7 @@ ScriptFunction::evaluate(Real const *args, unsigned argc)
         getLastPythonError().c_str());
     } else {
       result = suggested;
+      ok = true;
     }
   } else {
     if (PyErr_Occurred()) {
@@ -89,12 +94,196 @@ ScriptFunction::evaluate(Real const *args, unsigned argc)
     }
   }
   
-  Py_DECREF(retVal);
+  Py_XDECREF(retVal);
+
+  return ok;
+}
+
+//
+// Arguments are passed as read-only float64 arrays, one per argument. The
+// function may return anything that broadcasts to the number of rows.
+//
+bool
+ScriptFunction::callVectorized(std::vector<ArgList> const &args, Real *results)
+{
+  Py_ssize_t rows  = static_cast<Py_ssize_t>(args.size());
+  PyObject *numpy  = nullptr;
+  PyObject *pArgs  = nullptr;
+  PyObject *retVal = nullptr;
+  PyObject *array  = nullptr;
+  PyObject *tmp    = nullptr;
+  std::vector<Real> column(rows);
+  Py_buffer view;
+  bool ok = false;
+
+  numpy = PyImport_ImportModule("numpy");
+  if (numpy == nullptr)
+    goto done;
+
+  pArgs = PyTuple_New(argc);
+
+  for (unsigned j = 0; j < argc; ++j) {
+    for (Py_ssize_t i = 0; i < rows; ++i)
+      column[i] = args[i][j];
+
+    PyObject *bytes = PyBytes_FromStringAndSize(
+      reinterpret_cast<const char *>(column.data()),
+      rows * sizeof(Real));
+    if (bytes == nullptr)
+      goto done;
+
+    PyObject *arg = PyObject_CallMethod(
+      numpy,
+      "frombuffer",
+      "Os",
+      bytes,
+      "float64");
+    Py_DECREF(bytes);
+
+    if (arg == nullptr)
+      goto done;
+
+    PyTuple_SetItem(pArgs, j, arg);
+  }
+
+  retVal = PyObject_CallObject(pFunc, pArgs);
+  ++calls;
+  if (retVal == nullptr)
+    goto done;
+
+  tmp = PyObject_CallMethod(numpy, "asarray", "Os", retVal, "float64");
+  if (tmp == nullptr)
+    goto done;
+
+  array = PyObject_CallMethod(numpy, "broadcast_to", "O(n)", tmp, rows);
+  Py_DECREF(tmp);
+  if (array == nullptr)
+    goto done;
+
+  tmp = PyObject_CallMethod(numpy, "ascontiguousarray", "O", array);
+  Py_DECREF(array);
+  array = tmp;
+  if (array == nullptr)
+    goto done;
+
+  if (PyObject_GetBuffer(array, &view, PyBUF_C_CONTIGUOUS) != 0)
+    goto done;
+
+  if (static_cast<size_t>(view.len) == rows * sizeof(Real)) {
+    memcpy(results, view.buf, view.len);
+    ok = true;
+  }
+
+  PyBuffer_Release(&view);
+
+done:
+  if (!ok)
+    RZError(
+      "%s: vectorized call failed: %s\n",
+      name.c_str(),
+      PyErr_Occurred() 
+        ? getLastPythonError().c_str() 
+        : "unexpected result size");
+
+  Py_XDECREF(array);
+  Py_XDECREF(retVal);
+  Py_XDECREF(pArgs);
+  Py_XDECREF(numpy);
+
+  return ok;
+}
+
+void
+ScriptFunction::remember(ArgList const &args, Real result)
+{
+  if (memo.size() >= RZ_SCRIPT_MEMO_MAX_ENTRIES)
+    memo.clear();
+
+  memo[args] = result;
+}
+
+Real
+ScriptFunction::evaluate(Real const *args, unsigned argc)
+{
+  ArgList key(args, args + argc);
+  Real result = std::numeric_limits<Real>::quiet_NaN();
+  bool ok;
+
+  PyGILState_STATE state = PyGILState_Ensure();
+
+  if (pure) {
+    auto it = memo.find(key);
+    if (it != memo.end()) {
+      ++memoHits;
+      PyGILState_Release(state);
+      return it->second;
+    }
+  }
+
+  if (vectorized) {
+    std::vector<ArgList> rows = {key};
+    ok = callVectorized(rows, &result);
+  } else {
+    ok = callScalar(args, result);
+  }
+
+  if (ok && pure)
+    remember(key, result);
+
   PyGILState_Release(state);
 
   return result;
 }
 
+bool
+ScriptFunction::batched() const
+{
+  return vectorized;
+}
+
+bool
+ScriptFunction::evaluateBatch(std::vector<ArgList> const &args, Real *results)
+{
+  std::vector<ArgList> rows;
+  std::vector<size_t> index;
+  std::vector<Real> computed;
+  bool ok = true;
+
+  PyGILState_STATE state = PyGILState_Ensure();
+
+  // Memoized rows do not need to be passed to the function
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (pure) {
+      auto it = memo.find(args[i]);
+      if (it != memo.end()) {
+        ++memoHits;
+        results[i] = it->second;
+        continue;
+      }
+    }
+
+    index.push_back(i);
+    rows.push_back(args[i]);
+  }
+
+  if (!rows.empty()) {
+    computed.resize(rows.size());
+    ok = callVectorized(rows, computed.data());
+
+    if (ok) {
+      for (size_t i = 0; i < rows.size(); ++i) {
+        results[index[i]] = computed[i];
+        if (pure)
+          remember(rows[i], computed[i]);
+      }
+    }
+  }
+
+  PyGILState_Release(state);
+
+  return ok;
+}
+
 /////////////////////////////////// Script /////////////////////////////////////
 Script::Script(std::string const &path)
 {
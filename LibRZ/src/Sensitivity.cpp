@@ -0,0 +1,475 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <Sensitivity.h>
+#include <TopLevelModel.h>
+#include <OpticalElement.h>
+#include <Recipe.h>
+#include <ForkedWorkers.h>
+#include <Logger.h>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+using namespace RZ;
+
+#define RZ_SENSITIVITY_NOMINAL static_cast<size_t>(-1)
+
+std::string
+SensitivityMetric::label() const
+{
+  switch (kind) {
+    case SpotCentroidX:
+      return element + ".centroidX";
+
+    case SpotCentroidY:
+      return element + ".centroidY";
+
+    case SpotRmsRadius:
+      return element + ".rmsRadius";
+
+    case SpotMomentXX:
+      return element + ".momentXX";
+
+    case SpotMomentYY:
+      return element + ".momentYY";
+
+    case SpotMomentXY:
+      return element + ".momentXY";
+
+    case SpotTransmission:
+      return element + ".transmission";
+
+    case SpotOpdRms:
+      return element + ".opdRms";
+  }
+
+  return element + ".unknown";
+}
+
+SensitivityAnalysis::SensitivityAnalysis(TopLevelModel *model)
+{
+  m_model = model;
+}
+
+GenericModelParam *
+SensitivityAnalysis::lookupVariable(std::string const &name) const
+{
+  auto param = m_model->lookupDof(name);
+
+  if (param == nullptr)
+    param = m_model->lookupParam(name);
+
+  return param;
+}
+
+bool
+SensitivityAnalysis::setVariable(std::string const &name, Real value)
+{
+  if (m_model->lookupDof(name) != nullptr)
+    return m_model->setDof(name, value);
+
+  return m_model->setParam(name, value);
+}
+
+//
+// Looks up the elements of the metrics and makes them record their hits,
+// until restore() is called.
+//
+void
+SensitivityAnalysis::prepare(JacobianProperties const &props)
+{
+  m_elements.clear();
+  m_recorded.clear();
+  m_metricElements.clear();
+
+  for (auto &metric : props.metrics) {
+    auto element = m_model->lookupOpticalElementOrEx(metric.element);
+
+    if (element->opticalSurfaces().empty())
+      throw std::runtime_error(
+        "Element `" + metric.element + "' has no optical surfaces");
+
+    if (std::find(m_elements.begin(), m_elements.end(), element) == m_elements.end()) {
+      m_elements.push_back(element);
+      m_recorded.push_back(element->recordHits());
+    }
+
+    m_metricElements.push_back(element);
+  }
+
+  for (auto element : m_elements)
+    element->setRecordHits(true);
+}
+
+void
+SensitivityAnalysis::restore()
+{
+  for (size_t i = 0; i < m_elements.size(); ++i) {
+    m_elements[i]->setRecordHits(m_recorded[i]);
+    if (!m_recorded[i])
+      for (auto surface : m_elements[i]->opticalSurfaces()) {
+        surface->hits.clear();
+        surface->clearCache();
+      }
+  }
+
+  m_elements.clear();
+  m_recorded.clear();
+  m_metricElements.clear();
+}
+
+//
+// Traces the rays once, with the dof of the evaluation (if any) set to its
+// value, and saves the metrics to `dest'. The dof is restored afterwards.
+//
+bool
+SensitivityAnalysis::evaluate(
+  TracingProperties const &tracing,
+  JacobianProperties const &props,
+  std::vector<std::string> const &dofs,
+  Evaluation const &evaluation,
+  Real *dest)
+{
+  auto sim = m_model->simulation();
+  const RayList *pRays = tracing.pRays != nullptr
+    ? tracing.pRays
+    : &tracing.rays;
+  size_t count = tracing.pArrays != nullptr
+    ? tracing.pArrays->count
+    : pRays->size();
+  std::string dof;
+  Real saved = 0;
+  bool ok;
+
+  if (evaluation.dof != RZ_SENSITIVITY_NOMINAL) {
+    dof   = dofs[evaluation.dof];
+    saved = lookupVariable(dof)->value;
+    if (!setVariable(dof, evaluation.value))
+      return false;
+  }
+
+  for (auto element : m_elements)
+    for (auto surface : element->opticalSurfaces()) {
+      surface->hits.clear();
+      surface->clearCache();
+    }
+
+  sim->seedRandomStreams(props.seed);
+  ok = sim->trace(tracing);
+
+  if (!dof.empty())
+    setVariable(dof, saved);
+
+  if (!ok)
+    return false;
+
+  for (size_t i = 0; i < props.metrics.size(); ++i) {
+    auto &metric = props.metrics[i];
+    auto &hits   = m_metricElements[i]->opticalSurfaces().front()->hits;
+    auto &origins    = hits.origins();
+    auto &optLengths = hits.cumOptLengths();
+    size_t hitCount = hits.size();
+    Real n = hitCount, x0 = 0, y0 = 0, l0 = 0;
+    Real xx = 0, yy = 0, xy = 0, ll = 0;
+
+    for (size_t j = 0; j < hitCount; ++j) {
+      x0 += origins[3 * j + 0];
+      y0 += origins[3 * j + 1];
+      l0 += optLengths[j];
+    }
+
+    if (n > 0) {
+      x0 /= n;
+      y0 /= n;
+      l0 /= n;
+
+      for (size_t j = 0; j < hitCount; ++j) {
+        Real dx = origins[3 * j + 0] - x0;
+        Real dy = origins[3 * j + 1] - y0;
+        Real dl = optLengths[j] - l0;
+
+        xx += dx * dx;
+        yy += dy * dy;
+        xy += dx * dy;
+        ll += dl * dl;
+      }
+
+      xx /= n;
+      yy /= n;
+      xy /= n;
+      ll /= n;
+    }
+
+    switch (metric.kind) {
+      case SpotCentroidX:
+        dest[i] = x0;
+        break;
+
+      case SpotCentroidY:
+        dest[i] = y0;
+        break;
+
+      case SpotRmsRadius:
+        dest[i] = sqrt(xx + yy);
+        break;
+
+      case SpotMomentXX:
+        dest[i] = xx;
+        break;
+
+      case SpotMomentYY:
+        dest[i] = yy;
+        break;
+
+      case SpotMomentXY:
+        dest[i] = xy;
+        break;
+
+      case SpotTransmission:
+        dest[i] = count > 0 ? n / count : 0;
+        break;
+
+      case SpotOpdRms:
+        dest[i] = sqrt(ll);
+        break;
+    }
+  }
+
+  return true;
+}
+
+bool
+SensitivityAnalysis::metrics(
+  TracingProperties const &tracing,
+  JacobianProperties const &props,
+  std::vector<Real> &values)
+{
+  std::vector<std::string> none;
+  bool ok;
+
+  values.resize(props.metrics.size());
+
+  prepare(props);
+
+  try {
+    ok = evaluate(
+      tracing,
+      props,
+      none,
+      Evaluation {RZ_SENSITIVITY_NOMINAL, 0},
+      values.data());
+  } catch (...) {
+    restore();
+    throw;
+  }
+
+  restore();
+
+  return ok;
+}
+
+bool
+SensitivityAnalysis::jacobian(
+  TracingProperties const &tracing,
+  JacobianProperties const &props,
+  JacobianResult &result)
+{
+  TracingProperties childTracing = tracing;
+  std::vector<size_t> lower, upper;
+  size_t metrics = props.metrics.size();
+  size_t evaluations, perturbations;
+  unsigned int processes = props.processes;
+  Real *values;
+  double start = monotonicSeconds();
+  bool ok = true;
+
+  result = JacobianResult();
+
+  if (props.dofs.empty())
+    for (auto &name : m_model->dofs())
+      result.dofs.push_back(name);
+  else
+    result.dofs = props.dofs;
+
+  for (auto &metric : props.metrics)
+    result.metrics.push_back(metric.label());
+
+  // Plan the evaluations. The first one is the nominal one.
+  m_evaluations.clear();
+  m_evaluations.push_back(Evaluation {RZ_SENSITIVITY_NOMINAL, 0});
+
+  for (size_t k = 0; k < result.dofs.size(); ++k) {
+    auto param = lookupVariable(result.dofs[k]);
+    Real h, x, a, b;
+    Real min = -INFINITY, max = +INFINITY;
+
+    if (param == nullptr)
+      throw std::runtime_error(
+        "Unknown dof or parameter `" + result.dofs[k] + "'");
+
+    auto it = props.steps.find(result.dofs[k]);
+    h = it != props.steps.end() ? it->second : props.step;
+
+    if (!(h > 0))
+      throw std::runtime_error(
+        "Invalid difference step for dof `" + result.dofs[k] + "'");
+
+    if (param->description != nullptr) {
+      min = param->description->min;
+      max = param->description->max;
+    }
+
+    x = param->value;
+    a = props.central ? x - h : x;
+    b = x + h;
+
+    if (b > max) {
+      b = x;
+      a = x - h;
+    }
+
+    if (a < min) {
+      a = x;
+      b = x + h;
+    }
+
+    if (a < min || b > max)
+      throw std::runtime_error(
+        "Range of dof `" + result.dofs[k] + "' is narrower than its step");
+
+    if (a == x) {
+      lower.push_back(0);
+    } else {
+      lower.push_back(m_evaluations.size());
+      m_evaluations.push_back(Evaluation {k, a});
+    }
+
+    if (b == x) {
+      upper.push_back(0);
+    } else {
+      upper.push_back(m_evaluations.size());
+      m_evaluations.push_back(Evaluation {k, b});
+    }
+
+    result.steps.push_back(b - a);
+  }
+
+  evaluations   = m_evaluations.size();
+  perturbations = evaluations - 1;
+
+  if (processes == 0)
+    processes = std::max(std::thread::hardware_concurrency(), 1u);
+  processes = static_cast<unsigned int>(
+    std::min<size_t>(processes, perturbations));
+
+  childTracing.listener = nullptr;
+
+  prepare(props);
+
+  try {
+    ForkedWorkers workers("Sensitivity worker");
+
+    // Every evaluation writes a done flag, followed by its metrics
+    if (!workers.map(evaluations * (1 + metrics) * sizeof(Real))) {
+      restore();
+      return false;
+    }
+
+    values = reinterpret_cast<Real *>(workers.segment());
+
+    if (processes > 1) {
+      ok = workers.start(
+        processes,
+        [&] (unsigned int i) {
+          bool childOk = true;
+
+          m_model->simulation()->setProcesses(1);
+
+          for (size_t j = 1 + i; childOk && j < evaluations; j += processes) {
+            Real *dest = values + j * (1 + metrics);
+
+            childOk = evaluate(
+              childTracing,
+              props,
+              result.dofs,
+              m_evaluations[j],
+              dest + 1);
+
+            dest[0] = childOk ? 1 : 0;
+          }
+
+          return childOk;
+        });
+
+      // The nominal trace runs here, in parallel with the workers
+      if (ok)
+        ok = evaluate(
+          tracing,
+          props,
+          result.dofs,
+          m_evaluations[0],
+          values + 1);
+
+      ok = workers.wait() && ok;
+
+      for (size_t j = 1; ok && j < evaluations; ++j)
+        ok = values[j * (1 + metrics)] == 1;
+    } else {
+      // In-process, with the nominal trace last
+      for (size_t j = 1; ok && j < evaluations; ++j)
+        ok = evaluate(
+          childTracing,
+          props,
+          result.dofs,
+          m_evaluations[j],
+          values + j * (1 + metrics) + 1);
+
+      if (ok)
+        ok = evaluate(
+          tracing,
+          props,
+          result.dofs,
+          m_evaluations[0],
+          values + 1);
+    }
+
+    if (ok) {
+      result.nominal.assign(values + 1, values + 1 + metrics);
+      result.jacobian.resize(metrics * result.dofs.size());
+
+      for (size_t m = 0; m < metrics; ++m)
+        for (size_t k = 0; k < result.dofs.size(); ++k)
+          result.jacobian[m * result.dofs.size() + k] =
+            (values[upper[k] * (1 + metrics) + 1 + m]
+           - values[lower[k] * (1 + metrics) + 1 + m]) / result.steps[k];
+
+      result.traces = evaluations;
+    }
+  } catch (...) {
+    // The workers were killed and reaped when leaving the try block
+    restore();
+    throw;
+  }
+
+  restore();
+
+  result.elapsed = monotonicSeconds() - start;
+
+  return ok;
+}
@@ -23,6 +23,18 @@
 #include <OMModel.h>
 #include <CPURayTracingEngine.h>
 #include <Singleton.h>
+#include <Elements/Detector.h>
+#include <MediumBoundary.h>
+#include <ReferenceFrame.h>
+#include <EMInterface.h>
+#include <ForkedWorkers.h>
+#include <Logger.h>
+#include <Samplers/Circular.h>
+#include <cstring>
+#include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <set>
 
 using namespace RZ;
 
@@ -41,10 +53,19 @@ Simulation::~Simulation()
     delete m_engine;
 }
 
+//
+// Takes the current main beam through every surface of the path, one
+// stage at a time. Statistics, detector hits and recorded hits add up, so
+// this can be called once per block of a larger beam.
+//
 bool
-Simulation::traceSequential(TracingProperties const &props)
+Simulation::traceSequentialStages(
+  TracingProperties const &props,
+  const OpticalPath *path)
 {
-  const OpticalPath *path = m_model->lookupOpticalPathOrEx(props.path);
+  auto &profiler = m_engine->profiler();
+  bool profiling = profiler.enabled();
+  uint64_t t0 = 0, raysIn = 0, prevSize = 0;
   size_t n = 0;
 
   for (auto constSurf : path->m_sequence) {
@@ -57,15 +78,42 @@ Simulation::traceSequential(TracingProperties const &props)
     if (props.listener != nullptr && props.listener->cancelled())
       return false;
 
+    if (profiling) {
+      t0     = profiler.now();
+      raysIn = m_engine->beam()->countAlive();
+    }
+
     m_engine->beam()->computeInterceptStatistics(surface);
 
+    if (profiling)
+      profiler.record(
+        surface,
+        PHASE_STATISTICS,
+        t0,
+        raysIn,
+        m_engine->beam()->countIntercepted());
+
     // Save intermediate rays for representation
-    if (props.beamElement != nullptr)
+    if (props.beamElement != nullptr) {
+      if (profiling) {
+        t0       = profiler.now();
+        prevSize = m_intermediateRays.size();
+      }
+
       m_engine->beam()->extractRays(
         m_intermediateRays,
           OriginPOV | BeamIsSurfaceRelative | ExtractIntercepted,
         surface);
 
+      if (profiling)
+        profiler.record(
+          surface,
+          PHASE_EXTRACTION,
+          t0,
+          raysIn,
+          m_intermediateRays.size() - prevSize);
+    }
+
     m_engine->transmitThrough(surface);
 
     m_engine->updateOrigins(); // Destinations == origins
@@ -76,6 +124,110 @@ Simulation::traceSequential(TracingProperties const &props)
     ++n;
   }
 
+  return true;
+}
+
+//
+// Breadth-first tracing streams the whole beam through memory at every
+// stage (toRelative, cast, statistics, transmit, fromRelative...). Large
+// beams are instead traced depth-first in blocks of m_blockSize rays, that
+// go through the whole path while they are still in the cache. Each block
+// is copied into a small beam that temporarily replaces the main beam, and
+// copied back when it reaches the end of the path, so the final state of
+// the main beam is the same as in the breadth-first case.
+//
+bool
+Simulation::traceSequentialBlocks(
+  TracingProperties const &props,
+  const OpticalPath *path)
+{
+  RayBeam *main  = m_engine->beam();
+  RayBeam *block = m_engine->beamPool().acquire(m_blockSize);
+  uint64_t count = main->count;
+  bool ok = true;
+
+  m_engine->exchangeMainBeam(block);
+
+  try {
+    for (uint64_t start = 0; ok && start < count; start += m_blockSize) {
+      uint64_t len = std::min<uint64_t>(m_blockSize, count - start);
+
+      block->allocate(len, false);
+      main->copyTo(block, start, 0, len);
+
+      ok = traceSequentialStages(props, path);
+
+      block->copyTo(main, 0, start, len);
+    }
+  } catch (...) {
+    m_engine->exchangeMainBeam(main);
+    m_engine->beamPool().release(block);
+    throw;
+  }
+
+  m_engine->exchangeMainBeam(main);
+  m_engine->beamPool().release(block);
+
+  return ok;
+}
+
+//
+// Single precision traces keep the rays in a compact beam, and expand
+// them to double precision one block at a time into a pooled beam that
+// acts as the main beam of the engine. No full-size RayBeam is ever
+// allocated, and hence the traced beam is not kept (getRays() is empty).
+//
+bool
+Simulation::traceSequentialCompact(TracingProperties const &props)
+{
+  const OpticalPath *path = m_model->lookupOpticalPathOrEx(props.path);
+  uint64_t count = m_compactBeam.count;
+  uint64_t size  = m_blockSize > 0 ? m_blockSize : RZ_SIMULATION_DEFAULT_BLOCK_SIZE;
+  RayBeam *block;
+  bool ok = true;
+
+  if (count == 0)
+    return true;
+
+  block = m_engine->beamPool().acquire(std::min(size, count));
+  m_engine->exchangeMainBeam(block);
+
+  try {
+    for (uint64_t start = 0; ok && start < count; start += size) {
+      m_compactBeam.expand(block, start, std::min(size, count - start));
+
+      ok = traceSequentialStages(props, path);
+
+      if (ok && props.beamElement != nullptr)
+        block->extractRays(m_intermediateRays, OriginPOV | ExtractVignetted);
+    }
+  } catch (...) {
+    m_engine->exchangeMainBeam(nullptr);
+    m_engine->beamPool().release(block);
+    throw;
+  }
+
+  m_engine->exchangeMainBeam(nullptr);
+  m_engine->beamPool().release(block);
+
+  return ok;
+}
+
+bool
+Simulation::traceSequential(TracingProperties const &props)
+{
+  const OpticalPath *path = m_model->lookupOpticalPathOrEx(props.path);
+  RayBeam *beam = m_engine->ensureMainBeam();
+  bool ok;
+
+  if (m_blockSize > 0 && beam->count > m_blockSize)
+    ok = traceSequentialBlocks(props, path);
+  else
+    ok = traceSequentialStages(props, path);
+
+  if (!ok)
+    return false;
+
   if (props.beamElement != nullptr)
     m_engine->beam()->extractRays(
       m_intermediateRays,
@@ -100,7 +252,7 @@ Simulation::initNSBeam()
 bool
 Simulation::traceNonSequential(TracingProperties const &props)
 {
-  unsigned int propagations = 0;
+  auto const &ghosts = props.ghosts;
 
   auto factory =
     Singleton::instance()->lookupRayTracingHeuristicFactory(props.heuristic);
@@ -132,7 +284,52 @@ Simulation::traceNonSequential(TracingProperties const &props)
            by copying the relevant fields of the beam.
     */
 
+  if (!propagateNonSequential(props, 0))
+    return false;
+
+  // Ghost generations, each from the children of the previous one. The
+  // main beam is left as the primary generation left it.
+  for (unsigned int gen = 1; gen <= ghosts.maxDepth && !m_ghosts.empty(); ++gen) {
+    RayBeam *primary = m_engine->exchangeMainBeam(makeGhostBeam());
+    bool ok;
+
+    try {
+      ok = propagateNonSequential(props, gen);
+    } catch (...) {
+      m_engine->releaseBeam(m_engine->exchangeMainBeam(primary));
+      throw;
+    }
+
+    m_engine->releaseBeam(m_engine->exchangeMainBeam(primary));
+
+    if (!ok)
+      return false;
+  }
+
+  m_ghosts.clear();
+
+  return true;
+}
+
+//
+// Propagates the main beam until no ray is transferred to a new surface.
+// Rays of ghost generations below the maximum spawn their children right
+// before going through the interfaces.
+//
+bool
+Simulation::propagateNonSequential(
+  TracingProperties const &props,
+  unsigned int generation)
+{
+  unsigned int propagations = 0;
+  bool splitting = generation < props.ghosts.maxDepth;
+
+  m_ghosts.clear();
+
   auto tempBeam = m_engine->makeBeam();
+  auto &profiler = m_engine->profiler();
+  bool profiling = profiler.enabled();
+  uint64_t t0 = 0, raysIn = 0, prevSize = 0;
 
   do {
     m_transferredRays = 0;
@@ -160,16 +357,27 @@ Simulation::traceNonSequential(TracingProperties const &props)
       m_engine->setCurrentStage(surface->name, n, candidates.size());
 
       // Convert this beam to relative and store it in tempBeam
+      if (profiling) {
+        t0     = profiler.now();
+        raysIn = m_engine->beam()->countAlive();
+      }
+
       m_engine->beam()->toRelative(tempBeam, surface->frame);
 
+      if (profiling)
+        profiler.record(surface, PHASE_TO_RELATIVE, t0, raysIn, raysIn);
+
       // Cast all these rays to the current surface
       m_engine->castTo(surface, tempBeam);
 
       // Update this non-sequential beam from the temporary beam
       m_transferredRays += nsBeam->updateFromVisible(surface, tempBeam);
 
-      if (m_engine->cancelled())
+      if (m_engine->cancelled()) {
+        m_engine->releaseBeam(nsBeam);
+        m_engine->releaseBeam(tempBeam);
         return false;
+      }
 
       ++n;
     }
@@ -178,53 +386,644 @@ Simulation::traceNonSequential(TracingProperties const &props)
     m_engine->setMainBeam(nsBeam);
 
     // Compute statistics on intercepted rays
+    if (profiling) {
+      t0     = profiler.now();
+      raysIn = m_engine->beam()->countAlive();
+    }
+
     m_engine->beam()->computeInterceptStatistics();
 
+    if (profiling)
+      profiler.record(
+        nullptr,
+        PHASE_STATISTICS,
+        t0,
+        raysIn,
+        m_engine->beam()->countIntercepted());
+
     // Save intermediate rays for representation
-    if (props.beamElement != nullptr)
+    if (props.beamElement != nullptr) {
+      if (profiling) {
+        t0       = profiler.now();
+        prevSize = m_intermediateRays.size();
+      }
+
       m_engine->beam()->extractRays(
         m_intermediateRays,
           OriginPOV 
         | BeamIsSurfaceRelative
         | ExtractIntercepted);
+
+      if (profiling)
+        profiler.record(
+          nullptr,
+          PHASE_EXTRACTION,
+          t0,
+          raysIn,
+          m_intermediateRays.size() - prevSize);
+    }
     
+    if (splitting)
+      spawnGhosts(props.ghosts, generation + 1);
+
     // Transmit through all these surfaces
     m_engine->transmitThroughIntercepted();
 
     m_engine->updateOrigins();
 
-    if (m_engine->cancelled())
+    if (m_engine->cancelled()) {
+      m_engine->releaseBeam(tempBeam);
       return false;
+    }
 
   } while (++propagations <= props.maxPropagations && m_transferredRays > 0);
 
+  m_engine->releaseBeam(tempBeam);
+
   if (props.beamElement != nullptr)
     m_engine->beam()->extractRays(m_intermediateRays, OriginPOV | ExtractAll);
 
   return true;
 }
 
+//
+// Ghost ids keep the generation in the top bits of the ray id, so source
+// ids and generations that do not fit would be silently mixed up. Checked
+// before sharding, so that every shard sees weighted detectors. Detectors
+// that were not weighted are returned in `weighted', to restore them with
+// restoreGhosts() once the trace is over.
+//
+void
+Simulation::prepareGhosts(
+  TracingProperties const &props,
+  size_t count,
+  std::vector<Detector *> &weighted)
+{
+  uint32_t maxId = 0;
+
+  if (props.ghosts.maxDepth > RZ_GHOST_MAX_GENERATION)
+    throw std::runtime_error(
+      "Ghost splitting depth "
+      + std::to_string(props.ghosts.maxDepth)
+      + " exceeds the maximum of "
+      + std::to_string(RZ_GHOST_MAX_GENERATION));
+
+  if (props.pArrays != nullptr) {
+    if (props.pArrays->ids != nullptr)
+      for (size_t i = 0; i < count; ++i)
+        maxId = std::max(maxId, props.pArrays->ids[i]);
+  } else {
+    const RayList *pRays = props.pRays != nullptr ? props.pRays : &props.rays;
+    for (auto &ray : *pRays)
+      maxId = std::max(maxId, ray.id);
+  }
+
+  if (maxId > RZ_GHOST_ID_MASK)
+    throw std::runtime_error(
+      "Ray id "
+      + std::to_string(maxId)
+      + " does not fit in the "
+      + std::to_string(RZ_GHOST_GENERATION_SHIFT)
+      + " bits available to source rays in ghost splitting traces");
+
+  for (auto &name : m_model->detectors()) {
+    auto detector = m_model->lookupDetectorOrEx(name);
+
+    if (!detector->weighted()) {
+      detector->set("weighted", true);
+      weighted.push_back(detector);
+    }
+  }
+}
+
+void
+Simulation::restoreGhosts(std::vector<Detector *> const &weighted)
+{
+  for (auto detector : weighted)
+    detector->set("weighted", false);
+}
+
+//
+// Every intercepted ray of the (surface-relative) main beam whose interface
+// has a ghost reflectance leaves a child, in absolute coordinates, on the
+// surface it hit. Children are not traced until the end of the generation.
+//
+void
+Simulation::spawnGhosts(
+  GhostSplittingProperties const &props,
+  unsigned int generation)
+{
+  RayBeam *beam = m_engine->beam();
+
+  for (uint64_t i = 0; i < beam->count; ++i) {
+    if (!beam->hasRay(i) || !beam->isIntercepted(i))
+      continue;
+
+    auto surface = beam->surfaces[i];
+    if (surface == nullptr
+        || surface->boundary == nullptr
+        || surface->boundary->emInterface() == nullptr)
+      continue;
+
+    Vec3 direction(beam->directions + 3 * i);
+    Vec3 normal(beam->normals + 3 * i);
+    Real R =
+      surface->boundary->emInterface()->ghostReflectance(direction, normal);
+
+    if (R <= 0)
+      continue;
+
+    Complex amplitude = beam->amplitude[i] * sqrt(R);
+    Real weight = std::norm(amplitude);
+
+    beam->amplitude[i] *= sqrt(1 - R);
+
+    // Russian roulette
+    if (weight < props.cutoff) {
+      if (m_ghostRandState.randu() * props.cutoff >= weight)
+        continue;
+
+      amplitude *= sqrt(props.cutoff / weight);
+    }
+
+    GhostRay ghost;
+
+    ghost.origin       = surface->frame->fromRelative(
+      Vec3(beam->destinations + 3 * i));
+    ghost.direction    = surface->frame->fromRelativeVec(
+      direction - 2 * (direction * normal) * normal);
+    ghost.amplitude    = amplitude;
+    ghost.cumOptLength = beam->cumOptLengths[i];
+    ghost.wavelength   = beam->wavelengths[i];
+    ghost.refNdx       = beam->refNdx[i];
+    ghost.id           = ghostId(beam->ids[i], generation);
+    ghost.surface      = surface;
+
+    m_ghosts.push_back(ghost);
+  }
+}
+
+//
+// Non-sequential beam with the pending ghosts, as left by a propagation:
+// alive, at the surface they leave (which is not cast to again right away).
+//
+RayBeam *
+Simulation::makeGhostBeam()
+{
+  uint64_t count = m_ghosts.size();
+  RayBeam *beam  = m_engine->beamPool().acquire(count, true);
+
+  beam->clearMask();
+  memset(beam->chiefMask, 0, ((count + 63) >> 6) << 3);
+  memset(beam->intMask,   0, ((count + 63) >> 6) << 3);
+
+  for (uint64_t i = 0; i < count; ++i) {
+    auto &ghost = m_ghosts[i];
+
+    ghost.origin.copyToArray(beam->origins + 3 * i);
+    ghost.origin.copyToArray(beam->destinations + 3 * i);
+    ghost.direction.copyToArray(beam->directions + 3 * i);
+    ghost.direction.copyToArray(beam->normals + 3 * i);
+
+    beam->amplitude[i]     = ghost.amplitude;
+    beam->lengths[i]       = 0;
+    beam->cumOptLengths[i] = ghost.cumOptLength;
+    beam->wavelengths[i]   = ghost.wavelength;
+    beam->refNdx[i]        = ghost.refNdx;
+    beam->ids[i]           = ghost.id;
+    beam->surfaces[i]      = ghost.surface;
+  }
+
+  m_ghosts.clear();
+
+  return beam;
+}
+
+//////////////////////////// Multi-process tracing ////////////////////////////
+//
+// The shared segment is an anonymous MAP_SHARED mapping created before
+// forking, split in one slice per shard. Every slice starts with a header,
+// followed by the nonzero intercept statistics of the surfaces (one record
+// per surface and beam id) and, for every detector, the number of tiles
+// with hits and the tiles themselves (see DetectorStorage::packTiles()).
+//
+// Slices are sized for the worst case of their shard, but never above
+// RZ_SHARD_MAX_SLICE. As children write them from the start and pages are
+// only backed when touched, what is reserved but not written costs nothing.
+// If the statistics alone may not fit (too many beam ids per shard), the
+// trace is not sharded. If a child runs out of room anyway, the trace is
+// repeated in the parent.
+//
+#define RZ_SHARD_ALIGNMENT 64
+#define RZ_SHARD_MAX_SLICE (256 << 20)
+
+namespace RZ {
+  struct SimulationShardHeader {
+    uint64_t done;     // Set by the child after writing everything else
+    uint64_t overflow; // Set by the child if its results did not fit
+    uint64_t rays;
+    uint64_t stats;    // Number of SimulationShardStats records
+  };
+
+  struct SimulationShardStats {
+    uint32_t surface;
+    uint32_t id;
+    uint64_t intercepted;
+    uint64_t vignetted;
+    uint64_t pruned;
+  };
+
+  struct SimulationShardLayout {
+    std::vector<Detector *>       detectors;
+    std::vector<OpticalSurface *> surfaces;
+    size_t                        size = 0;
+  };
+}
+
+static inline size_t
+shardAlign(size_t size)
+{
+  return (size + RZ_SHARD_ALIGNMENT - 1) & ~size_t(RZ_SHARD_ALIGNMENT - 1);
+}
+
+// Each shard has its own random streams: those of the C library (used by
+// random samplers) and those of the EM interfaces of every surface.
+void
+Simulation::seedShard(unsigned int shard)
+{
+  seedRandomStreams(m_shardSeed + (static_cast<uint64_t>(shard) << 32));
+}
+
+void
+Simulation::seedRandomStreams(uint64_t seed)
+{
+  uint64_t n = 0;
+
+  srand(static_cast<unsigned>(seed));
+  m_ghostRandState.setSeed(seed);
+
+  for (auto element : m_model->allOpticalElements())
+    for (auto surface : element->opticalSurfaces())
+      if (surface->boundary != nullptr
+          && surface->boundary->emInterface() != nullptr)
+        surface->boundary->emInterface()->setSeed(seed + ++n);
+}
+
+//
+// Bounds the results of a shard: every beam id (and its ghosts) on every
+// surface, and every tile of every detector up to one per traced ray and
+// generation. False if the statistics alone would exceed the slice limit.
+//
+bool
+Simulation::planShards(
+  TracingProperties const &props,
+  size_t count,
+  SimulationShardLayout &layout)
+{
+  std::set<uint32_t> ids;
+  unsigned int shards = static_cast<unsigned int>(
+    std::min<size_t>(m_processes, count));
+  size_t rays = (count + shards - 1) / shards;
+  size_t generations = 1;
+  size_t size, perShard;
+
+  if (props.pArrays != nullptr) {
+    if (props.pArrays->ids != nullptr)
+      ids.insert(props.pArrays->ids, props.pArrays->ids + count);
+    else
+      ids.insert(0);
+  } else {
+    const RayList *pRays = props.pRays != nullptr ? props.pRays : &props.rays;
+    for (auto &ray : *pRays)
+      ids.insert(ray.id);
+  }
+
+  // Ghosts of every generation are counted apart
+  if (props.type == NonSequential)
+    generations += props.ghosts.maxDepth;
+
+  for (auto element : m_model->allOpticalElements())
+    for (auto surface : element->opticalSurfaces())
+      layout.surfaces.push_back(surface);
+
+  perShard = std::min(ids.size(), rays) * generations;
+  size     = shardAlign(sizeof(SimulationShardHeader))
+    + layout.surfaces.size() * perShard * sizeof(SimulationShardStats);
+
+  if (size > RZ_SHARD_MAX_SLICE) {
+    RZDebug(
+      "Simulation: %zu beam ids per shard are too many to shard the trace\n",
+      perShard);
+    return false;
+  }
+
+  for (auto &name : m_model->detectors()) {
+    auto detector = m_model->lookupDetectorOrEx(name);
+    uint64_t tiles =
+        uint64_t((detector->cols() + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS)
+      * ((detector->rows() + RZ_DETECTOR_TILE_MASK) >> RZ_DETECTOR_TILE_BITS);
+
+    layout.detectors.push_back(detector);
+    size = shardAlign(size) + sizeof(uint64_t)
+      + std::min<uint64_t>(tiles, rays * generations) * detector->tileRecordSize();
+
+    if (size > RZ_SHARD_MAX_SLICE)
+      size = RZ_SHARD_MAX_SLICE;
+  }
+
+  layout.size = shardAlign(size);
+
+  return true;
+}
+
+// Runs in the child process
+bool
+Simulation::traceShard(
+  TracingProperties const &props,
+  SimulationShardLayout const &layout,
+  size_t start,
+  size_t end,
+  unsigned int shard,
+  uint8_t *dest)
+{
+  TracingProperties shardProps = props;
+  RayArrays arrays;
+  RayList   rays;
+  auto header = reinterpret_cast<SimulationShardHeader *>(dest);
+  auto stats  = reinterpret_cast<SimulationShardStats *>(
+    dest + shardAlign(sizeof(SimulationShardHeader)));
+  size_t offset;
+
+  m_processes = 1;
+
+  shardProps.listener       = nullptr;
+  shardProps.beamElement    = nullptr;
+  shardProps.clearDetectors = true;
+  shardProps.pRays          = nullptr;
+  shardProps.pArrays        = nullptr;
+
+  if (props.pArrays != nullptr) {
+    arrays              = *props.pArrays;
+    arrays.count        = end - start;
+    arrays.origins     += 3 * start;
+    arrays.directions  += 3 * start;
+    if (arrays.wavelengths != nullptr)
+      arrays.wavelengths += start;
+    if (arrays.ids != nullptr)
+      arrays.ids += start;
+    shardProps.pArrays  = &arrays;
+  } else {
+    const RayList *pRays = props.pRays != nullptr ? props.pRays : &props.rays;
+    auto it = pRays->begin();
+
+    std::advance(it, start);
+    for (auto i = start; i < end; ++i)
+      rays.push_back(*it++);
+
+    shardProps.pRays = &rays;
+  }
+
+  shardProps.rays.clear();
+
+  seedShard(shard);
+  for (auto surface : layout.surfaces)
+    surface->clearStatistics();
+
+  if (!trace(shardProps))
+    return false;
+
+  header->stats = 0;
+  for (size_t i = 0; i < layout.surfaces.size(); ++i) {
+    for (auto &p : layout.surfaces[i]->statistics) {
+      auto &entry = p.second;
+
+      if (entry.intercepted == 0 && entry.vignetted == 0 && entry.pruned == 0)
+        continue;
+
+      offset = reinterpret_cast<uint8_t *>(stats + header->stats + 1) - dest;
+      if (offset > layout.size)
+        goto overflow;
+
+      stats[header->stats].surface     = static_cast<uint32_t>(i);
+      stats[header->stats].id          = p.first;
+      stats[header->stats].intercepted = entry.intercepted;
+      stats[header->stats].vignetted   = entry.vignetted;
+      stats[header->stats].pruned      = entry.pruned;
+      ++header->stats;
+    }
+  }
+
+  offset = reinterpret_cast<uint8_t *>(stats + header->stats) - dest;
+
+  for (auto detector : layout.detectors) {
+    uint64_t tiles;
+
+    offset = shardAlign(offset);
+    if (offset + sizeof(uint64_t) > layout.size)
+      goto overflow;
+
+    if (!detector->packTiles(
+        dest + offset + sizeof(uint64_t),
+        layout.size - offset - sizeof(uint64_t),
+        tiles))
+      goto overflow;
+
+    memcpy(dest + offset, &tiles, sizeof(uint64_t));
+    offset += sizeof(uint64_t) + tiles * detector->tileRecordSize();
+  }
+
+  header->rays = end - start;
+  header->done = 1;
+
+  return true;
+
+overflow:
+  header->overflow = 1;
+  header->done     = 1;
+
+  return true;
+}
+
+//
+// Forks up to m_processes children, each tracing a contiguous shard of
+// the rays on its copy-on-write copy of the model, and merges their
+// results into the detectors and surfaces of the parent. If the results
+// of any shard did not fit in its slice, nothing is merged and `overflow'
+// is set, for the caller to trace the rays in this process instead.
+//
+bool
+Simulation::traceSharded(
+  TracingProperties const &props,
+  size_t count,
+  SimulationShardLayout const &layout,
+  bool &overflow)
+{
+  ForkedWorkers workers("Shard");
+  unsigned int shards = static_cast<unsigned int>(
+    std::min<size_t>(m_processes, count));
+  uint8_t *segment = nullptr;
+  bool ok = false;
+
+  overflow = false;
+
+  if (!workers.map(layout.size * shards))
+    return false;
+
+  segment = workers.segment();
+
+  ok = workers.start(
+    shards,
+    [&] (unsigned int i) {
+      return traceShard(
+        props,
+        layout,
+        (count * i) / shards,
+        (count * (i + 1)) / shards,
+        i,
+        segment + i * layout.size);
+    });
+
+  ok = workers.wait() && ok;
+
+  for (unsigned int i = 0; ok && i < shards; ++i) {
+    auto header = reinterpret_cast<SimulationShardHeader *>(
+      segment + i * layout.size);
+    ok = header->done == 1;
+    overflow = overflow || header->overflow != 0;
+  }
+
+  if (!ok || overflow) {
+    if (overflow)
+      RZDebug("Simulation: shard results do not fit, tracing unsharded\n");
+    goto done;
+  }
+
+  // Merge the results
+  if (props.clearDetectors)
+    for (auto detector : layout.detectors)
+      detector->clear();
+
+  for (unsigned int i = 0; i < shards; ++i) {
+    uint8_t *base = segment + i * layout.size;
+    auto header = reinterpret_cast<const SimulationShardHeader *>(base);
+    auto stats  = reinterpret_cast<const SimulationShardStats *>(
+      base + shardAlign(sizeof(SimulationShardHeader)));
+    size_t offset;
+
+    for (uint64_t n = 0; n < header->stats; ++n) {
+      auto &entry = layout.surfaces[stats[n].surface]->statistics[stats[n].id];
+      entry.intercepted += stats[n].intercepted;
+      entry.vignetted   += stats[n].vignetted;
+      entry.pruned      += stats[n].pruned;
+    }
+
+    offset = reinterpret_cast<const uint8_t *>(stats + header->stats) - base;
+
+    for (auto detector : layout.detectors) {
+      uint64_t tiles;
+
+      offset = shardAlign(offset);
+      memcpy(&tiles, base + offset, sizeof(uint64_t));
+      offset += sizeof(uint64_t);
+
+      detector->mergeTiles(base + offset, tiles);
+      offset += tiles * detector->tileRecordSize();
+    }
+  }
+
+done:
+  m_engine->tick();
+  m_lastTick = m_engine->lastTick();
+
+  return ok;
+}
+
 bool
 Simulation::trace(TracingProperties const &props)
+{
+  std::vector<Detector *> weighted;
+  bool ok;
+
+  const RayList *pRays = props.pRays != nullptr 
+    ? props.pRays 
+    : &props.rays;
+  size_t count = props.pArrays != nullptr
+    ? props.pArrays->count
+    : pRays->size();
+
+  if (props.type == NonSequential && props.ghosts.maxDepth > 0)
+    prepareGhosts(props, count, weighted);
+
+  try {
+    ok = traceRays(props, count);
+  } catch (...) {
+    restoreGhosts(weighted);
+    throw;
+  }
+
+  restoreGhosts(weighted);
+
+  return ok;
+}
+
+bool
+Simulation::traceRays(TracingProperties const &props, size_t count)
 {
   bool ok = false;
+  bool compact;
 
   const RayList *pRays = props.pRays != nullptr 
     ? props.pRays 
     : &props.rays;
-  
+
+  if (m_processes > 1
+      && count > 1
+      && props.beamElement == nullptr
+      && !props.keepBeam) {
+    SimulationShardLayout layout;
+    bool recording = false;
+
+    for (auto element : m_model->allOpticalElements())
+      recording = recording || element->recordHits();
+
+    if (!recording && planShards(props, count, layout)) {
+      bool overflow;
+
+      if (props.clearPrevious)
+        m_intermediateRays.clear();
+
+      ok = traceSharded(props, count, layout, overflow);
+      if (!overflow)
+        return ok;
+    }
+  }
+
   if (props.clearPrevious)
     m_intermediateRays.clear();
 
+  compact = m_precision == SinglePrecision
+    && props.type == Sequential
+    && !props.keepBeam;
+
   m_engine->setListener(props.listener);
   m_engine->clear(); // Reset previous simulation
+  m_engine->profiler().reset();
 
   // Clear all detectors, if requested
   if (props.clearDetectors)
     for (auto p : m_model->detectors())
       m_model->lookupDetectorOrEx(p)->clear();
 
-  m_engine->pushRays(*pRays);
+  if (compact) {
+    if (props.pArrays != nullptr)
+      m_compactBeam.assign(*props.pArrays);
+    else
+      m_compactBeam.assign(*pRays);
+  } else if (props.pArrays != nullptr) {
+    m_engine->pushRays(*props.pArrays);
+  } else {
+    m_engine->pushRays(*pRays);
+  }
 
   if (props.startTime != nullptr)
     m_engine->setStartTime(*props.startTime);
@@ -233,7 +1032,7 @@ Simulation::trace(TracingProperties const &props)
 
   switch (props.type) {
     case Sequential:
-      ok = traceSequential(props);
+      ok = compact ? traceSequentialCompact(props) : traceSequential(props);
       break;
 
     case NonSequential:
@@ -257,3 +1056,479 @@ Simulation::lastTick() const
 {
   return m_lastTick;
 }
+
+void
+Simulation::setProfiling(bool enabled)
+{
+  m_engine->profiler().setEnabled(enabled);
+}
+
+bool
+Simulation::profiling() const
+{
+  return m_engine->profiler().enabled();
+}
+
+RayTracingProfiler const &
+Simulation::profiler() const
+{
+  return m_engine->profiler();
+}
+
+void
+Simulation::setProcesses(unsigned int processes)
+{
+  m_processes = std::max(processes, 1u);
+}
+
+unsigned int
+Simulation::processes() const
+{
+  return m_processes;
+}
+
+void
+Simulation::setBlockSize(uint64_t size)
+{
+  m_blockSize = (size + 63) & ~uint64_t(63);
+}
+
+uint64_t
+Simulation::blockSize() const
+{
+  return m_blockSize;
+}
+
+void
+Simulation::setPrecision(TracingPrecision precision)
+{
+  m_precision = precision;
+
+  // The compact beam is only meaningful in single precision
+  if (precision != SinglePrecision)
+    m_compactBeam.clear();
+}
+
+TracingPrecision
+Simulation::precision() const
+{
+  return m_precision;
+}
+
+void
+Simulation::setShardSeed(uint64_t seed)
+{
+  m_shardSeed = seed;
+}
+
+///////////////////////////// Progressive tracing //////////////////////////////
+struct SpotMetrics {
+  uint64_t hits = 0;
+  Real     x0   = 0;
+  Real     y0   = 0;
+  Real     rms  = 0;
+  Real     ee   = 0;
+};
+
+//
+// Spot metrics of a detector image, given as the difference between two
+// dense images (as returned by Detector::data()). Pixels are taken at
+// their centers.
+//
+static SpotMetrics
+spotMetrics(
+  Detector const *detector,
+  const uint32_t *image,
+  const uint32_t *base,
+  Real fraction)
+{
+  SpotMetrics metrics;
+  std::vector<std::pair<Real, uint32_t>> radii;
+  unsigned int cols   = detector->cols();
+  unsigned int rows   = detector->rows();
+  unsigned int stride = detector->stride();
+  Real pxWidth  = detector->pxWidth();
+  Real pxHeight = detector->pxHeight();
+  Real x0 = -.5 * cols * pxWidth + .5 * pxWidth;
+  Real y0 = -.5 * rows * pxHeight + .5 * pxHeight;
+  Real sx = 0, sy = 0, r2 = 0, target, cumul = 0;
+
+  for (unsigned int j = 0; j < rows; ++j) {
+    for (unsigned int i = 0; i < cols; ++i) {
+      size_t ndx = i + j * stride;
+      uint32_t counts = image[ndx] - (base != nullptr ? base[ndx] : 0);
+
+      if (counts > 0) {
+        metrics.hits += counts;
+        sx += counts * (x0 + i * pxWidth);
+        sy += counts * (y0 + j * pxHeight);
+      }
+    }
+  }
+
+  if (metrics.hits == 0)
+    return metrics;
+
+  metrics.x0 = sx / metrics.hits;
+  metrics.y0 = sy / metrics.hits;
+
+  for (unsigned int j = 0; j < rows; ++j) {
+    for (unsigned int i = 0; i < cols; ++i) {
+      size_t ndx = i + j * stride;
+      uint32_t counts = image[ndx] - (base != nullptr ? base[ndx] : 0);
+
+      if (counts > 0) {
+        Real dx = x0 + i * pxWidth  - metrics.x0;
+        Real dy = y0 + j * pxHeight - metrics.y0;
+        Real d2 = dx * dx + dy * dy;
+
+        r2 += counts * d2;
+        radii.push_back(std::make_pair(d2, counts));
+      }
+    }
+  }
+
+  metrics.rms = sqrt(r2 / metrics.hits);
+
+  std::sort(radii.begin(), radii.end());
+  target = fraction * metrics.hits;
+
+  for (auto &p : radii) {
+    cumul += p.second;
+    if (cumul >= target) {
+      metrics.ee = sqrt(p.first);
+      break;
+    }
+  }
+
+  return metrics;
+}
+
+// Relative standard error of `estimate', from the spread of batch values
+static Real
+batchRelativeError(std::vector<Real> const &values, Real estimate)
+{
+  size_t n = values.size();
+  Real mean = 0, var = 0;
+
+  if (n < 2 || estimate == 0)
+    return 0;
+
+  for (auto v : values)
+    mean += v;
+  mean /= n;
+
+  for (auto v : values)
+    var += (v - mean) * (v - mean);
+  var /= n - 1;
+
+  return sqrt(var / n) / fabs(estimate);
+}
+
+static uint64_t
+interceptedRays(OpticalSurface const *surface)
+{
+  uint64_t intercepted = 0;
+
+  for (auto &p : surface->statistics)
+    intercepted += p.second.intercepted;
+
+  return intercepted;
+}
+
+bool
+Simulation::traceProgressive(
+  TracingProperties const &props,
+  BeamProperties const &beam,
+  ProgressiveTracingProperties const &progProps,
+  ProgressiveTracingResult &result)
+{
+  TracingProperties batchProps = props;
+  BeamProperties batchBeam = beam;
+  Detector *detector = nullptr;
+  const OpticalSurface *surface = nullptr;
+  std::vector<uint32_t> base, prev;
+  std::vector<Real> transmissions, rmsRadii, eeRadii;
+  uint64_t intercepted = 0, prevIntercepted = 0;
+  size_t pixels = 0;
+  double start = monotonicSeconds();
+  RayList rays;
+
+  if (progProps.maxRays == 0 && progProps.timeBudget <= 0)
+    throw std::runtime_error(
+      "Progressive traces need either a maximum number of rays or a time budget");
+
+  if (progProps.batchRays == 0)
+    throw std::runtime_error("Progressive traces need non-empty batches");
+
+  if (!progProps.detector.empty()) {
+    detector = m_model->lookupDetectorOrEx(progProps.detector);
+    surface  = detector->opticalSurfaces().front();
+    pixels   = detector->rows() * detector->stride();
+  } else if (props.type == Sequential) {
+    auto path = m_model->lookupOpticalPathOrEx(props.path);
+    if (!path->m_sequence.empty())
+      surface = path->m_sequence.back();
+  }
+
+  result = ProgressiveTracingResult();
+
+  batchBeam.random    = true;
+  batchProps.pRays    = &rays;
+  batchProps.pArrays  = nullptr;
+  batchProps.rays.clear();
+
+  if (surface != nullptr)
+    prevIntercepted = interceptedRays(surface);
+
+  do {
+    uint64_t count = progProps.batchRays;
+    uint64_t batchIntercepted;
+    bool converged = true;
+
+    if (progProps.maxRays > 0)
+      count = std::min(count, progProps.maxRays - result.rays);
+
+    rays.clear();
+    batchBeam.numRays = count;
+    OMModel::addBeam(rays, batchBeam);
+
+    if (rays.empty())
+      break;
+
+    batchProps.clearDetectors = props.clearDetectors && result.batches == 0;
+    batchProps.clearPrevious  = props.clearPrevious  && result.batches == 0;
+
+    if (result.batches == 0 && detector != nullptr) {
+      // Whatever the detectors hold before the first batch is not ours
+      if (batchProps.clearDetectors)
+        base.assign(pixels, 0);
+      else
+        base.assign(detector->data(), detector->data() + pixels);
+      prev = base;
+    }
+
+    if (!trace(batchProps))
+      return false;
+
+    result.rays += rays.size();
+    ++result.batches;
+
+    if (surface != nullptr) {
+      batchIntercepted = interceptedRays(surface) - prevIntercepted;
+      prevIntercepted += batchIntercepted;
+      intercepted     += batchIntercepted;
+
+      transmissions.push_back(batchIntercepted / static_cast<Real>(rays.size()));
+
+      result.transmission      = intercepted / static_cast<Real>(result.rays);
+      result.transmissionError = batchRelativeError(transmissions, result.transmission);
+    }
+
+    if (detector != nullptr) {
+      const uint32_t *image = detector->data();
+      auto batch = spotMetrics(detector, image, prev.data(), progProps.encircledFraction);
+      auto total = spotMetrics(detector, image, base.data(), progProps.encircledFraction);
+
+      prev.assign(image, image + pixels);
+
+      if (batch.hits > 0) {
+        rmsRadii.push_back(batch.rms);
+        eeRadii.push_back(batch.ee);
+      }
+
+      result.centroidX            = total.x0;
+      result.centroidY            = total.y0;
+      result.rmsRadius            = total.rms;
+      result.rmsRadiusError       = batchRelativeError(rmsRadii, total.rms);
+      result.encircledRadius      = total.ee;
+      result.encircledRadiusError = batchRelativeError(eeRadii, total.ee);
+    }
+
+    result.elapsed = monotonicSeconds() - start;
+
+    if (result.batches >= std::max(progProps.minBatches, 2u)) {
+      converged = result.transmissionError    <= progProps.tolerance
+               && result.rmsRadiusError       <= progProps.tolerance
+               && result.encircledRadiusError <= progProps.tolerance;
+
+      if (converged) {
+        result.converged = true;
+        break;
+      }
+    }
+
+    if (props.listener != nullptr && props.listener->cancelled())
+      return false;
+  } while ((progProps.maxRays == 0 || result.rays < progProps.maxRays)
+    && (progProps.timeBudget <= 0 || result.elapsed < progProps.timeBudget));
+
+  return true;
+}
+
+////////////////////////////////// Ray aiming //////////////////////////////////
+
+//
+// Area of the intersection of two circles of radii r and R whose centers
+// are d apart.
+//
+static Real
+circleOverlap(Real r, Real R, Real d)
+{
+  if (d >= r + R)
+    return 0;
+
+  if (d <= fabs(R - r))
+    return M_PI * std::min(r, R) * std::min(r, R);
+
+  Real r2 = r * r;
+  Real R2 = R * R;
+  Real a  = acos((d * d + r2 - R2) / (2 * d * r));
+  Real b  = acos((d * d + R2 - r2) / (2 * d * R));
+
+  return r2 * (a - .5 * sin(2 * a)) + R2 * (b - .5 * sin(2 * b));
+}
+
+Real
+Simulation::aimBeam(
+  BeamProperties &beam,
+  std::string const &path,
+  unsigned int probes)
+{
+  BeamProperties probeBeam = beam;
+  TracingProperties props;
+  CircularSampler sampler;
+  std::vector<Vec3> coords;
+  std::list<DetectorStorage> spares;
+  std::list<Detector *> detectors;
+  std::list<std::pair<OpticalSurface *, std::map<uint32_t, RayBeamStatistics>>> saved;
+  std::list<RayHitBuffer> hits;
+  RayList rays;
+  Vec3 coord;
+  Real R = .5 * beam.diameter;
+  Real xMin = +INFINITY, xMax = -INFINITY, yMin = +INFINITY, yMax = -INFINITY;
+  Real x0, y0, rMax = 0, spacing, weight;
+  uint64_t survivors = 0;
+  bool ok;
+
+  beam.aimed = false;
+  beam.aimWeight = 1;
+
+  // Beams whose rays arrive from several directions have a different
+  // footprint per direction, and are traced whole.
+  if (beam.shape != Circular
+      || isZero(beam.diameter)
+      || probes == 0
+      || (std::isinf(beam.focusZ) && beam.objectShape != PointLike))
+    return 1;
+
+  // Same grid that OMModel::addBeam uses for the probe beam, so that
+  // the i-th probe ray comes from the i-th coordinate.
+  probeBeam.random     = false;
+  probeBeam.vignetting = true;
+  probeBeam.numRays    = probes;
+
+  sampler.setRadius(R);
+  sampler.setRandom(false);
+  if (!sampler.sample(probes))
+    throw std::runtime_error("Failed to acquire probe points for ray aiming");
+
+  while (sampler.get(coord))
+    coords.push_back(coord);
+
+  OMModel::addBeam(rays, probeBeam);
+
+  if (rays.size() != coords.size())
+    throw std::runtime_error("Unexpected number of probe rays for ray aiming");
+
+  // The probes must leave no trace in detectors, statistics or hits
+  for (auto &name : m_model->detectors()) {
+    auto detector = m_model->lookupDetectorOrEx(name);
+
+    // Aliases
+    if (std::find(detectors.begin(), detectors.end(), detector) != detectors.end())
+      continue;
+
+    spares.emplace_back(1, 1, detector->width(), detector->height());
+    detector->swapStorage(spares.back());
+    detectors.push_back(detector);
+  }
+
+  for (auto element : m_model->allOpticalElements())
+    for (auto surface : element->opticalSurfaces()) {
+      saved.push_back(std::make_pair(surface, surface->statistics));
+      hits.emplace_back();
+      hits.back().swap(surface->hits);
+    }
+
+  props.type           = Sequential;
+  props.path           = path;
+  props.pRays          = &rays;
+  props.keepBeam       = true;
+  props.clearPrevious  = false;
+  props.clearDetectors = false;
+
+  ok = trace(props);
+
+  if (ok) {
+    auto traced = m_engine->beam();
+
+    for (size_t i = 0; i < coords.size(); ++i)
+      if (traced->hasRay(i)) {
+        xMin = std::min(xMin, coords[i].x);
+        xMax = std::max(xMax, coords[i].x);
+        yMin = std::min(yMin, coords[i].y);
+        yMax = std::max(yMax, coords[i].y);
+        ++survivors;
+      }
+  }
+
+  // Put everything back
+  auto spare = spares.begin();
+  for (auto detector : detectors)
+    detector->swapStorage(*spare++);
+
+  auto hit = hits.begin();
+  for (auto &p : saved) {
+    p.first->statistics = std::move(p.second);
+    p.first->hits.swap(*hit++);
+    p.first->clearCache();
+  }
+
+  if (!ok)
+    throw std::runtime_error("Failed to trace probe rays for ray aiming");
+
+  // Fully vignetted: the beam is left whole, but it carries no flux
+  if (survivors == 0) {
+    beam.aimWeight = 0;
+    return 0;
+  }
+
+  x0 = .5 * (xMin + xMax);
+  y0 = .5 * (yMin + yMax);
+
+  for (size_t i = 0; i < coords.size(); ++i)
+    if (m_engine->beam()->hasRay(i)) {
+      Real dx = coords[i].x - x0;
+      Real dy = coords[i].y - y0;
+      rMax = std::max(rMax, sqrt(dx * dx + dy * dy));
+    }
+
+  // One probe spacing of margin, for the part of the footprint that
+  // falls between the probes.
+  spacing = R * sqrt(M_PI / coords.size());
+  rMax   += spacing;
+
+  weight  = circleOverlap(rMax, R, sqrt(x0 * x0 + y0 * y0)) / (M_PI * R * R);
+
+  if (weight >= 1)
+    return 1;
+
+  beam.aimed     = true;
+  beam.aimX      = x0;
+  beam.aimY      = y0;
+  beam.aimRadius = rMax;
+  beam.aimWeight = weight;
+
+  return weight;
+}
@@ -21,6 +21,7 @@
 #include <Elements/ApertureStop.h>
 #include <Recipe.h>
 #include <ParserContext.h>
+#include <RecipeCache.h>
 #include <Helpers.h>
 
 using namespace RZ;
@@ -167,16 +168,24 @@ TopLevelModel::fromFile(
 {
   std::string exceptionString;
   TopLevelModel *tlModel = nullptr;
-  Recipe *recipe = new Recipe();
+  RecipeCache *cache = RecipeCache::instance();
+  FileParserContext *ctx = nullptr;
+  FILE *fp = nullptr;
+  Recipe *recipe = cache->load(path, searchPaths);
+
+  // Unchanged models skip parsing altogether
+  if (recipe != nullptr)
+    goto build;
 
+  recipe = new Recipe();
   recipe->addDof("t", 0, 0, 1e6);
 
-  FileParserContext *ctx = new FileParserContext(recipe);
+  ctx = new FileParserContext(recipe);
 
   for (auto &srchPath : searchPaths)
     ctx->addSearchPath(srchPath);
 
-  FILE *fp = fopen(path.c_str(), "r");
+  fp = fopen(path.c_str(), "r");
   
   if (fp == nullptr) {
     exceptionString = string_printf(
@@ -196,6 +205,9 @@ TopLevelModel::fromFile(
     goto done;
   }
 
+  cache->save(path, searchPaths, recipe, ctx->dependencies());
+
+build:
   try {
     tlModel = new TopLevelModel(recipe);
     tlModel->setName(path);
@@ -209,7 +221,8 @@ done:
   if (fp != nullptr)
     fclose(fp);
 
-  delete ctx;
+  if (ctx != nullptr)
+    delete ctx;
 
   if (recipe != nullptr)
     delete recipe;
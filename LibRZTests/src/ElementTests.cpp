@@ -23,6 +23,7 @@
 #include <Element.h>
 #include <WorldFrame.h>
 #include <Singleton.h>
+#include <Elements/Detector.h>
 #include <algorithm>
 
 using namespace RZ;
@@ -256,3 +257,169 @@ TEST_CASE("Element port access", THIS_TEST_TAG)
     delete element;
   }
 }
+
+TEST_CASE("Tiled detector storage", THIS_TEST_TAG)
+{
+  // Not a multiple of the tile size, to exercise partial tiles
+  unsigned int cols = 1000, rows = 700;
+  Real pxSize = 15e-6;
+  Real width  = cols * pxSize;
+  Real height = rows * pxSize;
+
+  DetectorStorage dense(cols, rows, pxSize, pxSize);
+  DetectorStorage tiled(cols, rows, pxSize, pxSize);
+
+  tiled.setTiled(true);
+  REQUIRE(tiled.tiled());
+  REQUIRE(tiled.allocatedTiles() == 0);
+
+  // Concentrate the hits in a small region of the detector
+  for (auto i = 0; i < 10000; ++i) {
+    Real x = .05 * width  * RZ_URANDSIGN - .3 * width;
+    Real y = .05 * height * RZ_URANDSIGN + .2 * height;
+    Complex A = std::polar(1., 2 * M_PI * RZ_URANDSIGN);
+
+    REQUIRE(dense.hit(x, y, A) == tiled.hit(x, y, A));
+  }
+
+  printf("Tiled detector: %ld tiles allocated\n", tiled.allocatedTiles());
+  REQUIRE(tiled.allocatedTiles() > 0);
+  REQUIRE(tiled.allocatedTiles() < 16 * 11);
+  REQUIRE(tiled.memoryUsage() < dense.memoryUsage());
+  REQUIRE(dense.maxCounts() == tiled.maxCounts());
+  REQUIRE(releq(dense.maxEnergy(), tiled.maxEnergy()));
+
+  const uint32_t *denseData = dense.data();
+  const uint32_t *tiledData = tiled.data();
+  const Complex  *denseAmp  = dense.amplitude();
+  const Complex  *tiledAmp  = tiled.amplitude();
+
+  REQUIRE(dense.stride() == tiled.stride());
+
+  for (unsigned j = 0; j < rows; ++j)
+    for (unsigned i = 0; i < cols; ++i) {
+      auto ndx = i + j * dense.stride();
+      REQUIRE(denseData[ndx] == tiledData[ndx]);
+      REQUIRE(denseData[ndx] == tiled.counts(i, j));
+      REQUIRE(denseAmp[ndx] == tiledAmp[ndx]);
+    }
+
+  tiled.clear();
+  REQUIRE(tiled.allocatedTiles() == 0);
+  REQUIRE(tiled.maxCounts() == 0);
+
+  // Incoherent detectors drop the amplitude plane
+  tiled.setCoherent(false);
+  REQUIRE(tiled.amplitude() == nullptr);
+  REQUIRE(tiled.hit(0, 0, 1.));
+  REQUIRE(tiled.counts(cols / 2, rows / 2) == 1);
+  REQUIRE(tiled.maxEnergy() == 0);
+}
+
+TEST_CASE("Detector storage snapshots", THIS_TEST_TAG)
+{
+  WorldFrame world("world");
+  auto factory = Singleton::instance()->lookupElementFactory("Detector");
+  REQUIRE(factory != nullptr);
+
+  auto detector = static_cast<Detector *>(factory->make("det", &world, nullptr));
+  REQUIRE(detector->set("cols", 100));
+  REQUIRE(detector->set("rows", 80));
+
+  // Inject an image with some hits in the center
+  DetectorStorage image(100, 80, detector->pxWidth(), detector->pxHeight());
+  for (auto i = 0; i < 10; ++i)
+    REQUIRE(image.hit(0, 0, 1.));
+
+  detector->swapStorage(image);
+  REQUIRE(detector->maxCounts() == 10);
+  REQUIRE(image.maxCounts() == 0);
+
+  // Take it back into a spare of the wrong shape. The detector must be
+  // left clean and with its own shape.
+  DetectorStorage spare(3, 3, 1e-3, 1e-3);
+  detector->swapStorage(spare);
+
+  REQUIRE(detector->maxCounts() == 0);
+  REQUIRE(detector->cols() == 100);
+  REQUIRE(detector->rows() == 80);
+  REQUIRE(spare.maxCounts() == 10);
+  REQUIRE(spare.cols() == 100);
+  REQUIRE(spare.counts(50, 40) == 10);
+
+  delete detector;
+}
+
+TEST_CASE("Detector storage merging", THIS_TEST_TAG)
+{
+  DetectorStorage dense(100, 80, 15e-6, 15e-6);
+  DetectorStorage tiled(100, 80, 15e-6, 15e-6);
+  DetectorStorage other(100, 80, 15e-6, 15e-6);
+
+  tiled.setTiled(true);
+
+  for (auto i = 0; i < 3; ++i) {
+    REQUIRE(dense.hit(0, 0, 1.));
+    REQUIRE(tiled.hit(0, 0, 1.));
+  }
+
+  for (auto i = 0; i < 4; ++i) {
+    REQUIRE(other.hit(0, 0, 1.));
+    REQUIRE(other.hit(5e-4, 3.1e-4, 1.));
+  }
+
+  REQUIRE(dense.merge(other));
+  REQUIRE(tiled.merge(other));
+
+  for (auto storage : {&dense, &tiled}) {
+    REQUIRE(storage->counts(50, 40) == 7);
+    REQUIRE(storage->maxCounts() == 7);
+    REQUIRE(std::abs(storage->amplitudeAt(50, 40) - Complex(7.)) < 1e-12);
+    REQUIRE(std::abs(storage->maxEnergy() - 49.) < 1e-9);
+  }
+
+  REQUIRE(dense.counts(83, 60) == 4);
+  REQUIRE(tiled.counts(83, 60) == 4);
+  REQUIRE(tiled.allocatedTiles() == 2);
+
+  DetectorStorage wrong(10, 10, 15e-6, 15e-6);
+  REQUIRE(!dense.merge(wrong));
+}
+
+TEST_CASE("Property handles", THIS_TEST_TAG)
+{
+  WorldFrame world("world");
+
+  for (auto &p : Singleton::instance()->elementFactories()) {
+    auto factory = Singleton::instance()->lookupElementFactory(p);
+    auto element = factory->make(p, &world, nullptr);
+    REQUIRE(element != nullptr);
+
+    REQUIRE(element->propertyHandle("thisDoesNotExist") == RZ_INVALID_PROPERTY_HANDLE);
+    REQUIRE(!element->set(RZ_INVALID_PROPERTY_HANDLE, 1.));
+
+    for (auto &prop : element->properties()) {
+      auto handle = element->propertyHandle(prop);
+      REQUIRE(handle != RZ_INVALID_PROPERTY_HANDLE);
+      REQUIRE(element->propertyHandle(prop) == handle);
+      REQUIRE(element->propertyName(handle) == prop);
+      REQUIRE(element->queryPropertyType(handle) == element->queryPropertyType(prop));
+
+      if (element->queryPropertyType(handle) == RealValue
+          && !element->propertyIsHidden(prop)) {
+        PropertyValue before = element->get(prop);
+        std::string description = before.description();
+
+        // Setting the current value must be accepted and keep metadata
+        if (element->set(handle, before.asReal())) {
+          PropertyValue after = element->get(prop);
+          REQUIRE(after.type() == RealValue);
+          REQUIRE(after.asReal() == before.asReal());
+          REQUIRE(after.description() == description);
+        }
+      }
+    }
+
+    delete element;
+  }
+}
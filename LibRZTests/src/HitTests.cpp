@@ -664,3 +664,78 @@ TEST_CASE("Asymmetric lens: center and focus (object)", THIS_TEST_TAG)
 
   delete model;
 }
+
+TEST_CASE("Hits are recorded in columns by beam id", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_parabolicReflectorCode);
+  REQUIRE(model);
+
+  auto det = model->lookupOpticalElement("det");
+  REQUIRE(det != nullptr);
+  det->setRecordHits(true);
+
+  auto fp = det->opticalSurfaces().front();
+  auto M1 = model->lookupOpticalElement("M1");
+  RayList rays;
+  BeamProperties beamProp;
+
+  beamProp.length    = 1;
+  beamProp.diameter  = .5;
+  beamProp.numRays   = 1000;
+  beamProp.direction = -Vec3::eZ();
+  beamProp.shape     = Circular;
+  beamProp.setElementRelative(M1);
+  beamProp.collimate();
+  OMModel::addBeam(rays, beamProp);
+
+  // Beams 3 and 7, interleaved
+  uint32_t n = 0;
+  for (auto &ray : rays)
+    ray.id = (n++ & 1) ? 7 : 3;
+
+  REQUIRE(model->traceDefault(rays));
+  REQUIRE(fp->hits.size() == rays.size());
+  REQUIRE(fp->hits.groups().size() == 2);
+
+  auto beam3 = fp->hits.find(3);
+  auto beam7 = fp->hits.find(7);
+  REQUIRE(beam3 != nullptr);
+  REQUIRE(beam7 != nullptr);
+  REQUIRE(fp->hits.find(5) == nullptr);
+  REQUIRE(beam3->size() == rays.size() / 2);
+  REQUIRE(beam7->offset == beam3->size());
+
+  // Collimated beam on the focal plane of a parabola: a point
+  REQUIRE(beam7->origin(10).norm() < 1e-6);
+  REQUIRE(releq(beam7->direction(10).norm(), 1));
+
+  // Groups are views of the columns, which are sorted by id
+  auto &locations = fp->locations();
+  REQUIRE(locations.size() == 3 * rays.size());
+  REQUIRE(beam3->origins == locations.data());
+  REQUIRE(beam7->origins == locations.data() + 3 * beam3->size());
+
+  // Copies have their own groups
+  RayHitBuffer copy = fp->hits;
+  Real zero[3] = {0, 0, 0};
+  copy.push(5, zero, zero, 0);
+  REQUIRE(copy.size() == rays.size() + 1);
+  REQUIRE(copy.groups().size() == 3);
+  REQUIRE(copy.find(7)->offset == beam3->size() + 1);
+  REQUIRE(fp->hits.size() == rays.size());
+  REQUIRE(fp->hits.groups().size() == 2);
+
+  // One id per ray: a single set of columns, and a group per ray
+  det->clearHits();
+  n = 0;
+  for (auto &ray : rays)
+    ray.id = n++;
+
+  REQUIRE(model->traceDefault(rays));
+  REQUIRE(fp->hits.size() == rays.size());
+  REQUIRE(fp->locations().size() == 3 * rays.size());
+  REQUIRE(fp->hits.groups().size() == rays.size());
+  REQUIRE(fp->hits.find(10)->size() == 1);
+
+  delete model;
+}
@@ -27,6 +27,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <OpticalElement.h>
+#include <LargeAllocator.h>
 
 #define BEAM_SIZE 100
 
@@ -150,3 +151,192 @@ TEST_CASE("Ensuring that all rays are intercepted in the destination plane", THI
     }
   }
 }
+
+TEST_CASE("Beam pool recycles buffers by capacity", THIS_TEST_TAG)
+{
+  RayBeamPool pool;
+
+  auto beam = pool.acquire(1000);
+  REQUIRE(beam->count == 1000);
+  REQUIRE(beam->allocation == 1000);
+  REQUIRE(beam->countAlive() == 1000);
+  REQUIRE(pool.misses() == 1);
+
+  beam->intercept(3);
+  beam->setChiefRay(5);
+  beam->prune(7);
+  auto origins = beam->origins;
+
+  // Same buffers, smaller logical count, clean masks
+  pool.release(beam);
+  REQUIRE(pool.cached() == 1);
+
+  auto again = pool.acquire(500);
+  REQUIRE(again == beam);
+  REQUIRE(again->origins == origins);
+  REQUIRE(again->count == 500);
+  REQUIRE(again->allocation == 1000);
+  REQUIRE(again->countAlive() == 500);
+  REQUIRE(again->countIntercepted() == 0);
+  REQUIRE(!again->isChief(5));
+  REQUIRE(pool.hits() == 1);
+
+  // Growing within the allocation keeps the existing rays
+  again->origins[0] = 42;
+  again->prune(10);
+  again->allocate(800);
+  REQUIRE(again->origins == origins);
+  REQUIRE(again->origins[0] == 42);
+  REQUIRE(again->countAlive() == 799);
+
+  // Non-sequential beams are kept apart, and start pruned
+  auto ns = pool.acquire(100, true);
+  REQUIRE(ns != again);
+  REQUIRE(ns->nonSeq);
+  REQUIRE(ns->countAlive() == 0);
+
+  pool.release(again);
+  pool.release(ns);
+  REQUIRE(pool.cached() == 2);
+  REQUIRE(pool.cachedBytes() > 0);
+
+  pool.clear();
+  REQUIRE(pool.cached() == 0);
+}
+
+TEST_CASE("Engine reuses its beam across traces", THIS_TEST_TAG)
+{
+  CPURayTracingEngine engine;
+  RayBeam *first;
+
+  for (auto j = 0; j < BEAM_SIZE; ++j)
+    engine.pushRay(Point3::zero(), Vec3(0, 0, -1));
+
+  first = engine.ensureMainBeam();
+  REQUIRE(first->count == BEAM_SIZE);
+  REQUIRE(first->amplitude[0] == Complex(1, 0));
+
+  engine.clear();
+  REQUIRE(engine.beamPool().cached() == 1);
+
+  for (auto j = 0; j < BEAM_SIZE / 2; ++j)
+    engine.pushRay(Point3::zero(), Vec3(0, 0, -1));
+
+  REQUIRE(engine.ensureMainBeam() == first);
+  REQUIRE(first->count == BEAM_SIZE / 2);
+  REQUIRE(first->countAlive() == BEAM_SIZE / 2);
+}
+
+TEST_CASE("Large buffer allocation", THIS_TEST_TAG)
+{
+  LargeAllocStats before = largeAllocStats();
+  size_t small = 1000 * sizeof(uint32_t);
+  size_t large = 2 * RZ_LARGE_ALLOC_THRESHOLD + 100;
+  uint8_t *a = static_cast<uint8_t *>(allocLargeBuffer(small));
+  uint8_t *b = static_cast<uint8_t *>(allocLargeBuffer(large));
+  LargeAllocStats during = largeAllocStats();
+
+  REQUIRE(reinterpret_cast<uintptr_t>(a) % RZ_LARGE_ALLOC_ALIGNMENT == 0);
+  REQUIRE(reinterpret_cast<uintptr_t>(b) % RZ_LARGE_ALLOC_ALIGNMENT == 0);
+  REQUIRE(during.allocations == before.allocations + 2);
+  REQUIRE(during.inUse == before.inUse + small + large);
+  REQUIRE(during.peak >= during.inUse);
+  REQUIRE(during.mapped >= before.mapped + large);
+
+  // Both kinds of buffers start zeroed, and are zeroed again on request
+  for (size_t i = 0; i < small; i += 97)
+    REQUIRE(a[i] == 0);
+  for (size_t i = 0; i < large; i += 4093)
+    REQUIRE(b[i] == 0);
+
+  memset(a, 0xa5, small);
+  memset(b, 0xa5, large);
+  zeroLargeBuffer(a, small);
+  zeroLargeBuffer(b, large);
+
+  for (size_t i = 0; i < small; ++i)
+    REQUIRE(a[i] == 0);
+  for (size_t i = 0; i < large; ++i)
+    REQUIRE(b[i] == 0);
+
+  freeLargeBuffer(a);
+  freeLargeBuffer(b);
+
+  REQUIRE(largeAllocStats().inUse == before.inUse);
+  REQUIRE(largeAllocStats().mapped == before.mapped);
+
+  // Default-inserted elements are zero, even after shrinking and growing
+  std::vector<uint32_t, LargeAllocator<uint32_t>> vec(BEAM_SIZE);
+
+  std::fill(vec.begin(), vec.end(), 1);
+  vec.resize(BEAM_SIZE / 2);
+  vec.resize(BEAM_SIZE);
+
+  for (size_t i = 0; i < BEAM_SIZE / 2; ++i)
+    REQUIRE(vec[i] == 1);
+  for (size_t i = BEAM_SIZE / 2; i < BEAM_SIZE; ++i)
+    REQUIRE(vec[i] == 0);
+}
+
+TEST_CASE("Non-sequential beams are binned by surface", THIS_TEST_TAG)
+{
+  RayBeamPool pool;
+  RayBeamBins bins;
+  auto beam = pool.acquire(BEAM_SIZE, true);
+  auto A = reinterpret_cast<OpticalSurface *>(0x10);
+  auto B = reinterpret_cast<OpticalSurface *>(0x20);
+
+  // Alive rays alternate between A and B, every 5th ray is pruned
+  beam->clearMask();
+  for (auto i = 0; i < BEAM_SIZE; ++i) {
+    beam->surfaces[i] = (i & 1) ? B : A;
+    beam->ids[i]      = i;
+    beam->refNdx[i]   = i;
+    if (i % 5 == 4)
+      beam->prune(i);
+  }
+
+  beam->bin(bins);
+  REQUIRE(bins.bins() == 2);
+  REQUIRE(bins.surfaces[0] == A);
+  REQUIRE(bins.surfaces[1] == B);
+  REQUIRE(bins.runs == beam->countAlive());
+  REQUIRE(bins.binSize(0) + bins.binSize(1) == beam->countAlive());
+
+  for (size_t b = 0; b < bins.bins(); ++b)
+    for (auto k = bins.offsets[b]; k < bins.offsets[b + 1]; ++k) {
+      auto i = bins.indices[k];
+      REQUIRE(beam->hasRay(i));
+      REQUIRE(beam->surfaces[i] == bins.surfaces[b]);
+      if (k > bins.offsets[b])
+        REQUIRE(i > bins.indices[k - 1]);
+    }
+
+  // Gather the B rays, transmit them through something and scatter them
+  // back. Only the fields transmit() may update are scattered.
+  auto scratch = pool.acquire(bins.binSize(1));
+  auto indices = bins.indices.data() + bins.offsets[1];
+
+  beam->intercept(1);
+  scratch->gatherTransmit(beam, indices, bins.binSize(1));
+  REQUIRE(scratch->ids[0] == 1);
+  REQUIRE(scratch->refNdx[0] == 1);
+  REQUIRE(scratch->isIntercepted(0));
+  REQUIRE(!scratch->isIntercepted(1));
+
+  for (uint64_t k = 0; k < bins.binSize(1); ++k) {
+    scratch->refNdx[k] += 1000;
+    scratch->ids[k]     = 0;
+    scratch->prune(k);
+  }
+
+  beam->scatterTransmit(scratch, indices, bins.binSize(1));
+  for (auto i = 0; i < BEAM_SIZE; ++i) {
+    REQUIRE(beam->refNdx[i] == ((i & 1) && i % 5 != 4 ? i + 1000 : i));
+    REQUIRE(beam->ids[i] == i);
+    REQUIRE(beam->hasRay(i) == (!(i & 1) && i % 5 != 4));
+  }
+
+  pool.release(scratch);
+  pool.release(beam);
+}
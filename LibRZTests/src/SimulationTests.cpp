@@ -25,6 +25,9 @@
 #include <Simulation.h>
 #include <RayTracingEngine.h>
 #include <Elements/RayBeamElement.h>
+#include <Paraxial.h>
+#include <Sensitivity.h>
+#include <Optimizer.h>
 
 using namespace RZ;
 
@@ -66,6 +69,80 @@ static const char *g_rotatedFocusLens =
   "path bfp L1 to bfpDet;"
   "path img L1 to imgDet;";
 
+// Ring-like object at f/8 in front of the lens of g_rotatedFocusLens
+static BeamProperties
+objectBeamProperties(TopLevelModel *model, unsigned int numRays)
+{
+  auto object = model->lookupReferenceFrame("object");
+  REQUIRE(object != nullptr);
+
+  BeamProperties beamProp;
+
+  beamProp.length          = 1;
+  beamProp.diameter        = 0;
+  beamProp.direction       = -Vec3::eZ();
+  beamProp.numRays         = numRays;
+  beamProp.shape           = Point;
+  beamProp.objectShape     = RingLike;
+  beamProp.setPlaneRelative(object);
+  beamProp.setObjectFNum(8);
+
+  return beamProp;
+}
+
+// Ray ids cycle through [0, ids), so that the beam spans several statistics
+static RayList
+makeObjectBeam(TopLevelModel *model, unsigned int numRays, uint32_t ids = 1)
+{
+  RayList rays;
+  uint32_t n = 0;
+
+  OMModel::addBeam(rays, objectBeamProperties(model, numRays));
+
+  for (auto &ray : rays)
+    ray.id = n++ % ids;
+
+  return rays;
+}
+
+//
+// Image and per-beam statistics left by a trace on a detector, to compare
+// traces of the same beam done in different ways.
+//
+struct DetectorResults {
+  std::vector<uint32_t>                 image;
+  std::map<uint32_t, RayBeamStatistics> statistics;
+};
+
+static DetectorResults
+detectorResults(Detector *detector)
+{
+  DetectorResults results;
+  size_t pixels = detector->rows() * detector->stride();
+
+  results.image.assign(detector->data(), detector->data() + pixels);
+  results.statistics = detector->opticalSurfaces().front()->statistics;
+
+  return results;
+}
+
+static void
+requireSameResults(Detector *detector, DetectorResults const &expected)
+{
+  auto &statistics = detector->opticalSurfaces().front()->statistics;
+
+  for (size_t i = 0; i < expected.image.size(); ++i)
+    REQUIRE(detector->data()[i] == expected.image[i]);
+
+  REQUIRE(statistics.size() == expected.statistics.size());
+  for (auto &p : expected.statistics) {
+    auto &stats = statistics[p.first];
+    REQUIRE(stats.intercepted == p.second.intercepted);
+    REQUIRE(stats.vignetted   == p.second.vignetted);
+    REQUIRE(stats.pruned      == p.second.pruned);
+  }
+}
+
 
 TEST_CASE("Infinite reflection: stray light", THIS_TEST_TAG)
 {
@@ -367,3 +444,1067 @@ TEST_CASE("Rotated lens: 180 deg flip", THIS_TEST_TAG)
   delete model;
 }
 
+
+TEST_CASE("Per-stage profiling of a sequential trace", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto rays = makeObjectBeam(model, 1000);
+  REQUIRE(rays.size() == 1000);
+
+  auto sim = model->simulation();
+  REQUIRE(!sim->profiling());
+
+  // Disabled profiler: no events
+  REQUIRE(model->trace("img", rays, true));
+  REQUIRE(sim->profiler().events().empty());
+
+  sim->setProfiling(true);
+  REQUIRE(model->trace("img", rays, true));
+
+  // L1 has two surfaces, imgDet has one
+  unsigned int phaseCount[RZ_TRACING_PHASE_COUNT] = {0};
+  for (auto &ev : sim->profiler().events()) {
+    REQUIRE(ev.raysOut <= ev.raysIn);
+    REQUIRE(ev.raysIn <= rays.size());
+    ++phaseCount[ev.phase];
+  }
+
+  REQUIRE(phaseCount[PHASE_TO_RELATIVE]   == 3);
+  REQUIRE(phaseCount[PHASE_CAST]          == 3);
+  REQUIRE(phaseCount[PHASE_STATISTICS]    == 3);
+  REQUIRE(phaseCount[PHASE_EXTRACTION]    == 3);
+  REQUIRE(phaseCount[PHASE_TRANSMIT]      == 3);
+  REQUIRE(phaseCount[PHASE_FROM_RELATIVE] == 3);
+
+  auto summary = sim->profiler().summary();
+  REQUIRE(summary.size() == 3 * RZ_TRACING_PHASE_COUNT);
+
+  for (auto &stage : summary)
+    printf(
+      "  %-16s %-12s %8.3f ms %10lu rays in %10lu rays out (%.3g rays/s)\n",
+      stage.stage.c_str(),
+      tracingPhaseToString(stage.phase),
+      1e-6 * stage.duration,
+      stage.raysIn,
+      stage.raysOut,
+      stage.raysPerSecond());
+
+  auto json = sim->profiler().chromeTrace();
+  REQUIRE(json.find("\"traceEvents\"") != std::string::npos);
+  REQUIRE(json.find("L1.inputSurface") != std::string::npos);
+
+  delete model;
+}
+
+TEST_CASE("Tracing from ray arrays", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto detector = model->lookupOpticalElement("imgDet");
+  REQUIRE(detector);
+  detector->setRecordHits(true);
+
+  auto rays = makeObjectBeam(model, 1000);
+  REQUIRE(rays.size() == 1000);
+
+  std::vector<Real> origins, directions, wavelengths;
+  std::vector<uint32_t> ids;
+  uint32_t n = 0;
+
+  for (auto &ray : rays) {
+    ray.id         = n++;
+    ray.wavelength = 500e-9 + 1e-9 * (n % 7);
+
+    for (auto i = 0; i < 3; ++i) {
+      origins.push_back(ray.origin.coords[i]);
+      directions.push_back(ray.direction.coords[i]);
+    }
+
+    wavelengths.push_back(ray.wavelength);
+    ids.push_back(ray.id);
+  }
+
+  auto surface = detector->opticalSurfaces().front();
+  auto sim     = model->simulation();
+
+  REQUIRE(model->trace("img", rays));
+  auto expected = surface->hits;
+  REQUIRE(!expected.empty());
+
+  RayArrays arrays;
+  arrays.count       = rays.size();
+  arrays.origins     = origins.data();
+  arrays.directions  = directions.data();
+  arrays.wavelengths = wavelengths.data();
+  arrays.ids         = ids.data();
+
+  TracingProperties props;
+  props.path    = "img";
+  props.pArrays = &arrays;
+
+  detector->clearHits();
+  REQUIRE(sim->trace(props));
+  REQUIRE(surface->hits.size() == expected.size());
+
+  for (auto &expectedGroup : expected.groups()) {
+    auto group = surface->hits.find(expectedGroup.id);
+
+    REQUIRE(group != nullptr);
+    REQUIRE(group->size() == expectedGroup.size());
+
+    for (size_t i = 0; i < group->size(); ++i)
+      REQUIRE((group->origin(i) - expectedGroup.origin(i)).norm() < 1e-12);
+  }
+
+  // The final beam keeps one entry per input ray
+  auto beam = sim->engine()->beam();
+  REQUIRE(beam->count == rays.size());
+  REQUIRE(beam->countIntercepted() == expected.size());
+
+  for (size_t i = 0; i < beam->count; ++i) {
+    REQUIRE(beam->ids[i] == ids[i]);
+    REQUIRE(beam->wavelengths[i] == wavelengths[i]);
+  }
+
+  // Non-sequential tracing must accept them too
+  props.type = NonSequential;
+  props.path = "";
+  detector->clearHits();
+  REQUIRE(sim->trace(props));
+  REQUIRE(surface->hits.size() == expected.size());
+
+  delete model;
+}
+
+TEST_CASE("Sharded multi-process tracing", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto detector = model->lookupDetector("imgDet");
+  REQUIRE(detector != nullptr);
+
+  auto rays = makeObjectBeam(model, 1000, 2);
+  auto sim  = model->simulation();
+
+  REQUIRE(model->trace("img", rays));
+  auto expected = detectorResults(detector);
+  REQUIRE(detector->maxCounts() > 0);
+
+  detector->opticalSurfaces().front()->clearStatistics();
+  sim->setProcesses(4);
+  REQUIRE(sim->processes() == 4);
+  REQUIRE(model->trace("img", rays));
+  requireSameResults(detector, expected);
+
+  // Not clearing the detectors accumulates the shards on the parent image
+  REQUIRE(model->trace("img", rays, false, nullptr, false));
+  for (size_t i = 0; i < expected.image.size(); ++i)
+    REQUIRE(detector->data()[i] == 2 * expected.image[i]);
+
+  // Shards send back only the tiles with hits, also of tiled and weighted
+  // detectors, and the statistics of every beam id that was traced
+  uint32_t n = 0;
+  for (auto &ray : rays)
+    ray.id = n++;
+
+  REQUIRE(detector->set("tiled", true));
+  REQUIRE(detector->set("weighted", true));
+
+  sim->setProcesses(1);
+  detector->opticalSurfaces().front()->clearStatistics();
+  REQUIRE(model->trace("img", rays));
+  expected = detectorResults(detector);
+  std::vector<Real> weights(
+    detector->weights(),
+    detector->weights() + expected.image.size());
+  REQUIRE(expected.statistics.size() == rays.size());
+
+  sim->setProcesses(4);
+  detector->opticalSurfaces().front()->clearStatistics();
+  REQUIRE(model->trace("img", rays));
+  requireSameResults(detector, expected);
+  for (size_t i = 0; i < weights.size(); ++i)
+    REQUIRE(detector->weights()[i] == weights[i]);
+
+  delete model;
+}
+
+TEST_CASE("Depth-first block tracing", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto detector = model->lookupDetector("imgDet");
+  REQUIRE(detector != nullptr);
+
+  auto rays = makeObjectBeam(model, 5000, 3);
+  auto sim  = model->simulation();
+
+  // Whole beam, stage by stage
+  sim->setBlockSize(0);
+  REQUIRE(model->trace("img", rays));
+  auto expected = detectorResults(detector);
+  RayList expectedRays = sim->engine()->getRays();
+  REQUIRE(detector->maxCounts() > 0);
+
+  // Blocks of 1024 rays, the last one partial
+  detector->opticalSurfaces().front()->clearStatistics();
+  sim->setBlockSize(1000);
+  REQUIRE(sim->blockSize() == 1024);
+  REQUIRE(model->trace("img", rays));
+  requireSameResults(detector, expected);
+
+  // The main beam ends up as if it had been traced as a whole
+  auto outRays = sim->engine()->getRays();
+  REQUIRE(outRays.size() == expectedRays.size());
+
+  auto p = expectedRays.begin();
+  for (auto &ray : outRays) {
+    REQUIRE(ray.id == p->id);
+    REQUIRE((ray.origin - p->origin).norm() < 1e-12);
+    REQUIRE((ray.direction - p->direction).norm() < 1e-12);
+    REQUIRE(ray.length == p->length);
+    ++p;
+  }
+
+  delete model;
+}
+
+TEST_CASE("Single precision tracing", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto detector = model->lookupDetector("imgDet");
+  REQUIRE(detector != nullptr);
+
+  RayList rays;
+  auto beamProp = objectBeamProperties(model, 20000);
+
+  beamProp.objectShape     = CircleLike;
+  beamProp.random          = true;
+  beamProp.setObjectFNum(10); // Clear of the rim of the lens
+
+  OMModel::addBeam(rays, beamProp);
+
+  auto sim     = model->simulation();
+  auto surface = detector->opticalSurfaces().front();
+  BeamTestStatistics doubleStats, floatStats;
+
+  detector->setRecordHits(true);
+  sim->setBlockSize(4096);
+
+  REQUIRE(sim->precision() == DoublePrecision);
+  REQUIRE(model->trace("img", rays));
+  doubleStats.computeFromSurface(surface);
+  REQUIRE(doubleStats.intercepted > 0);
+  REQUIRE(doubleStats.rmsRad > 0);
+
+  surface->clearStatistics();
+  detector->clearHits();
+
+  sim->setPrecision(SinglePrecision);
+  REQUIRE(model->trace("img", rays));
+  floatStats.computeFromSurface(surface);
+
+  // Spot centroids and sizes agree well below the pixel size
+  REQUIRE(floatStats.intercepted == doubleStats.intercepted);
+  REQUIRE(floatStats.vignetted   == doubleStats.vignetted);
+  REQUIRE(fabs(floatStats.x0 - doubleStats.x0) < 1e-7);
+  REQUIRE(fabs(floatStats.y0 - doubleStats.y0) < 1e-7);
+  REQUIRE(fabs(floatStats.rmsRad - doubleStats.rmsRad) < 1e-4 * doubleStats.rmsRad);
+
+  // The traced beam is not kept in single precision
+  REQUIRE(sim->engine()->getRays().empty());
+
+  delete model;
+}
+
+TEST_CASE("Progressive tracing", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto L1       = model->lookupOpticalElement("L1");
+  auto detector = model->lookupDetector("imgDet");
+  REQUIRE(L1 != nullptr);
+  REQUIRE(detector != nullptr);
+
+  // Collimated, so that it diverges again after the focus
+  BeamProperties beamProp;
+
+  beamProp.length          = 1;
+  beamProp.diameter        = 5e-3;
+  beamProp.direction       = -Vec3::eZ();
+  beamProp.shape           = Circular;
+  beamProp.objectShape     = PointLike;
+  beamProp.setElementRelative(L1);
+  beamProp.collimate();
+
+  auto sim = model->simulation();
+  TracingProperties props;
+  ProgressiveTracingProperties progProps;
+  ProgressiveTracingResult result;
+
+  props.type = Sequential;
+  props.path = "img";
+
+  progProps.detector  = "imgDet";
+  progProps.batchRays = 2000;
+  progProps.maxRays   = 1000000;
+  progProps.tolerance = 1e-3;
+
+  REQUIRE(sim->traceProgressive(props, beamProp, progProps, result));
+  REQUIRE(result.converged);
+  REQUIRE(result.batches > progProps.minBatches);
+  REQUIRE(result.rays < progProps.maxRays);
+  REQUIRE(result.rays == result.batches * progProps.batchRays);
+  REQUIRE(result.transmission == 1);
+  REQUIRE(result.rmsRadius > 0);
+  REQUIRE(result.encircledRadius > 0);
+  REQUIRE(result.rmsRadiusError <= progProps.tolerance);
+  REQUIRE(result.encircledRadiusError <= progProps.tolerance);
+
+  // The detector holds every batch
+  uint64_t total = 0;
+  for (size_t i = 0; i < detector->rows() * detector->stride(); ++i)
+    total += detector->data()[i];
+  REQUIRE(total == result.rays);
+
+  // A uniform disk of radius R has an RMS radius of R / sqrt(2)
+  Real radius = result.rmsRadius * sqrt(2.);
+  REQUIRE(fabs(result.encircledRadius - radius * sqrt(.8)) < .05 * radius);
+
+  // Unreachable tolerance: the ray budget is the limit
+  progProps.tolerance = 1e-9;
+  progProps.maxRays   = 9000;
+  REQUIRE(sim->traceProgressive(props, beamProp, progProps, result));
+  REQUIRE(!result.converged);
+  REQUIRE(result.rays == 9000);
+  REQUIRE(result.batches == 5);
+
+  delete model;
+}
+
+static const char *g_offAxisStop =
+  "ApertureStop stop(radius = 5e-3);"
+  "translate(dz = -5e-2) Detector det(flip = true, pixelWidth = 1e-4, pixelHeight = 1e-4);"
+  "path stop to det;";
+
+static uint64_t
+detectorCounts(Detector *detector)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < detector->rows() * detector->stride(); ++i)
+    total += detector->data()[i];
+
+  return total;
+}
+
+TEST_CASE("Ray aiming", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_offAxisStop);
+  REQUIRE(model);
+
+  auto stop     = model->lookupOpticalElement("stop");
+  auto detector = model->lookupDetector("det");
+  REQUIRE(stop != nullptr);
+  REQUIRE(detector != nullptr);
+
+  // Off-axis field, with the stop far from the center of the beam
+  BeamProperties beamProp;
+
+  beamProp.length      = 1;
+  beamProp.diameter    = 1e-1;
+  beamProp.numRays     = 20000;
+  beamProp.direction   = Vec3(.1, 0, -1).normalized();
+  beamProp.offset      = Vec3(2e-2, 0, 0);
+  beamProp.shape       = Circular;
+  beamProp.objectShape = PointLike;
+  beamProp.setElementRelative(stop);
+  beamProp.collimate();
+
+  auto sim = model->simulation();
+  TracingProperties props;
+  RayList rays;
+
+  props.type  = Sequential;
+  props.pRays = &rays;
+
+  OMModel::addBeam(rays, beamProp);
+  REQUIRE(sim->trace(props));
+
+  uint64_t counts = detectorCounts(detector);
+  Real transmission = counts / static_cast<Real>(rays.size());
+  printf("Ray aiming: unaimed transmission %g\n", transmission);
+  REQUIRE(transmission > 0);
+  REQUIRE(transmission < .05);
+
+  // Probing leaves the previous result alone
+  Real weight = sim->aimBeam(beamProp);
+  printf("Ray aiming: weight %g, radius %g\n", weight, beamProp.aimRadius);
+  REQUIRE(beamProp.aimed);
+  REQUIRE(weight == beamProp.aimWeight);
+  REQUIRE(weight > transmission);
+  REQUIRE(weight < .1);
+  REQUIRE(detectorCounts(detector) == counts);
+
+  rays.clear();
+  OMModel::addBeam(rays, beamProp);
+  REQUIRE(rays.size() >= beamProp.numRays);
+  REQUIRE(sim->trace(props));
+
+  Real aimedTransmission = detectorCounts(detector) / static_cast<Real>(rays.size());
+  printf("Ray aiming: aimed transmission %g\n", aimedTransmission);
+  REQUIRE(aimedTransmission > .25);
+  REQUIRE(fabs(aimedTransmission * weight - transmission) < .1 * transmission);
+
+  // Random beams are resampled until there are enough rays
+  beamProp.random = true;
+  rays.clear();
+  OMModel::addBeam(rays, beamProp);
+  REQUIRE(rays.size() == beamProp.numRays);
+
+  // Nothing gets through a closed stop
+  stop->set("radius", 1e-6);
+  beamProp.random = false;
+  REQUIRE(sim->aimBeam(beamProp) == 0);
+  REQUIRE(!beamProp.aimed);
+  REQUIRE(beamProp.aimWeight == 0);
+
+  delete model;
+}
+
+static const char *g_stopAndIdealLens =
+  "translate(dz = .1) ApertureStop stop(radius = 5e-3);"
+  "IdealLens L(focalLength = .2);"
+  "translate(dz = -.2) Detector det;"
+  "path stop to L to det;";
+
+static const char *g_concaveMirror =
+  "ConicMirror M(curvature = 1, thickness = 1e-2, diameter = .1);"
+  "translate(dz = .51) Detector det;"
+  "path M to det;";
+
+TEST_CASE("Paraxial model: stop and ideal lens", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_stopAndIdealLens);
+  REQUIRE(model);
+
+  ParaxialModel paraxial(model->lookupOpticalPath());
+  paraxial.setFieldAngle(1e-2);
+  REQUIRE(paraxial.evaluate());
+
+  auto &p = paraxial.properties();
+  REQUIRE(paraxial.surfaces().size() == 3);
+  REQUIRE(releq(p.efl, .2));
+  REQUIRE(fabs(p.backFocalPoint) < 1e-12);
+  REQUIRE(fabs(p.imagePosition)  < 1e-12);
+  REQUIRE(releq(p.fNumber, 20));
+
+  // The stop is the entrance pupil, and the lens images it 2x, .2 m
+  // before the lens.
+  REQUIRE(p.stopIndex == 0);
+  REQUIRE(fabs(p.entrancePupilPosition) < 1e-12);
+  REQUIRE(releq(p.entrancePupilRadius, 5e-3));
+  REQUIRE(releq(p.exitPupilPosition, -.4));
+  REQUIRE(releq(p.exitPupilRadius, 1e-2));
+
+  REQUIRE(releq(fabs(p.imageHeight), .2 * tan(1e-2)));
+  REQUIRE(fabs(paraxial.surfaces()[0].chiefHeight) < 1e-12);
+  REQUIRE(releq(paraxial.surfaces()[1].marginalHeight, 5e-3));
+
+  // Geometry changes are picked up by the next evaluation
+  model->lookupOpticalElement("L")->set("focalLength", .1);
+  REQUIRE(paraxial.evaluate());
+  REQUIRE(releq(p.efl, .1));
+  REQUIRE(releq(p.backFocalPoint, -.1));
+
+  delete model;
+}
+
+TEST_CASE("Paraxial model: thick lens", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  ParaxialModel paraxial(model->lookupOpticalPath("img"));
+  REQUIRE(paraxial.evaluate());
+
+  // Lensmaker's equation, with the thickness at the vertices
+  Real n  = 1.5;
+  Real R  = 2 * .2 * (n - 1);
+  Real t  = 2e-3;
+  Real h  = 2.5e-2;
+  Real d  = t + 2 * (.5 * h * h / R); // Parabolic surfaces (K = -1)
+  Real f  = 1 / ((n - 1) * (2 / R - (n - 1) * d / (n * R * R)));
+  Real bfd = f * (1 - (n - 1) * d / (n * R));
+
+  auto &p = paraxial.properties();
+  printf("Paraxial model: EFL %g (expected %g), BFD %g\n", p.efl, f, bfd);
+  REQUIRE(releq(p.efl, f, 1e-9));
+  REQUIRE(releq(p.backFocalPoint, bfd - (.5 * t + 2 * .2 - .5 * d), 1e-9));
+
+  // Gaussian imaging between the principal planes
+  Real objDist = .5 * t + 2 * .2 - .5 * d;
+  paraxial.setObjectDistance(objDist);
+  REQUIRE(paraxial.evaluate());
+
+  Real s  = -objDist - p.frontPrincipalPlane;
+  Real sp = p.imagePosition - p.backPrincipalPlane;
+  REQUIRE(releq(1 / sp - 1 / s, 1 / f, 1e-9));
+  REQUIRE(p.magnification < 0);
+
+  delete model;
+}
+
+TEST_CASE("Paraxial model: concave mirror", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_concaveMirror);
+  REQUIRE(model);
+
+  ParaxialModel paraxial(model->lookupOpticalPath());
+  REQUIRE(paraxial.evaluate());
+
+  auto &p = paraxial.properties();
+  REQUIRE(releq(p.efl, .5));
+  REQUIRE(fabs(p.backFocalPoint) < 1e-12);
+  REQUIRE(paraxial.surfaces()[1].distance > 0);
+
+  delete model;
+}
+
+TEST_CASE("Finite-difference Jacobian", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto L1       = model->lookupOpticalElement("L1");
+  auto detector = model->lookupDetector("imgDet");
+  REQUIRE(L1 != nullptr);
+  REQUIRE(detector != nullptr);
+
+  BeamProperties beamProp;
+  RayList rays;
+
+  beamProp.length      = 1;
+  beamProp.diameter    = 5e-3;
+  beamProp.numRays     = 2000;
+  beamProp.random      = true;
+  beamProp.direction   = Vec3(0, .002, -1).normalized();
+  beamProp.shape       = Circular;
+  beamProp.objectShape = PointLike;
+  beamProp.setElementRelative(L1);
+  beamProp.collimate();
+  OMModel::addBeam(rays, beamProp);
+
+  TracingProperties tracing;
+  tracing.type  = Sequential;
+  tracing.path  = "img";
+  tracing.pRays = &rays;
+
+  JacobianProperties props;
+  JacobianResult parallel, serial;
+
+  props.dofs    = {"focalLength", "angle", "thickness"};
+  props.metrics = {
+    {SpotCentroidY,    "imgDet"},
+    {SpotRmsRadius,    "imgDet"},
+    {SpotTransmission, "imgDet"}
+  };
+  props.step    = 1e-5;
+
+  SensitivityAnalysis analysis(model);
+
+  props.processes = 4;
+  REQUIRE(analysis.jacobian(tracing, props, parallel));
+  props.processes = 1;
+  REQUIRE(analysis.jacobian(tracing, props, serial));
+
+  REQUIRE(parallel.dofs.size() == 3);
+  REQUIRE(parallel.metrics.size() == 3);
+  REQUIRE(parallel.metrics[0] == "imgDet.centroidY");
+  REQUIRE(parallel.jacobian.size() == 9);
+
+  // "angle" is at the bottom of its range: forward difference
+  REQUIRE(parallel.traces == 1 + 2 + 1 + 2);
+  REQUIRE(releq(parallel.steps[0], 2e-5));
+  REQUIRE(releq(parallel.steps[1], 1e-5));
+
+  // Forked and in-process evaluations are the same traces
+  for (size_t i = 0; i < parallel.jacobian.size(); ++i)
+    REQUIRE(parallel.jacobian[i] == serial.jacobian[i]);
+
+  for (size_t i = 0; i < parallel.nominal.size(); ++i)
+    REQUIRE(parallel.nominal[i] == serial.nominal[i]);
+
+  for (size_t k = 0; k < parallel.dofs.size(); ++k) {
+    printf(
+      "Jacobian: d/d%-12s centroidY %-12g rms %-12g transmission %g\n",
+      parallel.dofs[k].c_str(),
+      parallel.at(0, k),
+      parallel.at(1, k),
+      parallel.at(2, k));
+    REQUIRE(parallel.at(2, k) == 0);
+  }
+
+  REQUIRE(parallel.nominal[2] == 1);
+  REQUIRE(parallel.at(1, 0) != 0);
+  REQUIRE(parallel.at(0, 1) != 0);
+
+  // Same as two separate traces of the same rays
+  Real plus, minus;
+  Real f = model->lookupDof("focalLength")->value;
+
+  auto rmsRadius = [&] () {
+    Real x0 = 0, y0 = 0, r2 = 0;
+    auto &hits = detector->opticalSurfaces().front()->locations();
+    size_t n   = hits.size() / 3;
+
+    for (size_t i = 0; i < n; ++i) {
+      x0 += hits[3 * i + 0];
+      y0 += hits[3 * i + 1];
+    }
+
+    x0 /= n;
+    y0 /= n;
+
+    for (size_t i = 0; i < n; ++i) {
+      Real dx = hits[3 * i + 0] - x0;
+      Real dy = hits[3 * i + 1] - y0;
+      r2 += dx * dx + dy * dy;
+    }
+
+    return sqrt(r2 / n);
+  };
+
+  detector->setRecordHits(true);
+
+  model->setDof("focalLength", f + 1e-5);
+  detector->clearHits();
+  REQUIRE(model->simulation()->trace(tracing));
+  plus = rmsRadius();
+
+  model->setDof("focalLength", f - 1e-5);
+  detector->clearHits();
+  REQUIRE(model->simulation()->trace(tracing));
+  minus = rmsRadius();
+
+  model->setDof("focalLength", f);
+
+  REQUIRE(releq(parallel.at(1, 0), (plus - minus) / 2e-5, 1e-6));
+
+  // The detectors hold the nominal image
+  uint64_t total = 0;
+  detector->setRecordHits(false);
+  REQUIRE(analysis.jacobian(tracing, props, parallel));
+  for (size_t i = 0; i < detector->rows() * detector->stride(); ++i)
+    total += detector->data()[i];
+  REQUIRE(total == rays.size());
+  REQUIRE(detector->opticalSurfaces().front()->hits.empty());
+
+  // A beam wider than the lens is partially vignetted: the transmission
+  // is the ratio of their areas, (D / d)^2, and grows as 2 D / d^2
+  Real D = model->lookupDof("D")->value;
+  Real d = 8e-2;
+
+  beamProp.diameter = d;
+  rays.clear();
+  OMModel::addBeam(rays, beamProp);
+
+  tracing.path  = "bfp";
+  props.dofs    = {"D"};
+  props.metrics = {{SpotTransmission, "bfpDet"}};
+  props.step    = 1e-3;
+
+  REQUIRE(analysis.jacobian(tracing, props, parallel));
+  REQUIRE(fabs(parallel.nominal[0] - D * D / (d * d)) < .05);
+  REQUIRE(parallel.at(0, 0) != 0);
+  REQUIRE(releq(parallel.at(0, 0), 2 * D / (d * d), .2));
+
+  delete model;
+}
+
+TEST_CASE("Damped least squares optimizer", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_rotatedFocusLens);
+  REQUIRE(model);
+
+  auto L1 = model->lookupOpticalElement("L1");
+  REQUIRE(L1 != nullptr);
+
+  BeamProperties beamProp;
+  RayList rays;
+  Real tilt = .002;
+
+  beamProp.length      = 1;
+  beamProp.diameter    = 5e-3;
+  beamProp.numRays     = 2000;
+  beamProp.random      = true;
+  beamProp.direction   = Vec3(0, tilt, -1).normalized();
+  beamProp.shape       = Circular;
+  beamProp.objectShape = PointLike;
+  beamProp.setElementRelative(L1);
+  beamProp.collimate();
+  OMModel::addBeam(rays, beamProp);
+
+  TracingProperties tracing;
+  tracing.type  = Sequential;
+  tracing.path  = "bfp";
+  tracing.pRays = &rays;
+
+  // The image of a field point moves with the focal length
+  OptimizerProperties props;
+  OptimizerResult result;
+
+  props.variables = {"focalLength"};
+  props.targets   = {{{SpotCentroidY, "bfpDet"}, .15 * tilt, 1e6}};
+  props.step      = 1e-5;
+  props.tolerance = 1e-12;
+  props.processes = 2;
+
+  Optimizer optimizer(model);
+
+  REQUIRE(optimizer.optimize(tracing, props, result));
+
+  printf(
+    "Optimizer: f = %g -> %g, merit %g -> %g in %u iterations (%u traces)\n",
+    result.initial[0],
+    result.values[0],
+    result.merits.front(),
+    result.merit(),
+    result.iterations,
+    result.traces);
+
+  REQUIRE(result.converged);
+  REQUIRE(result.variables.size() == 1);
+  REQUIRE(result.metrics[0] == "bfpDet.centroidY");
+  REQUIRE(result.initial[0] == .2);
+  REQUIRE(result.iterations > 0);
+  REQUIRE(result.iterations < 10);
+  REQUIRE(result.merits.size() == result.iterations + 1);
+  REQUIRE(releq(result.values[0], .15, 1e-2));
+  REQUIRE(fabs(result.nominal[0] - .15 * tilt) < 1e-9);
+  REQUIRE(model->lookupDof("focalLength")->value == result.values[0]);
+
+  for (size_t i = 1; i < result.merits.size(); ++i)
+    REQUIRE(result.merits[i] < result.merits[i - 1]);
+
+  // The merit is deterministic: re-evaluating it gives the same metrics
+  SensitivityAnalysis analysis(model);
+  JacobianProperties jProps;
+  std::vector<Real> metrics;
+
+  jProps.metrics = {{SpotCentroidY, "bfpDet"}, {SpotOpdRms, "bfpDet"}};
+  REQUIRE(analysis.metrics(tracing, jProps, metrics));
+  REQUIRE(metrics[0] == result.nominal[0]);
+  REQUIRE(metrics[1] >= 0);
+
+  // Out of reach: the focal length stops at the bottom of its range
+  props.targets[0].target = .05 * tilt;
+  REQUIRE(optimizer.optimize(tracing, props, result));
+  REQUIRE(result.converged);
+  REQUIRE(result.values[0] == .1);
+  REQUIRE(model->lookupDof("focalLength")->value == .1);
+
+  delete model;
+}
+
+static const char *g_window =
+  "CircularWindow W(thickness = 1e-2, diameter = 5e-2, n = 1.5);"
+  "translate(dz = -.1) Detector back;"
+  "translate(dz = .1) Detector front(flip = true);";
+
+static uint64_t
+ghostIntercepted(
+  OpticalElement *element,
+  std::string const &surface,
+  unsigned int generation)
+{
+  auto surf = element->lookupSurface(surface);
+  auto it   = surf->statistics.find(ghostId(3, generation));
+
+  return it == surf->statistics.end() ? 0 : it->second.intercepted;
+}
+
+TEST_CASE("Ghost splitting", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_window);
+  REQUIRE(model);
+
+  auto W = model->lookupOpticalElement("W");
+  REQUIRE(W != nullptr);
+
+  REQUIRE(ghostGeneration(ghostId(3, 2)) == 2);
+  REQUIRE(ghostSourceId(ghostId(3, 2)) == 3);
+
+  RayList rays;
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      Ray ray;
+      ray.origin    = Vec3(1e-3 * (i - 5), 1e-3 * (j - 5), .05);
+      ray.direction = -Vec3::eZ();
+      ray.id        = 3;
+      rays.push_back(ray);
+    }
+  }
+
+  TracingProperties tracing;
+  tracing.type     = NonSequential;
+  tracing.pRays    = &rays;
+  tracing.keepBeam = true;
+
+  auto sim = model->simulation();
+  sim->seedRandomStreams(1);
+
+  // No splitting: a single generation at full power
+  REQUIRE(sim->trace(tracing));
+  REQUIRE(ghostIntercepted(W, "outputFace", 0) == 100);
+  REQUIRE(ghostIntercepted(W, "inputFace", 0) == 100);
+  REQUIRE(W->lookupSurface("outputFace")->statistics.size() == 1);
+  REQUIRE(releq(std::norm(sim->engine()->beam()->amplitude[0]), 1));
+
+  // Normal incidence on n = 1.5: R = .04 per interface. The primary rays
+  // keep (1 - R)^2 after both faces.
+  tracing.ghosts.maxDepth = 3;
+  W->clearHits();
+  REQUIRE(sim->trace(tracing));
+
+  auto beam = sim->engine()->beam();
+  REQUIRE(beam->count == 100);
+  REQUIRE(ghostGeneration(beam->ids[0]) == 0);
+  REQUIRE(releq(std::norm(beam->amplitude[0]), .96 * .96));
+
+  // Gen 1: reflected off outputFace (outwards) and inputFace (inwards,
+  // through outputFace). Gen 2: reflected back off outputFace.
+  REQUIRE(ghostIntercepted(W, "outputFace", 0) == 100);
+  REQUIRE(ghostIntercepted(W, "outputFace", 1) == 100);
+  REQUIRE(ghostIntercepted(W, "inputFace", 1) == 0);
+  REQUIRE(ghostIntercepted(W, "inputFace", 2) == 100);
+
+  // Gen 3 weighs .04^3 < cutoff and plays Russian roulette
+  auto gen3 = ghostIntercepted(W, "outputFace", 3);
+  REQUIRE(gen3 > 0);
+  REQUIRE(gen3 < 100);
+
+  // Children beams come from the pool
+  REQUIRE(sim->engine()->beamPool().hits() > 0);
+
+  delete model;
+}
+
+static void
+detectorTotals(Detector const *detector, uint64_t &counts, Real &weight)
+{
+  const uint32_t *data = detector->data();
+  const Real *weights  = detector->weights();
+
+  counts = 0;
+  weight = 0;
+
+  for (unsigned int j = 0; j < detector->rows(); ++j) {
+    for (unsigned int i = 0; i < detector->cols(); ++i) {
+      counts += data[i + j * detector->stride()];
+      if (weights != nullptr)
+        weight += weights[i + j * detector->stride()];
+    }
+  }
+}
+
+TEST_CASE("Ghost splitting detectors", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(g_window);
+  REQUIRE(model);
+
+  auto back  = model->lookupDetector("back");
+  auto front = model->lookupDetector("front");
+  REQUIRE(back != nullptr);
+  REQUIRE(front != nullptr);
+
+  RayList rays;
+  for (int i = 0; i < 100; ++i) {
+    Ray ray;
+    ray.origin    = Vec3(5e-5 * (i - 50), 0, .05);
+    ray.direction = -Vec3::eZ();
+    ray.id        = 3;
+    rays.push_back(ray);
+  }
+
+  TracingProperties tracing;
+  tracing.type            = NonSequential;
+  tracing.pRays           = &rays;
+  tracing.ghosts.maxDepth = 2;
+
+  auto sim = model->simulation();
+  sim->seedRandomStreams(1);
+
+  uint64_t counts;
+  Real weight;
+
+  // Detectors are weighted only while the trace lasts
+  REQUIRE(sim->trace(tracing));
+  REQUIRE(!back->weighted());
+  REQUIRE(back->weights() == nullptr);
+
+  // Weighted detectors keep the power of the hits. The primary rays reach
+  // the back detector with (1 - R)^2, and those reflected twice inside the
+  // window with R^2 (1 - R): the last generation is not split further.
+  REQUIRE(back->set("weighted", true));
+  REQUIRE(sim->trace(tracing));
+  REQUIRE(back->weighted());
+  REQUIRE(!front->weighted());
+
+  detectorTotals(back, counts, weight);
+  REQUIRE(counts == 200);
+  REQUIRE(releq(weight, 100 * .96 * (.96 + .04 * .04)));
+  REQUIRE(releq(back->maxWeight(), .96 * (.96 + .04 * .04)));
+
+  // Restricted to the primary generation
+  REQUIRE(back->set("generation", 0));
+  REQUIRE(sim->trace(tracing));
+  detectorTotals(back, counts, weight);
+  REQUIRE(counts == 100);
+  REQUIRE(releq(weight, 100 * .96 * .96));
+
+  // Restricted to the ghost of the second generation
+  REQUIRE(back->set("generation", 2));
+  REQUIRE(sim->trace(tracing));
+  detectorTotals(back, counts, weight);
+  REQUIRE(counts == 100);
+  REQUIRE(releq(weight, 100 * .96 * .04 * .04));
+
+  // Ids and generations that do not fit in a ghost id are rejected
+  tracing.ghosts.maxDepth = RZ_GHOST_MAX_GENERATION + 1;
+  REQUIRE_THROWS(sim->trace(tracing));
+
+  tracing.ghosts.maxDepth = 2;
+  rays.front().id = RZ_GHOST_ID_MASK + 1;
+  REQUIRE_THROWS(sim->trace(tracing));
+  REQUIRE(back->weighted());
+  REQUIRE(!front->weighted());
+
+  delete model;
+}
+
+TEST_CASE("Per-ray amplitudes", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString("Detector det; path det;");
+  REQUIRE(model);
+
+  auto det = model->lookupDetector("det");
+  REQUIRE(det != nullptr);
+
+  RayList rays;
+  std::vector<Real> pupil;
+  BeamProperties beamProp;
+
+  beamProp.length   = .1;
+  beamProp.diameter = 5e-3;
+  beamProp.numRays  = 1000;
+  beamProp.collimate();
+
+  OMModel::addBeam(rays, beamProp, &pupil);
+  REQUIRE(!rays.empty());
+  REQUIRE(pupil.size() == 2 * rays.size());
+
+  // Intensity falls linearly from the rim to the center of the pupil
+  Real R = .5 * beamProp.diameter;
+  Real expected = 0;
+  size_t i = 0;
+  for (auto &ray : rays) {
+    Real x = pupil[2 * i], y = pupil[2 * i + 1];
+    Real r = sqrt(x * x + y * y);
+
+    REQUIRE(r <= R * (1 + 1e-9));
+    REQUIRE(releq(r, sqrt(ray.origin.x * ray.origin.x + ray.origin.y * ray.origin.y)));
+
+    ray.amplitude = sqrt(r / R);
+    expected += r / R;
+    ++i;
+  }
+
+  auto sim = model->simulation();
+  uint64_t counts;
+  Real weight;
+
+  REQUIRE(det->set("weighted", true));
+
+  REQUIRE(model->traceDefault(rays));
+  detectorTotals(det, counts, weight);
+  REQUIRE(counts == rays.size());
+  REQUIRE(releq(weight, expected));
+
+  sim->setPrecision(SinglePrecision);
+  REQUIRE(model->traceDefault(rays));
+  detectorTotals(det, counts, weight);
+  REQUIRE(counts == rays.size());
+  REQUIRE(fabs(weight - expected) < 1e-5 * expected);
+
+  delete model;
+}
+
+TEST_CASE("Non-sequential trace of interleaved surfaces", THIS_TEST_TAG)
+{
+  // Two windows side by side. Rays alternate between them, so every
+  // propagation transmits a beam interleaved by surface. Binning it must
+  // not change the traced rays.
+  auto model = TopLevelModel::fromString(
+    "translate(dx = -.05) CircularWindow W1(thickness = 1e-2, diameter = 5e-2, n = 1.5);"
+    "translate(dx =  .05) CircularWindow W2(thickness = 2e-2, diameter = 5e-2, n = 2);"
+    "translate(dz = -.1) Detector back(pixelWidth = 1e-3, pixelHeight = 1e-3, cols = 200, rows = 200);");
+  REQUIRE(model);
+
+  RayList rays;
+
+  for (int i = 0; i < 200; ++i) {
+    Ray ray;
+    Real x = (i & 1) ? .05 : -.05;
+
+    ray.origin    = Vec3(x + 1e-4 * (i >> 1) - .005, 0, .05);
+    ray.direction = Vec3(0, .1, -1).normalized();
+    ray.id        = i & 1;
+    rays.push_back(ray);
+  }
+
+  TracingProperties tracing;
+  tracing.type     = NonSequential;
+  tracing.pRays    = &rays;
+  tracing.keepBeam = true;
+
+  auto sim = model->simulation();
+  std::vector<Vec3> destinations, directions;
+
+  REQUIRE(!sim->engine()->surfaceBinning());
+  REQUIRE(sim->trace(tracing));
+
+  auto beam = sim->engine()->beam();
+  REQUIRE(beam->countAlive() == 200);
+  for (uint64_t i = 0; i < beam->count; ++i) {
+    destinations.push_back(Vec3(beam->destinations + 3 * i));
+    directions.push_back(Vec3(beam->directions + 3 * i));
+  }
+
+  sim->engine()->setSurfaceBinning(true);
+  REQUIRE(sim->trace(tracing));
+
+  beam = sim->engine()->beam();
+  REQUIRE(beam->countAlive() == 200);
+  for (uint64_t i = 0; i < beam->count; ++i) {
+    REQUIRE((Vec3(beam->destinations + 3 * i) - destinations[i]).norm() == 0);
+    REQUIRE((Vec3(beam->directions + 3 * i) - directions[i]).norm() == 0);
+  }
+
+  // Each window took its half of the rays, in both traces
+  auto W1 = model->lookupOpticalElement("W1");
+  auto W2 = model->lookupOpticalElement("W2");
+  REQUIRE(W1->lookupSurface("inputFace")->statistics[0].intercepted == 200);
+  REQUIRE(W1->lookupSurface("inputFace")->statistics.count(1) == 0);
+  REQUIRE(W2->lookupSurface("inputFace")->statistics[1].intercepted == 200);
+
+  delete model;
+}
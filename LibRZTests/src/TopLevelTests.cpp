@@ -20,6 +20,13 @@
 #define THIS_TEST_TAG "[TopLevel]"
 
 #include <TopLevelModel.h>
+#include <ExprTkEvaluator.h>
+#include <RecipeCache.h>
+#include <ParserContext.h>
+#include <Helpers.h>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 #include <catch2/catch_test_macros.hpp>
 
 using namespace RZ;
@@ -312,3 +319,477 @@ TEST_CASE("Element rotation and translation", THIS_TEST_TAG)
   delete model;
 }
 
+
+TEST_CASE("Dependency graph evaluation", THIS_TEST_TAG)
+{
+  // Diamond: c depends on u through both a and b
+  auto model = TopLevelModel::fromString(
+    "dof u = 0;"
+    "var a = 2 * u;"
+    "var b = u + 1;"
+    "var c = a + b;"
+    "translate(dx = c, dy = a) BlockElement block (width = c + 1);"
+  );
+
+  REQUIRE(model != nullptr);
+
+  auto element = model->lookupElement("block");
+  REQUIRE(element != nullptr);
+
+  auto frame = element->parentFrame();
+  REQUIRE(frame != nullptr);
+
+  for (auto i = 0; i < 10; ++i) {
+    Real u = RZ_URANDSIGN;
+    Real c = 3 * u + 1;
+
+    model->resetEvaluationCounts();
+    model->setDof("u", u);
+
+    REQUIRE(releq(c, frame->getCenter().x));
+    REQUIRE(releq(2 * u, frame->getCenter().y));
+    REQUIRE(releq(c + 1, element->get<Real>("width")));
+
+    // Every expression in the cone of u must be evaluated exactly once,
+    // and the rest (the constant dz) not at all.
+    std::string graph = model->dependencyGraph();
+    size_t evals = 0, pos = 0;
+
+    while ((pos = graph.find(" evals", pos)) != std::string::npos) {
+      REQUIRE(graph[pos - 2] == 'n');
+      REQUIRE((graph[pos - 1] == '0' || graph[pos - 1] == '1'));
+      if (graph[pos - 1] == '1')
+        ++evals;
+      ++pos;
+    }
+
+    REQUIRE(evals == 6);
+  }
+
+  delete model;
+}
+
+TEST_CASE("Column expression evaluation", THIS_TEST_TAG)
+{
+  GenericModelParam x, y, k;
+  GenericEvaluatorSymbolDict dict = {{"x", &x}, {"y", &y}, {"k", &k}};
+  ExprTkEvaluator evaluator(&dict);
+
+  REQUIRE(evaluator.compile("k * x * x + sin(y)"));
+
+  // x is read from interleaved triplets (like ray origins), y is a
+  // plain array and k stays constant for all rows.
+  const size_t count = 1000;
+  std::vector<Real> xyz(3 * count), y0(count), out(2 * count);
+
+  for (size_t i = 0; i < count; ++i) {
+    xyz[3 * i] = RZ_URANDSIGN;
+    y0[i]      = RZ_URANDSIGN;
+  }
+
+  x.value = 7;
+  y.value = 8;
+  k.value = 3;
+
+  REQUIRE(evaluator.evaluate(
+    {{"x", xyz.data(), 3}, {"y", y0.data()}},
+    out.data(),
+    count,
+    2));
+
+  // Symbols are restored after the evaluation
+  REQUIRE(x.value == 7);
+  REQUIRE(y.value == 8);
+
+  for (size_t i = 0; i < count; ++i) {
+    x.value = xyz[3 * i];
+    y.value = y0[i];
+    REQUIRE(releq(out[2 * i], evaluator.evaluate()));
+  }
+
+  REQUIRE(!evaluator.evaluate({{"z", y0.data()}}, out.data(), count));
+}
+
+static void
+writeFile(std::string const &path, std::string const &contents)
+{
+  FILE *fp = fopen(path.c_str(), "w");
+  REQUIRE(fp != nullptr);
+  fputs(contents.c_str(), fp);
+  fclose(fp);
+}
+
+static std::string
+modelSummary(TopLevelModel *model)
+{
+  std::string summary;
+
+  for (auto el : model->allElements()) {
+    auto frame = el->parentFrame();
+    summary += el->name() + " " + el->factory()->name();
+    summary += string_printf(
+      " %g %g %g\n",
+      frame->getCenter().x,
+      frame->getCenter().y,
+      frame->getCenter().z);
+  }
+
+  for (auto &dof : model->dofs())
+    summary += dof + "\n";
+
+  return summary;
+}
+
+TEST_CASE("Script function memoization and batching", THIS_TEST_TAG)
+{
+  char dirTemplate[] = "/tmp/rztests-XXXXXX";
+  std::string dir = mkdtemp(dirTemplate);
+  std::string script = dir + "/rzscriptfuncs.py";
+
+  writeFile(
+    script,
+    "import RZLink\n"
+    "calls = {'square': 0, 'vsquare': 0, 'one': 0}\n"
+    "def one(x):\n"
+    "  calls['one'] += 1\n"
+    "  return 1\n"
+    "def square(x):\n"
+    "  calls['square'] += 1\n"
+    "  return x * x\n"
+    "def vsquare(x):\n"
+    "  calls['vsquare'] += 1\n"
+    "  return x * x\n"
+    "try:\n"
+    "  import numpy\n"
+    "  RZLink.register('vsquare', 1, vsquare, vectorized = True)\n"
+    "  haveNumpy = 1\n"
+    "except ImportError:\n"
+    "  RZLink.register('vsquare', 1, vsquare)\n"
+    "  haveNumpy = 0\n"
+    "RZLink.register('one', 1, one)\n"
+    "RZLink.register('square', 1, square, pure = True)\n"
+    "RZLink.register('squareCalls', 1, lambda _: calls['square'])\n"
+    "RZLink.register('vsquareCalls', 1, lambda _: calls['vsquare'])\n"
+    "RZLink.register('oneCalls', 1, lambda _: calls['one'])\n"
+    "RZLink.register('haveNumpy', 1, lambda _: haveNumpy)\n");
+
+  auto model = TopLevelModel::fromString(
+    "script \"" + script + "\";"
+    "dof u = 0;"
+    "var a = square(u);"
+    "translate(dx = a) BlockElement block;"
+    "translate(dx = squareCalls(a)) BlockElement counter;");
+
+  REQUIRE(model != nullptr);
+
+  auto block   = model->lookupElement("block")->parentFrame();
+  auto counter = model->lookupElement("counter")->parentFrame();
+
+  REQUIRE(releq(1, counter->getCenter().x));
+
+  // Pure functions are only called once per set of arguments
+  for (auto i = 0; i < 4; ++i) {
+    for (Real u : {1., 2., 3.}) {
+      REQUIRE(model->setDof("u", u));
+      REQUIRE(releq(u * u, block->getCenter().x));
+    }
+  }
+
+  REQUIRE(releq(4, counter->getCenter().x));
+
+  // Vectorized functions are called once per column evaluation, and
+  // the rest once per row
+  GenericModelParam x;
+  GenericEvaluatorSymbolDict dict = {{"x", &x}};
+  ExprTkEvaluator expr(&dict), calls(&dict), oneCalls(&dict), haveNumpy(&dict);
+
+  for (auto func : model->customFunctions()) {
+    expr.registerCustomFunction(func);
+    calls.registerCustomFunction(func);
+    oneCalls.registerCustomFunction(func);
+    haveNumpy.registerCustomFunction(func);
+  }
+
+  REQUIRE(expr.compile("vsquare(x) + one(x)"));
+  REQUIRE(calls.compile("vsquareCalls(0)"));
+  REQUIRE(oneCalls.compile("oneCalls(0)"));
+  REQUIRE(haveNumpy.compile("haveNumpy(0)"));
+
+  const size_t count = 1000;
+  std::vector<Real> xs(count), out(count);
+
+  for (size_t i = 0; i < count; ++i)
+    xs[i] = i % 10;
+
+  REQUIRE(expr.evaluate({{"x", xs.data()}}, out.data(), count));
+
+  for (size_t i = 0; i < count; ++i)
+    REQUIRE(releq(xs[i] * xs[i] + 1, out[i]));
+
+  if (haveNumpy.evaluate() != 0)
+    REQUIRE(calls.evaluate() == 1);
+  else
+    REQUIRE(calls.evaluate() == count);
+
+  REQUIRE(oneCalls.evaluate() == count);
+
+  delete model;
+
+  unlink(script.c_str());
+  rmdir(dir.c_str());
+}
+
+TEST_CASE("Recipe cache", THIS_TEST_TAG)
+{
+  char dirTemplate[] = "/tmp/rztests-XXXXXX";
+  std::string dir = mkdtemp(dirTemplate);
+  std::string part = dir + "/part.rzm";
+  std::string main = dir + "/main.rzm";
+  RecipeCache *cache = RecipeCache::instance();
+  std::string oldDir = cache->directory();
+  bool wasEnabled = cache->enabled();
+
+  cache->setDirectory(dir + "/cache");
+  cache->setEnabled(true);
+
+  writeFile(
+    part,
+    "parameter width = 1;"
+    "element Stage {"
+    "  dof alpha = 0;"
+    "  BlockElement base(width = width);"
+    "  on top_side of base {"
+    "    rotate (alpha, 1, 0, 0) { translate (dz = 1) { port platform; } }"
+    "  }"
+    "}");
+
+  writeFile(
+    main,
+    "import \"part.rzm\";"
+    "dof u = 0;"
+    "var a = 2 * u;"
+    "translate (dx = a) Stage stage;"
+    "on platform of stage { BlockElement top; }");
+
+  TopLevelModel *parsed = TopLevelModel::fromFile(main, {dir});
+  REQUIRE(parsed != nullptr);
+  auto misses = cache->misses();
+  auto hits   = cache->hits();
+
+  // Unchanged: taken from the cache
+  TopLevelModel *cached = TopLevelModel::fromFile(main, {dir});
+  REQUIRE(cached != nullptr);
+  REQUIRE(cache->hits() == hits + 1);
+  REQUIRE(modelSummary(parsed) == modelSummary(cached));
+
+  REQUIRE(parsed->setDof("u", 0.5));
+  REQUIRE(cached->setDof("u", 0.5));
+  REQUIRE(modelSummary(parsed) == modelSummary(cached));
+
+  delete cached;
+
+  // Changing an import invalidates the entry
+  writeFile(
+    part,
+    "parameter width = 1;"
+    "element Stage {"
+    "  dof alpha = 0;"
+    "  BlockElement base(width = width);"
+    "  on top_side of base {"
+    "    rotate (alpha, 1, 0, 0) { translate (dz = 2) { port platform; } }"
+    "  }"
+    "}");
+
+  cached = TopLevelModel::fromFile(main, {dir});
+  REQUIRE(cached != nullptr);
+  REQUIRE(cache->misses() == misses + 1);
+  REQUIRE(modelSummary(parsed) != modelSummary(cached));
+
+  delete cached;
+  delete parsed;
+
+  cache->setDirectory(oldDir);
+  cache->setEnabled(wasEnabled);
+
+  std::string cmd = "rm -rf " + dir;
+  REQUIRE(system(cmd.c_str()) == 0);
+}
+
+static Recipe *
+parseRecipe(std::string const &source)
+{
+  Recipe *recipe = new Recipe();
+  StringParserContext ctx(recipe);
+
+  recipe->addDof("t", 0, 0, 1e6);
+  ctx.setContents(source, "<test>");
+  ctx.parse();
+
+  return recipe;
+}
+
+TEST_CASE("Incremental model update", THIS_TEST_TAG)
+{
+  auto model = TopLevelModel::fromString(
+    "dof u = 0;"
+    "parameter w = 1;"
+    "var a = 2 * u;"
+    "translate(dx = a) BlockElement block (width = w);"
+  );
+
+  REQUIRE(model != nullptr);
+
+  auto element = model->lookupElement("block");
+  REQUIRE(element != nullptr);
+
+  auto frame = element->parentFrame();
+  auto frameName = frame->name();
+
+  // Same layout, different expressions and defaults
+  Recipe *edited = parseRecipe(
+    "dof u = 0;"
+    "parameter w = 3;"
+    "var a = 5 * u + w;"
+    "translate(dx = a) BlockElement block (width = w + 1);"
+  );
+
+  REQUIRE(model->update(edited));
+  REQUIRE(model->lookupElement("block") == element);
+  REQUIRE(releq(3, frame->getCenter().x));
+  REQUIRE(releq(4, element->get<Real>("width")));
+
+  // New dependencies must be honored
+  for (auto i = 0; i < 10; ++i) {
+    Real u = RZ_URANDSIGN;
+    Real w = RZ_URANDSIGN;
+
+    REQUIRE(model->setDof("u", u));
+    REQUIRE(model->setParam("w", w));
+    REQUIRE(releq(5 * u + w, frame->getCenter().x));
+    REQUIRE(releq(w + 1, element->get<Real>("width")));
+  }
+
+  // Added elements are created, the rest are kept
+  Recipe *grown = parseRecipe(
+    "dof u = 0;"
+    "parameter w = 3;"
+    "var a = 5 * u + w;"
+    "translate(dx = a) BlockElement block (width = w + 1);"
+    "translate(dy = a) BlockElement other (height = a);"
+  );
+
+  REQUIRE(model->update(grown));
+  REQUIRE(model->lookupElement("block") == element);
+  REQUIRE(element->parentFrame() == frame);
+
+  auto other = model->lookupElement("other");
+  REQUIRE(other != nullptr);
+
+  REQUIRE(model->setParam("w", 3));
+  REQUIRE(model->setDof("u", 1));
+  REQUIRE(releq(5 + 3, other->parentFrame()->getCenter().y));
+  REQUIRE(releq(5 + 3, other->get<Real>("height")));
+  REQUIRE(releq(5 + 3, frame->getCenter().x));
+
+  // Removed elements are destroyed, and properties that are no longer
+  // assigned go back to their defaults
+  Recipe *shrunk = parseRecipe(
+    "dof u = 0;"
+    "parameter w = 3;"
+    "var a = 5 * u + w;"
+    "translate(dx = a) BlockElement block;"
+  );
+
+  REQUIRE(model->update(shrunk));
+  REQUIRE(model->lookupElement("block") == element);
+  REQUIRE(model->lookupElement("other") == nullptr);
+  REQUIRE(releq(
+    *element->factory()->queryProperty("width"),
+    element->get<Real>("width")));
+
+  // Elements moved to other frames are created again
+  Recipe *moved = parseRecipe(
+    "dof u = 0;"
+    "parameter w = 3;"
+    "var a = 5 * u + w;"
+    "rotate(90, 0, 0, 1) BlockElement block (width = w + 1);"
+  );
+
+  REQUIRE(model->update(moved));
+  element = model->lookupElement("block");
+  REQUIRE(element != nullptr);
+  REQUIRE(element->parentFrame()->name() != frameName);
+  REQUIRE(model->lookupReferenceFrame(frameName) == nullptr);
+  REQUIRE(releq(4, element->get<Real>("width")));
+
+  // Broken expressions leave the model as it was
+  Recipe *broken = parseRecipe(
+    "dof u = 0;"
+    "parameter w = 3;"
+    "var a = 5 * u + w;"
+    "rotate(90, 0, 0, 1) BlockElement block (width = q + 1);"
+    "BlockElement another;"
+  );
+
+  REQUIRE(!model->update(broken));
+  delete broken;
+
+  REQUIRE(model->lookupElement("block") == element);
+  REQUIRE(model->lookupElement("another") == nullptr);
+
+  REQUIRE(model->setParam("w", 2));
+  REQUIRE(releq(3, element->get<Real>("width")));
+
+  delete model;
+}
+
+TEST_CASE("Incremental update of composite elements", THIS_TEST_TAG)
+{
+  std::string part =
+    "dof u = 0;"
+    "var a = 2 * u;"
+    "element Part {"
+    "  parameter h = 1;"
+    "  BlockElement b(height = h, width = u + 1);"
+    "}";
+
+  auto model = TopLevelModel::fromString(part + "Part first(h = a);");
+  REQUIRE(model != nullptr);
+
+  auto first = model->lookupElement("first");
+  REQUIRE(first != nullptr);
+
+  Recipe *grown = parseRecipe(part + "Part first(h = a); Part second(h = a + 1);");
+  REQUIRE(model->update(grown));
+  REQUIRE(model->lookupElement("first") == first);
+
+  auto second = model->lookupElement("second");
+  REQUIRE(second != nullptr);
+
+  REQUIRE(model->setDof("u", 1));
+  REQUIRE(releq(2, first->get<Real>("h")));
+  REQUIRE(releq(3, second->get<Real>("h")));
+
+  // The nested model of the removed element depended on u
+  Recipe *shrunk = parseRecipe(part + "Part second(h = a + 1);");
+  REQUIRE(model->update(shrunk));
+  REQUIRE(model->lookupElement("first") == nullptr);
+  REQUIRE(model->lookupElement("second") == second);
+
+  REQUIRE(model->setDof("u", 2));
+  REQUIRE(releq(5, second->get<Real>("h")));
+
+  // Custom element definitions must not change
+  Recipe *redefined = parseRecipe(
+    "dof u = 0;"
+    "var a = 2 * u;"
+    "element Part {"
+    "  parameter h = 2;"
+    "  BlockElement b(height = h, width = u + 1);"
+    "}"
+    "Part second(h = a + 1);");
+  REQUIRE(!model->update(redefined));
+  delete redefined;
+
+  delete model;
+}
@@ -0,0 +1,219 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RZBENCH_BENCHMARK_H
+#define _RZBENCH_BENCHMARK_H
+
+#include <TopLevelModel.h>
+#include <RayTracingProfiler.h>
+#include <JSON.h>
+#include <LargeAllocator.h>
+#include <CompactRayBeam.h>
+#include <string>
+#include <list>
+#include <vector>
+
+#define RZBENCH_FORMAT_VERSION 1
+#define RZBENCH_RNG_SEED       0x5eed
+
+namespace RZ {
+  //
+  // A benchmark case describes a model, the path along which it is traced
+  // and the beam that is used to illuminate it. Beams are generated with
+  // a fixed seed so that two runs of the same case trace the same rays.
+  //
+  class BenchmarkCase {
+    protected:
+      std::string m_name;
+      std::string m_description;
+      bool        m_nonSequential = false;
+      std::string m_path;
+
+    public:
+      BenchmarkCase(
+        std::string const &name,
+        std::string const &description,
+        std::string const &path = "",
+        bool nonSequential = false);
+      virtual ~BenchmarkCase();
+
+      std::string const &name() const;
+      std::string const &description() const;
+      std::string const &path() const;
+      bool nonSequential() const;
+
+      virtual TopLevelModel *load(std::string const &examplesDir) const = 0;
+      virtual void makeBeam(
+        TopLevelModel *,
+        unsigned int rays,
+        RayList &dest) const = 0;
+  };
+
+  //
+  // Case based on one of the example models, illuminated from the first
+  // element of the path or from a focal plane.
+  //
+  class ModelFileBenchmarkCase : public BenchmarkCase {
+      std::string m_file;
+      std::string m_focalPlane; // If empty, first element of the path
+      Real        m_diameter;
+      Real        m_fNum;       // Collimated if zero
+
+    public:
+      ModelFileBenchmarkCase(
+        std::string const &name,
+        std::string const &description,
+        std::string const &file,
+        std::string const &path,
+        Real diameter,
+        std::string const &focalPlane = "",
+        Real fNum = 0);
+
+      virtual TopLevelModel *load(std::string const &) const override;
+      virtual void makeBeam(
+        TopLevelModel *,
+        unsigned int rays,
+        RayList &dest) const override;
+  };
+
+  //
+  // Synthetic non-sequential scene: a stack of weak spherical lenses
+  // followed by a detector. Every lens contributes two surfaces.
+  //
+  class StackedLensesBenchmarkCase : public BenchmarkCase {
+      unsigned int m_lenses;
+
+    public:
+      StackedLensesBenchmarkCase(unsigned int lenses);
+
+      std::string modelSource() const;
+
+      virtual TopLevelModel *load(std::string const &) const override;
+      virtual void makeBeam(
+        TopLevelModel *,
+        unsigned int rays,
+        RayList &dest) const override;
+  };
+
+  struct BenchmarkResult {
+    std::string caseName;
+    bool        nonSequential = false;
+    uint64_t    rays          = 0;
+    unsigned    repeat        = 0;
+    double      elapsed       = 0; // [s] Best run
+    double      mean          = 0; // [s] Mean over all runs
+    uint64_t    peakRSS       = 0; // [bytes]
+    std::list<RayTracingStageSummary> stages; // Of the best run
+
+    inline double
+    raysPerSecond() const
+    {
+      return elapsed > 0 ? rays / elapsed : 0;
+    }
+
+    std::string key() const;
+    std::string toJSON(std::string const &indent = "") const;
+    static BenchmarkResult fromJSON(JSONValue const &);
+  };
+
+  //
+  // Result of the large beam allocation benchmark. The same trace is run
+  // with transparent huge pages disabled and enabled, each on a freshly
+  // loaded model so that every buffer is allocated under its own policy.
+  //
+  struct AllocationBenchmarkResult {
+    std::string     caseName;
+    bool            hugePages     = false;
+    uint64_t        rays          = 0;
+    unsigned        repeat        = 0;
+    double          elapsed       = 0; // [s] Best run
+    double          mean          = 0; // [s] Mean over all runs
+    uint64_t        peakRSS       = 0; // [bytes]
+    uint64_t        anonHugePages = 0; // [bytes] Actually backed by huge pages
+    LargeAllocStats alloc;             // Sampled right after the last run
+
+    inline double
+    raysPerSecond() const
+    {
+      return elapsed > 0 ? rays / elapsed : 0;
+    }
+
+    std::string toJSON(std::string const &indent = "") const;
+  };
+
+  struct BenchmarkComparison {
+    std::string key;
+    std::string metric;
+    double      baseline;
+    double      current;
+    double      change;     // Relative, positive means worse
+    bool        regression;
+  };
+
+  class BenchmarkRunner {
+      std::string  m_examplesDir;
+      unsigned int m_repeat = 3;
+      int64_t      m_blockSize = -1; // Simulation default
+      TracingPrecision m_precision = DoublePrecision;
+      std::vector<BenchmarkCase *> m_cases;
+      std::vector<BenchmarkResult> m_results;
+
+      BenchmarkResult runOne(
+        BenchmarkCase const *,
+        TopLevelModel *,
+        unsigned int rays);
+
+    public:
+      BenchmarkRunner(std::string const &examplesDir);
+      ~BenchmarkRunner();
+
+      void setRepeat(unsigned int);
+      void setBlockSize(uint64_t);
+      void setPrecision(TracingPrecision);
+      std::vector<BenchmarkCase *> const &cases() const;
+
+      // Restrict the cases to the given names. Returns false if some
+      // name does not match any case.
+      bool select(std::list<std::string> const &);
+
+      bool run(std::vector<unsigned int> const &rayCounts);
+
+      // Trace `rays' rays through the first selected case, without and
+      // with huge pages.
+      std::vector<AllocationBenchmarkResult> runAllocation(uint64_t rays);
+      std::string allocationToJSON(
+        std::vector<AllocationBenchmarkResult> const &) const;
+
+      std::vector<BenchmarkResult> const &results() const;
+      std::string toJSON() const;
+      bool save(std::string const &path) const;
+
+      static std::vector<BenchmarkResult> loadResults(std::string const &path);
+      static std::list<BenchmarkComparison> compare(
+        std::vector<BenchmarkResult> const &baseline,
+        std::vector<BenchmarkResult> const &current,
+        Real tolerance,
+        Real rssTolerance);
+  };
+
+  uint64_t peakResidentSetSize();
+  uint64_t anonHugePageSize();
+  void resetPeakResidentSetSize();
+}
+
+#endif // _RZBENCH_BENCHMARK_H
@@ -0,0 +1,881 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <Benchmark.h>
+#include <Simulation.h>
+#include <Logger.h>
+#include <sys/resource.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <map>
+
+using namespace RZ;
+
+////////////////////////////// Memory accounting ///////////////////////////////
+uint64_t
+RZ::peakResidentSetSize()
+{
+  FILE *fp = fopen("/proc/self/status", "r");
+  char line[256];
+  unsigned long kib;
+  uint64_t peak = 0;
+
+  if (fp != nullptr) {
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+      if (sscanf(line, "VmHWM: %lu kB", &kib) == 1) {
+        peak = static_cast<uint64_t>(kib) << 10;
+        break;
+      }
+    }
+
+    fclose(fp);
+  }
+
+  // Not Linux, fall back to the process-wide maximum
+  if (peak == 0) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+      peak = static_cast<uint64_t>(usage.ru_maxrss) << 10;
+  }
+
+  return peak;
+}
+
+//
+// Anonymous memory of the process that is currently backed by transparent
+// huge pages. Zero if this cannot be determined.
+//
+uint64_t
+RZ::anonHugePageSize()
+{
+  FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  unsigned long kib;
+  uint64_t size = 0;
+
+  if (fp != nullptr) {
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+      if (sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+        size = static_cast<uint64_t>(kib) << 10;
+        break;
+      }
+    }
+
+    fclose(fp);
+  }
+
+  return size;
+}
+
+//
+// Writing 5 to clear_refs resets the peak RSS of the process to its
+// current RSS (Linux >= 4.0). This lets us attribute peaks to individual
+// benchmark runs instead of reporting the maximum of the whole session.
+//
+void
+RZ::resetPeakResidentSetSize()
+{
+  FILE *fp = fopen("/proc/self/clear_refs", "w");
+
+  if (fp != nullptr) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+}
+
+////////////////////////////// Benchmark cases /////////////////////////////////
+BenchmarkCase::BenchmarkCase(
+  std::string const &name,
+  std::string const &description,
+  std::string const &path,
+  bool nonSequential) :
+  m_name(name),
+  m_description(description),
+  m_nonSequential(nonSequential),
+  m_path(path)
+{
+}
+
+BenchmarkCase::~BenchmarkCase()
+{
+}
+
+std::string const &
+BenchmarkCase::name() const
+{
+  return m_name;
+}
+
+std::string const &
+BenchmarkCase::description() const
+{
+  return m_description;
+}
+
+std::string const &
+BenchmarkCase::path() const
+{
+  return m_path;
+}
+
+bool
+BenchmarkCase::nonSequential() const
+{
+  return m_nonSequential;
+}
+
+ModelFileBenchmarkCase::ModelFileBenchmarkCase(
+  std::string const &name,
+  std::string const &description,
+  std::string const &file,
+  std::string const &path,
+  Real diameter,
+  std::string const &focalPlane,
+  Real fNum) : BenchmarkCase(name, description, path)
+{
+  m_file       = file;
+  m_focalPlane = focalPlane;
+  m_diameter   = diameter;
+  m_fNum       = fNum;
+}
+
+TopLevelModel *
+ModelFileBenchmarkCase::load(std::string const &examplesDir) const
+{
+  std::string fullPath = examplesDir + "/" + m_file;
+  std::string dir      = fullPath.substr(0, fullPath.find_last_of('/'));
+
+  return TopLevelModel::fromFile(fullPath, {dir});
+}
+
+void
+ModelFileBenchmarkCase::makeBeam(
+  TopLevelModel *model,
+  unsigned int rays,
+  RayList &dest) const
+{
+  BeamProperties prop;
+
+  if (m_focalPlane.empty()) {
+    auto path = model->lookupOpticalPathOrEx(m_path);
+    if (path->m_sequence.empty())
+      throw std::runtime_error("Optical path `" + m_path + "' is empty");
+
+    prop.setElementRelative(path->m_sequence.front()->parent);
+  } else {
+    auto fp = model->getFocalPlane(m_focalPlane);
+    if (fp == nullptr)
+      throw std::runtime_error("No such focal plane `" + m_focalPlane + "'");
+
+    prop.setPlaneRelative(fp);
+  }
+
+  prop.numRays  = rays;
+  prop.random   = true;
+  prop.diameter = m_diameter;
+
+  if (m_fNum > 0)
+    prop.setFNum(m_fNum, BeamDiameter);
+  else
+    prop.collimate();
+
+  srand(RZBENCH_RNG_SEED);
+  OMModel::addBeam(dest, prop);
+}
+
+#define RZBENCH_LENS_SEPARATION 20e-3
+#define RZBENCH_LENS_RADIUS     25e-3
+
+StackedLensesBenchmarkCase::StackedLensesBenchmarkCase(unsigned int lenses) :
+  BenchmarkCase(
+    string_printf("ns_lenses%u", lenses),
+    string_printf(
+      "Synthetic non-sequential scene with %u lenses (%u surfaces)",
+      lenses,
+      2 * lenses + 1),
+    "",
+    true)
+{
+  m_lenses = lenses;
+}
+
+std::string
+StackedLensesBenchmarkCase::modelSource() const
+{
+  std::string source;
+
+  for (unsigned i = 0; i < m_lenses; ++i)
+    source += string_printf(
+      "translate(dz = %g) "
+      "SphericalLens lens%u(curvature = 1, radius = %g, thickness = 2e-3, n = 1.5);\n",
+      -RZBENCH_LENS_SEPARATION * i,
+      i,
+      RZBENCH_LENS_RADIUS);
+
+  source += string_printf(
+    "translate(dz = %g) "
+    "Detector det(cols = 1024, rows = 1024, pixelWidth = 50e-6, pixelHeight = 50e-6);\n",
+    -RZBENCH_LENS_SEPARATION * m_lenses);
+
+  return source;
+}
+
+TopLevelModel *
+StackedLensesBenchmarkCase::load(std::string const &) const
+{
+  return TopLevelModel::fromString(modelSource(), {}, m_name);
+}
+
+void
+StackedLensesBenchmarkCase::makeBeam(
+  TopLevelModel *,
+  unsigned int rays,
+  RayList &dest) const
+{
+  BeamProperties prop;
+
+  // Sky-relative beams start at `length' above the origin, going down
+  prop.numRays  = rays;
+  prop.random   = true;
+  prop.diameter = 1.5 * RZBENCH_LENS_RADIUS;
+  prop.length   = 1;
+  prop.collimate();
+
+  srand(RZBENCH_RNG_SEED);
+  OMModel::addBeam(dest, prop);
+}
+
+////////////////////////////// Benchmark results ///////////////////////////////
+std::string
+BenchmarkResult::key() const
+{
+  return caseName + "/" + std::to_string(rays);
+}
+
+std::string
+BenchmarkResult::toJSON(std::string const &indent) const
+{
+  std::string json;
+  bool first = true;
+
+  json += indent + "{\n";
+  json += indent + "  \"case\": \"" + jsonEscape(caseName) + "\",\n";
+  json += indent + "  \"type\": \"";
+  json += nonSequential ? "non-sequential" : "sequential";
+  json += "\",\n";
+  json += indent + string_printf("  \"rays\": %lu,\n", rays);
+  json += indent + string_printf("  \"repeat\": %u,\n", repeat);
+  json += indent + string_printf("  \"elapsed\": %.9e,\n", elapsed);
+  json += indent + string_printf("  \"mean\": %.9e,\n", mean);
+  json += indent + string_printf("  \"raysPerSecond\": %.6e,\n", raysPerSecond());
+  json += indent + string_printf("  \"peakRSS\": %lu,\n", peakRSS);
+  json += indent + "  \"stages\": [";
+
+  for (auto &stage : stages) {
+    if (!first)
+      json += ",";
+
+    json += "\n" + indent + string_printf(
+      "    {\"stage\": \"%s\", \"phase\": \"%s\", \"calls\": %lu, "
+      "\"duration\": %lu, \"raysIn\": %lu, \"raysOut\": %lu}",
+      jsonEscape(stage.stage).c_str(),
+      tracingPhaseToString(stage.phase),
+      stage.calls,
+      stage.duration,
+      stage.raysIn,
+      stage.raysOut);
+
+    first = false;
+  }
+
+  json += "\n" + indent + "  ]\n";
+  json += indent + "}";
+
+  return json;
+}
+
+std::string
+AllocationBenchmarkResult::toJSON(std::string const &indent) const
+{
+  std::string json;
+
+  json += indent + "{\n";
+  json += indent + "  \"case\": \"" + jsonEscape(caseName) + "\",\n";
+  json += indent + "  \"hugePages\": ";
+  json += hugePages ? "true" : "false";
+  json += ",\n";
+  json += indent + string_printf("  \"rays\": %lu,\n", rays);
+  json += indent + string_printf("  \"repeat\": %u,\n", repeat);
+  json += indent + string_printf("  \"elapsed\": %.9e,\n", elapsed);
+  json += indent + string_printf("  \"mean\": %.9e,\n", mean);
+  json += indent + string_printf("  \"raysPerSecond\": %.6e,\n", raysPerSecond());
+  json += indent + string_printf("  \"peakRSS\": %lu,\n", peakRSS);
+  json += indent + string_printf("  \"anonHugePages\": %lu,\n", anonHugePages);
+  json += indent + "  \"allocator\": {";
+  json += string_printf(
+    "\"allocations\": %lu, \"releases\": %lu, \"inUse\": %lu, "
+    "\"peak\": %lu, \"mapped\": %lu, \"hugePages\": %lu}\n",
+    alloc.allocations,
+    alloc.releases,
+    alloc.inUse,
+    alloc.peak,
+    alloc.mapped,
+    alloc.hugePages);
+  json += indent + "}";
+
+  return json;
+}
+
+static RayTracingPhase
+phaseFromString(std::string const &name)
+{
+  for (int i = 0; i < RZ_TRACING_PHASE_COUNT; ++i) {
+    auto phase = static_cast<RayTracingPhase>(i);
+    if (name == tracingPhaseToString(phase))
+      return phase;
+  }
+
+  throw std::runtime_error("Unknown tracing phase `" + name + "'");
+}
+
+BenchmarkResult
+BenchmarkResult::fromJSON(JSONValue const &value)
+{
+  BenchmarkResult result;
+  auto &stages = value["stages"];
+
+  result.caseName      = value["case"].asString();
+  result.nonSequential = value.get("type", "sequential") == "non-sequential";
+  result.rays          = static_cast<uint64_t>(value["rays"].asNumber());
+  result.repeat        = static_cast<unsigned>(value.get("repeat", 1.));
+  result.elapsed       = value["elapsed"].asNumber();
+  result.mean          = value.get("mean", result.elapsed);
+  result.peakRSS       = static_cast<uint64_t>(value.get("peakRSS", 0.));
+
+  for (size_t i = 0; i < stages.size(); ++i) {
+    RayTracingStageSummary summ;
+    auto &stage = stages[i];
+
+    summ.stage    = stage["stage"].asString();
+    summ.phase    = phaseFromString(stage["phase"].asString());
+    summ.calls    = static_cast<uint64_t>(stage.get("calls", 0.));
+    summ.duration = static_cast<uint64_t>(stage.get("duration", 0.));
+    summ.raysIn   = static_cast<uint64_t>(stage.get("raysIn", 0.));
+    summ.raysOut  = static_cast<uint64_t>(stage.get("raysOut", 0.));
+
+    result.stages.push_back(summ);
+  }
+
+  return result;
+}
+
+////////////////////////////// Benchmark runner ////////////////////////////////
+BenchmarkRunner::BenchmarkRunner(std::string const &examplesDir)
+{
+  m_examplesDir = examplesDir;
+
+  m_cases.push_back(
+    new ModelFileBenchmarkCase(
+      "sosm_lens",
+      "Steering mirror, folding mirror and lens (sequential)",
+      "sosm_lens.rzm",
+      "",
+      30e-3));
+
+  m_cases.push_back(
+    new ModelFileBenchmarkCase(
+      "sosm_stop",
+      "Steering mirror with aperture stop and obstruction (sequential)",
+      "sosm_stop.rzm",
+      "",
+      30e-3));
+
+  m_cases.push_back(
+    new ModelFileBenchmarkCase(
+      "sosm_two",
+      "Steering mirror and two mirrors (sequential)",
+      "sosm_two.rzm",
+      "",
+      30e-3));
+
+  m_cases.push_back(
+    new ModelFileBenchmarkCase(
+      "lowfs",
+      "LOWFS pick-off arm, f/17.37 beam from the NGSS focal plane (sequential)",
+      "LOWFS/model.rzm",
+      "",
+      40e-3,
+      "ngssFocalPlane",
+      17.37));
+
+  m_cases.push_back(new StackedLensesBenchmarkCase(12));
+}
+
+BenchmarkRunner::~BenchmarkRunner()
+{
+  for (auto p : m_cases)
+    delete p;
+}
+
+void
+BenchmarkRunner::setRepeat(unsigned int repeat)
+{
+  m_repeat = repeat > 0 ? repeat : 1;
+}
+
+void
+BenchmarkRunner::setBlockSize(uint64_t size)
+{
+  m_blockSize = static_cast<int64_t>(size);
+}
+
+void
+BenchmarkRunner::setPrecision(TracingPrecision precision)
+{
+  m_precision = precision;
+}
+
+std::vector<BenchmarkCase *> const &
+BenchmarkRunner::cases() const
+{
+  return m_cases;
+}
+
+bool
+BenchmarkRunner::select(std::list<std::string> const &names)
+{
+  std::vector<BenchmarkCase *> selected, rest;
+
+  for (auto &name : names) {
+    bool found = false;
+
+    for (auto p : m_cases) {
+      if (p->name() == name) {
+        selected.push_back(p);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      RZError("No such benchmark case `%s'\n", name.c_str());
+      return false;
+    }
+  }
+
+  for (auto p : m_cases)
+    if (std::find(selected.begin(), selected.end(), p) == selected.end())
+      delete p;
+
+  m_cases = selected;
+
+  return true;
+}
+
+BenchmarkResult
+BenchmarkRunner::runOne(
+  BenchmarkCase const *bCase,
+  TopLevelModel *model,
+  unsigned int rays)
+{
+  BenchmarkResult result;
+  Simulation *sim = model->simulation();
+  double total = 0;
+
+  result.caseName      = bCase->name();
+  result.nonSequential = bCase->nonSequential();
+  result.rays          = rays;
+  result.repeat        = m_repeat;
+
+  if (m_blockSize >= 0)
+    sim->setBlockSize(static_cast<uint64_t>(m_blockSize));
+
+  sim->setPrecision(m_precision);
+
+  resetPeakResidentSetSize();
+
+  {
+    RayList beam;
+
+    bCase->makeBeam(model, rays, beam);
+    sim->setProfiling(true);
+
+    for (unsigned i = 0; i < m_repeat; ++i) {
+      double start = monotonicSeconds(), elapsed;
+      bool ok;
+
+      if (bCase->nonSequential())
+        ok = model->traceNonSequential(beam);
+      else
+        ok = model->trace(bCase->path(), beam);
+
+      elapsed = monotonicSeconds() - start;
+
+      if (!ok)
+        throw std::runtime_error("Trace of `" + bCase->name() + "' failed");
+
+      total += elapsed;
+
+      if (i == 0 || elapsed < result.elapsed) {
+        result.elapsed = elapsed;
+        result.stages  = sim->profiler().summary();
+      }
+    }
+
+    sim->setProfiling(false);
+  }
+
+  result.mean    = total / m_repeat;
+  result.peakRSS = peakResidentSetSize();
+
+  return result;
+}
+
+bool
+BenchmarkRunner::run(std::vector<unsigned int> const &rayCounts)
+{
+  for (auto p : m_cases) {
+    TopLevelModel *model = nullptr;
+
+    try {
+      model = p->load(m_examplesDir);
+
+      for (auto rays : rayCounts) {
+        RZInfo("%s: tracing %u rays (%u runs)\n", p->name().c_str(), rays, m_repeat);
+        m_results.push_back(runOne(p, model, rays));
+
+        auto &last = m_results.back();
+        RZInfo(
+          "%s: %.3e rays/s, peak RSS %.1f MiB\n",
+          p->name().c_str(),
+          last.raysPerSecond(),
+          last.peakRSS / 1048576.);
+      }
+    } catch (std::runtime_error const &e) {
+      RZError("%s: %s\n", p->name().c_str(), e.what());
+      if (model != nullptr)
+        delete model;
+      return false;
+    }
+
+    delete model;
+  }
+
+  return true;
+}
+
+//
+// The beam of the allocation benchmark is a pattern of at most
+// RZBENCH_ALLOC_PATTERN_RAYS rays from the case, repeated up to the
+// requested count. This keeps the input small next to the 50M-ray beams
+// it is meant for (a RayList of that size would need several GiB alone).
+//
+#define RZBENCH_ALLOC_PATTERN_RAYS 100000
+
+std::vector<AllocationBenchmarkResult>
+BenchmarkRunner::runAllocation(uint64_t rays)
+{
+  std::vector<AllocationBenchmarkResult> results;
+  BenchmarkCase const *bCase;
+  bool prevHugePages = largeAllocHugePages();
+
+  if (m_cases.empty())
+    throw std::runtime_error("No benchmark case selected");
+
+  bCase = m_cases.front();
+
+  for (int variant = 0; variant < 2; ++variant) {
+    AllocationBenchmarkResult result;
+    TopLevelModel *model = nullptr;
+    double total = 0;
+
+    result.caseName  = bCase->name();
+    result.hugePages = variant == 1;
+    result.rays      = rays;
+    result.repeat    = m_repeat;
+
+    setLargeAllocHugePages(result.hugePages);
+    resetLargeAllocPeak();
+    resetPeakResidentSetSize();
+
+    try {
+      RayList pattern;
+      std::vector<Real, LargeAllocator<Real>> origins(3 * rays);
+      std::vector<Real, LargeAllocator<Real>> directions(3 * rays);
+      std::vector<Real, LargeAllocator<Real>> wavelengths(rays);
+      RayArrays arrays;
+      TracingProperties props;
+      Simulation *sim;
+      uint64_t i = 0;
+
+      model = bCase->load(m_examplesDir);
+      sim   = model->simulation();
+
+      if (m_blockSize >= 0)
+        sim->setBlockSize(static_cast<uint64_t>(m_blockSize));
+
+      sim->setPrecision(m_precision);
+
+      bCase->makeBeam(
+        model,
+        static_cast<unsigned>(std::min<uint64_t>(rays, RZBENCH_ALLOC_PATTERN_RAYS)),
+        pattern);
+
+      if (pattern.empty())
+        throw std::runtime_error("Case `" + bCase->name() + "' produced no rays");
+
+      while (i < rays) {
+        for (auto &ray : pattern) {
+          if (i == rays)
+            break;
+
+          ray.origin.copyToArray(origins.data() + 3 * i);
+          ray.direction.copyToArray(directions.data() + 3 * i);
+          wavelengths[i] = ray.wavelength;
+          ++i;
+        }
+      }
+
+      arrays.count       = rays;
+      arrays.origins     = origins.data();
+      arrays.directions  = directions.data();
+      arrays.wavelengths = wavelengths.data();
+
+      props.type    = bCase->nonSequential() ? NonSequential : Sequential;
+      props.path    = bCase->path();
+      props.pArrays = &arrays;
+
+      RZInfo(
+        "%s: tracing %lu rays, huge pages %s (%u runs)\n",
+        bCase->name().c_str(),
+        rays,
+        result.hugePages ? "on" : "off",
+        m_repeat);
+
+      for (unsigned n = 0; n < m_repeat; ++n) {
+        double start = monotonicSeconds(), elapsed;
+
+        if (!sim->trace(props))
+          throw std::runtime_error("Trace of `" + bCase->name() + "' failed");
+
+        elapsed = monotonicSeconds() - start;
+        total  += elapsed;
+
+        if (n == 0 || elapsed < result.elapsed)
+          result.elapsed = elapsed;
+      }
+
+      result.alloc         = largeAllocStats();
+      result.anonHugePages = anonHugePageSize();
+    } catch (std::runtime_error const &e) {
+      if (model != nullptr)
+        delete model;
+      setLargeAllocHugePages(prevHugePages);
+      throw;
+    }
+
+    delete model;
+
+    result.mean    = total / m_repeat;
+    result.peakRSS = peakResidentSetSize();
+
+    RZInfo(
+      "%s: %.3e rays/s, peak RSS %.1f MiB, %.1f MiB in huge pages\n",
+      bCase->name().c_str(),
+      result.raysPerSecond(),
+      result.peakRSS / 1048576.,
+      result.anonHugePages / 1048576.);
+
+    results.push_back(result);
+  }
+
+  setLargeAllocHugePages(prevHugePages);
+
+  return results;
+}
+
+std::string
+BenchmarkRunner::allocationToJSON(
+  std::vector<AllocationBenchmarkResult> const &results) const
+{
+  std::string json;
+  bool first = true;
+
+  json += "{\n";
+  json += "  \"format\": \"RZBench-alloc\",\n";
+  json += string_printf("  \"version\": %d,\n", RZBENCH_FORMAT_VERSION);
+  json += string_printf("  \"repeat\": %u,\n", m_repeat);
+  json += "  \"results\": [";
+
+  for (auto &result : results) {
+    if (!first)
+      json += ",";
+
+    json += "\n" + result.toJSON("    ");
+    first = false;
+  }
+
+  json += "\n  ]\n}\n";
+
+  return json;
+}
+
+std::vector<BenchmarkResult> const &
+BenchmarkRunner::results() const
+{
+  return m_results;
+}
+
+std::string
+BenchmarkRunner::toJSON() const
+{
+  std::string json;
+  char date[64] = "";
+  time_t now = time(nullptr);
+  struct tm tm;
+  bool first = true;
+
+  if (gmtime_r(&now, &tm) != nullptr)
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+  json += "{\n";
+  json += "  \"format\": \"RZBench\",\n";
+  json += string_printf("  \"version\": %d,\n", RZBENCH_FORMAT_VERSION);
+  json += string_printf("  \"date\": \"%s\",\n", date);
+  json += string_printf("  \"repeat\": %u,\n", m_repeat);
+  json += "  \"results\": [";
+
+  for (auto &result : m_results) {
+    if (!first)
+      json += ",";
+
+    json += "\n" + result.toJSON("    ");
+    first = false;
+  }
+
+  json += "\n  ]\n}\n";
+
+  return json;
+}
+
+bool
+BenchmarkRunner::save(std::string const &path) const
+{
+  FILE *fp = fopen(path.c_str(), "w");
+  std::string json;
+  bool ok = false;
+
+  if (fp == nullptr) {
+    RZError("Cannot save results to `%s': %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  json = toJSON();
+
+  if (fwrite(json.c_str(), json.size(), 1, fp) < 1)
+    RZError("Failed to write results to `%s': %s\n", path.c_str(), strerror(errno));
+  else
+    ok = true;
+
+  fclose(fp);
+
+  return ok;
+}
+
+std::vector<BenchmarkResult>
+BenchmarkRunner::loadResults(std::string const &path)
+{
+  std::vector<BenchmarkResult> results;
+  auto doc = JSONValue::fromFile(path);
+
+  if (doc.get("format", "") != "RZBench")
+    throw std::runtime_error(path + ": not a RZBench result file");
+
+  if (doc.get("version", 0.) > RZBENCH_FORMAT_VERSION)
+    throw std::runtime_error(path + ": unsupported result file version");
+
+  auto &list = doc["results"];
+  for (size_t i = 0; i < list.size(); ++i)
+    results.push_back(BenchmarkResult::fromJSON(list[i]));
+
+  return results;
+}
+
+//
+// Only the throughput and the peak RSS of each (case, rays) pair decide
+// whether there is a regression. Per-stage durations are too noisy for
+// short runs and are compared for information purposes only.
+//
+std::list<BenchmarkComparison>
+BenchmarkRunner::compare(
+  std::vector<BenchmarkResult> const &baseline,
+  std::vector<BenchmarkResult> const &current,
+  Real tolerance,
+  Real rssTolerance)
+{
+  std::list<BenchmarkComparison> result;
+  std::map<std::string, BenchmarkResult const *> index;
+
+  for (auto &r : baseline)
+    index[r.key()] = &r;
+
+  for (auto &cur : current) {
+    auto it = index.find(cur.key());
+    if (it == index.end())
+      continue;
+
+    auto base = it->second;
+    BenchmarkComparison comp;
+
+    comp.key      = cur.key();
+    comp.metric   = "raysPerSecond";
+    comp.baseline = base->raysPerSecond();
+    comp.current  = cur.raysPerSecond();
+    comp.change   = comp.baseline > 0 ? 1 - comp.current / comp.baseline : 0;
+    comp.regression = comp.change > tolerance;
+    result.push_back(comp);
+
+    if (base->peakRSS > 0 && cur.peakRSS > 0) {
+      comp.metric   = "peakRSS";
+      comp.baseline = base->peakRSS;
+      comp.current  = cur.peakRSS;
+      comp.change   = comp.current / comp.baseline - 1;
+      comp.regression = comp.change > rssTolerance;
+      result.push_back(comp);
+    }
+
+    for (auto &stage : cur.stages) {
+      for (auto &baseStage : base->stages) {
+        if (baseStage.stage == stage.stage && baseStage.phase == stage.phase) {
+          comp.metric     = stage.stage + " (" + tracingPhaseToString(stage.phase) + ")";
+          comp.baseline   = 1e-9 * baseStage.duration;
+          comp.current    = 1e-9 * stage.duration;
+          comp.change     = comp.baseline > 0 ? comp.current / comp.baseline - 1 : 0;
+          comp.regression = false;
+          result.push_back(comp);
+          break;
+        }
+      }
+    }
+  }
+
+  return result;
+}
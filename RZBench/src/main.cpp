@@ -0,0 +1,297 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <Benchmark.h>
+#include <Logger.h>
+#include <getopt.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef RZBENCH_EXAMPLES_DIR
+#  define RZBENCH_EXAMPLES_DIR "examples"
+#endif // RZBENCH_EXAMPLES_DIR
+
+#define RZBENCH_DEFAULT_MAX_RAYS     1000000
+#define RZBENCH_DEFAULT_TOLERANCE    0.1
+#define RZBENCH_DEFAULT_RSS_TOLERANCE 0.2
+#define RZBENCH_SUGGESTED_ALLOC_RAYS 50000000
+
+using namespace RZ;
+
+static void
+help(const char *argv0)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s [OPTIONS]\n\n", argv0);
+  fprintf(stderr, "Runs the RayZaler tracing benchmarks and prints the results in JSON\n");
+  fprintf(stderr, "format. Ray counts go in decades from 1e3 up to the maximum.\n\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -o, --output FILE         Save results to FILE instead of stdout\n");
+  fprintf(stderr, "  -c, --compare FILE        Compare results against baseline FILE\n");
+  fprintf(stderr, "  -i, --input FILE          Do not run, compare results in FILE instead\n");
+  fprintf(stderr, "  -t, --tolerance FRAC      Throughput regression threshold (default: %g)\n", RZBENCH_DEFAULT_TOLERANCE);
+  fprintf(stderr, "  -m, --rss-tolerance FRAC  Peak RSS regression threshold (default: %g)\n", RZBENCH_DEFAULT_RSS_TOLERANCE);
+  fprintf(stderr, "  -M, --max-rays N          Largest ray count (default: %g, up to 1e7)\n", (double) RZBENCH_DEFAULT_MAX_RAYS);
+  fprintf(stderr, "  -n, --repeat N            Runs per measurement, the best one is kept\n");
+  fprintf(stderr, "  -a, --alloc-rays N        Instead, trace N rays (e.g. %g) through the\n", (double) RZBENCH_SUGGESTED_ALLOC_RAYS);
+  fprintf(stderr, "                            first selected case without and with huge\n");
+  fprintf(stderr, "                            pages, and report allocation statistics\n");
+  fprintf(stderr, "  -B, --block-size N        Rays per depth-first block in sequential\n");
+  fprintf(stderr, "                            traces, 0 to trace stage by stage\n");
+  fprintf(stderr, "  -S, --single              Store sequential beams in single precision\n");
+  fprintf(stderr, "  -s, --case NAME           Run only case NAME (may be repeated)\n");
+  fprintf(stderr, "  -x, --examples DIR        Directory of the example models\n");
+  fprintf(stderr, "                            (default: %s)\n", RZBENCH_EXAMPLES_DIR);
+  fprintf(stderr, "  -l, --list                List benchmark cases and exit\n");
+  fprintf(stderr, "  -v, --verbose             Report progress of each measurement\n");
+  fprintf(stderr, "  -h, --help                This help\n\n");
+  fprintf(stderr, "The exit code is 2 if a regression is detected.\n");
+}
+
+static struct option g_options[] = {
+  {"output",        required_argument, nullptr, 'o'},
+  {"compare",       required_argument, nullptr, 'c'},
+  {"input",         required_argument, nullptr, 'i'},
+  {"tolerance",     required_argument, nullptr, 't'},
+  {"rss-tolerance", required_argument, nullptr, 'm'},
+  {"max-rays",      required_argument, nullptr, 'M'},
+  {"repeat",        required_argument, nullptr, 'n'},
+  {"alloc-rays",    required_argument, nullptr, 'a'},
+  {"block-size",    required_argument, nullptr, 'B'},
+  {"single",        no_argument,       nullptr, 'S'},
+  {"case",          required_argument, nullptr, 's'},
+  {"examples",      required_argument, nullptr, 'x'},
+  {"list",          no_argument,       nullptr, 'l'},
+  {"verbose",       no_argument,       nullptr, 'v'},
+  {"help",          no_argument,       nullptr, 'h'},
+  {nullptr,         0,                 nullptr, 0}
+};
+
+static bool
+reportComparison(
+  std::vector<BenchmarkResult> const &baseline,
+  std::vector<BenchmarkResult> const &current,
+  Real tolerance,
+  Real rssTolerance)
+{
+  auto comparison = BenchmarkRunner::compare(
+    baseline,
+    current,
+    tolerance,
+    rssTolerance);
+  unsigned regressions = 0;
+
+  for (auto &comp : comparison) {
+    bool isStage = comp.metric != "raysPerSecond" && comp.metric != "peakRSS";
+
+    // Stage timings are only shown if they changed noticeably and
+    // they are long enough to be meaningful (1 ms)
+    if (isStage && (comp.change <= tolerance || comp.current < 1e-3))
+      continue;
+
+    fprintf(
+      stderr,
+      "%-10s %-24s %-40s %12.4e -> %12.4e (%+6.1f%%)\n",
+      comp.regression ? "REGRESSION" : (isStage ? "note" : "ok"),
+      comp.key.c_str(),
+      comp.metric.c_str(),
+      comp.baseline,
+      comp.current,
+      100 * (comp.metric == "raysPerSecond" ? -comp.change : comp.change));
+
+    if (comp.regression)
+      ++regressions;
+  }
+
+  if (comparison.empty())
+    fprintf(stderr, "No common measurements between baseline and results\n");
+  else if (regressions > 0)
+    fprintf(stderr, "%u regression(s) detected\n", regressions);
+  else
+    fprintf(stderr, "No regressions detected\n");
+
+  return regressions == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string output, baselineFile, inputFile;
+  std::string examplesDir = RZBENCH_EXAMPLES_DIR;
+  std::list<std::string> selected;
+  Real tolerance    = RZBENCH_DEFAULT_TOLERANCE;
+  Real rssTolerance = RZBENCH_DEFAULT_RSS_TOLERANCE;
+  unsigned int maxRays = RZBENCH_DEFAULT_MAX_RAYS;
+  unsigned int repeat  = 3;
+  uint64_t allocRays   = 0;
+  int64_t blockSize    = -1;
+  bool single = false;
+  bool list = false;
+  bool verbose = false;
+  StdErrLogger logger;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "o:c:i:t:m:M:n:a:B:Ss:x:lvh", g_options, nullptr)) != -1) {
+    switch (c) {
+      case 'o':
+        output = optarg;
+        break;
+
+      case 'c':
+        baselineFile = optarg;
+        break;
+
+      case 'i':
+        inputFile = optarg;
+        break;
+
+      case 't':
+        tolerance = atof(optarg);
+        break;
+
+      case 'm':
+        rssTolerance = atof(optarg);
+        break;
+
+      case 'M':
+        maxRays = static_cast<unsigned int>(atof(optarg));
+        break;
+
+      case 'n':
+        repeat = static_cast<unsigned int>(atoi(optarg));
+        break;
+
+      case 'a':
+        allocRays = static_cast<uint64_t>(atof(optarg));
+        break;
+
+      case 'B':
+        blockSize = static_cast<int64_t>(atof(optarg));
+        break;
+
+      case 'S':
+        single = true;
+        break;
+
+      case 's':
+        selected.push_back(optarg);
+        break;
+
+      case 'x':
+        examplesDir = optarg;
+        break;
+
+      case 'l':
+        list = true;
+        break;
+
+      case 'v':
+        verbose = true;
+        break;
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      default:
+        help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  Logger::setDefaultLogger(&logger);
+  Logger::setLogLevel(verbose ? LOG_INFO : LOG_WARNING);
+
+  if (maxRays < 1000 || maxRays > 10000000) {
+    fprintf(stderr, "%s: the maximum number of rays must be between 1e3 and 1e7\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    std::vector<BenchmarkResult> current;
+
+    if (!inputFile.empty()) {
+      current = BenchmarkRunner::loadResults(inputFile);
+    } else {
+      BenchmarkRunner runner(examplesDir);
+      std::vector<unsigned int> rayCounts;
+
+      if (list) {
+        for (auto p : runner.cases())
+          printf("%-16s %s\n", p->name().c_str(), p->description().c_str());
+        exit(EXIT_SUCCESS);
+      }
+
+      if (!selected.empty() && !runner.select(selected))
+        exit(EXIT_FAILURE);
+
+      if (blockSize >= 0)
+        runner.setBlockSize(static_cast<uint64_t>(blockSize));
+
+      if (single)
+        runner.setPrecision(SinglePrecision);
+
+      if (allocRays > 0) {
+        std::string json;
+
+        runner.setRepeat(repeat);
+        json = runner.allocationToJSON(runner.runAllocation(allocRays));
+
+        if (output.empty()) {
+          fputs(json.c_str(), stdout);
+        } else {
+          FILE *fp = fopen(output.c_str(), "w");
+          if (fp == nullptr) {
+            fprintf(stderr, "%s: cannot open %s for writing\n", argv[0], output.c_str());
+            exit(EXIT_FAILURE);
+          }
+          fputs(json.c_str(), fp);
+          fclose(fp);
+        }
+
+        exit(EXIT_SUCCESS);
+      }
+
+      for (unsigned int rays = 1000; rays <= maxRays; rays *= 10)
+        rayCounts.push_back(rays);
+
+      runner.setRepeat(repeat);
+
+      if (!runner.run(rayCounts))
+        exit(EXIT_FAILURE);
+
+      if (output.empty())
+        fputs(runner.toJSON().c_str(), stdout);
+      else if (!runner.save(output))
+        exit(EXIT_FAILURE);
+
+      current = runner.results();
+    }
+
+    if (!baselineFile.empty()) {
+      auto baseline = BenchmarkRunner::loadResults(baselineFile);
+      if (!reportComparison(baseline, current, tolerance, rssTolerance))
+        exit(2);
+    }
+  } catch (std::runtime_error const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
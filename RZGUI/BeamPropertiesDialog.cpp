@@ -111,6 +111,12 @@ BeamPropertiesDialog::connectAll()
         this,
         SLOT(onExprEditChanged()));
 
+  connect(
+        ui->intensityEdit,
+        SIGNAL(textChanged(QString)),
+        this,
+        SLOT(onExprEditChanged()));
+
   connect(
         ui->beamTypeCombo,
         SIGNAL(activated(int)),
@@ -229,6 +235,7 @@ BeamPropertiesDialog::parseProperties()
   m_properties.offsetY      = ui->offsetYEdit->text();
   m_properties.offsetZ      = ui->offsetZEdit->text();
   m_properties.wavelength   = ui->wlEdit->text();
+  m_properties.intensity    = ui->intensityEdit->text();
   m_properties.random       = ui->beamSamplingCombo->currentIndex() == 1;
   m_properties.colorByWl    = ui->wavelengthColorButton->isChecked();
   m_properties.focalPlane   = ui->focalPlaneCombo->currentData().toString();
@@ -260,6 +267,7 @@ BeamPropertiesDialog::refreshUi()
   BLOCKSIG(ui->offsetYEdit,       setText(m_properties.offsetY));
   BLOCKSIG(ui->offsetZEdit,       setText(m_properties.offsetZ));
   BLOCKSIG(ui->wlEdit,            setText(m_properties.wavelength));
+  BLOCKSIG(ui->intensityEdit,     setText(m_properties.intensity));
   BLOCKSIG(ui->beamSamplingCombo, setCurrentIndex(m_properties.random ? 1 : 0));
   BLOCKSIG(ui->pathEdit,          setText(m_properties.path));
   BLOCKSIG(ui->rayNumberSpin,     setValue(m_properties.rays));
@@ -441,6 +449,8 @@ BeamPropertiesDialog::highlightFaultyField(QString const &failed)
       edit = ui->offsetZEdit;
     else if (failed == "wavelength")
       edit = ui->wlEdit;
+    else if (failed == "intensity")
+      edit = ui->intensityEdit;
     else if (failed == "length")
       edit = ui->lengthEdit;
   }
@@ -36,7 +36,8 @@ ImageNavWidget::ImageNavWidget(QWidget *parent)
 inline qreal
 ImageNavWidget::pixelValue(unsigned p)
 {
-  if (m_showPhotons) {
+  // Incoherent detectors have no amplitude plane. Fall back to counts.
+  if (m_showPhotons || m_detector->amplitude() == nullptr) {
     const uint32_t *photons = m_detector->data();
     return photons[p]; 
   } else {
@@ -49,6 +50,9 @@ ImageNavWidget::pixelValue(unsigned p)
 inline qreal
 ImageNavWidget::pixelPhase(unsigned p)
 {
+  if (m_detector->amplitude() == nullptr)
+    return 0;
+
   const RZ::Complex A = m_detector->amplitude()[p];
   return std::arg(A);
 }
@@ -87,7 +91,7 @@ ImageNavWidget::recalcImage()
     m_asBytes.resize(allocation);
 
     if (m_autoscale) {
-      m_sane_max = m_arr_max = m_showPhotons 
+      m_sane_max = m_arr_max = m_showPhotons || !m_detector->coherent()
         ? m_detector->maxCounts()
         : m_detector->maxEnergy();
 
@@ -247,7 +251,7 @@ ImageNavWidget::setDetector(RZ::Detector *det)
     unsigned int height = m_detector->rows();
 
     m_sane_min = 0;
-    m_sane_max = m_showPhotons 
+    m_sane_max = m_showPhotons || !m_detector->coherent()
       ? m_detector->maxCounts()
       : m_detector->maxEnergy();
     m_ratio = static_cast<qreal>(height) / static_cast<qreal>(width);
@@ -103,6 +103,10 @@ MainWindow::logFunction(
     case RZ::LOG_INFO:
       prefix = "<b>Info</b>: ";
       break;
+
+    case RZ::LOG_DEBUG:
+      prefix = "<b>Debug</b>: ";
+      break;
   }
 
   QTextCursor cursor = ui->logTextEdit->textCursor();
@@ -242,6 +242,7 @@ SimulationBeamProperties::serialize() const
   SERIALIZE(offsetY);
   SERIALIZE(offsetZ);
   SERIALIZE(wavelength);
+  SERIALIZE(intensity);
   SERIALIZE(length);
   SERIALIZE(random);
   SERIALIZE(rays);
@@ -278,6 +279,7 @@ SimulationBeamProperties::deserialize(QJsonObject const &obj)
   DESERIALIZE(offsetY);
   DESERIALIZE(offsetZ);
   DESERIALIZE(wavelength);
+  DESERIALIZE(intensity);
   DESERIALIZE(length);
   DESERIALIZE(random);
   DESERIALIZE(rays);
@@ -72,6 +72,7 @@ struct SimulationBeamProperties : public JsonSerializable {
   QString offsetY      = "0";       // m
   QString offsetZ      = "0";       // m
   QString wavelength   = "525";     // nm
+  QString intensity    = "1";       // Relative to the chief ray
   QString length       = "1";       // m
 
   bool    negativeZ    = true;
@@ -18,6 +18,7 @@
 
 #include "SimulationSession.h"
 #include <ParserContext.h>
+#include <RecipeCache.h>
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
@@ -27,6 +28,7 @@
 #include <QThread>
 #include <QDir>
 #include "AsyncRayTracer.h"
+#include "SweepArtifactWriter.h"
 #include <DataProducts/Scatter.h>
 #include <QJsonObject>
 #include <QJsonArray>
@@ -34,6 +36,7 @@
 #include <sys/stat.h>
 #include <Logger.h>
 #include <cmath>
+#include <algorithm>
 #include <QElapsedTimer>
 #include <GUIHelpers.h>
 
@@ -82,10 +85,18 @@ RZGUIBeamColoring::id2color(uint32_t id, GLfloat *rgb) const
 /////////////////////////// BeamSimulationState ///////////////////////////////
 BeamSimulationState::BeamSimulationState(
     const SimulationBeamProperties &prop,
-    ExprEvaluationContext *ctx) : evalCtx(ctx)
+    RZ::ExprEvaluationContext *ctx) : evalCtx(ctx)
 {
   properties = prop;
   stateName  = prop.name;
+
+  // Per-ray variables: random values (rayU, rayN) and the coordinates of
+  // the ray in the pupil, normalized to the beam radius (rayX, rayY).
+  // Expressions depending on them are evaluated for each ray of the beam.
+  evalCtx.defineVariable("rayU");
+  evalCtx.defineVariable("rayN");
+  evalCtx.defineVariable("rayX");
+  evalCtx.defineVariable("rayY");
 }
 
 //////////////////////////// SimulationState //////////////////////////////////
@@ -107,10 +118,26 @@ SimulationState::canRun() const
   return m_complete;
 }
 
-void
+//
+// Artifacts are written asynchronously by the session's artifact writer.
+// If the detector has to be cleared after each step, its image is swapped
+// into a snapshot buffer that is saved while the next step is traced. This
+// returns false if all snapshot buffers are still being written, in which
+// case it must be called again after the writer saves one of them.
+//
+bool
 SimulationState::saveArtifacts()
 {
   if (m_properties.saveArtifacts) {
+    SweepArtifactWriter *writer = m_session->artifactWriter();
+    SweepArtifact artifact;
+
+    if (m_properties.clearDetector) {
+      artifact.snapshot = writer->takeSnapshot();
+      if (artifact.snapshot == nullptr)
+        return false;
+    }
+
     QString path = getCurrentOutputFileName();
     if (!m_properties.overwrite) {
       while (QFile(getCurrentOutputFileName()).exists())
@@ -121,18 +148,25 @@ SimulationState::saveArtifacts()
 
     std::string fileName = path.toStdString();
 
-    if (m_properties.saveCSV)
-      saveCSV();
+    if (m_properties.saveCSV && m_csvFp != nullptr) {
+      artifact.csvFp   = m_csvFp;
+      artifact.csvLine = makeCSVLine();
+    }
 
-    if (m_properties.clearDetector) {  
-      RZInfo("Saving detector state to %s\n", fileName.c_str());
-      m_saveDetector->savePNG(fileName);
-      m_saveDetector->clear();
+    if (m_properties.clearDetector) {
+      m_saveDetector->swapStorage(*artifact.snapshot);
+      artifact.fileName = fileName;
     } else if (done()) {
+      // Nothing else is traced after this, no need to snapshot
       RZInfo("Saving final state to %s\n", fileName.c_str());
       m_saveDetector->savePNG(fileName);
     }
+
+    if (artifact.snapshot != nullptr || artifact.csvFp != nullptr)
+      writer->push(artifact);
   }
+
+  return true;
 }
 
 void
@@ -198,8 +232,19 @@ SimulationState::createNewBeamStates()
     TRY_DEFINE_BEAM_EXPR(offsetY);
     TRY_DEFINE_BEAM_EXPR(offsetZ);
     TRY_DEFINE_BEAM_EXPR(wavelength);
+    TRY_DEFINE_BEAM_EXPR(intensity);
     TRY_DEFINE_BEAM_EXPR(length);
 
+    auto perRay = [beamState] (const char *expr) {
+      for (auto var : {"rayU", "rayN", "rayX", "rayY"})
+        if (beamState->evalCtx.dependsOn(expr, var))
+          return true;
+      return false;
+    };
+
+    beamState->perRayWavelength = perRay("wavelength");
+    beamState->perRayIntensity  = perRay("intensity");
+
     beamState->complete = true;
   }
 #undef TRY_DEFINE_BEAM_EXPR
@@ -222,7 +267,7 @@ SimulationState::setProperties(SimulationProperties const &prop)
   if (m_evalModelCtx != nullptr)
     delete m_evalModelCtx;
 
-  m_evalModelCtx = new ExprEvaluationContext(&m_evalSimCtx);
+  m_evalModelCtx = new RZ::ExprEvaluationContext(&m_evalSimCtx);
 
   // Start by DOF expressions
   for (auto p : prop.dofs) {
@@ -369,12 +414,80 @@ SimulationState::allocateRays()
         break;
     }
 
-    RZ::OMModel::addBeam(*m_currentRayGroup, prop);
+    if (beamState->perRayWavelength
+      || beamState->perRayIntensity
+      || beamState->evalCtx.eval("intensity") != 1) {
+      RZ::RayList rays;
+      std::vector<RZ::Real> pupil;
+      RZ::Real R = .5 * D;
+
+      RZ::OMModel::addBeam(rays, prop, &pupil);
+
+      if (!RZ::isZero(R))
+        for (auto &coord : pupil)
+          coord /= R;
+
+      assignRayProperties(beamState, rays, pupil);
+      m_currentRayGroup->splice(m_currentRayGroup->end(), rays);
+    } else {
+      RZ::OMModel::addBeam(*m_currentRayGroup, prop);
+    }
   }
 
   return true;
 }
 
+// The wavelength and intensity expressions are compiled once and evaluated
+// over the columns of per-ray values. The pupil holds the normalized (x, y)
+// coordinates of each ray, interleaved. The beam's wavelength (used for
+// coloring) is still the one of the chief ray.
+void
+SimulationState::assignRayProperties(
+    BeamSimulationState *beamState,
+    RZ::RayList &rays,
+    std::vector<RZ::Real> const &pupil)
+{
+  size_t count = rays.size();
+  std::vector<RZ::Real> rayU(count), rayN(count), wl(count), I(count);
+  std::string name = beamState->stateName.toStdString();
+  size_t i = 0;
+
+  for (i = 0; i < count; ++i) {
+    rayU[i] = randUniform();
+    rayN[i] = randNormal();
+  }
+
+  std::vector<RZ::GenericEvaluatorColumn> columns = {
+    {"rayU", rayU.data()},
+    {"rayN", rayN.data()},
+    {"rayX", pupil.data(),     2},
+    {"rayY", pupil.data() + 1, 2}
+  };
+
+  if (beamState->perRayWavelength
+    && !beamState->evalCtx.evalColumns(
+      "wavelength",
+      columns,
+      wl.data(),
+      count)) {
+    RZError("Cannot evaluate per-ray wavelengths of beam %s\n", name.c_str());
+    return;
+  }
+
+  if (!beamState->evalCtx.evalColumns("intensity", columns, I.data(), count)) {
+    RZError("Cannot evaluate per-ray intensities of beam %s\n", name.c_str());
+    return;
+  }
+
+  i = 0;
+  for (auto &ray : rays) {
+    if (beamState->perRayWavelength)
+      ray.wavelength = wl[i] * 1e-9;
+    ray.amplitude = sqrt(std::max<RZ::Real>(I[i], 0));
+    ++i;
+  }
+}
+
 void
 SimulationState::clearBeams()
 {
@@ -556,14 +669,9 @@ toStringPrecision(const T a_value, const int n = 16)
     return std::move(out).str();
 }
 
-void
-SimulationState::saveCSV()
+std::string
+SimulationState::makeCSVLine() const
 {
-  if (m_csvFp == nullptr) {
-    RZError("saveCSV() called with no CSV file!\n");
-    return;
-  }
-
   std::string line;
 
   line += std::to_string(m_currStep) + ","
@@ -579,18 +687,21 @@ SimulationState::saveCSV()
 
   line += getCurrentOutputFileName().toStdString() + "\n";
 
-  if (fwrite(line.c_str(), line.size(), 1, m_csvFp) < 1)
-    RZError(
-          "fwrite(): failed to write state to CSV file: %s\n",
-          strerror(errno));
+  return line;
 }
 
 void
 SimulationState::closeCSV()
 {
-  // Lazy close previous file
+  // Lazy close previous file. This is done by the writer, after all the
+  // pending lines of this file.
   if (m_csvFp != nullptr) {
-    fclose(m_csvFp);
+    SweepArtifact artifact;
+
+    artifact.csvFp    = m_csvFp;
+    artifact.closeCSV = true;
+    m_session->artifactWriter()->push(artifact);
+
     m_csvFp = nullptr;
   }
 }
@@ -627,79 +738,35 @@ SimulationState::extractFootprintsFromSurface(
     std::string const &path,
     RZ::OpticalSurface *surf)
 {
-  uint32_t currId = 0xffffffff;
-  BeamSimulationState *beamState = nullptr;
-  SurfaceFootprint *footprint = nullptr;
-  auto &locations = surf->locations();
-  auto &directions = surf->directions();
-  size_t i = 0;
-  size_t prevIndex = 0;
-  size_t hitsCount = surf->hits.size();
-
-  std::map<uint32_t, SurfaceFootprint *> idToFootprint;
-
-  for (i = 0; i < hitsCount; ++i) {
-    auto &hit = surf->hits[i];
-
-    if (hit.id != currId) {
-      if (footprint != nullptr) {
-        footprint->locations.insert(
-              footprint->locations.end(),
-              &locations[3 * prevIndex],
-              &locations[3 * i]);
-
-        footprint->directions.insert(
-              footprint->directions.end(),
-              &directions[3 * prevIndex],
-              &directions[3 * i]);
-      }
-
-      prevIndex  = i;
-
-      currId     = hit.id;
-      beamState  = nullptr;
-      footprint  = nullptr;
-
-      auto it = m_idToBeam.find(currId);
-      if (it == m_idToBeam.end())
-        continue;
-
-      beamState = it->second;
-
-      // What??? What is this even for
-      auto fit = idToFootprint.find(currId);
-      if (fit == idToFootprint.end()) {
-        SurfaceFootprint fp;
-        fp.fullName    = path + "." + surf->name;
-        fp.label       = beamState->stateName.toStdString();
-        fp.color       = 0xff000000 | m_session->idToRgba(currId);
-        fp.id          = currId;
-        auto sit = surf->statistics.find(currId);
-        // We artificall
-        if (sit != surf->statistics.end()) {
-          fp.vignetted   = sit->second.vignetted;
-          fp.transmitted = sit->second.intercepted;
-        }
-
-        m_footprints.push_back(std::move(fp));
-        footprint = &m_footprints.back();
-        idToFootprint[currId] = footprint;
-      } else {
-        footprint = fit->second;
-      }
+  // The columns of every beam are copied into its footprint, and the hits
+  // are cleared afterwards.
+  for (auto &group : surf->hits.groups()) {
+    uint32_t id = group.id;
+
+    auto it = m_idToBeam.find(id);
+    if (it == m_idToBeam.end())
+      continue;
+
+    BeamSimulationState *beamState = it->second;
+    SurfaceFootprint fp;
+
+    fp.fullName    = path + "." + surf->name;
+    fp.label       = beamState->stateName.toStdString();
+    fp.color       = 0xff000000 | m_session->idToRgba(id);
+    fp.id          = id;
+    fp.vignetted   = 0;
+    fp.transmitted = 0;
+
+    auto sit = surf->statistics.find(id);
+    if (sit != surf->statistics.end()) {
+      fp.vignetted   = sit->second.vignetted;
+      fp.transmitted = sit->second.intercepted;
     }
-  }
 
-  if (footprint != nullptr) {
-    footprint->locations.insert(
-          footprint->locations.end(),
-          &locations[3 * prevIndex],
-          &locations[3 * hitsCount]);
+    fp.locations.assign(group.origins, group.origins + 3 * group.size());
+    fp.directions.assign(group.directions, group.directions + 3 * group.size());
 
-    footprint->directions.insert(
-          footprint->directions.end(),
-          &directions[3 * prevIndex],
-          &directions[3 * hitsCount]);
+    m_footprints.push_back(std::move(fp));
   }
 
   surf->hits.clear();
@@ -984,10 +1051,14 @@ SimulationSession::reload(RZ::ParserContext *context)
   RZ::TopLevelModel *topLevelModel = nullptr;
   std::string strPath = m_path.toStdString();
   std::string strName = m_fileName.toStdString();
+  std::list<std::string> searchPaths = {m_searchPath.toStdString()};
+  RZ::RecipeCache *cache = RZ::RecipeCache::instance();
   std::string error;
   bool isParserError = false;
   FILE *fp = fopen(strPath.c_str(), "r");
 
+  m_lastReloadInPlace = false;
+
   if (fp == nullptr) {
     error = "Cannot open " + strName + " for reading: ";
     error += strerror(errno);
@@ -995,29 +1066,53 @@ SimulationSession::reload(RZ::ParserContext *context)
   }
 
   if (context == nullptr) {
-    recipe = new RZ::Recipe();
-    recipe->addDof("t", 0, 0, 1e6);
+    recipe = cache->load(strPath, searchPaths);
 
-    fileCtx = new RZ::FileParserContext(recipe);
-    fileCtx->addSearchPath(m_searchPath.toStdString());
-    fileCtx->setFile(fp, strName.c_str());
-    context = fileCtx;
+    if (recipe == nullptr) {
+      recipe = new RZ::Recipe();
+      recipe->addDof("t", 0, 0, 1e6);
+
+      fileCtx = new RZ::FileParserContext(recipe);
+      fileCtx->addSearchPath(m_searchPath.toStdString());
+      fileCtx->setFile(fp, strName.c_str());
+      context = fileCtx;
+    } else {
+      // Unchanged model, taken from the recipe cache
+      fclose(fp);
+    }
   } else {
     recipe = context->recipe();
   }
 
-  try {
-    context->parse();
-  } catch (RZ::ParserError const &e) {
-    isParserError = true;
-    parserError = e;
+  if (context != nullptr) {
+    try {
+      context->parse();
+    } catch (RZ::ParserError const &e) {
+      isParserError = true;
+      parserError = e;
 
-    goto done;
-  } catch (std::runtime_error const &e) {
-    error = "Model file has errors:<pre>";
-    error += e.what();
-    error += "</pre>";
+      goto done;
+    } catch (std::runtime_error const &e) {
+      error = "Model file has errors:<pre>";
+      error += e.what();
+      error += "</pre>";
+
+      goto done;
+    }
 
+    if (fileCtx != nullptr)
+      cache->save(strPath, searchPaths, recipe, fileCtx->dependencies());
+  }
+
+  // Edits are applied to the current model in place whenever possible.
+  // Elements that did not change are kept, with their detector images.
+  if (m_topLevelModel != nullptr
+      && !m_tracer->running()
+      && m_topLevelModel->update(recipe)) {
+    std::swap(recipe, m_recipe);
+    m_lastReloadInPlace = true;
+    m_selectedElement   = nullptr;
+    ok = true;
     goto done;
   }
 
@@ -1072,11 +1167,20 @@ SimulationSession::reload(RZ::ParserContext *context)
   ok = true;
 
 done:
-  if (ok) {
+  if (ok && !m_lastReloadInPlace) {
     if (!m_simState->setTopLevelModel(topLevelModel)) {
       error = "Failed to top model of simulation state (memory leak)!";
       ok = false;
     } else {
+      // Detectors that are still there keep their images
+      if (m_topLevelModel != nullptr) {
+        for (auto &name : topLevelModel->detectors()) {
+          auto oldDet = m_topLevelModel->lookupDetector(name);
+          if (oldDet != nullptr)
+            topLevelModel->lookupDetector(name)->adoptStorage(oldDet);
+        }
+      }
+
       std::swap(recipe, m_recipe);
       std::swap(topLevelModel, m_topLevelModel);
       m_selectedElement = nullptr;
@@ -1126,9 +1230,40 @@ SimulationSession::SimulationSession(
         m_tracerThread,
         SLOT(deleteLater()));
 
+  // Sweep artifacts are saved in their own thread, so that writing the
+  // results of a step overlaps with the tracing of the next one.
+  m_writerThread = new QThread;
+  connect(
+        m_writerThread,
+        SIGNAL(finished()),
+        m_writerThread,
+        SLOT(deleteLater()));
+
+  m_writer = new SweepArtifactWriter;
+  m_writer->moveToThread(m_writerThread);
+
+  connect(
+        m_writer,
+        SIGNAL(writeRequested()),
+        m_writer,
+        SLOT(onWriteRequested()));
+
+  connect(
+        m_writer,
+        SIGNAL(saved()),
+        this,
+        SLOT(onArtifactSaved()));
+
+  connect(
+        m_writer,
+        SIGNAL(error(QString)),
+        this,
+        SLOT(onArtifactError(QString)));
+
   reload();
 
   m_tracerThread->start();
+  m_writerThread->start();
 }
 
 SimulationSession::~SimulationSession()
@@ -1144,6 +1279,17 @@ SimulationSession::~SimulationSession()
   if (m_simState != nullptr)
     delete m_simState;
 
+  // Whatever is still queued is written by the destructor
+  if (m_writerThread != nullptr) {
+    m_writerThread->quit();
+    m_writerThread->wait();
+  }
+
+  if (m_writer != nullptr) {
+    disconnect(m_writer, nullptr, this, nullptr);
+    delete m_writer;
+  }
+
   if (m_topLevelModel != nullptr)
     delete m_topLevelModel;
 
@@ -1173,6 +1319,12 @@ SimulationSession::tracer() const
   return m_tracer;
 }
 
+SweepArtifactWriter *
+SimulationSession::artifactWriter() const
+{
+  return m_writer;
+}
+
 RZ::Recipe *
 SimulationSession::recipe() const
 {
@@ -1267,7 +1419,7 @@ SimulationSession::iterateSimulation()
 bool
 SimulationSession::runSimulation()
 {
-  if (m_simState->running()) {
+  if (m_simState->running() || m_waitingForWriter || m_finishPending) {
     RZWarning("Cannot start simulation: another simulation is in progress\n");
     return true;
   }
@@ -1378,25 +1530,67 @@ SimulationSession::onSimulationDone(bool haveBeam)
   if (m_simPending == 0)
     m_simState->releaseRays();
 
-  m_simState->saveArtifacts();
+  // All snapshots in flight: resume from onArtifactSaved()
+  if (!m_simState->saveArtifacts()) {
+    m_waitingForWriter = true;
+    return;
+  }
+
+  continueSweep();
+}
 
+void
+SimulationSession::continueSweep()
+{
   if (m_simState->sweepStep()) {
     iterateSimulation();
   } else {
-    struct timeval now, diff;
-    gettimeofday(&now, nullptr);
+    m_simState->extractFootprints();
 
-    timersub(&now, &m_simulationStart, &diff);
+    // Do not report the end of the sweep until everything is saved
+    if (m_writer->idle())
+      finishSweep();
+    else
+      m_finishPending = true;
+  }
+}
 
-    m_simState->extractFootprints();
+void
+SimulationSession::finishSweep()
+{
+  struct timeval now, diff;
+  gettimeofday(&now, nullptr);
+
+  timersub(&now, &m_simulationStart, &diff);
+
+  m_finishPending = false;
+
+  emit sweepFinished();
+  RZInfo(
+        "Simulation finished (%s)\n",
+        timeDeltaToString(diff).toStdString().c_str());
+}
 
-    emit sweepFinished();
-    RZInfo(
-          "Simulation finished (%s)\n",
-          timeDeltaToString(diff).toStdString().c_str());
+void
+SimulationSession::onArtifactSaved()
+{
+  if (m_waitingForWriter) {
+    if (!m_simState->saveArtifacts())
+      return;
+
+    m_waitingForWriter = false;
+    continueSweep();
+  } else if (m_finishPending && m_writer->idle()) {
+    finishSweep();
   }
 }
 
+void
+SimulationSession::onArtifactError(QString err)
+{
+  emit simulationError(err);
+}
+
 void
 SimulationSession::onSimulationAborted()
 {
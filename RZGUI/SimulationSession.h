@@ -28,7 +28,7 @@
 #include "SimulationProperties.h"
 #include "SpotDiagramWindow.h"
 #include "GUIHelpers.h"
-#include "ExprEvaluationContext.h"
+#include <ExprEvaluationContext.h>
 
 #define RZGUI_MODEL_REFRESH_MS 100
 #define RZGUI_MODEL_DEFAULT_RAY_COLOR 0xffff00 // Yellow
@@ -49,6 +49,7 @@
 //
 
 class AsyncRayTracer;
+class SweepArtifactWriter;
 class FileParserContext;
 class QAbstractTableModel;
 
@@ -78,11 +79,13 @@ struct BeamSimulationState {
   uint32_t                 id = 0;
   QString                  stateName;
   SimulationBeamProperties properties;
-  ExprEvaluationContext    evalCtx;
+  RZ::ExprEvaluationContext evalCtx;
   bool                     complete = false;
   qreal                    wavelength = 555e-9;
+  bool                     perRayWavelength = false; // Depends on per-ray variables
+  bool                     perRayIntensity  = false; // Ditto
 
-  BeamSimulationState(const SimulationBeamProperties &, ExprEvaluationContext *);
+  BeamSimulationState(const SimulationBeamProperties &, RZ::ExprEvaluationContext *);
 };
 
 typedef RZ::RayList RayGroup;
@@ -94,8 +97,8 @@ class SimulationState {
   RZ::TopLevelModel       *m_topLevelModel = nullptr;
   RZ::ExprRandomState     *m_randState     = nullptr;
   RZ::RayBeamElement      *m_beamElement   = nullptr;
-  ExprEvaluationContext    m_evalSimCtx;
-  ExprEvaluationContext   *m_evalModelCtx = nullptr;
+  RZ::ExprEvaluationContext  m_evalSimCtx;
+  RZ::ExprEvaluationContext *m_evalModelCtx = nullptr;
   std::string              m_lastCompileError = "";
   std::string              m_firstFailedExpr = "";
   std::string              m_firstFailedBeamExpr = "";
@@ -150,10 +153,14 @@ class SimulationState {
       RZ::OpticalSurface *);
 
   bool openCSV();
-  void saveCSV();
+  std::string makeCSVLine() const;
   void closeCSV();
 
   bool createNewBeamStates();
+  void assignRayProperties(
+      BeamSimulationState *,
+      RZ::RayList &,
+      std::vector<RZ::Real> const &pupil);
 
 public:
   SimulationState(SimulationSession *);
@@ -170,7 +177,7 @@ public:
   int currStep() const;
   int simCount() const;
 
-  void saveArtifacts();
+  bool saveArtifacts();
   bool allocateRays();
   void releaseRays();
 
@@ -194,9 +201,12 @@ class SimulationSession : public QObject
   QString            m_searchPath;
   RZ::Recipe        *m_recipe            = nullptr;
   RZ::TopLevelModel *m_topLevelModel     = nullptr;
+  bool               m_lastReloadInPlace = false;
   RZ::Element       *m_selectedElement   = nullptr;
   AsyncRayTracer    *m_tracer            = nullptr;
   QThread           *m_tracerThread      = nullptr;
+  SweepArtifactWriter *m_writer        = nullptr;
+  QThread           *m_writerThread      = nullptr;
   SimulationState   *m_simState          = nullptr;
   QTimer            *m_timer             = nullptr;
   RZ::RayColoring   *m_beamColoring;
@@ -204,12 +214,16 @@ class SimulationSession : public QObject
   bool               m_paused            = false;
   bool               m_playing           = false;
   int                m_simPending        = 0;
+  bool               m_waitingForWriter  = false;
+  bool               m_finishPending     = false;
 
   struct timeval     m_simulationStart;
   struct timeval     m_lastModelRefresh;
 
   void               updateAnim();
   void               iterateSimulation();
+  void               continueSweep();
+  void               finishSweep();
 
 public:
   explicit SimulationSession(QString const &path, QObject *parent = nullptr);
@@ -219,6 +233,7 @@ public:
   RZ::Recipe          *recipe() const;
   RZ::TopLevelModel   *topLevelModel() const;
   AsyncRayTracer      *tracer() const;
+  SweepArtifactWriter *artifactWriter() const;
 
   // Session actions
   void                 selectElement(RZ::Element *);
@@ -253,6 +268,8 @@ public slots:
   void onSimulationDone(bool);
   void onSimulationAborted();
   void onSimulationError(QString);
+  void onArtifactSaved();
+  void onArtifactError(QString);
 };
 
 #endif // SIMULATIONSESSION_H
@@ -0,0 +1,159 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include "SweepArtifactWriter.h"
+#include <Elements/Detector.h>
+#include <Logger.h>
+#include <QMutexLocker>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+SweepArtifactWriter::SweepArtifactWriter(QObject *parent)
+  : QObject{parent}
+{
+}
+
+SweepArtifactWriter::~SweepArtifactWriter()
+{
+  flush();
+
+  for (auto p : m_freeSnapshots)
+    delete p;
+}
+
+RZ::DetectorStorage *
+SweepArtifactWriter::takeSnapshot()
+{
+  QMutexLocker<QMutex> locker(&m_mutex);
+  RZ::DetectorStorage *snapshot = nullptr;
+
+  if (!m_freeSnapshots.empty()) {
+    snapshot = m_freeSnapshots.front();
+    m_freeSnapshots.pop_front();
+  } else if (m_allocSnapshots < RZGUI_SWEEP_SNAPSHOT_BUFFERS) {
+    // Shape does not matter, the detector will reshape it on swap
+    snapshot = new RZ::DetectorStorage(1, 1, 15e-6, 15e-6);
+    ++m_allocSnapshots;
+  }
+
+  return snapshot;
+}
+
+void
+SweepArtifactWriter::push(SweepArtifact const &artifact)
+{
+  m_mutex.lock();
+  m_queue.push_back(artifact);
+  m_mutex.unlock();
+
+  emit writeRequested();
+}
+
+bool
+SweepArtifactWriter::idle()
+{
+  QMutexLocker<QMutex> locker(&m_mutex);
+
+  return m_queue.empty() && !m_busy;
+}
+
+bool
+SweepArtifactWriter::write(SweepArtifact &artifact)
+{
+  bool ok = true;
+
+  if (artifact.snapshot != nullptr) {
+    if (!artifact.fileName.empty()) {
+      RZInfo("Saving detector state to %s\n", artifact.fileName.c_str());
+      try {
+        ok = artifact.snapshot->savePNG(artifact.fileName);
+      } catch (std::exception const &e) {
+        RZError("Cannot save %s: %s\n", artifact.fileName.c_str(), e.what());
+        ok = false;
+      }
+    }
+
+    artifact.snapshot->clear();
+  }
+
+  if (artifact.csvFp != nullptr) {
+    if (!artifact.csvLine.empty()
+        && fwrite(
+          artifact.csvLine.c_str(),
+          artifact.csvLine.size(),
+          1,
+          artifact.csvFp) < 1) {
+      RZError(
+            "fwrite(): failed to write state to CSV file: %s\n",
+            strerror(errno));
+      ok = false;
+    }
+
+    if (artifact.closeCSV)
+      fclose(artifact.csvFp);
+  }
+
+  return ok;
+}
+
+//
+// The queue is drained in a loop, so several writeRequested() signals may
+// be served by a single call. The rest of them find the queue empty.
+//
+void
+SweepArtifactWriter::onWriteRequested()
+{
+  for (;;) {
+    SweepArtifact artifact;
+    bool ok;
+
+    m_mutex.lock();
+    if (m_queue.empty()) {
+      m_busy = false;
+      m_mutex.unlock();
+      break;
+    }
+
+    artifact = m_queue.front();
+    m_queue.pop_front();
+    m_busy = true;
+    m_mutex.unlock();
+
+    ok = write(artifact);
+
+    if (artifact.snapshot != nullptr) {
+      m_mutex.lock();
+      m_freeSnapshots.push_back(artifact.snapshot);
+      m_mutex.unlock();
+    }
+
+    if (!ok)
+      emit error(
+          "Failed to save simulation artifacts to "
+          + QString::fromStdString(artifact.fileName));
+
+    emit saved();
+  }
+}
+
+void
+SweepArtifactWriter::flush()
+{
+  onWriteRequested();
+}
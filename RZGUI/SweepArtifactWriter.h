@@ -0,0 +1,86 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef SWEEPARTIFACTWRITER_H
+#define SWEEPARTIFACTWRITER_H
+
+#include <QObject>
+#include <QMutex>
+#include <cstdio>
+#include <list>
+#include <string>
+
+// Detector snapshots in flight. With two of them, the image of step k - 1
+// is written while step k is traced into the detector.
+#define RZGUI_SWEEP_SNAPSHOT_BUFFERS 2
+
+namespace RZ {
+  class DetectorStorage;
+}
+
+//
+// Everything that has to be saved after a sweep step. The CSV line is
+// composed in the GUI thread (it depends on the DOFs of the step), and
+// the detector image is handed over as a snapshot taken from the writer.
+//
+struct SweepArtifact {
+  RZ::DetectorStorage *snapshot = nullptr; // Taken with takeSnapshot()
+  std::string          fileName;           // PNG file for the snapshot
+  FILE                *csvFp    = nullptr;
+  std::string          csvLine;
+  bool                 closeCSV = false;   // Close csvFp after writing
+};
+
+//
+// Writes sweep artifacts in its own thread, in the order they were pushed.
+// Snapshot buffers are recycled: the GUI takes a clear one, swaps it with
+// the detector storage and pushes it. The writer saves it, clears it and
+// returns it to the pool. If no snapshot is available the GUI must wait
+// for saved() before taking another one.
+//
+class SweepArtifactWriter : public QObject
+{
+  Q_OBJECT
+
+  QMutex                           m_mutex;
+  std::list<SweepArtifact>         m_queue;
+  std::list<RZ::DetectorStorage *> m_freeSnapshots;
+  unsigned int                     m_allocSnapshots = 0;
+  bool                             m_busy = false;
+
+  bool write(SweepArtifact &);
+
+public:
+  explicit SweepArtifactWriter(QObject *parent = nullptr);
+  virtual ~SweepArtifactWriter() override;
+
+  RZ::DetectorStorage *takeSnapshot(); // Null if all of them are in flight
+  void push(SweepArtifact const &);
+  bool idle();
+  void flush();
+
+signals:
+  void writeRequested();
+  void saved();
+  void error(QString);
+
+public slots:
+  void onWriteRequested();
+};
+
+#endif // SWEEPARTIFACTWRITER_H
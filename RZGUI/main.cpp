@@ -24,6 +24,7 @@
 #include <FT2Facade.h>
 #include <QResource>
 #include <Logger.h>
+#include <RecipeCache.h>
 
 bool
 loadEmbeddedFontAs(const char *name, const char *file)
@@ -64,6 +65,8 @@ main(int argc, char *argv[])
 
   loadFonts();
 
+  RZ::RecipeCache::instance()->setDefaultEnabled(true);
+
   w.show();
 
   for (auto i = 1; i < argc; ++i) {
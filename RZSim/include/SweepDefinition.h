@@ -0,0 +1,139 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RZSIM_SWEEP_DEFINITION_H
+#define _RZSIM_SWEEP_DEFINITION_H
+
+#include <OMModel.h>
+#include <Optimizer.h>
+#include <SkySampler.h>
+#include <JSON.h>
+#include <string>
+#include <vector>
+#include <list>
+
+namespace RZ {
+  enum SweepTracerType {
+    SWEEP_TRACER_GEOMETRIC_OPTICS,
+    SWEEP_TRACER_DIFFRACTION
+  };
+
+  enum SweepType {
+    SWEEP_ONE_SHOT,
+    SWEEP_1D,
+    SWEEP_2D
+  };
+
+  enum SweepBeamType {
+    SWEEP_BEAM_COLLIMATED,
+    SWEEP_BEAM_CONVERGING,
+    SWEEP_BEAM_DIVERGING
+  };
+
+  enum SweepBeamReference {
+    SWEEP_BEAM_REFERENCE_INPUT_ELEMENT,
+    SWEEP_BEAM_REFERENCE_APERTURE_STOP,
+    SWEEP_BEAM_REFERENCE_FOCAL_PLANE
+  };
+
+  //
+  // Beam of a sweep, as saved by the simulation dialog of the GUI. Numeric
+  // properties are expressions, that may depend on the sweep variables
+  // (i, j, step...) and the DOFs. The wavelength (in nm) may also depend
+  // on the per-ray random variables rayU and rayN.
+  //
+  struct SweepBeam {
+    std::string        name;
+    SweepBeamType      beam        = SWEEP_BEAM_COLLIMATED;
+    SweepBeamReference ref         = SWEEP_BEAM_REFERENCE_INPUT_ELEMENT;
+    BeamShape          shape       = Circular;
+    SkyObjectShape     objectShape = PointLike;
+
+    unsigned int rays         = 1000;
+    std::string  path;
+    std::string  diameter     = "40e-3";   // m
+    std::string  span         = "0";       // deg
+    std::string  focalPlane;
+    std::string  apertureStop;
+    std::string  fNum         = "17.37";
+    std::string  uX           = "0";
+    std::string  uY           = "0";
+    std::string  offsetX      = "0";       // m
+    std::string  offsetY      = "0";       // m
+    std::string  offsetZ      = "0";       // m
+    std::string  wavelength   = "525";     // nm
+    std::string  length       = "1";       // m
+
+    bool negativeZ = true;
+    bool random    = false;
+
+    static SweepBeam fromJSON(JSONValue const &);
+  };
+
+  //
+  // Sweep description, in the same JSON format used by the GUI to save
+  // simulation settings. Files with no "beams" array (saved by older
+  // versions) describe a single beam in the top-level object.
+  //
+  // The optional "optimize" object describes an optimization of the DOFs
+  // (see Optimizer.h), run by rzsim --optimize from the DOF values and
+  // beams of the first step of the sweep:
+  //
+  //   "optimize": {
+  //     "variables": ["focus", "tilt"],
+  //     "targets": [
+  //       {"metric": "RMS_RADIUS", "element": "det", "weight": 1e6},
+  //       {"metric": "CENTROID_X", "element": "det", "target": 1e-4}
+  //     ],
+  //     "maxIterations": 50,
+  //     "tolerance": 1e-6,
+  //     "step": 1e-6
+  //   }
+  //
+  struct SweepDefinition {
+    SweepTracerType ttype = SWEEP_TRACER_GEOMETRIC_OPTICS;
+    SweepType       type  = SWEEP_ONE_SHOT;
+    bool            nonSeq = false;
+    unsigned int    Ni     = 10;
+    unsigned int    Nj     = 10;
+    std::string     path;
+
+    std::vector<SweepBeam> beams;
+    std::list<std::pair<std::string, std::string>> dofs; // In file order
+
+    bool        saveArtifacts = false;
+    bool        saveCSV       = true;
+    bool        clearDetector = false;
+    bool        overwrite     = false;
+    std::string saveDir       = "artifacts";
+    std::string saveDetector;
+
+    bool                hasOptimization = false;
+    OptimizerProperties optimization;
+
+    // Ni and Nj, with the unused dimensions of the sweep collapsed
+    unsigned int effectiveNi() const;
+    unsigned int effectiveNj() const;
+    unsigned int steps() const;
+
+    static SweepDefinition fromJSON(JSONValue const &);
+    static SweepDefinition fromFile(std::string const &path);
+  };
+}
+
+#endif // _RZSIM_SWEEP_DEFINITION_H
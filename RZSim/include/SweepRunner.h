@@ -0,0 +1,119 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#ifndef _RZSIM_SWEEP_RUNNER_H
+#define _RZSIM_SWEEP_RUNNER_H
+
+#include <SweepDefinition.h>
+#include <TopLevelModel.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <list>
+
+#define RZSIM_DEFAULT_SEED 0x5eed
+
+namespace RZ {
+  class Detector;
+  class SweepWorker;
+
+  struct SweepStepResult {
+    unsigned int      step = 0;
+    unsigned int      i    = 0;
+    unsigned int      j    = 0;
+    bool              ok   = false;
+    std::vector<Real> dofs;         // In the order of the sweep definition
+    std::string       fileName;     // Empty if no frame was saved
+    uint64_t          rays        = 0;
+    uint64_t          intercepted = 0; // By the saved detector
+    uint64_t          vignetted   = 0;
+    uint64_t          pruned      = 0;
+    uint32_t          maxCounts   = 0;
+    double            elapsed     = 0; // [s]
+  };
+
+  //
+  // Runs a sweep with no GUI. Every worker thread owns a copy of the model
+  // and takes the next pending step until the sweep is done, so the steps
+  // are not traced in order. The random variables of each step (stepU,
+  // stepN, rayU, rayN, randomly sampled beams and the random state of the
+  // model) are seeded from the sweep seed and the step number, making the
+  // results independent of the number of threads.
+  //
+  // If the detector is not cleared between steps, every worker accumulates
+  // its steps on its own detector, and they are all merged at the end.
+  //
+  // optimize() runs the optimization of the sweep instead, from the first
+  // step, on a single model. The threads are used as forked processes to
+  // evaluate the Jacobian.
+  //
+  class SweepRunner {
+      SweepDefinition        m_definition;
+      std::string            m_modelFile;
+      std::list<std::string> m_searchPaths;
+      std::string            m_outputDir;
+      std::string            m_prefix;
+      unsigned int           m_threads = 1;
+      unsigned int           m_processes = 1; // Per trace
+      uint64_t               m_seed    = RZSIM_DEFAULT_SEED;
+      bool                   m_verbose = false;
+
+      std::vector<SweepWorker *>   m_workers;
+      std::vector<SweepStepResult> m_results;
+      OptimizerResult              m_optimization;
+      std::atomic<unsigned int>    m_nextStep;
+      std::atomic<bool>            m_failed;
+      std::mutex                   m_beamMutex;
+      std::mutex                   m_reportMutex;
+      unsigned int                 m_done = 0;
+
+      friend class SweepWorker;
+
+      void clearWorkers();
+      void makePrefix(std::string const &detectorName);
+      void workerLoop(SweepWorker *);
+      void report(SweepStepResult const &);
+      bool saveCSV() const;
+      bool saveOptimizationCSV() const;
+
+    public:
+      SweepRunner(
+        SweepDefinition const &definition,
+        std::string const &modelFile,
+        std::list<std::string> const &searchPaths = std::list<std::string>());
+      ~SweepRunner();
+
+      void setThreads(unsigned int);
+      void setProcesses(unsigned int);
+      void setOutputDir(std::string const &); // Overrides saveDir
+      void setSeed(uint64_t);
+      void setVerbose(bool);
+
+      std::string outputFileName(std::string const &suffix) const;
+      std::string frameFileName(unsigned int step) const;
+
+      bool run();
+      bool optimize();
+
+      std::vector<SweepStepResult> const &results() const;
+      OptimizerResult const &optimization() const;
+  };
+}
+
+#endif // _RZSIM_SWEEP_RUNNER_H
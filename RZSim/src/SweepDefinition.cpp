@@ -0,0 +1,336 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <SweepDefinition.h>
+#include <stdexcept>
+#include <cstdio>
+
+using namespace RZ;
+
+template <typename T>
+struct SweepEnumName {
+  const char *name;
+  T           value;
+};
+
+template <typename T, size_t N>
+static void
+parseEnum(
+  JSONValue const &obj,
+  std::string const &key,
+  SweepEnumName<T> const (&names)[N],
+  std::string const &what,
+  T &value)
+{
+  if (!obj.has(key))
+    return;
+
+  if (!obj[key].isString())
+    throw std::runtime_error(
+      "Invalid value for property `" + key + "' (not a string)");
+
+  auto const &asString = obj[key].asString();
+
+  for (auto &p : names) {
+    if (asString == p.name) {
+      value = p.value;
+      return;
+    }
+  }
+
+  throw std::runtime_error("Unknown " + what + " `" + asString + "'");
+}
+
+// Expressions can also be given as plain numbers
+static void
+parseExpr(JSONValue const &obj, std::string const &key, std::string &value)
+{
+  if (!obj.has(key))
+    return;
+
+  if (obj[key].isString()) {
+    value = obj[key].asString();
+  } else if (obj[key].isNumber()) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", obj[key].asNumber());
+    value = buf;
+  } else {
+    throw std::runtime_error(
+      "Invalid value for property `" + key + "' (not an expression)");
+  }
+}
+
+static void
+parseCount(JSONValue const &obj, std::string const &key, unsigned int &value)
+{
+  if (!obj.has(key))
+    return;
+
+  if (!obj[key].isNumber() || obj[key].asNumber() < 1)
+    throw std::runtime_error(
+      "Invalid value for property `" + key + "' (not a positive number)");
+
+  value = static_cast<unsigned int>(obj[key].asNumber());
+}
+
+static void
+parseString(JSONValue const &obj, std::string const &key, std::string &value)
+{
+  if (!obj.has(key) || obj[key].isNull())
+    return;
+
+  if (!obj[key].isString())
+    throw std::runtime_error(
+      "Invalid value for property `" + key + "' (not a string)");
+
+  value = obj[key].asString();
+}
+
+static void
+parseReal(JSONValue const &obj, std::string const &key, Real &value)
+{
+  if (!obj.has(key))
+    return;
+
+  if (!obj[key].isNumber())
+    throw std::runtime_error(
+      "Invalid value for property `" + key + "' (not a number)");
+
+  value = obj[key].asNumber();
+}
+
+static void
+parseBool(JSONValue const &obj, std::string const &key, bool &value)
+{
+  value = obj.getBool(key, value);
+}
+
+///////////////////////////////// SweepBeam ////////////////////////////////////
+SweepBeam
+SweepBeam::fromJSON(JSONValue const &obj)
+{
+  static const SweepEnumName<SweepBeamType> beamTypes[] = {
+    {"COLLIMATED", SWEEP_BEAM_COLLIMATED},
+    {"CONVERGING", SWEEP_BEAM_CONVERGING},
+    {"DIVERGING",  SWEEP_BEAM_DIVERGING}
+  };
+
+  static const SweepEnumName<BeamShape> shapes[] = {
+    {"CIRCULAR", Circular},
+    {"RING",     Ring},
+    {"POINT",    Point},
+    {"CUSTOM",   Custom}
+  };
+
+  static const SweepEnumName<SkyObjectShape> objectShapes[] = {
+    {"POINTLIKE",  PointLike},
+    {"CIRCLELIKE", CircleLike},
+    {"RINGLIKE",   RingLike},
+    {"EXTENDED",   Extended}
+  };
+
+  static const SweepEnumName<SweepBeamReference> references[] = {
+    {"INPUT_ELEMENT", SWEEP_BEAM_REFERENCE_INPUT_ELEMENT},
+    {"APERTURE_STOP", SWEEP_BEAM_REFERENCE_APERTURE_STOP},
+    {"FOCAL_PLANE",   SWEEP_BEAM_REFERENCE_FOCAL_PLANE}
+  };
+
+  SweepBeam beam;
+
+  if (!obj.isObject())
+    throw std::runtime_error("Beam description is not an object");
+
+  parseString(obj, "name", beam.name);
+  parseEnum(obj, "beam", beamTypes, "beam type", beam.beam);
+  parseEnum(obj, "shape", shapes, "beam shape", beam.shape);
+  parseEnum(obj, "objectShape", objectShapes, "sky object type", beam.objectShape);
+  parseEnum(obj, "ref", references, "beam reference", beam.ref);
+  parseString(obj, "path", beam.path);
+
+  parseExpr(obj, "diameter", beam.diameter);
+  parseExpr(obj, "span", beam.span);
+  parseString(obj, "focalPlane", beam.focalPlane);
+  parseString(obj, "apertureStop", beam.apertureStop);
+  parseExpr(obj, "fNum", beam.fNum);
+  parseExpr(obj, "uX", beam.uX);
+  parseExpr(obj, "uY", beam.uY);
+  parseBool(obj, "negativeZ", beam.negativeZ);
+  parseExpr(obj, "offsetX", beam.offsetX);
+  parseExpr(obj, "offsetY", beam.offsetY);
+  parseExpr(obj, "offsetZ", beam.offsetZ);
+  parseExpr(obj, "wavelength", beam.wavelength);
+  parseExpr(obj, "length", beam.length);
+  parseBool(obj, "random", beam.random);
+  parseCount(obj, "rays", beam.rays);
+
+  return beam;
+}
+
+///////////////////////////////// Optimization /////////////////////////////////
+static OptimizerTarget
+parseTarget(JSONValue const &obj)
+{
+  static const SweepEnumName<SensitivityMetricKind> metrics[] = {
+    {"CENTROID_X",   SpotCentroidX},
+    {"CENTROID_Y",   SpotCentroidY},
+    {"RMS_RADIUS",   SpotRmsRadius},
+    {"MOMENT_XX",    SpotMomentXX},
+    {"MOMENT_YY",    SpotMomentYY},
+    {"MOMENT_XY",    SpotMomentXY},
+    {"TRANSMISSION", SpotTransmission},
+    {"OPD_RMS",      SpotOpdRms}
+  };
+
+  OptimizerTarget target;
+
+  if (!obj.isObject())
+    throw std::runtime_error("Optimization target is not an object");
+
+  parseEnum(obj, "metric", metrics, "metric", target.metric.kind);
+  parseString(obj, "element", target.metric.element);
+  parseReal(obj, "target", target.target);
+  parseReal(obj, "weight", target.weight);
+
+  if (target.metric.element.empty())
+    throw std::runtime_error("Optimization target has no element");
+
+  return target;
+}
+
+static void
+parseOptimization(JSONValue const &obj, OptimizerProperties &props)
+{
+  if (!obj.isObject())
+    throw std::runtime_error("Invalid value for property `optimize' (not an object)");
+
+  if (obj.has("variables")) {
+    auto const &variables = obj["variables"];
+
+    if (!variables.isArray())
+      throw std::runtime_error("Invalid value for property `variables' (not an array)");
+
+    for (size_t i = 0; i < variables.size(); ++i) {
+      if (!variables[i].isString())
+        throw std::runtime_error("Optimization variables must be strings");
+      props.variables.push_back(variables[i].asString());
+    }
+  }
+
+  if (!obj.has("targets") || !obj["targets"].isArray())
+    throw std::runtime_error("Optimization has no `targets' array");
+
+  for (size_t i = 0; i < obj["targets"].size(); ++i)
+    props.targets.push_back(parseTarget(obj["targets"][i]));
+
+  parseCount(obj, "maxIterations", props.maxIterations);
+  parseReal(obj, "tolerance", props.tolerance);
+  parseReal(obj, "damping", props.damping);
+  parseReal(obj, "step", props.step);
+  parseBool(obj, "central", props.central);
+}
+
+////////////////////////////// SweepDefinition /////////////////////////////////
+unsigned int
+SweepDefinition::effectiveNi() const
+{
+  return type == SWEEP_ONE_SHOT ? 1 : Ni;
+}
+
+unsigned int
+SweepDefinition::effectiveNj() const
+{
+  return type == SWEEP_2D ? Nj : 1;
+}
+
+unsigned int
+SweepDefinition::steps() const
+{
+  return effectiveNi() * effectiveNj();
+}
+
+SweepDefinition
+SweepDefinition::fromJSON(JSONValue const &obj)
+{
+  static const SweepEnumName<SweepTracerType> tracerTypes[] = {
+    {"GEOMETRIC_OPTICS", SWEEP_TRACER_GEOMETRIC_OPTICS},
+    {"DIFFRACTION",      SWEEP_TRACER_DIFFRACTION}
+  };
+
+  static const SweepEnumName<SweepType> sweepTypes[] = {
+    {"ONE_SHOT", SWEEP_ONE_SHOT},
+    {"1D_SWEEP", SWEEP_1D},
+    {"2D_SWEEP", SWEEP_2D}
+  };
+
+  SweepDefinition def;
+
+  if (!obj.isObject())
+    throw std::runtime_error("Sweep description is not an object");
+
+  parseEnum(obj, "ttype", tracerTypes, "tracer type", def.ttype);
+  parseEnum(obj, "type", sweepTypes, "simulation type", def.type);
+  parseCount(obj, "Ni", def.Ni);
+  parseCount(obj, "Nj", def.Nj);
+  parseString(obj, "path", def.path);
+
+  if (obj.has("beams")) {
+    auto const &beams = obj["beams"];
+
+    if (!beams.isArray())
+      throw std::runtime_error("Invalid value for property `beams' (not an array)");
+
+    for (size_t i = 0; i < beams.size(); ++i)
+      def.beams.push_back(SweepBeam::fromJSON(beams[i]));
+  } else {
+    def.beams.push_back(SweepBeam::fromJSON(obj));
+  }
+
+  if (obj.has("dofs")) {
+    auto const &dofs = obj["dofs"];
+
+    if (!dofs.isObject())
+      throw std::runtime_error("Invalid value for property `dofs' (not an object)");
+
+    for (auto &key : dofs.keys()) {
+      std::string expr;
+      parseExpr(dofs, key, expr);
+      def.dofs.push_back(std::make_pair(key, expr));
+    }
+  }
+
+  parseBool(obj, "nonSeq", def.nonSeq);
+  parseBool(obj, "saveArtifacts", def.saveArtifacts);
+  parseBool(obj, "saveCSV", def.saveCSV);
+  parseBool(obj, "clearDetector", def.clearDetector);
+  parseBool(obj, "overwrite", def.overwrite);
+  parseString(obj, "saveDir", def.saveDir);
+  parseString(obj, "saveDetector", def.saveDetector);
+
+  if (obj.has("optimize")) {
+    def.hasOptimization = true;
+    parseOptimization(obj["optimize"], def.optimization);
+  }
+
+  return def;
+}
+
+SweepDefinition
+SweepDefinition::fromFile(std::string const &path)
+{
+  return fromJSON(JSONValue::fromFile(path));
+}
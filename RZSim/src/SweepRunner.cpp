@@ -0,0 +1,832 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <SweepRunner.h>
+#include <ExprEvaluationContext.h>
+#include <Simulation.h>
+#include <Elements/Detector.h>
+#include <Logger.h>
+#include <Helpers.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+namespace RZ {
+  //
+  // Per-thread state of a sweep: a copy of the model, the evaluation
+  // contexts of the sweep, DOF and beam expressions and the beam itself.
+  //
+  class SweepWorker {
+      SweepRunner            *m_runner;
+      SweepDefinition const  &m_def;
+      TopLevelModel          *m_model    = nullptr;
+      Detector               *m_detector = nullptr;
+      ExprEvaluationContext   m_simCtx;
+      ExprEvaluationContext  *m_modelCtx = nullptr;
+      std::vector<ExprEvaluationContext *> m_beamCtx;
+      std::vector<bool>       m_perRayWavelength;
+      std::mt19937_64         m_rng;
+      std::uniform_real_distribution<Real> m_uniform;
+      std::normal_distribution<Real>       m_normal;
+      RayList                 m_rays;
+
+      Real randUniform();
+      Real randNormal();
+      void makeBeams(unsigned int step);
+      void assignRayWavelengths(ExprEvaluationContext *, RayList &);
+      void setupStep(unsigned int step, SweepStepResult &);
+
+    public:
+      std::thread thread;
+
+      SweepWorker(SweepRunner *);
+      ~SweepWorker();
+
+      Detector *detector() const;
+      void prepare();
+      void runStep(unsigned int step, SweepStepResult &);
+      bool optimize(OptimizerResult &);
+  };
+}
+
+using namespace RZ;
+
+static bool
+fileExists(std::string const &path)
+{
+  return access(path.c_str(), F_OK) == 0;
+}
+
+/////////////////////////////////// SweepWorker ////////////////////////////////
+SweepWorker::SweepWorker(SweepRunner *runner) :
+  m_runner(runner), m_def(runner->m_definition)
+{
+}
+
+SweepWorker::~SweepWorker()
+{
+  for (auto ctx : m_beamCtx)
+    delete ctx;
+
+  if (m_modelCtx != nullptr)
+    delete m_modelCtx;
+
+  if (m_model != nullptr)
+    delete m_model;
+}
+
+Detector *
+SweepWorker::detector() const
+{
+  return m_detector;
+}
+
+Real
+SweepWorker::randUniform()
+{
+  return m_uniform(m_rng);
+}
+
+Real
+SweepWorker::randNormal()
+{
+  return m_normal(m_rng);
+}
+
+void
+SweepWorker::prepare()
+{
+  m_model = TopLevelModel::fromFile(m_runner->m_modelFile, m_runner->m_searchPaths);
+  if (m_model == nullptr)
+    throw std::runtime_error("Cannot load model " + m_runner->m_modelFile);
+
+  m_model->simulation()->setProcesses(m_runner->m_processes);
+
+  // Sweep variables
+  for (auto var : {"i", "j", "Ni", "Nj", "simU", "simN", "stepU", "stepN", "step", "sim"})
+    m_simCtx.defineVariable(var);
+
+  m_simCtx.setVariable("Ni", m_def.effectiveNi());
+  m_simCtx.setVariable("Nj", m_def.effectiveNj());
+  m_simCtx.setVariable("sim", 1);
+
+  // These are the same for the whole sweep
+  m_rng.seed(m_runner->m_seed);
+  m_simCtx.setVariable("simU", randUniform());
+  m_simCtx.setVariable("simN", randNormal());
+
+  // DOF expressions
+  for (auto &dof : m_def.dofs)
+    m_simCtx.defineVariable("dof_" + dof.first);
+
+  m_modelCtx = new ExprEvaluationContext(&m_simCtx);
+
+  for (auto &dof : m_def.dofs) {
+    if (m_model->lookupDof(dof.first) == nullptr)
+      throw std::runtime_error("Model has no DOF named `" + dof.first + "'");
+
+    if (!m_modelCtx->defineExpression(dof.first, dof.second))
+      throw std::runtime_error(
+        "Invalid expression for DOF `" + dof.first + "': "
+        + m_modelCtx->getLastError());
+  }
+
+  // Beam expressions
+  for (auto &beam : m_def.beams) {
+    auto ctx = new ExprEvaluationContext(m_modelCtx);
+    m_beamCtx.push_back(ctx);
+
+    ctx->defineVariable("rayU");
+    ctx->defineVariable("rayN");
+
+#define DEFINE_BEAM_EXPR(field)                                           \
+    if (!ctx->defineExpression(#field, beam.field))                       \
+      throw std::runtime_error(                                           \
+        "Invalid expression for property `" #field "' of beam `"          \
+        + beam.name + "': " + ctx->getLastError())
+
+    DEFINE_BEAM_EXPR(diameter);
+    DEFINE_BEAM_EXPR(span);
+    DEFINE_BEAM_EXPR(fNum);
+    DEFINE_BEAM_EXPR(uX);
+    DEFINE_BEAM_EXPR(uY);
+    DEFINE_BEAM_EXPR(offsetX);
+    DEFINE_BEAM_EXPR(offsetY);
+    DEFINE_BEAM_EXPR(offsetZ);
+    DEFINE_BEAM_EXPR(wavelength);
+    DEFINE_BEAM_EXPR(length);
+#undef DEFINE_BEAM_EXPR
+
+    m_perRayWavelength.push_back(
+         ctx->dependsOn("wavelength", "rayU")
+      || ctx->dependsOn("wavelength", "rayN"));
+  }
+
+  // Detector whose frames are saved
+  if (m_def.saveDetector.empty()) {
+    const OpticalPath *path = m_model->lookupOpticalPath(m_def.path);
+
+    if (path == nullptr)
+      throw std::runtime_error(
+        m_def.path.empty()
+        ? "Model contains no optical paths"
+        : "No such optical path `" + m_def.path + "'");
+
+    for (auto p : path->m_sequence)
+      if (p->parent->factory()->name() == "Detector")
+        m_detector = static_cast<Detector *>(p->parent);
+
+    if (m_detector == nullptr)
+      throw std::runtime_error(
+        m_def.path.empty()
+        ? "Default optical path has no detectors"
+        : "Optical path `" + m_def.path + "' has no detectors");
+  } else {
+    m_detector = m_model->lookupDetector(m_def.saveDetector);
+    if (m_detector == nullptr)
+      throw std::runtime_error("Detector `" + m_def.saveDetector + "' not found");
+  }
+
+  m_detector->clear();
+}
+
+// Same as the GUI: the wavelength is compiled once and evaluated over the
+// columns of per-ray random values.
+void
+SweepWorker::assignRayWavelengths(ExprEvaluationContext *ctx, RayList &rays)
+{
+  size_t count = rays.size();
+  std::vector<Real> rayU(count), rayN(count), wl(count);
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    rayU[i] = randUniform();
+    rayN[i] = randNormal();
+  }
+
+  if (!ctx->evalColumns(
+        "wavelength",
+        {{"rayU", rayU.data()}, {"rayN", rayN.data()}},
+        wl.data(),
+        count))
+    throw std::runtime_error("Cannot evaluate per-ray wavelengths");
+
+  i = 0;
+  for (auto &ray : rays)
+    ray.wavelength = wl[i++] * 1e-9;
+}
+
+void
+SweepWorker::makeBeams(unsigned int step)
+{
+  // Randomly sampled beams are drawn from the C library generator. It is
+  // reseeded for every step, and only one thread may draw from it.
+  std::lock_guard<std::mutex> lock(m_runner->m_beamMutex);
+
+  srand(static_cast<unsigned>(m_runner->m_seed + step));
+
+  m_rays.clear();
+
+  for (size_t n = 0; n < m_def.beams.size(); ++n) {
+    auto &beam = m_def.beams[n];
+    auto ctx   = m_beamCtx[n];
+    const OpticalPath *path;
+    OpticalElement *element;
+    ReferenceFrame *fp;
+    BeamProperties prop;
+
+    switch (beam.ref) {
+      case SWEEP_BEAM_REFERENCE_INPUT_ELEMENT:
+        path = m_model->lookupOpticalPath(m_def.path);
+        if (path == nullptr)
+          throw std::runtime_error("The defined optical path does not exist");
+
+        if (path->m_sequence.size() == 0)
+          throw std::runtime_error("Optical path contains no elements");
+
+        prop.setElementRelative(path->m_sequence.front()->parent);
+        break;
+
+      case SWEEP_BEAM_REFERENCE_APERTURE_STOP:
+        element = m_model->lookupOpticalElement(beam.apertureStop);
+        if (element == nullptr)
+          throw std::runtime_error(
+            "The specified element `" + beam.apertureStop + "' does not exist");
+
+        prop.setElementRelative(element);
+        break;
+
+      case SWEEP_BEAM_REFERENCE_FOCAL_PLANE:
+        fp = m_model->getFocalPlane(beam.focalPlane);
+        if (fp == nullptr)
+          throw std::runtime_error(
+            "The specified focal plane `" + beam.focalPlane + "' does not exist");
+
+        prop.setPlaneRelative(fp);
+        break;
+    }
+
+    auto D  = ctx->eval("diameter");
+    auto S  = ctx->eval("span");
+    auto ux = ctx->eval("uX");
+    auto uy = ctx->eval("uY");
+    auto x0 = ctx->eval("offsetX");
+    auto y0 = ctx->eval("offsetY");
+    auto z0 = ctx->eval("offsetZ");
+    auto wl = ctx->eval("wavelength") * 1e-9;
+    auto lg = ctx->eval("length");
+
+    auto uz = -sqrt(1 - ux * ux - uy * uy);
+
+    if (!beam.negativeZ) {
+      ux = -ux;
+      uy = -uy;
+      uz = -uz;
+    }
+
+    prop.direction  = Vec3(ux, uy, uz);
+    prop.offset     = Vec3(x0, y0, z0);
+    prop.length     = lg;
+    prop.id         = static_cast<uint32_t>(n);
+    prop.wavelength = wl;
+
+    // Chief ray
+    prop.vignetting = false;
+    prop.shape      = Point;
+    prop.numRays    = 1;
+
+    OMModel::addBeam(m_rays, prop);
+
+    // Main beam
+    prop.vignetting      = true;
+    prop.shape           = beam.shape;
+    prop.numRays         = beam.rays;
+    prop.diameter        = D;
+    prop.random          = beam.random;
+    prop.objectShape     = beam.objectShape;
+    prop.angularDiameter = deg2rad(S);
+    prop.objectPath      = beam.path;
+
+    switch (beam.beam) {
+      case SWEEP_BEAM_COLLIMATED:
+        prop.collimate();
+        break;
+
+      case SWEEP_BEAM_CONVERGING:
+        prop.setFNum(fabs(ctx->eval("fNum")), BeamDiameter);
+        break;
+
+      case SWEEP_BEAM_DIVERGING:
+        prop.setFNum(-fabs(ctx->eval("fNum")), BeamDiameter);
+        break;
+    }
+
+    if (m_perRayWavelength[n]) {
+      RayList rays;
+      OMModel::addBeam(rays, prop);
+      assignRayWavelengths(ctx, rays);
+      m_rays.splice(m_rays.end(), rays);
+    } else {
+      OMModel::addBeam(m_rays, prop);
+    }
+  }
+}
+
+// Sweep variables, DOFs and beams of a step
+void
+SweepWorker::setupStep(unsigned int step, SweepStepResult &result)
+{
+  unsigned int Ni = m_def.effectiveNi();
+
+  result.step = step;
+  result.i    = step % Ni;
+  result.j    = step / Ni;
+
+  std::seed_seq seq {
+    static_cast<uint32_t>(m_runner->m_seed),
+    static_cast<uint32_t>(m_runner->m_seed >> 32),
+    static_cast<uint32_t>(step)};
+  m_rng.seed(seq);
+  m_uniform.reset();
+  m_normal.reset();
+
+  m_simCtx.setVariable("i", result.i);
+  m_simCtx.setVariable("j", result.j);
+  m_simCtx.setVariable("step", step);
+  m_simCtx.setVariable("stepU", randUniform());
+  m_simCtx.setVariable("stepN", randNormal());
+
+  // Random expressions of the model are also reproducible step-wise
+  m_model->randState()->setSeed(m_runner->m_seed + step);
+  m_model->updateRandState();
+
+  for (auto &dof : m_def.dofs) {
+    auto value = m_modelCtx->eval(dof.first);
+    m_simCtx.setVariable("dof_" + dof.first, value);
+    m_model->setDof(dof.first, value);
+    result.dofs.push_back(value);
+  }
+
+  makeBeams(step);
+}
+
+void
+SweepWorker::runStep(unsigned int step, SweepStepResult &result)
+{
+  double start;
+  bool ok;
+
+  setupStep(step, result);
+
+  for (auto surface : m_detector->opticalSurfaces())
+    surface->clearStatistics();
+
+  start = monotonicSeconds();
+
+  if (m_def.nonSeq)
+    ok = m_model->traceNonSequential(m_rays, false, nullptr, m_def.clearDetector);
+  else if (m_def.ttype == SWEEP_TRACER_DIFFRACTION)
+    ok = m_model->traceDiffraction(m_def.path, m_rays, nullptr, m_def.clearDetector);
+  else
+    ok = m_model->trace(m_def.path, m_rays, false, nullptr, m_def.clearDetector);
+
+  result.elapsed = monotonicSeconds() - start;
+
+  if (!ok)
+    throw std::runtime_error("Tracer error");
+
+  result.rays = m_rays.size();
+
+  for (auto surface : m_detector->opticalSurfaces()) {
+    for (auto &p : surface->statistics) {
+      result.intercepted += p.second.intercepted;
+      result.vignetted   += p.second.vignetted;
+      result.pruned      += p.second.pruned;
+    }
+  }
+
+  result.maxCounts = m_detector->maxCounts();
+
+  if (m_def.clearDetector) {
+    result.fileName = m_runner->frameFileName(step);
+    if (!m_detector->savePNG(result.fileName))
+      throw std::runtime_error("Cannot save frame to " + result.fileName);
+  }
+
+  result.ok = true;
+}
+
+bool
+SweepWorker::optimize(OptimizerResult &result)
+{
+  SweepStepResult step;
+  TracingProperties tracing;
+  OptimizerProperties props = m_def.optimization;
+  Optimizer optimizer(m_model);
+
+  if (m_def.ttype == SWEEP_TRACER_DIFFRACTION)
+    throw std::runtime_error("Diffraction sweeps cannot be optimized");
+
+  setupStep(0, step);
+
+  tracing.type  = m_def.nonSeq ? NonSequential : Sequential;
+  tracing.path  = m_def.path;
+  tracing.pRays = &m_rays;
+
+  props.processes = m_runner->m_threads;
+  props.seed      = m_runner->m_seed;
+
+  return optimizer.optimize(tracing, props, result);
+}
+
+/////////////////////////////////// SweepRunner ////////////////////////////////
+SweepRunner::SweepRunner(
+  SweepDefinition const &definition,
+  std::string const &modelFile,
+  std::list<std::string> const &searchPaths) :
+  m_definition(definition),
+  m_modelFile(modelFile),
+  m_searchPaths(searchPaths),
+  m_outputDir(definition.saveDir)
+{
+  m_nextStep = 0;
+  m_failed   = false;
+}
+
+SweepRunner::~SweepRunner()
+{
+  clearWorkers();
+}
+
+void
+SweepRunner::clearWorkers()
+{
+  for (auto worker : m_workers)
+    delete worker;
+
+  m_workers.clear();
+}
+
+void
+SweepRunner::setThreads(unsigned int threads)
+{
+  m_threads = std::max(threads, 1u);
+}
+
+void
+SweepRunner::setProcesses(unsigned int processes)
+{
+  m_processes = std::max(processes, 1u);
+}
+
+void
+SweepRunner::setOutputDir(std::string const &dir)
+{
+  m_outputDir = dir;
+}
+
+void
+SweepRunner::setSeed(uint64_t seed)
+{
+  m_seed = seed;
+}
+
+void
+SweepRunner::setVerbose(bool verbose)
+{
+  m_verbose = verbose;
+}
+
+std::string
+SweepRunner::outputFileName(std::string const &suffix) const
+{
+  return m_outputDir + "/" + m_prefix + suffix;
+}
+
+std::string
+SweepRunner::frameFileName(unsigned int step) const
+{
+  if (m_definition.clearDetector)
+    return outputFileName(string_printf("step_%03u.png", step));
+  else
+    return outputFileName("integrated.png");
+}
+
+// Same naming scheme as the GUI: the prefix is bumped until it does not
+// collide with the results of a previous run, unless overwriting.
+void
+SweepRunner::makePrefix(std::string const &detectorName)
+{
+  std::string name = detectorName.empty() ? "default" : detectorName;
+  unsigned int count = 0;
+
+  for (;;) {
+    m_prefix = string_printf("sim_%03u_", count++) + name + "_";
+
+    if (m_definition.overwrite)
+      break;
+
+    if (!fileExists(frameFileName(0))
+      && !fileExists(outputFileName("steps.csv"))
+      && !fileExists(outputFileName("optimization.csv")))
+      break;
+  }
+}
+
+void
+SweepRunner::report(SweepStepResult const &result)
+{
+  std::lock_guard<std::mutex> lock(m_reportMutex);
+
+  ++m_done;
+
+  if (m_verbose)
+    RZInfo(
+      "Step %u/%u (i = %u, j = %u): %llu rays, %llu intercepted, %.3f s\n",
+      m_done,
+      m_definition.steps(),
+      result.i,
+      result.j,
+      static_cast<unsigned long long>(result.rays),
+      static_cast<unsigned long long>(result.intercepted),
+      result.elapsed);
+}
+
+void
+SweepRunner::workerLoop(SweepWorker *worker)
+{
+  unsigned int steps = m_definition.steps();
+  unsigned int step;
+
+  while (!m_failed && (step = m_nextStep++) < steps) {
+    try {
+      worker->runStep(step, m_results[step]);
+      report(m_results[step]);
+    } catch (std::exception const &e) {
+      RZError("Step %u failed: %s\n", step, e.what());
+      m_failed = true;
+    } catch (...) {
+      RZError("Step %u failed: unknown exception\n", step);
+      m_failed = true;
+    }
+  }
+}
+
+bool
+SweepRunner::saveCSV() const
+{
+  std::string fileName = outputFileName("steps.csv");
+  FILE *fp = fopen(fileName.c_str(), "wb");
+  bool ok = false;
+
+  if (fp == nullptr) {
+    RZError("fopen(): cannot open `%s': %s\n", fileName.c_str(), strerror(errno));
+    goto done;
+  }
+
+  fprintf(fp, "step,i,j,");
+  for (auto &dof : m_definition.dofs)
+    fprintf(fp, "dof_%s,", dof.first.c_str());
+  fprintf(fp, "rays,intercepted,vignetted,pruned,maxCounts,elapsed,filename\n");
+
+  for (auto &result : m_results) {
+    fprintf(fp, "%u,%u,%u,", result.step, result.i, result.j);
+
+    for (auto value : result.dofs)
+      fprintf(fp, "%.17g,", value);
+
+    fprintf(
+      fp,
+      "%llu,%llu,%llu,%llu,%u,%.6e,%s\n",
+      static_cast<unsigned long long>(result.rays),
+      static_cast<unsigned long long>(result.intercepted),
+      static_cast<unsigned long long>(result.vignetted),
+      static_cast<unsigned long long>(result.pruned),
+      result.maxCounts,
+      result.elapsed,
+      result.fileName.c_str());
+  }
+
+  if (ferror(fp)) {
+    RZError("Write error while saving `%s'\n", fileName.c_str());
+    goto done;
+  }
+
+  RZInfo("Simulation log saved to %s\n", fileName.c_str());
+
+  ok = true;
+
+done:
+  if (fp != nullptr)
+    fclose(fp);
+
+  return ok;
+}
+
+bool
+SweepRunner::run()
+{
+  unsigned int steps   = m_definition.steps();
+  unsigned int workers = std::min(m_threads, steps);
+  double start = monotonicSeconds();
+
+  if (m_definition.beams.empty())
+    throw std::runtime_error("The sweep defines no beams");
+
+  clearWorkers();
+  m_results.assign(steps, SweepStepResult());
+  m_nextStep = 0;
+  m_failed   = false;
+  m_done     = 0;
+
+  if (mkdir(m_outputDir.c_str(), 0755) == -1 && errno != EEXIST) {
+    RZError("mkdir(): cannot create `%s': %s\n", m_outputDir.c_str(), strerror(errno));
+    return false;
+  }
+
+  // Models are loaded one after the other, as the recipe cache is shared
+  for (unsigned int i = 0; i < workers; ++i) {
+    auto worker = new SweepWorker(this);
+    m_workers.push_back(worker);
+    worker->prepare();
+  }
+
+  makePrefix(m_workers[0]->detector()->name());
+
+  RZInfo(
+    "Running %u steps of %s on %u thread(s)\n",
+    steps,
+    m_modelFile.c_str(),
+    workers);
+
+  for (auto worker : m_workers)
+    worker->thread = std::thread(&SweepRunner::workerLoop, this, worker);
+
+  for (auto worker : m_workers)
+    worker->thread.join();
+
+  if (m_failed)
+    return false;
+
+  // Integrated image: every worker accumulated a subset of the steps
+  if (!m_definition.clearDetector) {
+    auto detector = m_workers[0]->detector();
+    std::string fileName = frameFileName(0);
+
+    for (unsigned int i = 1; i < workers; ++i)
+      if (!detector->merge(m_workers[i]->detector())) {
+        RZError("Detectors of the workers have different shapes\n");
+        return false;
+      }
+
+    if (!detector->savePNG(fileName)) {
+      RZError("Cannot save integrated image to %s\n", fileName.c_str());
+      return false;
+    }
+
+    for (auto &result : m_results)
+      result.fileName = fileName;
+  }
+
+  if (m_definition.saveCSV && !saveCSV())
+    return false;
+
+  RZInfo("Sweep done in %.3f s\n", monotonicSeconds() - start);
+
+  return true;
+}
+
+bool
+SweepRunner::saveOptimizationCSV() const
+{
+  std::string fileName = outputFileName("optimization.csv");
+  FILE *fp = fopen(fileName.c_str(), "wb");
+  bool ok = false;
+
+  if (fp == nullptr) {
+    RZError("fopen(): cannot open `%s': %s\n", fileName.c_str(), strerror(errno));
+    goto done;
+  }
+
+  fprintf(fp, "name,initial,optimized\n");
+  for (size_t k = 0; k < m_optimization.variables.size(); ++k)
+    fprintf(
+      fp,
+      "dof_%s,%.17g,%.17g\n",
+      m_optimization.variables[k].c_str(),
+      m_optimization.initial[k],
+      m_optimization.values[k]);
+
+  for (size_t i = 0; i < m_optimization.metrics.size(); ++i)
+    fprintf(
+      fp,
+      "%s,,%.17g\n",
+      m_optimization.metrics[i].c_str(),
+      m_optimization.nominal[i]);
+
+  fprintf(
+    fp,
+    "merit,%.17g,%.17g\n",
+    m_optimization.merits.front(),
+    m_optimization.merit());
+
+  if (ferror(fp)) {
+    RZError("Write error while saving `%s'\n", fileName.c_str());
+    goto done;
+  }
+
+  RZInfo("Optimization results saved to %s\n", fileName.c_str());
+
+  ok = true;
+
+done:
+  if (fp != nullptr)
+    fclose(fp);
+
+  return ok;
+}
+
+bool
+SweepRunner::optimize()
+{
+  double start = monotonicSeconds();
+
+  if (!m_definition.hasOptimization)
+    throw std::runtime_error("The sweep defines no optimization");
+
+  if (m_definition.beams.empty())
+    throw std::runtime_error("The sweep defines no beams");
+
+  clearWorkers();
+  m_optimization = OptimizerResult();
+
+  if (mkdir(m_outputDir.c_str(), 0755) == -1 && errno != EEXIST) {
+    RZError("mkdir(): cannot create `%s': %s\n", m_outputDir.c_str(), strerror(errno));
+    return false;
+  }
+
+  auto worker = new SweepWorker(this);
+  m_workers.push_back(worker);
+  worker->prepare();
+
+  makePrefix(worker->detector()->name());
+
+  RZInfo(
+    "Optimizing %s with %u process(es)\n",
+    m_modelFile.c_str(),
+    m_threads);
+
+  if (!worker->optimize(m_optimization)) {
+    RZError("Optimization failed\n");
+    return false;
+  }
+
+  if (m_verbose)
+    for (size_t i = 0; i < m_optimization.merits.size(); ++i)
+      RZInfo("Iteration %zu: merit %g\n", i, m_optimization.merits[i]);
+
+  if (m_definition.saveCSV && !saveOptimizationCSV())
+    return false;
+
+  RZInfo(
+    "Optimization %s after %u iterations (%u traces) in %.3f s\n",
+    m_optimization.converged ? "converged" : "stopped",
+    m_optimization.iterations,
+    m_optimization.traces,
+    monotonicSeconds() - start);
+
+  return true;
+}
+
+std::vector<SweepStepResult> const &
+SweepRunner::results() const
+{
+  return m_results;
+}
+
+OptimizerResult const &
+SweepRunner::optimization() const
+{
+  return m_optimization;
+}
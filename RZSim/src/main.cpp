@@ -0,0 +1,192 @@
+//
+//  Copyright (c) 2025 Gonzalo José Carracedo Carballal
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as
+//  published by the Free Software Foundation, either version 3 of the
+//  License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this program.  If not, see
+//  <http://www.gnu.org/licenses/>
+//
+
+#include <SweepRunner.h>
+#include <Logger.h>
+#include <RecipeCache.h>
+#include <getopt.h>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+
+using namespace RZ;
+
+static void
+help(const char *argv0)
+{
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s [OPTIONS] MODEL SWEEP\n\n", argv0);
+  fprintf(stderr, "Runs the simulation described by the JSON file SWEEP (as saved by the\n");
+  fprintf(stderr, "simulation dialog of RZGUI) on MODEL, with no GUI. Detector frames and\n");
+  fprintf(stderr, "a CSV log with the DOFs and statistics of every step are written to the\n");
+  fprintf(stderr, "save directory of the sweep.\n\n");
+  fprintf(stderr, "With --optimize, the DOFs of the model are optimized instead, as\n");
+  fprintf(stderr, "described by the `optimize' object of SWEEP, and the result is written\n");
+  fprintf(stderr, "to the standard output and to a CSV file in the save directory.\n\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -t, --threads N           Number of worker threads (default: %u, 1 with -p)\n", std::max(std::thread::hardware_concurrency(), 1u));
+  fprintf(stderr, "  -p, --processes N         Split every trace across N forked processes.\n");
+  fprintf(stderr, "                            Cannot be combined with more than one thread\n");
+  fprintf(stderr, "  -o, --output DIR          Save results to DIR instead of the save directory\n");
+  fprintf(stderr, "  -I, --include DIR         Add DIR to the model search path\n");
+  fprintf(stderr, "  -s, --seed N              Seed of the random variables (default: %u)\n", RZSIM_DEFAULT_SEED);
+  fprintf(stderr, "  -O, --optimize            Optimize the DOFs instead of running the sweep\n");
+  fprintf(stderr, "  -v, --verbose             Report progress of each step\n");
+  fprintf(stderr, "  -h, --help                This help\n");
+}
+
+static struct option g_options[] = {
+  {"threads",   required_argument, nullptr, 't'},
+  {"processes", required_argument, nullptr, 'p'},
+  {"output",    required_argument, nullptr, 'o'},
+  {"include",   required_argument, nullptr, 'I'},
+  {"seed",      required_argument, nullptr, 's'},
+  {"optimize",  no_argument,       nullptr, 'O'},
+  {"verbose",   no_argument,       nullptr, 'v'},
+  {"help",      no_argument,       nullptr, 'h'},
+  {nullptr,     0,                 nullptr, 0}
+};
+
+int
+main(int argc, char **argv)
+{
+  std::string output;
+  std::list<std::string> searchPaths;
+  unsigned int threads = 0;
+  unsigned int processes = 1;
+  bool threadsGiven = false;
+  uint64_t seed = RZSIM_DEFAULT_SEED;
+  bool verbose = false;
+  bool optimize = false;
+  StdErrLogger logger;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "t:p:o:I:s:Ovh", g_options, nullptr)) != -1) {
+    switch (c) {
+      case 't':
+        threads = static_cast<unsigned int>(atoi(optarg));
+        threadsGiven = true;
+        break;
+
+      case 'p':
+        processes = static_cast<unsigned int>(atoi(optarg));
+        break;
+
+      case 'o':
+        output = optarg;
+        break;
+
+      case 'I':
+        searchPaths.push_back(optarg);
+        break;
+
+      case 's':
+        seed = strtoull(optarg, nullptr, 0);
+        break;
+
+      case 'O':
+        optimize = true;
+        break;
+
+      case 'v':
+        verbose = true;
+        break;
+
+      case 'h':
+        help(argv[0]);
+        exit(EXIT_SUCCESS);
+
+      default:
+        help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (argc - optind != 2) {
+    help(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Forked traces must not run concurrently: every worker would fork a
+  // full copy of the process, and the children inherit the locks held by
+  // the other threads at the time of the fork.
+  if (!threadsGiven)
+    threads = processes > 1 ? 1 : std::max(std::thread::hardware_concurrency(), 1u);
+
+  if (threads < 1 || processes < 1) {
+    fprintf(stderr, "%s: the number of threads and processes must be positive\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (threads > 1 && processes > 1) {
+    fprintf(stderr, "%s: --threads and --processes cannot be both greater than 1\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  Logger::setDefaultLogger(&logger);
+  Logger::setLogLevel(verbose ? LOG_INFO : LOG_WARNING);
+  RecipeCache::instance()->setDefaultEnabled(true);
+
+  // Like the GUI, relative imports are also looked up next to the model
+  std::string modelFile = argv[optind];
+  auto slash = modelFile.rfind('/');
+  searchPaths.push_back(slash == std::string::npos ? "." : modelFile.substr(0, slash));
+
+  try {
+    auto definition = SweepDefinition::fromFile(argv[optind + 1]);
+    SweepRunner runner(definition, modelFile, searchPaths);
+
+    runner.setThreads(threads);
+    runner.setProcesses(processes);
+    runner.setSeed(seed);
+    runner.setVerbose(verbose);
+
+    if (!output.empty())
+      runner.setOutputDir(output);
+
+    if (optimize) {
+      if (!runner.optimize())
+        exit(EXIT_FAILURE);
+
+      auto const &result = runner.optimization();
+
+      for (size_t k = 0; k < result.variables.size(); ++k)
+        printf(
+          "%-24s %-24.17g -> %.17g\n",
+          result.variables[k].c_str(),
+          result.initial[k],
+          result.values[k]);
+
+      for (size_t i = 0; i < result.metrics.size(); ++i)
+        printf("%-24s %.17g\n", result.metrics[i].c_str(), result.nominal[i]);
+
+      printf(
+        "%-24s %-24.17g -> %.17g\n",
+        "merit",
+        result.merits.front(),
+        result.merit());
+    } else if (!runner.run()) {
+      exit(EXIT_FAILURE);
+    }
+  } catch (std::exception const &e) {
+    fprintf(stderr, "%s: %s\n", argv[0], e.what());
+    exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}